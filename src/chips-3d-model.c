@@ -1,4 +1,15 @@
 #include "chips-3d-model.h"
+#include "chips-culling.h"
+#include "chips-importer.h"
+#include "chips-mesh-file.h"
+#include "chips-mesh-optimizer.h"
+#include "chips-mesh-simplifier.h"
+#include "chips-model-cache.h"
+#include "chips-parallel.h"
+#include "chips-profiler.h"
+#include "chips-ray-picker.h"
+
+#include <glib/gstdio.h>
 
 static void initable_iface_init       (GInitableIface      *initable_iface);
 static void async_initable_iface_init (GAsyncInitableIface *async_initable_iface);
@@ -8,173 +19,2235 @@ G_DEFINE_TYPE_WITH_CODE (Chips3DModel, chips_3d_model, G_TYPE_OBJECT,
 
 typedef struct
 {
-        float        *vertex_buffer;
-        size_t        vertex_buffer_size;
+        GFile        *file;
+        float         weld_epsilon;
+        guint32       quantize_vertices : 1;
+        guint32       use_cache : 1;
+
+        ChipsVertexFormat vertex_format;
+        GBytes       *vertex_buffer;
         unsigned int  number_of_vertices;
-        unsigned int *vertex_arrangement;
+        GBytes       *vertex_arrangement;
+        unsigned int  number_of_indices;
+        unsigned int  index_size;
+        GArray       *levels_of_detail;
+        GArray       *clusters;
+        GPtrArray    *bounding_volume_hierarchies;
+        float         bounds_minimum[3];
+        float         bounds_maximum[3];
+
+        /* Filled in by the analysis at the end of loading, under the
+         * progress lock, since windows frame the model before then
+         */
+        float         bounding_sphere_radius;
+        double        surface_area;
+        guint32       analyzed : 1;
+
+        /* One hash per CHIPS_3D_MODEL_CHUNK_SIZE bytes of each buffer */
+        GArray       *vertex_buffer_chunk_hashes;
+        GArray       *vertex_arrangement_chunk_hashes;
+
+        GMutex        progress_lock;
+        GMainContext *progress_context;
+        gint64        progress_report_time;
+        guint64       bytes_processed;
+        guint64       bytes_total;
+        guint64       vertices_processed;
+        guint64       vertices_available;
+        guint64       indices_available;
+        guint32       progress_pending : 1;
+        guint32       geometry_pending : 1;
+
+        /* The vertex and index buffers can be dropped while nothing
+         * holds them, as long as they can be mapped back in from a mesh
+         * file that hasn't changed since
+         */
+        GMutex        geometry_lock;
+        char         *geometry_filename;
+        GStatBuf      geometry_file_status;
+        guint         geometry_holds;
+        guint32       geometry_released : 1;
+
+        /* Built in the background once asked for, since picking
+         * isn't needed to show the model
+         */
+        GMutex          picking_lock;
+        ChipsRayPicker *ray_picker;
+        guint32         picking_requested : 1;
+
+        /* Changes to the file get loaded into a replacement model,
+         * once it has been left alone for a moment
+         */
+        GFileMonitor   *file_monitor;
+        guint           reload_timeout_id;
+        GCancellable   *reload_cancellable;
 } Chips3DModelPrivate;
 
 #define CHIPS_3D_MODEL_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), CHIPS_TYPE_3D_MODEL, Chips3DModelPrivate))
 
+#define PROGRESS_INTERVAL (G_USEC_PER_SEC / 20)
+#define VERTICES_PER_CHUNK 65536
+
+/* Mesh files are validated, and handed out, this many indices at a time */
+#define INDICES_PER_GEOMETRY_BATCH (3 * 1024 * 1024)
+
+/* Simplification stops once a level gets this small */
+#define LEVEL_OF_DETAIL_MINIMUM_TRIANGLES 1024
+
+/* Big enough that culling costs far less than drawing, small enough
+ * that a cluster rarely straddles the edge of the view by much
+ */
+#define TRIANGLES_PER_CLUSTER 1024
+
+/* How many chunks get hashed at a time */
+#define CHUNKS_PER_HASH_JOB 16
+
+/* How long the file has to go without changing before it's reloaded,
+ * in milliseconds, so a model still being written isn't read half done
+ */
+#define RELOAD_DELAY 500
+
+enum
+{
+        PROP_FILE = 1,
+        PROP_WELD_EPSILON,
+        PROP_QUANTIZE_VERTICES,
+        PROP_USE_CACHE,
+        NUMBER_OF_PROPERTIES
+};
+
+static GParamSpec *properties[NUMBER_OF_PROPERTIES];
+
+enum
+{
+        PROGRESS,
+        GEOMETRY_AVAILABLE,
+        REPLACED,
+        NUMBER_OF_SIGNALS
+};
+
+static guint signals[NUMBER_OF_SIGNALS];
+
+static const float cube_vertices[] = {
+        -0.5f, -0.5f, -0.5f,
+        -0.5f,  0.5f, -0.5f,
+         0.5f,  0.5f, -0.5f,
+         0.5f,  0.5f, -0.5f,
+         0.5f, -0.5f, -0.5f,
+        -0.5f, -0.5f, -0.5f,
+
+        -0.5f, -0.5f,  0.5f,
+         0.5f, -0.5f,  0.5f,
+         0.5f,  0.5f,  0.5f,
+         0.5f,  0.5f,  0.5f,
+        -0.5f,  0.5f,  0.5f,
+        -0.5f, -0.5f,  0.5f,
+
+        -0.5f,  0.5f,  0.5f,
+        -0.5f,  0.5f, -0.5f,
+        -0.5f, -0.5f, -0.5f,
+        -0.5f, -0.5f, -0.5f,
+        -0.5f, -0.5f,  0.5f,
+        -0.5f,  0.5f,  0.5f,
+
+         0.5f,  0.5f,  0.5f,
+         0.5f, -0.5f,  0.5f,
+         0.5f, -0.5f, -0.5f,
+         0.5f, -0.5f, -0.5f,
+         0.5f,  0.5f, -0.5f,
+         0.5f,  0.5f,  0.5f,
+
+        -0.5f, -0.5f, -0.5f,
+         0.5f, -0.5f, -0.5f,
+         0.5f, -0.5f,  0.5f,
+         0.5f, -0.5f,  0.5f,
+        -0.5f, -0.5f,  0.5f,
+        -0.5f, -0.5f, -0.5f,
+
+        -0.5f,  0.5f, -0.5f,
+        -0.5f,  0.5f,  0.5f,
+         0.5f,  0.5f,  0.5f,
+         0.5f,  0.5f,  0.5f,
+         0.5f,  0.5f, -0.5f,
+        -0.5f,  0.5f, -0.5f,
+};
+
 static gboolean
-initable_init (GInitable     *initable,
-               GCancellable  *cancellable,
-               GError       **error)
+emit_progress (Chips3DModel *self)
 {
-        Chips3DModel *self = CHIPS_3D_MODEL (initable);
         Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
-        size_t arrangement_buffer_size;
-        size_t i;
-        static float vertices[] = {
-                -0.5f, -0.5f, -0.5f,
-                -0.5f,  0.5f, -0.5f,
-                 0.5f,  0.5f, -0.5f,
-                 0.5f,  0.5f, -0.5f,
-                 0.5f, -0.5f, -0.5f,
-                -0.5f, -0.5f, -0.5f,
-
-                -0.5f, -0.5f,  0.5f,
-                 0.5f, -0.5f,  0.5f,
-                 0.5f,  0.5f,  0.5f,
-                 0.5f,  0.5f,  0.5f,
-                -0.5f,  0.5f,  0.5f,
-                -0.5f, -0.5f,  0.5f,
-
-                -0.5f,  0.5f,  0.5f,
-                -0.5f,  0.5f, -0.5f,
-                -0.5f, -0.5f, -0.5f,
-                -0.5f, -0.5f, -0.5f,
-                -0.5f, -0.5f,  0.5f,
-                -0.5f,  0.5f,  0.5f,
-
-                 0.5f,  0.5f,  0.5f,
-                 0.5f, -0.5f,  0.5f,
-                 0.5f, -0.5f, -0.5f,
-                 0.5f, -0.5f, -0.5f,
-                 0.5f,  0.5f, -0.5f,
-                 0.5f,  0.5f,  0.5f,
-
-                -0.5f, -0.5f, -0.5f,
-                 0.5f, -0.5f, -0.5f,
-                 0.5f, -0.5f,  0.5f,
-                 0.5f, -0.5f,  0.5f,
-                -0.5f, -0.5f,  0.5f,
-                -0.5f, -0.5f, -0.5f,
-
-                -0.5f,  0.5f, -0.5f,
-                -0.5f,  0.5f,  0.5f,
-                 0.5f,  0.5f,  0.5f,
-                 0.5f,  0.5f,  0.5f,
-                 0.5f,  0.5f, -0.5f,
-                -0.5f,  0.5f, -0.5f,
-        };
+        guint64 bytes_processed, bytes_total, vertices_processed;
 
-        priv->number_of_vertices = G_N_ELEMENTS (vertices) / 3;
-        priv->vertex_buffer_size = sizeof (vertices);
+        g_mutex_lock (&priv->progress_lock);
+        bytes_processed = priv->bytes_processed;
+        bytes_total = priv->bytes_total;
+        vertices_processed = priv->vertices_processed;
+        priv->progress_pending = FALSE;
+        g_mutex_unlock (&priv->progress_lock);
 
-        priv->vertex_buffer = g_malloc (priv->vertex_buffer_size);
-        memcpy (priv->vertex_buffer,
-                vertices,
-                priv->vertex_buffer_size);
+        g_signal_emit (self, signals[PROGRESS], 0,
+                       bytes_processed,
+                       bytes_total,
+                       vertices_processed);
 
-        arrangement_buffer_size = priv->number_of_vertices * sizeof (unsigned int);
-        priv->vertex_arrangement = g_malloc (arrangement_buffer_size);
+        return G_SOURCE_REMOVE;
+}
+
+/* Called from worker threads.  Progress is accumulated under a lock and
+ * handed to the thread that started the load at most every
+ * PROGRESS_INTERVAL, so chunk-sized updates don't flood the main loop.
+ */
+static void
+report_progress (Chips3DModel *self,
+                 size_t        bytes_processed,
+                 size_t        vertices_processed,
+                 gboolean      force)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+        gint64 now;
+
+        g_mutex_lock (&priv->progress_lock);
+        priv->bytes_processed += bytes_processed;
+        priv->vertices_processed += vertices_processed;
+
+        now = g_get_monotonic_time ();
+
+        if (priv->progress_context != NULL &&
+            !priv->progress_pending &&
+            (force || now - priv->progress_report_time >= PROGRESS_INTERVAL)) {
+                priv->progress_pending = TRUE;
+                priv->progress_report_time = now;
 
-        for (i = 0; i < priv->number_of_vertices; i++) {
-                priv->vertex_arrangement[i] = i;
+                g_main_context_invoke_full (priv->progress_context,
+                                            G_PRIORITY_DEFAULT,
+                                            (GSourceFunc) emit_progress,
+                                            g_object_ref (self),
+                                            g_object_unref);
         }
+        g_mutex_unlock (&priv->progress_lock);
+}
 
-        return TRUE;
+static gboolean
+emit_geometry_available (Chips3DModel *self)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+        guint64 vertices_available, indices_available;
+
+        g_mutex_lock (&priv->progress_lock);
+        vertices_available = priv->vertices_available;
+        indices_available = priv->indices_available;
+        priv->geometry_pending = FALSE;
+        g_mutex_unlock (&priv->progress_lock);
+
+        g_signal_emit (self, signals[GEOMETRY_AVAILABLE], 0,
+                       vertices_available,
+                       indices_available);
+
+        return G_SOURCE_REMOVE;
 }
 
+/* Called from the loading thread once the start of the final vertex and
+ * index buffers won't change anymore, so it can be drawn before the
+ * rest is ready
+ */
 static void
-initable_iface_init (GInitableIface *initable_iface)
+report_geometry_available (Chips3DModel *self,
+                           size_t        vertices_available,
+                           size_t        indices_available)
 {
-        initable_iface->init = initable_init;
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+
+        g_mutex_lock (&priv->progress_lock);
+        priv->vertices_available = MAX (priv->vertices_available, vertices_available);
+        priv->indices_available = MAX (priv->indices_available, indices_available);
+
+        if (priv->progress_context != NULL && !priv->geometry_pending) {
+                priv->geometry_pending = TRUE;
+
+                g_main_context_invoke_full (priv->progress_context,
+                                            G_PRIORITY_DEFAULT,
+                                            (GSourceFunc) emit_geometry_available,
+                                            g_object_ref (self),
+                                            g_object_unref);
+        }
+        g_mutex_unlock (&priv->progress_lock);
 }
 
+typedef struct
+{
+        Chips3DModel *self;
+        guint32      *vertex_arrangement;
+} ArrangementJob;
+
 static void
-async_initable_iface_init (GAsyncInitableIface *async_initable_iface)
+arrange_vertex_range (size_t          start,
+                      size_t          end,
+                      ArrangementJob *job)
 {
+        size_t i;
+
+        for (i = start; i < end; i++) {
+                job->vertex_arrangement[i] = i;
+        }
+
+        report_progress (job->self,
+                         (end - start) * 3 * sizeof (float),
+                         end - start,
+                         FALSE);
 }
 
-static void
-chips_3d_model_dispose (GObject *object)
+static gboolean
+load_cube (Chips3DModel       *self,
+           ChipsImportedMesh  *mesh,
+           GCancellable       *cancellable,
+           GError            **error)
 {
-        Chips3DModel *self = CHIPS_3D_MODEL (object);
         Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+        ArrangementJob job;
 
-        g_clear_pointer (&priv->vertex_buffer, g_free);
-        g_clear_pointer (&priv->vertex_arrangement, g_free);
+        g_mutex_lock (&priv->progress_lock);
+        priv->bytes_total = sizeof (cube_vertices);
+        g_mutex_unlock (&priv->progress_lock);
 
-        G_OBJECT_CLASS (chips_3d_model_parent_class)->dispose (object);
+        job.self = self;
+        job.vertex_arrangement = g_new (guint32, G_N_ELEMENTS (cube_vertices) / 3);
+
+        mesh->number_of_vertices = G_N_ELEMENTS (cube_vertices) / 3;
+        mesh->number_of_indices = mesh->number_of_vertices;
+        mesh->index_size = sizeof (guint32);
+        mesh->vertex_buffer = g_bytes_new_static (cube_vertices, sizeof (cube_vertices));
+        mesh->vertex_arrangement = g_bytes_new_take (job.vertex_arrangement,
+                                                     mesh->number_of_indices * sizeof (guint32));
+
+        return chips_parallel_for (mesh->number_of_indices,
+                                   VERTICES_PER_CHUNK,
+                                   (ChipsParallelFunc) arrange_vertex_range,
+                                   &job,
+                                   cancellable,
+                                   error);
 }
 
+typedef struct
+{
+        Chips3DModel *self;
+        gconstpointer vertex_arrangement;
+        size_t        index_size;
+        volatile int  has_bad_index;
+} ValidationJob;
+
 static void
-chips_3d_model_finalize (GObject *object)
+validate_vertex_arrangement_range (size_t         start,
+                                   size_t         end,
+                                   ValidationJob *job)
 {
-        Chips3DModel *self = CHIPS_3D_MODEL (object);
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (job->self);
+        guint32 largest_index = 0;
+        size_t i;
 
-        G_OBJECT_CLASS (chips_3d_model_parent_class)->finalize (object);
+        if (job->index_size == sizeof (guint16)) {
+                const guint16 *vertex_arrangement = job->vertex_arrangement;
+
+                for (i = start; i < end; i++) {
+                        largest_index = MAX (largest_index, vertex_arrangement[i]);
+                }
+        } else {
+                const guint32 *vertex_arrangement = job->vertex_arrangement;
+
+                for (i = start; i < end; i++) {
+                        largest_index = MAX (largest_index, vertex_arrangement[i]);
+                }
+        }
+
+        if (largest_index >= priv->number_of_vertices) {
+                g_atomic_int_set (&job->has_bad_index, TRUE);
+        }
+
+        report_progress (job->self, (end - start) * job->index_size, 0, FALSE);
 }
 
-static void
-chips_3d_model_class_init (Chips3DModelClass *own_class)
+static gboolean
+load_levels_of_detail (Chips3DModel   *self,
+                       ChipsMeshFile  *mesh_file,
+                       const char     *filename,
+                       GError        **error)
 {
-        GObjectClass *object_class = G_OBJECT_CLASS (own_class);
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+        g_autoptr (GBytes) section = NULL;
+        const ChipsMeshLevelOfDetail *levels_of_detail;
+        size_t size, number_of_levels, i;
 
-        object_class->dispose = chips_3d_model_dispose;
-        object_class->finalize = chips_3d_model_finalize;
+        priv->levels_of_detail = g_array_new (FALSE, FALSE, sizeof (ChipsMeshLevelOfDetail));
+        section = chips_mesh_file_get_section (mesh_file, CHIPS_MESH_SECTION_LEVELS_OF_DETAIL);
+
+        if (section == NULL) {
+                ChipsMeshLevelOfDetail level = { 0 };
+
+                level.number_of_indices = priv->number_of_indices;
+                g_array_append_val (priv->levels_of_detail, level);
+                return TRUE;
+        }
+
+        levels_of_detail = g_bytes_get_data (section, &size);
+        number_of_levels = size / sizeof (ChipsMeshLevelOfDetail);
+
+        if (number_of_levels == 0 || size % sizeof (ChipsMeshLevelOfDetail) != 0) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "'%s' has a malformed level of detail table", filename);
+                return FALSE;
+        }
 
-        g_type_class_add_private (own_class, sizeof (Chips3DModelClass));
+        for (i = 0; i < number_of_levels; i++) {
+                if (levels_of_detail[i].first_index > priv->number_of_indices ||
+                    levels_of_detail[i].number_of_indices > priv->number_of_indices - levels_of_detail[i].first_index) {
+                        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                                     "'%s' has a level of detail past the end of the index buffer", filename);
+                        return FALSE;
+                }
+        }
+
+        g_array_append_vals (priv->levels_of_detail, levels_of_detail, number_of_levels);
+
+        return TRUE;
 }
 
-static void
-chips_3d_model_init (Chips3DModel *self)
+static gboolean
+load_clusters (Chips3DModel   *self,
+               ChipsMeshFile  *mesh_file,
+               const char     *filename,
+               GError        **error)
 {
         Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+        g_autoptr (GBytes) section = NULL;
+        const ChipsMeshCluster *clusters;
+        size_t size, number_of_clusters, i, k;
+
+        section = chips_mesh_file_get_section (mesh_file, CHIPS_MESH_SECTION_CLUSTERS);
+
+        /* Files written before clustering are drawn without culling */
+        if (section == NULL || g_bytes_get_size (section) == 0) {
+                return TRUE;
+        }
+
+        clusters = g_bytes_get_data (section, &size);
+        number_of_clusters = size / sizeof (ChipsMeshCluster);
+
+        if (size % sizeof (ChipsMeshCluster) != 0) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "'%s' has a malformed cluster table", filename);
+                return FALSE;
+        }
+
+        for (i = 0; i < number_of_clusters; i++) {
+                const ChipsMeshLevelOfDetail *level;
+                gboolean has_bad_bounds = FALSE;
+
+                if (clusters[i].level >= priv->levels_of_detail->len) {
+                        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                                     "'%s' has a cluster in a level of detail that doesn't exist", filename);
+                        return FALSE;
+                }
+
+                level = &g_array_index (priv->levels_of_detail, ChipsMeshLevelOfDetail, clusters[i].level);
+
+                if (clusters[i].first_index < level->first_index ||
+                    clusters[i].first_index - level->first_index > level->number_of_indices ||
+                    clusters[i].number_of_indices > level->number_of_indices - (clusters[i].first_index - level->first_index)) {
+                        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                                     "'%s' has a cluster outside of its level of detail", filename);
+                        return FALSE;
+                }
+
+                for (k = 0; k < 3; k++) {
+                        if (!(clusters[i].bounds_minimum[k] <= clusters[i].bounds_maximum[k]) ||
+                            !isfinite (clusters[i].bounds_minimum[k]) ||
+                            !isfinite (clusters[i].bounds_maximum[k])) {
+                                has_bad_bounds = TRUE;
+                        }
+                }
+
+                if (has_bad_bounds) {
+                        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                                     "'%s' has a cluster with malformed bounds", filename);
+                        return FALSE;
+                }
+        }
+
+        priv->clusters = g_array_sized_new (FALSE, FALSE, sizeof (ChipsMeshCluster), number_of_clusters);
+        g_array_append_vals (priv->clusters, clusters, number_of_clusters);
+
+        return TRUE;
 }
 
-const float *
-chips_3d_model_get_vertex_buffer (Chips3DModel *self)
+/* The file is mapped, not read, so the vertex and index sections are
+ * used in place.  The only pass over the data is a bounds check on the
+ * indices, which keeps a corrupt file from making the GPU read past the
+ * end of the vertex buffer.  It goes in batches, and each checked batch
+ * is made available right away.
+ */
+static gboolean
+load_mesh_file (Chips3DModel  *self,
+                const char    *filename,
+                GCancellable  *cancellable,
+                GError       **error)
 {
         Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+        g_autoptr (ChipsMeshFile) mesh_file = NULL;
+        const ChipsMeshFileHeader *header;
+        g_autoptr (GBytes) vertex_format = NULL;
+        ValidationJob job = { 0 };
+        size_t start, end;
+        gint64 span_start;
+
+        span_start = chips_profiler_begin_span ();
+        mesh_file = chips_mesh_file_open (filename, error);
+
+        if (mesh_file == NULL) {
+                return FALSE;
+        }
+
+        header = chips_mesh_file_get_header (mesh_file);
+        vertex_format = chips_mesh_file_get_section (mesh_file, CHIPS_MESH_SECTION_VERTEX_FORMAT);
+
+        /* Files without a format section only have float positions */
+        if (vertex_format == NULL) {
+                chips_vertex_format_init (&priv->vertex_format,
+                                          CHIPS_VERTEX_ENCODING_FLOAT,
+                                          CHIPS_VERTEX_ENCODING_NONE,
+                                          CHIPS_VERTEX_ENCODING_NONE);
+        } else if (g_bytes_get_size (vertex_format) == sizeof (ChipsVertexFormat)) {
+                memcpy (&priv->vertex_format,
+                        g_bytes_get_data (vertex_format, NULL),
+                        sizeof (ChipsVertexFormat));
+
+                if (!chips_vertex_format_validate (&priv->vertex_format, error)) {
+                        g_prefix_error (error, "'%s': ", filename);
+                        return FALSE;
+                }
+        } else {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "'%s' has a malformed vertex format", filename);
+                return FALSE;
+        }
 
-        return priv->vertex_buffer;
+        if (header->vertex_stride != priv->vertex_format.stride ||
+            (header->index_size != sizeof (guint16) && header->index_size != sizeof (guint32))) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                             "'%s' uses an unsupported vertex layout", filename);
+                return FALSE;
+        }
+
+        if (header->number_of_vertices > G_MAXUINT || header->number_of_indices > G_MAXUINT) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                             "'%s' has too many vertices", filename);
+                return FALSE;
+        }
+
+        priv->number_of_vertices = header->number_of_vertices;
+        priv->number_of_indices = header->number_of_indices;
+        priv->index_size = header->index_size;
+        priv->vertex_buffer = chips_mesh_file_get_section (mesh_file, CHIPS_MESH_SECTION_VERTICES);
+        priv->vertex_arrangement = chips_mesh_file_get_section (mesh_file, CHIPS_MESH_SECTION_VERTEX_ARRANGEMENT);
+
+        if (priv->vertex_buffer == NULL ||
+            priv->vertex_arrangement == NULL ||
+            g_bytes_get_size (priv->vertex_buffer) != (size_t) priv->number_of_vertices * header->vertex_stride ||
+            g_bytes_get_size (priv->vertex_arrangement) != (size_t) priv->number_of_indices * header->index_size) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "'%s' has missing or truncated geometry", filename);
+                return FALSE;
+        }
+
+        if (!load_levels_of_detail (self, mesh_file, filename, error)) {
+                return FALSE;
+        }
+
+        if (!load_clusters (self, mesh_file, filename, error)) {
+                return FALSE;
+        }
+
+        memcpy (priv->bounds_minimum, header->bounds_minimum, sizeof (priv->bounds_minimum));
+        memcpy (priv->bounds_maximum, header->bounds_maximum, sizeof (priv->bounds_maximum));
+
+        g_mutex_lock (&priv->progress_lock);
+        priv->bytes_total = chips_mesh_file_get_size (mesh_file);
+        g_mutex_unlock (&priv->progress_lock);
+
+        report_progress (self,
+                         chips_mesh_file_get_size (mesh_file) - g_bytes_get_size (priv->vertex_arrangement),
+                         priv->number_of_vertices,
+                         FALSE);
+
+        job.self = self;
+        job.index_size = priv->index_size;
+
+        for (start = 0; start < priv->number_of_indices; start = end) {
+                end = MIN (start + INDICES_PER_GEOMETRY_BATCH, priv->number_of_indices);
+                job.vertex_arrangement = (const guint8 *) g_bytes_get_data (priv->vertex_arrangement, NULL) +
+                                         start * priv->index_size;
+
+                if (!chips_parallel_for (end - start,
+                                         VERTICES_PER_CHUNK,
+                                         (ChipsParallelFunc) validate_vertex_arrangement_range,
+                                         &job,
+                                         cancellable,
+                                         error)) {
+                        return FALSE;
+                }
+
+                if (job.has_bad_index) {
+                        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                                     "'%s' refers to vertices that don't exist", filename);
+                        return FALSE;
+                }
+
+                report_geometry_available (self, priv->number_of_vertices, end);
+        }
+
+        chips_profiler_end_span (span_start, "load", "load mesh file");
+
+        return TRUE;
 }
 
-size_t
-chips_3d_model_get_vertex_buffer_size (Chips3DModel *self)
+static gboolean
+has_suffix (const char *filename,
+            const char *suffix)
 {
-        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+        size_t filename_length, suffix_length;
+
+        filename_length = strlen (filename);
+        suffix_length = strlen (suffix);
+
+        if (filename_length < suffix_length) {
+                return FALSE;
+        }
 
-        return priv->vertex_buffer_size;
+        return g_ascii_strcasecmp (filename + filename_length - suffix_length, suffix) == 0;
 }
 
-unsigned int
-chips_3d_model_get_number_of_vertices (Chips3DModel *self)
+typedef gboolean (* ImportFunc) (GBytes                   *contents,
+                                 ChipsImportedMesh        *mesh,
+                                 ChipsImportProgressFunc   progress_func,
+                                 gpointer                  user_data,
+                                 GCancellable             *cancellable,
+                                 GError                  **error);
+
+static void
+on_import_progress (size_t        bytes_processed,
+                    size_t        vertices_processed,
+                    Chips3DModel *self)
+{
+        report_progress (self, bytes_processed, vertices_processed, FALSE);
+}
+
+static gboolean
+import_file (Chips3DModel       *self,
+             const char         *filename,
+             ImportFunc          import_func,
+             ChipsImportedMesh  *mesh,
+             GCancellable       *cancellable,
+             GError            **error)
 {
         Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+        g_autoptr (GMappedFile) mapped_file = NULL;
+        g_autoptr (GBytes) contents = NULL;
+        gint64 span_start;
 
-        return priv->number_of_vertices;
+        span_start = chips_profiler_begin_span ();
+        mapped_file = g_mapped_file_new (filename, FALSE, error);
+
+        if (mapped_file == NULL) {
+                return FALSE;
+        }
+
+        contents = g_mapped_file_get_bytes (mapped_file);
+
+        g_mutex_lock (&priv->progress_lock);
+        priv->bytes_total = g_bytes_get_size (contents);
+        g_mutex_unlock (&priv->progress_lock);
+
+        if (!import_func (contents,
+                          mesh,
+                          (ChipsImportProgressFunc) on_import_progress,
+                          self,
+                          cancellable,
+                          error)) {
+                g_prefix_error (error, "'%s': ", filename);
+                return FALSE;
+        }
+
+        chips_profiler_end_span (span_start, "load", "import");
+
+        return TRUE;
 }
 
-unsigned int *
-chips_3d_model_get_vertex_arrangement (Chips3DModel *self)
+/* Formats like STL repeat every corner of every triangle, and the cube
+ * is stored that way too, so before the geometry is kept, shared corners
+ * are merged, coarser levels of detail are appended to the index
+ * buffer, each level is split into spatial clusters for culling,
+ * triangles and vertices are put in an order the GPU caches
+ * well, and the index buffer is narrowed when it can be.  Finally
+ * normals are generated and packed in with the positions, quantized
+ * unless the quantize-vertices property says otherwise.
+ */
+static gboolean
+optimize_mesh (Chips3DModel       *self,
+               ChipsImportedMesh  *mesh,
+               GCancellable       *cancellable,
+               GError            **error)
 {
         Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+        ChipsVertexCacheStatistics before, after;
+        g_autoptr (GBytes) normals = NULL;
+        GBytes *vertices;
+        gint64 span_start;
+
+        span_start = chips_profiler_begin_span ();
+
+        if (!chips_mesh_weld_vertices (mesh, priv->weld_epsilon, cancellable, error)) {
+                return FALSE;
+        }
+
+        chips_mesh_compute_bounds (mesh, priv->bounds_minimum, priv->bounds_maximum);
+        chips_profiler_end_span (span_start, "load", "weld vertices");
+
+        span_start = chips_profiler_begin_span ();
+
+        if (!chips_mesh_build_levels_of_detail (mesh, LEVEL_OF_DETAIL_MINIMUM_TRIANGLES, cancellable, error)) {
+                return FALSE;
+        }
+
+        chips_profiler_end_span (span_start, "load", "build levels of detail");
+
+        span_start = chips_profiler_begin_span ();
+
+        if (!chips_mesh_build_clusters (mesh, TRIANGLES_PER_CLUSTER, cancellable, error)) {
+                return FALSE;
+        }
+
+        chips_profiler_end_span (span_start, "load", "build clusters");
+
+        chips_mesh_analyze_vertex_cache (mesh, CHIPS_MESH_VERTEX_CACHE_SIZE, &before);
+
+        span_start = chips_profiler_begin_span ();
+
+        if (!chips_mesh_optimize_triangle_order (mesh, CHIPS_MESH_VERTEX_CACHE_SIZE, cancellable, error)) {
+                return FALSE;
+        }
+
+        chips_profiler_end_span (span_start, "load", "optimize triangle order");
+
+        span_start = chips_profiler_begin_span ();
+
+        if (!chips_mesh_optimize_vertex_fetch (mesh, cancellable, error)) {
+                return FALSE;
+        }
+
+        chips_profiler_end_span (span_start, "load", "optimize vertex fetch");
+
+        chips_mesh_analyze_vertex_cache (mesh, CHIPS_MESH_VERTEX_CACHE_SIZE, &after);
+
+        g_debug ("vertex cache: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f",
+                 before.average_cache_miss_ratio,
+                 after.average_cache_miss_ratio,
+                 before.average_transform_to_vertex_ratio,
+                 after.average_transform_to_vertex_ratio);
+
+        span_start = chips_profiler_begin_span ();
+
+        if (!chips_mesh_compact_indices (mesh, cancellable, error)) {
+                return FALSE;
+        }
+
+        chips_profiler_end_span (span_start, "load", "compact indices");
+
+        if (mesh->number_of_vertices > G_MAXUINT || mesh->number_of_indices > G_MAXUINT) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                             "model has too many vertices");
+                return FALSE;
+        }
+
+        span_start = chips_profiler_begin_span ();
+        normals = chips_mesh_compute_normals (mesh, cancellable, error);
+
+        if (normals == NULL) {
+                return FALSE;
+        }
+
+        chips_profiler_end_span (span_start, "load", "compute normals");
+
+        if (priv->quantize_vertices) {
+                chips_vertex_format_init (&priv->vertex_format,
+                                          CHIPS_VERTEX_ENCODING_NORMALIZED_SHORT,
+                                          CHIPS_VERTEX_ENCODING_OCTAHEDRAL_SHORT,
+                                          CHIPS_VERTEX_ENCODING_NORMALIZED_SHORT);
+        } else {
+                chips_vertex_format_init (&priv->vertex_format,
+                                          CHIPS_VERTEX_ENCODING_FLOAT,
+                                          CHIPS_VERTEX_ENCODING_FLOAT,
+                                          CHIPS_VERTEX_ENCODING_FLOAT);
+        }
+
+        /* None of the importers read texture coordinates yet */
+        span_start = chips_profiler_begin_span ();
+        vertices = chips_vertex_format_encode (&priv->vertex_format,
+                                               g_bytes_get_data (mesh->vertex_buffer, NULL),
+                                               g_bytes_get_data (normals, NULL),
+                                               NULL,
+                                               mesh->number_of_vertices,
+                                               cancellable,
+                                               error);
+
+        if (vertices == NULL) {
+                return FALSE;
+        }
+
+        chips_profiler_end_span (span_start, "load", "encode vertices");
 
-        return priv->vertex_arrangement;
+        priv->vertex_buffer = vertices;
+        priv->number_of_vertices = mesh->number_of_vertices;
+        priv->vertex_arrangement = g_steal_pointer (&mesh->vertex_arrangement);
+        priv->number_of_indices = mesh->number_of_indices;
+        priv->index_size = mesh->index_size;
+        priv->levels_of_detail = g_steal_pointer (&mesh->levels_of_detail);
+        priv->clusters = g_steal_pointer (&mesh->clusters);
+
+        /* Nothing is final until the very end here, since every step
+         * before rewrites the whole index buffer
+         */
+        report_geometry_available (self, priv->number_of_vertices, priv->number_of_indices);
+
+        return TRUE;
 }
 
-intptr_t
-chips_3d_model_get_vertex_buffer_get_stride (Chips3DModel *self)
+typedef struct
+{
+        const ChipsVertexFormat *format;
+        const guint8            *vertices;
+        const guint8            *vertex_arrangement;
+        size_t                   index_size;
+        guint64                  first_index;
+        float                    center[3];
+
+        GMutex                   lock;
+        float                    radius_squared;
+        double                   surface_area;
+} AnalysisJob;
+
+/* Four vertices at a time, keeping the furthest of each lane */
+static void
+measure_radius_range (size_t       start,
+                      size_t       end,
+                      AnalysisJob *job)
 {
-        return 0;
+        ChipsFloat4 largest = { 0.0f, 0.0f, 0.0f, 0.0f };
+        float radius_squared;
+        size_t i, lane;
+
+        for (i = start; i < end; i += 4) {
+                ChipsFloat4 x = { 0 }, y = { 0 }, z = { 0 }, distance_squared;
+                ChipsInt4 further;
+
+                for (lane = 0; lane < 4 && i + lane < end; lane++) {
+                        float position[3];
+
+                        chips_vertex_format_decode_position (job->format,
+                                                             job->vertices + (i + lane) * job->format->stride,
+                                                             position);
+                        x[lane] = position[0] - job->center[0];
+                        y[lane] = position[1] - job->center[1];
+                        z[lane] = position[2] - job->center[2];
+                }
+
+                distance_squared = x * x + y * y + z * z;
+                further = distance_squared > largest;
+                largest = (ChipsFloat4) (((ChipsInt4) distance_squared & further) | ((ChipsInt4) largest & ~further));
+        }
+
+        radius_squared = MAX (MAX (largest[0], largest[1]), MAX (largest[2], largest[3]));
+
+        g_mutex_lock (&job->lock);
+        job->radius_squared = MAX (job->radius_squared, radius_squared);
+        g_mutex_unlock (&job->lock);
 }
 
-intptr_t
-chips_3d_model_get_vertex_buffer_get_offset (Chips3DModel *self)
+static void
+get_corner (AnalysisJob *job,
+            size_t       index_number,
+            float       *position)
+{
+        guint32 index;
+
+        if (job->index_size == sizeof (guint16)) {
+                index = ((const guint16 *) job->vertex_arrangement)[index_number];
+        } else {
+                index = ((const guint32 *) job->vertex_arrangement)[index_number];
+        }
+
+        chips_vertex_format_decode_position (job->format,
+                                             job->vertices + (size_t) index * job->format->stride,
+                                             position);
+}
+
+/* Four triangles at a time, half the length of the cross product of two
+ * edges each
+ */
+static void
+measure_surface_area_range (size_t       start,
+                            size_t       end,
+                            AnalysisJob *job)
+{
+        double surface_area = 0.0;
+        size_t i, lane;
+
+        for (i = start; i < end; i += 4) {
+                ChipsFloat4 first_edge[3] = { { 0 } }, second_edge[3] = { { 0 } };
+                ChipsFloat4 normal_x, normal_y, normal_z, area;
+
+                for (lane = 0; lane < 4 && i + lane < end; lane++) {
+                        size_t first_index = job->first_index + (i + lane) * 3;
+                        float corners[3][3];
+                        size_t k;
+
+                        get_corner (job, first_index, corners[0]);
+                        get_corner (job, first_index + 1, corners[1]);
+                        get_corner (job, first_index + 2, corners[2]);
+
+                        for (k = 0; k < 3; k++) {
+                                first_edge[k][lane] = corners[1][k] - corners[0][k];
+                                second_edge[k][lane] = corners[2][k] - corners[0][k];
+                        }
+                }
+
+                normal_x = first_edge[1] * second_edge[2] - first_edge[2] * second_edge[1];
+                normal_y = first_edge[2] * second_edge[0] - first_edge[0] * second_edge[2];
+                normal_z = first_edge[0] * second_edge[1] - first_edge[1] * second_edge[0];
+                area = normal_x * normal_x + normal_y * normal_y + normal_z * normal_z;
+
+                for (lane = 0; lane < 4; lane++) {
+                        surface_area += sqrtf (area[lane]) / 2.0f;
+                }
+        }
+
+        g_mutex_lock (&job->lock);
+        job->surface_area += surface_area;
+        g_mutex_unlock (&job->lock);
+}
+
+/* Works out the smallest sphere around the model centered on its
+ * bounds, and how much surface its full detail level has, going over
+ * the final geometry however it was loaded
+ */
+static gboolean
+analyze_geometry (Chips3DModel  *self,
+                  GCancellable  *cancellable,
+                  GError       **error)
 {
-        return 0;
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+        const ChipsMeshLevelOfDetail *level_of_detail;
+        AnalysisJob job = { 0 };
+        gboolean analyzed;
+        size_t k;
+        gint64 span_start;
+
+        span_start = chips_profiler_begin_span ();
+        level_of_detail = &g_array_index (priv->levels_of_detail, ChipsMeshLevelOfDetail, 0);
+
+        job.format = &priv->vertex_format;
+        job.vertices = g_bytes_get_data (priv->vertex_buffer, NULL);
+        job.vertex_arrangement = g_bytes_get_data (priv->vertex_arrangement, NULL);
+        job.index_size = priv->index_size;
+        job.first_index = level_of_detail->first_index;
+
+        for (k = 0; k < 3; k++) {
+                job.center[k] = (priv->bounds_minimum[k] + priv->bounds_maximum[k]) / 2.0f;
+        }
+
+        g_mutex_init (&job.lock);
+
+        analyzed = chips_parallel_for (priv->number_of_vertices,
+                                       VERTICES_PER_CHUNK,
+                                       (ChipsParallelFunc) measure_radius_range,
+                                       &job,
+                                       cancellable,
+                                       error) &&
+                   chips_parallel_for (level_of_detail->number_of_indices / 3,
+                                       VERTICES_PER_CHUNK,
+                                       (ChipsParallelFunc) measure_surface_area_range,
+                                       &job,
+                                       cancellable,
+                                       error);
+
+        g_mutex_clear (&job.lock);
+
+        if (!analyzed) {
+                return FALSE;
+        }
+
+        g_mutex_lock (&priv->progress_lock);
+        priv->bounding_sphere_radius = sqrtf (job.radius_squared);
+        priv->surface_area = job.surface_area;
+        priv->analyzed = TRUE;
+        g_mutex_unlock (&priv->progress_lock);
+
+        chips_profiler_end_span (span_start, "load", "analyze geometry");
+
+        g_debug ("bounding sphere radius %g, surface area %g",
+                 priv->bounding_sphere_radius,
+                 priv->surface_area);
+
+        return TRUE;
+}
+
+/* Each level of detail gets its own tree over the clusters drawn at
+ * that level
+ */
+static void
+build_bounding_volume_hierarchies (Chips3DModel *self)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+        g_autoptr (GArray) level_clusters = NULL;
+        size_t i, j;
+        gint64 span_start;
+
+        priv->bounding_volume_hierarchies = g_ptr_array_new_with_free_func ((GDestroyNotify) chips_bvh_free);
+
+        if (priv->clusters == NULL) {
+                return;
+        }
+
+        span_start = chips_profiler_begin_span ();
+
+        level_clusters = g_array_new (FALSE, FALSE, sizeof (ChipsMeshCluster));
+
+        for (i = 0; i < priv->levels_of_detail->len; i++) {
+                g_array_set_size (level_clusters, 0);
+
+                for (j = 0; j < priv->clusters->len; j++) {
+                        const ChipsMeshCluster *cluster = &g_array_index (priv->clusters, ChipsMeshCluster, j);
+
+                        if (cluster->level == i) {
+                                g_array_append_vals (level_clusters, cluster, 1);
+                        }
+                }
+
+                if (level_clusters->len == 0) {
+                        g_ptr_array_add (priv->bounding_volume_hierarchies, NULL);
+                        continue;
+                }
+
+                g_ptr_array_add (priv->bounding_volume_hierarchies,
+                                 chips_bvh_new ((const ChipsMeshCluster *) level_clusters->data,
+                                                level_clusters->len));
+        }
+
+        chips_profiler_end_span (span_start, "load", "build bounding volume hierarchies");
+}
+
+typedef struct
+{
+        const guint8 *data;
+        size_t        size;
+        guint64      *hashes;
+} HashJob;
+
+/* Not meant to stand up to anyone trying to make chunks collide, just
+ * to tell edited chunks apart quickly
+ */
+static guint64
+hash_chunk (const guint8 *data,
+            size_t        size)
+{
+        guint64 hash = G_GUINT64_CONSTANT (0xcbf29ce484222325) ^ size;
+        size_t i;
+
+        for (i = 0; i + sizeof (guint64) <= size; i += sizeof (guint64)) {
+                guint64 word;
+
+                memcpy (&word, data + i, sizeof (word));
+                hash = (hash ^ word) * G_GUINT64_CONSTANT (0x9e3779b97f4a7c15);
+                hash ^= hash >> 29;
+        }
+
+        for (; i < size; i++) {
+                hash = (hash ^ data[i]) * G_GUINT64_CONSTANT (0x9e3779b97f4a7c15);
+        }
+
+        return hash;
+}
+
+static void
+hash_chunk_range (size_t   start,
+                  size_t   end,
+                  HashJob *job)
+{
+        size_t i;
+
+        for (i = start; i < end; i++) {
+                size_t offset = i * CHIPS_3D_MODEL_CHUNK_SIZE;
+
+                job->hashes[i] = hash_chunk (job->data + offset,
+                                             MIN (job->size - offset, CHIPS_3D_MODEL_CHUNK_SIZE));
+        }
+}
+
+static GArray *
+hash_chunks (GBytes        *bytes,
+             GCancellable  *cancellable,
+             GError       **error)
+{
+        g_autoptr (GArray) hashes = NULL;
+        HashJob job;
+        size_t number_of_chunks;
+
+        job.data = g_bytes_get_data (bytes, &job.size);
+        number_of_chunks = (job.size + CHIPS_3D_MODEL_CHUNK_SIZE - 1) / CHIPS_3D_MODEL_CHUNK_SIZE;
+
+        hashes = g_array_sized_new (FALSE, FALSE, sizeof (guint64), number_of_chunks);
+        g_array_set_size (hashes, number_of_chunks);
+        job.hashes = (guint64 *) hashes->data;
+
+        if (!chips_parallel_for (number_of_chunks,
+                                 CHUNKS_PER_HASH_JOB,
+                                 (ChipsParallelFunc) hash_chunk_range,
+                                 &job,
+                                 cancellable,
+                                 error)) {
+                return NULL;
+        }
+
+        return g_steal_pointer (&hashes);
+}
+
+static gboolean
+hash_geometry (Chips3DModel  *self,
+               GCancellable  *cancellable,
+               GError       **error)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+        gint64 span_start;
+
+        span_start = chips_profiler_begin_span ();
+
+        priv->vertex_buffer_chunk_hashes = hash_chunks (priv->vertex_buffer, cancellable, error);
+
+        if (priv->vertex_buffer_chunk_hashes == NULL) {
+                return FALSE;
+        }
+
+        priv->vertex_arrangement_chunk_hashes = hash_chunks (priv->vertex_arrangement, cancellable, error);
+
+        if (priv->vertex_arrangement_chunk_hashes == NULL) {
+                return FALSE;
+        }
+
+        chips_profiler_end_span (span_start, "load", "hash geometry");
+
+        return TRUE;
+}
+
+static void
+clear_geometry (Chips3DModel *self)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+
+        g_clear_pointer (&priv->vertex_buffer, g_bytes_unref);
+        g_clear_pointer (&priv->vertex_arrangement, g_bytes_unref);
+        g_clear_pointer (&priv->levels_of_detail, g_array_unref);
+        g_clear_pointer (&priv->clusters, g_array_unref);
+        priv->number_of_vertices = 0;
+        priv->number_of_indices = 0;
+        priv->index_size = 0;
+
+        g_mutex_lock (&priv->progress_lock);
+        priv->bytes_processed = 0;
+        priv->vertices_processed = 0;
+        g_mutex_unlock (&priv->progress_lock);
+}
+
+/* Notes that the geometry is in filename, so it can be let go of and
+ * read back later.  Loading reads the geometry without holding it, so
+ * this waits until loading is done with it, and then lets it go right
+ * away if nothing held it in the meantime.
+ */
+static void
+set_geometry_filename (Chips3DModel *self,
+                       const char   *filename)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+        GStatBuf status;
+
+        if (g_stat (filename, &status) < 0) {
+                return;
+        }
+
+        g_mutex_lock (&priv->geometry_lock);
+        g_free (priv->geometry_filename);
+        priv->geometry_filename = g_strdup (filename);
+        priv->geometry_file_status = status;
+
+        if (priv->geometry_holds == 0) {
+                g_clear_pointer (&priv->vertex_buffer, g_bytes_unref);
+                g_clear_pointer (&priv->vertex_arrangement, g_bytes_unref);
+                priv->geometry_released = TRUE;
+        }
+        g_mutex_unlock (&priv->geometry_lock);
+}
+
+/* A cache entry that doesn't load is thrown away, and the model gets
+ * imported again as if it were never cached
+ */
+static gboolean
+load_cached_model (Chips3DModel  *self,
+                   const char    *cache_key,
+                   char         **geometry_filename,
+                   GCancellable  *cancellable)
+{
+        g_autofree char *filename = NULL;
+        g_autoptr (GError) error = NULL;
+
+        filename = chips_model_cache_lookup (cache_key);
+
+        if (filename == NULL) {
+                return FALSE;
+        }
+
+        if (!load_mesh_file (self, filename, cancellable, &error)) {
+                g_debug ("couldn't load cached model: %s", error->message);
+                chips_model_cache_remove (cache_key);
+                clear_geometry (self);
+                return FALSE;
+        }
+
+        *geometry_filename = g_steal_pointer (&filename);
+
+        return TRUE;
+}
+
+/* Returns where the model got saved, or NULL if it couldn't be */
+static char *
+save_cached_model (Chips3DModel *self,
+                   const char   *cache_key,
+                   GCancellable *cancellable)
+{
+        g_autofree char *filename = NULL;
+        g_autofree char *directory = NULL;
+        g_autoptr (GError) error = NULL;
+
+        filename = chips_model_cache_get_filename (cache_key);
+        directory = g_path_get_dirname (filename);
+
+        if (g_mkdir_with_parents (directory, 0700) < 0) {
+                g_debug ("couldn't create model cache directory '%s': %m", directory);
+                return NULL;
+        }
+
+        if (!chips_3d_model_save (self, filename, cancellable, &error)) {
+                g_debug ("couldn't cache model: %s", error->message);
+                return NULL;
+        }
+
+        chips_model_cache_trim (CHIPS_MODEL_CACHE_MAXIMUM_SIZE);
+
+        return g_steal_pointer (&filename);
+}
+
+static gboolean
+load_model (Chips3DModel  *self,
+            GCancellable  *cancellable,
+            GError       **error)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+        g_autofree char *filename = NULL;
+        g_autofree char *cache_key = NULL;
+        g_autofree char *geometry_filename = NULL;
+        ChipsImportedMesh mesh = { 0 };
+        gboolean loaded;
+        gboolean loaded_from_cache = FALSE;
+        gint64 span_start;
+
+        span_start = chips_profiler_begin_span ();
+
+        if (priv->file == NULL) {
+                loaded = load_cube (self, &mesh, cancellable, error) &&
+                         optimize_mesh (self, &mesh, cancellable, error);
+        } else {
+
+                filename = g_file_get_path (priv->file);
+
+                if (priv->use_cache && filename != NULL && !chips_mesh_file_is_mesh_file (filename)) {
+                        cache_key = chips_model_cache_compute_key (priv->file,
+                                                                   priv->weld_epsilon,
+                                                                   priv->quantize_vertices,
+                                                                   cancellable,
+                                                                   NULL);
+                }
+
+                if (filename != NULL && chips_mesh_file_is_mesh_file (filename)) {
+                        loaded = load_mesh_file (self, filename, cancellable, error);
+
+                        if (loaded) {
+                                geometry_filename = g_strdup (filename);
+                        }
+                } else if (cache_key != NULL && load_cached_model (self, cache_key, &geometry_filename, cancellable)) {
+                        loaded = TRUE;
+                        loaded_from_cache = TRUE;
+                } else if (filename != NULL && has_suffix (filename, ".obj")) {
+                        loaded = import_file (self, filename, chips_import_obj, &mesh, cancellable, error) &&
+                                 optimize_mesh (self, &mesh, cancellable, error);
+                } else if (filename != NULL && has_suffix (filename, ".stl")) {
+                        loaded = import_file (self, filename, chips_import_stl, &mesh, cancellable, error) &&
+                                 optimize_mesh (self, &mesh, cancellable, error);
+                } else {
+                        g_autofree char *name = g_file_get_parse_name (priv->file);
+
+                        g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                                     "'%s' is not in a supported model format", name);
+                        return FALSE;
+                }
+        }
+
+        chips_imported_mesh_clear (&mesh);
+
+        if (!loaded) {
+                return FALSE;
+        }
+
+        if (!analyze_geometry (self, cancellable, error)) {
+                return FALSE;
+        }
+
+        build_bounding_volume_hierarchies (self);
+
+        if (!hash_geometry (self, cancellable, error)) {
+                return FALSE;
+        }
+
+        if (cache_key != NULL && !loaded_from_cache) {
+                geometry_filename = save_cached_model (self, cache_key, cancellable);
+        }
+
+        if (geometry_filename != NULL) {
+                set_geometry_filename (self, geometry_filename);
+        }
+
+        chips_profiler_end_span (span_start, "load", "load model");
+
+        report_progress (self, 0, 0, TRUE);
+
+        return TRUE;
+}
+
+static gboolean
+initable_init (GInitable     *initable,
+               GCancellable  *cancellable,
+               GError       **error)
+{
+        Chips3DModel *self = CHIPS_3D_MODEL (initable);
+
+        return load_model (self, cancellable, error);
+}
+
+static void
+initable_iface_init (GInitableIface *initable_iface)
+{
+        initable_iface->init = initable_init;
+}
+
+static void
+load_model_in_thread (GTask        *task,
+                      Chips3DModel *self,
+                      gpointer      task_data,
+                      GCancellable *cancellable)
+{
+        GError *error = NULL;
+
+        if (!load_model (self, cancellable, &error)) {
+                g_task_return_error (task, error);
+                return;
+        }
+
+        g_task_return_boolean (task, TRUE);
+}
+
+static void
+async_initable_init_async (GAsyncInitable      *initable,
+                           int                  io_priority,
+                           GCancellable        *cancellable,
+                           GAsyncReadyCallback  callback,
+                           gpointer             user_data)
+{
+        Chips3DModel *self = CHIPS_3D_MODEL (initable);
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+        g_autoptr (GTask) task = NULL;
+
+        task = g_task_new (self, cancellable, callback, user_data);
+        g_task_set_source_tag (task, async_initable_init_async);
+        g_task_set_priority (task, io_priority);
+
+        g_mutex_lock (&priv->progress_lock);
+        priv->progress_context = g_main_context_ref_thread_default ();
+        g_mutex_unlock (&priv->progress_lock);
+
+        g_task_run_in_thread (task, (GTaskThreadFunc) load_model_in_thread);
+}
+
+static gboolean
+async_initable_init_finish (GAsyncInitable  *initable,
+                            GAsyncResult    *result,
+                            GError         **error)
+{
+        g_return_val_if_fail (g_task_is_valid (result, initable), FALSE);
+
+        return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+static void
+async_initable_iface_init (GAsyncInitableIface *async_initable_iface)
+{
+        async_initable_iface->init_async = async_initable_init_async;
+        async_initable_iface->init_finish = async_initable_init_finish;
+}
+
+static void
+chips_3d_model_dispose (GObject *object)
+{
+        Chips3DModel *self = CHIPS_3D_MODEL (object);
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+
+        if (priv->reload_timeout_id != 0) {
+                g_source_remove (priv->reload_timeout_id);
+                priv->reload_timeout_id = 0;
+        }
+
+        g_cancellable_cancel (priv->reload_cancellable);
+        g_clear_object (&priv->reload_cancellable);
+        g_clear_object (&priv->file_monitor);
+
+        g_clear_pointer (&priv->vertex_buffer, g_bytes_unref);
+        g_clear_pointer (&priv->vertex_arrangement, g_bytes_unref);
+        g_clear_pointer (&priv->levels_of_detail, g_array_unref);
+        g_clear_pointer (&priv->clusters, g_array_unref);
+        g_clear_pointer (&priv->bounding_volume_hierarchies, g_ptr_array_unref);
+        g_clear_pointer (&priv->vertex_buffer_chunk_hashes, g_array_unref);
+        g_clear_pointer (&priv->vertex_arrangement_chunk_hashes, g_array_unref);
+        g_clear_pointer (&priv->ray_picker, chips_ray_picker_free);
+        g_clear_pointer (&priv->progress_context, g_main_context_unref);
+        g_clear_pointer (&priv->geometry_filename, g_free);
+        g_clear_object (&priv->file);
+
+        G_OBJECT_CLASS (chips_3d_model_parent_class)->dispose (object);
+}
+
+static void
+chips_3d_model_finalize (GObject *object)
+{
+        Chips3DModel *self = CHIPS_3D_MODEL (object);
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+
+        g_mutex_clear (&priv->progress_lock);
+        g_mutex_clear (&priv->geometry_lock);
+        g_mutex_clear (&priv->picking_lock);
+
+        G_OBJECT_CLASS (chips_3d_model_parent_class)->finalize (object);
+}
+
+static void
+chips_3d_model_set_property (GObject      *object,
+                             guint         property_id,
+                             const GValue *value,
+                             GParamSpec   *param_spec)
+{
+        Chips3DModel *self = CHIPS_3D_MODEL (object);
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+
+        switch (property_id) {
+                case PROP_FILE:
+                        priv->file = g_value_dup_object (value);
+                        break;
+                case PROP_WELD_EPSILON:
+                        priv->weld_epsilon = g_value_get_float (value);
+                        break;
+                case PROP_QUANTIZE_VERTICES:
+                        priv->quantize_vertices = g_value_get_boolean (value);
+                        break;
+                case PROP_USE_CACHE:
+                        priv->use_cache = g_value_get_boolean (value);
+                        break;
+                default:
+                        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, param_spec);
+                        break;
+        }
+}
+
+static void
+chips_3d_model_get_property (GObject    *object,
+                             guint       property_id,
+                             GValue     *value,
+                             GParamSpec *param_spec)
+{
+        Chips3DModel *self = CHIPS_3D_MODEL (object);
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+
+        switch (property_id) {
+                case PROP_FILE:
+                        g_value_set_object (value, priv->file);
+                        break;
+                case PROP_WELD_EPSILON:
+                        g_value_set_float (value, priv->weld_epsilon);
+                        break;
+                case PROP_QUANTIZE_VERTICES:
+                        g_value_set_boolean (value, priv->quantize_vertices);
+                        break;
+                case PROP_USE_CACHE:
+                        g_value_set_boolean (value, priv->use_cache);
+                        break;
+                default:
+                        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, param_spec);
+                        break;
+        }
+}
+
+static void
+chips_3d_model_class_init (Chips3DModelClass *own_class)
+{
+        GObjectClass *object_class = G_OBJECT_CLASS (own_class);
+
+        object_class->dispose = chips_3d_model_dispose;
+        object_class->finalize = chips_3d_model_finalize;
+        object_class->set_property = chips_3d_model_set_property;
+        object_class->get_property = chips_3d_model_get_property;
+
+        properties[PROP_FILE] = g_param_spec_object ("file",
+                                                     "File",
+                                                     "File the model is loaded from, or NULL for a cube",
+                                                     G_TYPE_FILE,
+                                                     G_PARAM_READWRITE |
+                                                     G_PARAM_CONSTRUCT_ONLY |
+                                                     G_PARAM_STATIC_STRINGS);
+
+        properties[PROP_WELD_EPSILON] = g_param_spec_float ("weld-epsilon",
+                                                            "Weld epsilon",
+                                                            "Distance under which imported vertices are merged, or 0 to only merge identical ones",
+                                                            0.0f,
+                                                            G_MAXFLOAT,
+                                                            0.0f,
+                                                            G_PARAM_READWRITE |
+                                                            G_PARAM_CONSTRUCT_ONLY |
+                                                            G_PARAM_STATIC_STRINGS);
+
+        properties[PROP_QUANTIZE_VERTICES] = g_param_spec_boolean ("quantize-vertices",
+                                                                   "Quantize vertices",
+                                                                   "Whether imported vertices are stored as 16 bit integers instead of floats",
+                                                                   TRUE,
+                                                                   G_PARAM_READWRITE |
+                                                                   G_PARAM_CONSTRUCT_ONLY |
+                                                                   G_PARAM_STATIC_STRINGS);
+
+        properties[PROP_USE_CACHE] = g_param_spec_boolean ("use-cache",
+                                                           "Use cache",
+                                                           "Whether imported models are kept processed in the user's cache directory and reused",
+                                                           TRUE,
+                                                           G_PARAM_READWRITE |
+                                                           G_PARAM_CONSTRUCT_ONLY |
+                                                           G_PARAM_STATIC_STRINGS);
+
+        g_object_class_install_properties (object_class, NUMBER_OF_PROPERTIES, properties);
+
+        signals[PROGRESS] = g_signal_new ("progress",
+                                          G_TYPE_FROM_CLASS (own_class),
+                                          G_SIGNAL_RUN_LAST,
+                                          0,
+                                          NULL,
+                                          NULL,
+                                          NULL,
+                                          G_TYPE_NONE,
+                                          3,
+                                          G_TYPE_UINT64,
+                                          G_TYPE_UINT64,
+                                          G_TYPE_UINT64);
+
+        /* The vertex buffer, index buffer and vertex format can be read
+         * from the handler, but only the announced number of vertices
+         * and indices from the start of each buffer are final
+         */
+        signals[GEOMETRY_AVAILABLE] = g_signal_new ("geometry-available",
+                                                    G_TYPE_FROM_CLASS (own_class),
+                                                    G_SIGNAL_RUN_LAST,
+                                                    0,
+                                                    NULL,
+                                                    NULL,
+                                                    NULL,
+                                                    G_TYPE_NONE,
+                                                    2,
+                                                    G_TYPE_UINT64,
+                                                    G_TYPE_UINT64);
+
+        /* Emitted with a fully loaded model made from the file after it
+         * changed on disk, for everything showing this one to switch to
+         */
+        signals[REPLACED] = g_signal_new ("replaced",
+                                          G_TYPE_FROM_CLASS (own_class),
+                                          G_SIGNAL_RUN_LAST,
+                                          0,
+                                          NULL,
+                                          NULL,
+                                          NULL,
+                                          G_TYPE_NONE,
+                                          1,
+                                          CHIPS_TYPE_3D_MODEL);
+
+        g_type_class_add_private (own_class, sizeof (Chips3DModelPrivate));
+}
+
+static void
+chips_3d_model_init (Chips3DModel *self)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+
+        g_mutex_init (&priv->progress_lock);
+        g_mutex_init (&priv->geometry_lock);
+        g_mutex_init (&priv->picking_lock);
+}
+
+GFile *
+chips_3d_model_get_file (Chips3DModel *self)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+
+        return priv->file;
+}
+
+gconstpointer
+chips_3d_model_get_vertex_buffer (Chips3DModel *self)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+
+        return g_bytes_get_data (priv->vertex_buffer, NULL);
+}
+
+size_t
+chips_3d_model_get_vertex_buffer_size (Chips3DModel *self)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+
+        return (size_t) priv->number_of_vertices * priv->vertex_format.stride;
+}
+
+unsigned int
+chips_3d_model_get_number_of_vertices (Chips3DModel *self)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+
+        return priv->number_of_vertices;
+}
+
+gconstpointer
+chips_3d_model_get_vertex_arrangement (Chips3DModel *self)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+
+        return g_bytes_get_data (priv->vertex_arrangement, NULL);
+}
+
+size_t
+chips_3d_model_get_vertex_arrangement_size (Chips3DModel *self)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+
+        return (size_t) priv->number_of_indices * priv->index_size;
+}
+
+unsigned int
+chips_3d_model_get_number_of_indices (Chips3DModel *self)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+
+        return priv->number_of_indices;
+}
+
+/* Either 2 or 4 bytes */
+unsigned int
+chips_3d_model_get_index_size (Chips3DModel *self)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+
+        return priv->index_size;
+}
+
+/* How much of the geometry has streamed in so far, for whoever starts
+ * watching a load after some geometry-available signals went by
+ */
+void
+chips_3d_model_get_geometry_available (Chips3DModel *self,
+                                       guint64      *vertices_available,
+                                       guint64      *indices_available)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+
+        g_mutex_lock (&priv->progress_lock);
+        *vertices_available = priv->vertices_available;
+        *indices_available = priv->indices_available;
+        g_mutex_unlock (&priv->progress_lock);
+}
+
+/* Maps the geometry back in from the file it was last read from or
+ * cached in, as long as that file is the same as it was then
+ */
+static gboolean
+restore_geometry (Chips3DModel  *self,
+                  GError       **error)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+        g_autoptr (ChipsMeshFile) mesh_file = NULL;
+        g_autoptr (GBytes) vertex_buffer = NULL;
+        g_autoptr (GBytes) vertex_arrangement = NULL;
+        GStatBuf status;
+
+        if (g_stat (priv->geometry_filename, &status) < 0 ||
+            status.st_size != priv->geometry_file_status.st_size ||
+            status.st_mtime != priv->geometry_file_status.st_mtime) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_WRONG_ETAG,
+                             "'%s' changed since the model was loaded", priv->geometry_filename);
+                return FALSE;
+        }
+
+        mesh_file = chips_mesh_file_open (priv->geometry_filename, error);
+
+        if (mesh_file == NULL) {
+                return FALSE;
+        }
+
+        vertex_buffer = chips_mesh_file_get_section (mesh_file, CHIPS_MESH_SECTION_VERTICES);
+        vertex_arrangement = chips_mesh_file_get_section (mesh_file, CHIPS_MESH_SECTION_VERTEX_ARRANGEMENT);
+
+        if (vertex_buffer == NULL ||
+            vertex_arrangement == NULL ||
+            g_bytes_get_size (vertex_buffer) != chips_3d_model_get_vertex_buffer_size (self) ||
+            g_bytes_get_size (vertex_arrangement) != chips_3d_model_get_vertex_arrangement_size (self)) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "'%s' has missing or truncated geometry", priv->geometry_filename);
+                return FALSE;
+        }
+
+        priv->vertex_buffer = g_steal_pointer (&vertex_buffer);
+        priv->vertex_arrangement = g_steal_pointer (&vertex_arrangement);
+        priv->geometry_released = FALSE;
+
+        return TRUE;
+}
+
+/* The vertex buffer and vertex arrangement are only guaranteed to be
+ * there between this and chips_3d_model_release_geometry().  Fails if
+ * they were let go of and can't be read back.
+ */
+gboolean
+chips_3d_model_hold_geometry (Chips3DModel  *self,
+                              GError       **error)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+        gboolean held = TRUE;
+
+        g_mutex_lock (&priv->geometry_lock);
+        if (priv->geometry_released) {
+                held = restore_geometry (self, error);
+        }
+
+        if (held) {
+                priv->geometry_holds++;
+        }
+        g_mutex_unlock (&priv->geometry_lock);
+
+        return held;
+}
+
+/* Once nothing holds the geometry it's let go of, if it can be read
+ * back from a file
+ */
+void
+chips_3d_model_release_geometry (Chips3DModel *self)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+
+        g_mutex_lock (&priv->geometry_lock);
+        g_assert (priv->geometry_holds > 0);
+        priv->geometry_holds--;
+
+        if (priv->geometry_holds == 0 && priv->geometry_filename != NULL) {
+                g_clear_pointer (&priv->vertex_buffer, g_bytes_unref);
+                g_clear_pointer (&priv->vertex_arrangement, g_bytes_unref);
+                priv->geometry_released = TRUE;
+        }
+        g_mutex_unlock (&priv->geometry_lock);
+}
+
+/* How much memory the vertex buffer and vertex arrangement take up
+ * right now, which is nothing while they're let go of
+ */
+size_t
+chips_3d_model_get_resident_size (Chips3DModel *self)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+        size_t size = 0;
+
+        g_mutex_lock (&priv->geometry_lock);
+        if (!priv->geometry_released) {
+                size = chips_3d_model_get_vertex_buffer_size (self) +
+                       chips_3d_model_get_vertex_arrangement_size (self);
+        }
+        g_mutex_unlock (&priv->geometry_lock);
+
+        return size;
+}
+
+const guint64 *
+chips_3d_model_get_vertex_buffer_chunk_hashes (Chips3DModel *self,
+                                               size_t       *number_of_chunks)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+
+        *number_of_chunks = priv->vertex_buffer_chunk_hashes->len;
+        return (const guint64 *) priv->vertex_buffer_chunk_hashes->data;
+}
+
+const guint64 *
+chips_3d_model_get_vertex_arrangement_chunk_hashes (Chips3DModel *self,
+                                                    size_t       *number_of_chunks)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+
+        *number_of_chunks = priv->vertex_arrangement_chunk_hashes->len;
+        return (const guint64 *) priv->vertex_arrangement_chunk_hashes->data;
+}
+
+void
+chips_3d_model_get_bounds (Chips3DModel   *self,
+                           graphene_box_t *bounds)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+        graphene_point3d_t minimum, maximum;
+
+        graphene_point3d_init (&minimum, priv->bounds_minimum[0], priv->bounds_minimum[1], priv->bounds_minimum[2]);
+        graphene_point3d_init (&maximum, priv->bounds_maximum[0], priv->bounds_maximum[1], priv->bounds_maximum[2]);
+        graphene_box_init (bounds, &minimum, &maximum);
+}
+
+/* Centered on the bounds, which are known as soon as geometry starts
+ * arriving.  Until the model is initialized, the sphere is the one
+ * through the corners of the bounds, and after that it's the smallest
+ * one that fits.
+ */
+void
+chips_3d_model_get_bounding_sphere (Chips3DModel      *self,
+                                    graphene_sphere_t *sphere)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+        graphene_point3d_t center;
+        graphene_vec3_t size;
+        graphene_box_t bounds;
+        float radius;
+
+        chips_3d_model_get_bounds (self, &bounds);
+        graphene_box_get_center (&bounds, &center);
+        graphene_box_get_size (&bounds, &size);
+        radius = graphene_vec3_length (&size) / 2.0f;
+
+        g_mutex_lock (&priv->progress_lock);
+        if (priv->analyzed) {
+                radius = priv->bounding_sphere_radius;
+        }
+        g_mutex_unlock (&priv->progress_lock);
+
+        graphene_sphere_init (sphere, &center, radius);
+}
+
+/* The area of every triangle of the full detail model, added up */
+double
+chips_3d_model_get_surface_area (Chips3DModel *self)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+        double surface_area;
+
+        g_mutex_lock (&priv->progress_lock);
+        surface_area = priv->surface_area;
+        g_mutex_unlock (&priv->progress_lock);
+
+        return surface_area;
+}
+
+unsigned int
+chips_3d_model_get_number_of_levels_of_detail (Chips3DModel *self)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+
+        return priv->levels_of_detail->len;
+}
+
+/* Level 0 is the full model, and each level after it is coarser */
+const ChipsMeshLevelOfDetail *
+chips_3d_model_get_level_of_detail (Chips3DModel *self,
+                                    unsigned int  level)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+
+        g_return_val_if_fail (level < priv->levels_of_detail->len, NULL);
+
+        return &g_array_index (priv->levels_of_detail, ChipsMeshLevelOfDetail, level);
+}
+
+/* Returns the coarsest level that strays no further than
+ * acceptable_error model units from the real surface
+ */
+unsigned int
+chips_3d_model_choose_level_of_detail (Chips3DModel *self,
+                                       float         acceptable_error)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+        unsigned int level = 0;
+        unsigned int i;
+
+        for (i = 1; i < priv->levels_of_detail->len; i++) {
+                if (g_array_index (priv->levels_of_detail, ChipsMeshLevelOfDetail, i).error > acceptable_error) {
+                        break;
+                }
+
+                level = i;
+        }
+
+        return level;
+}
+
+/* Replaces the contents of visible_ranges with the runs of the level's
+ * index buffer that could be in the frustum.  The frustum is in model
+ * space, so it should come from the full model-view-projection matrix.
+ */
+void
+chips_3d_model_cull (Chips3DModel       *self,
+                     unsigned int        level,
+                     const ChipsFrustum *frustum,
+                     GArray             *visible_ranges)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+        const ChipsMeshLevelOfDetail *level_of_detail;
+        const ChipsBvh *bvh = NULL;
+
+        g_return_if_fail (level < priv->levels_of_detail->len);
+
+        g_array_set_size (visible_ranges, 0);
+
+        if (level < priv->bounding_volume_hierarchies->len) {
+                bvh = g_ptr_array_index (priv->bounding_volume_hierarchies, level);
+        }
+
+        if (bvh == NULL) {
+                ChipsIndexRange range;
+
+                level_of_detail = &g_array_index (priv->levels_of_detail, ChipsMeshLevelOfDetail, level);
+                range.first_index = level_of_detail->first_index;
+                range.number_of_indices = level_of_detail->number_of_indices;
+                g_array_append_val (visible_ranges, range);
+                return;
+        }
+
+        chips_bvh_cull (bvh, frustum, visible_ranges);
+}
+
+static void
+build_ray_picker_in_thread (GTask        *task,
+                            Chips3DModel *self,
+                            gpointer      task_data,
+                            GCancellable *cancellable)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+        const ChipsMeshLevelOfDetail *level_of_detail;
+        ChipsRayPicker *ray_picker;
+        GError *error = NULL;
+        gint64 span_start;
+
+        if (!chips_3d_model_hold_geometry (self, &error)) {
+                g_task_return_error (task, error);
+                return;
+        }
+
+        span_start = chips_profiler_begin_span ();
+        level_of_detail = &g_array_index (priv->levels_of_detail, ChipsMeshLevelOfDetail, 0);
+        ray_picker = chips_ray_picker_new (&priv->vertex_format,
+                                           g_bytes_get_data (priv->vertex_buffer, NULL),
+                                           g_bytes_get_data (priv->vertex_arrangement, NULL),
+                                           priv->index_size,
+                                           level_of_detail->first_index,
+                                           level_of_detail->number_of_indices,
+                                           cancellable,
+                                           &error);
+
+        chips_3d_model_release_geometry (self);
+
+        if (ray_picker == NULL) {
+                g_task_return_error (task, error);
+                return;
+        }
+
+        chips_profiler_end_span (span_start, "load", "build ray picker");
+
+        g_mutex_lock (&priv->picking_lock);
+        priv->ray_picker = ray_picker;
+        g_mutex_unlock (&priv->picking_lock);
+
+        g_task_return_boolean (task, TRUE);
+}
+
+static void
+on_ray_picker_built (Chips3DModel *self,
+                     GAsyncResult *result,
+                     gpointer      user_data)
+{
+        g_autoptr (GError) error = NULL;
+
+        if (!g_task_propagate_boolean (G_TASK (result), &error)) {
+                g_warning ("couldn't prepare model for picking: %s", error->message);
+        }
+}
+
+/* Starts building what chips_3d_model_pick() needs, in another thread,
+ * over the full detail level of an initialized model.  Only the first
+ * call does anything.
+ */
+void
+chips_3d_model_prepare_picking (Chips3DModel *self)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+        g_autoptr (GTask) task = NULL;
+
+        g_return_if_fail (priv->levels_of_detail != NULL && priv->levels_of_detail->len > 0);
+
+        if (priv->picking_requested) {
+                return;
+        }
+
+        priv->picking_requested = TRUE;
+
+        task = g_task_new (self, NULL, (GAsyncReadyCallback) on_ray_picker_built, NULL);
+        g_task_set_source_tag (task, chips_3d_model_prepare_picking);
+        g_task_set_priority (task, G_PRIORITY_LOW);
+        g_task_run_in_thread (task, (GTaskThreadFunc) build_ray_picker_in_thread);
+}
+
+static void
+on_replacement_initialized (GAsyncInitable *replacement_initable,
+                            GAsyncResult   *result,
+                            Chips3DModel   *self)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+        g_autoptr (GObject) replacement = NULL;
+        g_autoptr (GError) error = NULL;
+
+        replacement = g_async_initable_new_finish (replacement_initable, result, &error);
+
+        if (replacement == NULL) {
+                /* A failed reload usually means the file was caught half
+                 * written, so the next change gets another try
+                 */
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                        g_warning ("couldn't reload model: %s", error->message);
+                }
+
+                g_object_unref (self);
+                return;
+        }
+
+        g_clear_object (&priv->reload_cancellable);
+        g_clear_object (&priv->file_monitor);
+
+        chips_3d_model_watch_file (CHIPS_3D_MODEL (replacement));
+        g_signal_emit (self, signals[REPLACED], 0, replacement);
+
+        g_object_unref (self);
+}
+
+static gboolean
+reload (Chips3DModel *self)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+
+        priv->reload_timeout_id = 0;
+
+        g_cancellable_cancel (priv->reload_cancellable);
+        g_clear_object (&priv->reload_cancellable);
+        priv->reload_cancellable = g_cancellable_new ();
+
+        g_async_initable_new_async (CHIPS_TYPE_3D_MODEL,
+                                    G_PRIORITY_LOW,
+                                    priv->reload_cancellable,
+                                    (GAsyncReadyCallback) on_replacement_initialized,
+                                    g_object_ref (self),
+                                    "file", priv->file,
+                                    "weld-epsilon", priv->weld_epsilon,
+                                    "quantize-vertices", (gboolean) priv->quantize_vertices,
+                                    "use-cache", (gboolean) priv->use_cache,
+                                    NULL);
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+on_file_changed (Chips3DModel      *self,
+                 GFile             *file,
+                 GFile             *other_file,
+                 GFileMonitorEvent  event,
+                 GFileMonitor      *file_monitor)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+
+        /* Exporters that write a new file and rename it over the old
+         * one show up as it being created
+         */
+        if (event != G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT && event != G_FILE_MONITOR_EVENT_CREATED) {
+                return;
+        }
+
+        if (priv->reload_timeout_id != 0) {
+                g_source_remove (priv->reload_timeout_id);
+        }
+
+        priv->reload_timeout_id = g_timeout_add (RELOAD_DELAY, (GSourceFunc) reload, self);
+}
+
+/* Loads the file again whenever it changes, in the background, and
+ * emits replaced with the result.  The replacement watches the file
+ * from then on, and this model stops.  Needs an initialized model.
+ */
+void
+chips_3d_model_watch_file (Chips3DModel *self)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+        g_autoptr (GError) error = NULL;
+
+        if (priv->file == NULL || priv->file_monitor != NULL) {
+                return;
+        }
+
+        priv->file_monitor = g_file_monitor_file (priv->file, G_FILE_MONITOR_NONE, NULL, &error);
+
+        if (priv->file_monitor == NULL) {
+                g_debug ("couldn't watch model file: %s", error->message);
+                return;
+        }
+
+        g_signal_connect_swapped (priv->file_monitor,
+                                  "changed",
+                                  G_CALLBACK (on_file_changed),
+                                  self);
+}
+
+/* Casts a ray, in model space, at the full detail model, and fills in
+ * hit with the nearest triangle it meets.  Returns FALSE if it misses,
+ * or if the model isn't ready for picking yet.
+ */
+gboolean
+chips_3d_model_pick (Chips3DModel             *self,
+                     const graphene_point3d_t *origin,
+                     const graphene_vec3_t    *direction,
+                     ChipsRayHit              *hit)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+        ChipsRayPicker *ray_picker;
+
+        g_mutex_lock (&priv->picking_lock);
+        ray_picker = priv->ray_picker;
+        g_mutex_unlock (&priv->picking_lock);
+
+        if (ray_picker == NULL) {
+                return FALSE;
+        }
+
+        return chips_ray_picker_cast (ray_picker, origin, direction, hit);
+}
+
+/* The hierarchy over the level's clusters, or NULL if the level wasn't
+ * split into clusters
+ */
+const ChipsBvh *
+chips_3d_model_get_bounding_volume_hierarchy (Chips3DModel *self,
+                                              unsigned int  level)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+
+        if (priv->bounding_volume_hierarchies == NULL || level >= priv->bounding_volume_hierarchies->len) {
+                return NULL;
+        }
+
+        return g_ptr_array_index (priv->bounding_volume_hierarchies, level);
+}
+
+const ChipsVertexFormat *
+chips_3d_model_get_vertex_format (Chips3DModel *self)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+
+        return &priv->vertex_format;
+}
+
+intptr_t
+chips_3d_model_get_vertex_buffer_get_stride (Chips3DModel *self)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+
+        return priv->vertex_format.stride;
+}
+
+intptr_t
+chips_3d_model_get_vertex_buffer_get_offset (Chips3DModel         *self,
+                                             ChipsVertexAttribute  attribute)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+
+        return priv->vertex_format.attributes[attribute].offset;
+}
+
+gboolean
+chips_3d_model_save (Chips3DModel  *self,
+                     const char    *filename,
+                     GCancellable  *cancellable,
+                     GError       **error)
+{
+        Chips3DModelPrivate *priv = CHIPS_3D_MODEL_GET_PRIVATE (self);
+        ChipsMeshFileHeader header = { { 0 } };
+        g_autoptr (GBytes) vertex_format = g_bytes_new (&priv->vertex_format, sizeof (ChipsVertexFormat));
+        g_autoptr (GBytes) levels_of_detail = g_bytes_new (priv->levels_of_detail->data,
+                                                           priv->levels_of_detail->len * sizeof (ChipsMeshLevelOfDetail));
+        g_autoptr (GBytes) clusters = priv->clusters != NULL?
+                                      g_bytes_new (priv->clusters->data, priv->clusters->len * sizeof (ChipsMeshCluster)) :
+                                      g_bytes_new (NULL, 0);
+        ChipsMeshSection sections[] = {
+                { CHIPS_MESH_SECTION_VERTEX_FORMAT, vertex_format },
+                { CHIPS_MESH_SECTION_LEVELS_OF_DETAIL, levels_of_detail },
+                { CHIPS_MESH_SECTION_CLUSTERS, clusters },
+                { CHIPS_MESH_SECTION_VERTICES, NULL },
+                { CHIPS_MESH_SECTION_VERTEX_ARRANGEMENT, NULL },
+        };
+        gboolean saved;
+
+        if (!chips_3d_model_hold_geometry (self, error)) {
+                return FALSE;
+        }
+
+        sections[3].data = priv->vertex_buffer;
+        sections[4].data = priv->vertex_arrangement;
+
+        header.number_of_vertices = priv->number_of_vertices;
+        header.number_of_indices = priv->number_of_indices;
+        header.vertex_stride = priv->vertex_format.stride;
+        header.index_size = priv->index_size;
+        memcpy (header.bounds_minimum, priv->bounds_minimum, sizeof (header.bounds_minimum));
+        memcpy (header.bounds_maximum, priv->bounds_maximum, sizeof (header.bounds_maximum));
+
+        saved = chips_mesh_file_save (filename,
+                                      &header,
+                                      sections,
+                                      G_N_ELEMENTS (sections),
+                                      cancellable,
+                                      error);
+
+        chips_3d_model_release_geometry (self);
+
+        return saved;
 }
@@ -2,6 +2,10 @@
 #define CHIPS_3D_MODEL_H
 
 #include "chips.h"
+#include "chips-culling.h"
+#include "chips-importer.h"
+#include "chips-ray-picker.h"
+#include "chips-vertex-format.h"
 
 #define CHIPS_TYPE_3D_MODEL chips_3d_model_get_type ()
 G_DECLARE_DERIVABLE_TYPE (Chips3DModel, chips_3d_model, CHIPS, 3D_MODEL, GObject);
@@ -11,13 +15,69 @@ struct _Chips3DModelClass
         GObjectClass parent_class;
 };
 
-const float * chips_3d_model_get_vertex_buffer      (Chips3DModel *self);
-size_t        chips_3d_model_get_vertex_buffer_size (Chips3DModel *self);
+/* The vertex and index buffers are hashed in pieces this big, so a
+ * reloaded model can be compared against the one it replaces
+ */
+#define CHIPS_3D_MODEL_CHUNK_SIZE (64 * 1024)
 
-unsigned int  chips_3d_model_get_number_of_vertices (Chips3DModel *self);
-unsigned int *chips_3d_model_get_vertex_arrangement (Chips3DModel *self);
+GFile *              chips_3d_model_get_file               (Chips3DModel *self);
 
-intptr_t      chips_3d_model_get_vertex_buffer_get_stride (Chips3DModel *self);
-intptr_t      chips_3d_model_get_vertex_buffer_get_offset (Chips3DModel *self);
+gconstpointer        chips_3d_model_get_vertex_buffer      (Chips3DModel *self);
+size_t               chips_3d_model_get_vertex_buffer_size (Chips3DModel *self);
+
+unsigned int         chips_3d_model_get_number_of_vertices (Chips3DModel *self);
+gconstpointer        chips_3d_model_get_vertex_arrangement (Chips3DModel *self);
+size_t               chips_3d_model_get_vertex_arrangement_size (Chips3DModel *self);
+unsigned int         chips_3d_model_get_number_of_indices  (Chips3DModel *self);
+unsigned int         chips_3d_model_get_index_size         (Chips3DModel *self);
+void                 chips_3d_model_get_geometry_available (Chips3DModel *self,
+                                                            guint64      *vertices_available,
+                                                            guint64      *indices_available);
+gboolean             chips_3d_model_hold_geometry          (Chips3DModel  *self,
+                                                            GError       **error);
+void                 chips_3d_model_release_geometry       (Chips3DModel *self);
+size_t               chips_3d_model_get_resident_size      (Chips3DModel *self);
+const guint64 *      chips_3d_model_get_vertex_buffer_chunk_hashes (Chips3DModel *self,
+                                                                    size_t       *number_of_chunks);
+const guint64 *      chips_3d_model_get_vertex_arrangement_chunk_hashes (Chips3DModel *self,
+                                                                         size_t       *number_of_chunks);
+
+void                 chips_3d_model_watch_file             (Chips3DModel *self);
+
+void                 chips_3d_model_get_bounds             (Chips3DModel   *self,
+                                                            graphene_box_t *bounds);
+void                 chips_3d_model_get_bounding_sphere    (Chips3DModel      *self,
+                                                            graphene_sphere_t *sphere);
+double               chips_3d_model_get_surface_area       (Chips3DModel *self);
+
+unsigned int         chips_3d_model_get_number_of_levels_of_detail (Chips3DModel *self);
+const ChipsMeshLevelOfDetail *
+                     chips_3d_model_get_level_of_detail    (Chips3DModel *self,
+                                                            unsigned int  level);
+unsigned int         chips_3d_model_choose_level_of_detail (Chips3DModel *self,
+                                                            float         acceptable_error);
+void                 chips_3d_model_cull                   (Chips3DModel       *self,
+                                                            unsigned int        level,
+                                                            const ChipsFrustum *frustum,
+                                                            GArray             *visible_ranges);
+const ChipsBvh *     chips_3d_model_get_bounding_volume_hierarchy (Chips3DModel *self,
+                                                                   unsigned int  level);
+
+void                 chips_3d_model_prepare_picking        (Chips3DModel             *self);
+gboolean             chips_3d_model_pick                   (Chips3DModel             *self,
+                                                            const graphene_point3d_t *origin,
+                                                            const graphene_vec3_t    *direction,
+                                                            ChipsRayHit              *hit);
+
+const ChipsVertexFormat *
+                     chips_3d_model_get_vertex_format      (Chips3DModel *self);
+intptr_t             chips_3d_model_get_vertex_buffer_get_stride (Chips3DModel *self);
+intptr_t             chips_3d_model_get_vertex_buffer_get_offset (Chips3DModel         *self,
+                                                                  ChipsVertexAttribute  attribute);
+
+gboolean             chips_3d_model_save                   (Chips3DModel  *self,
+                                                            const char    *filename,
+                                                            GCancellable  *cancellable,
+                                                            GError       **error);
 
 #endif /* CHIPS_3D_MODEL_H */
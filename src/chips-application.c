@@ -17,20 +17,134 @@
  */
 #include "chips-application.h"
 #include "chips-main-window.h"
+#include "chips-model-converter.h"
+#include "chips-profiler.h"
+#include "chips-residency-manager.h"
 
 struct _ChipsApplication
 {
         GtkApplication parent_object;
         GtkWidget *main_window;
+
+        /* Every model some window is showing, or about to, by file */
+        GHashTable *models;
+
+        ChipsResidencyManager *residency_manager;
+
+        gboolean occlusion_culling;
+        gboolean profiler_overlay;
 };
 
+/* One model in the registry.  The registry doesn't keep the model
+ * alive, the windows showing it do, and the entry goes away with the
+ * model, or as soon as it fails to load, so opening the file again
+ * tries again.
+ */
+typedef struct
+{
+        ChipsApplication *application;
+        GFile            *file;
+        Chips3DModel     *model;
+
+        /* Windows waiting for the model to finish loading */
+        GList            *waiters;
+
+        guint32           loaded : 1;
+} ModelEntry;
+
+/* A window waiting on a model, which stops waiting if its cancellable
+ * is cancelled, without the load stopping
+ */
+typedef struct
+{
+        ModelEntry *entry;
+        GTask      *task;
+        gulong      cancelled_id;
+} ModelWaiter;
+
 G_DEFINE_TYPE (ChipsApplication, chips_application, GTK_TYPE_APPLICATION);
 
+static void on_model_finalized (ModelEntry *entry,
+                                GObject    *where_the_model_was);
+static void on_model_replaced  (ModelEntry   *entry,
+                                Chips3DModel *replacement,
+                                Chips3DModel *model);
+
+static void
+track_model (ModelEntry   *entry,
+             Chips3DModel *model)
+{
+        entry->model = model;
+
+        g_object_weak_ref (G_OBJECT (entry->model),
+                           (GWeakNotify) on_model_finalized,
+                           entry);
+        g_signal_connect_swapped (entry->model,
+                                  "replaced",
+                                  G_CALLBACK (on_model_replaced),
+                                  entry);
+}
+
+static void
+untrack_model (ModelEntry *entry)
+{
+        g_signal_handlers_disconnect_by_data (entry->model, entry);
+        g_object_weak_unref (G_OBJECT (entry->model),
+                             (GWeakNotify) on_model_finalized,
+                             entry);
+        entry->model = NULL;
+}
+
+static void
+model_waiter_free (ModelWaiter *waiter)
+{
+        g_cancellable_disconnect (g_task_get_cancellable (waiter->task), waiter->cancelled_id);
+        g_object_unref (waiter->task);
+        g_slice_free (ModelWaiter, waiter);
+}
+
+static void
+model_entry_free (ModelEntry *entry)
+{
+        if (entry->model != NULL) {
+                untrack_model (entry);
+        }
+
+        g_list_free_full (entry->waiters, (GDestroyNotify) model_waiter_free);
+        g_object_unref (entry->file);
+        g_slice_free (ModelEntry, entry);
+}
+
+static void
+on_model_finalized (ModelEntry *entry,
+                    GObject    *where_the_model_was)
+{
+        entry->model = NULL;
+        g_hash_table_remove (entry->application->models, entry->file);
+}
+
+/* Windows opening the file from now on get the reloaded model.  The
+ * windows showing the old one switch over on their own.
+ */
+static void
+on_model_replaced (ModelEntry   *entry,
+                   Chips3DModel *replacement,
+                   Chips3DModel *model)
+{
+        untrack_model (entry);
+        track_model (entry, replacement);
+
+        chips_3d_model_prepare_picking (replacement);
+}
+
 static void
 chips_application_dispose (GObject *object)
 {
         ChipsApplication *self = CHIPS_APPLICATION (object);
 
+        g_clear_pointer (&self->models, g_hash_table_unref);
+        g_clear_pointer (&self->residency_manager, chips_residency_manager_free);
+
         G_OBJECT_CLASS (chips_application_parent_class)->dispose (object);
 }
 
@@ -50,6 +164,14 @@ chips_application_startup (GApplication *application)
         G_APPLICATION_CLASS (chips_application_parent_class)->startup (application);
 }
 
+static void
+chips_application_shutdown (GApplication *application)
+{
+        chips_profiler_stop ();
+
+        G_APPLICATION_CLASS (chips_application_parent_class)->shutdown (application);
+}
+
 static void
 activate_main_window (ChipsApplication *self)
 {
@@ -63,6 +185,125 @@ activate_main_window (ChipsApplication *self)
         gtk_widget_show (self->main_window);
 }
 
+static void
+open_main_window (ChipsApplication *self,
+                  GFile            *file)
+{
+        GtkWidget *window;
+
+        window = g_object_new (CHIPS_TYPE_MAIN_WINDOW,
+                               "file", file,
+                               NULL);
+        gtk_application_add_window (GTK_APPLICATION (self), GTK_WINDOW (window));
+        gtk_widget_show (window);
+}
+
+/* Runs without a display, so a library of models can be converted on a
+ * machine nobody is logged in to
+ */
+static int
+convert_models (GVariantDict *options)
+{
+        g_autoptr (ChipsModelConverter) converter = NULL;
+        g_autofree const char **paths = NULL;
+        g_autofree char *output_directory = NULL;
+        int number_of_jobs = 0, memory_budget = 0;
+        gboolean converted;
+        size_t i;
+
+        if (!g_variant_dict_lookup (options, G_OPTION_REMAINING, "^a&ay", &paths)) {
+                g_printerr ("%s\n", _("Give the models, or directories of models, to convert"));
+                return 1;
+        }
+
+        g_variant_dict_lookup (options, "output-directory", "^ay", &output_directory);
+        g_variant_dict_lookup (options, "jobs", "i", &number_of_jobs);
+        g_variant_dict_lookup (options, "memory-budget", "i", &memory_budget);
+
+        if (number_of_jobs < 0 || memory_budget < 0) {
+                g_printerr ("%s\n", _("The number of jobs and memory budget can't be negative"));
+                return 1;
+        }
+
+        converter = chips_model_converter_new (output_directory,
+                                               number_of_jobs,
+                                               (guint64) memory_budget * 1024 * 1024);
+
+        for (i = 0; paths[i] != NULL; i++) {
+                g_autoptr (GError) error = NULL;
+
+                if (!chips_model_converter_add_path (converter, paths[i], &error)) {
+                        g_printerr ("%s\n", error->message);
+                        return 1;
+                }
+        }
+
+        converted = chips_model_converter_run (converter);
+
+        /* The application never starts up, so it doesn't shut down
+         * either
+         */
+        chips_profiler_stop ();
+
+        return converted? 0 : 1;
+}
+
+static int
+chips_application_handle_local_options (GApplication *application,
+                                        GVariantDict *options)
+{
+        ChipsApplication *self = CHIPS_APPLICATION (application);
+        g_autofree char *trace_filename = NULL;
+        int budget;
+
+        if (g_variant_dict_lookup (options, "gpu-memory-budget", "i", &budget)) {
+                if (budget <= 0) {
+                        g_printerr ("%s\n", _("The GPU memory budget has to be positive"));
+                        return 1;
+                }
+
+                chips_residency_manager_set_budget (self->residency_manager,
+                                                    (guint64) budget * 1024 * 1024);
+        }
+
+        if (g_variant_dict_contains (options, "occlusion-culling")) {
+                self->occlusion_culling = TRUE;
+        }
+
+        if (g_variant_dict_contains (options, "profiler-overlay")) {
+                self->profiler_overlay = TRUE;
+        }
+
+        if (!g_variant_dict_lookup (options, "trace", "^ay", &trace_filename) &&
+            g_getenv ("CHIPS_TRACE") != NULL) {
+                trace_filename = g_strdup (g_getenv ("CHIPS_TRACE"));
+        }
+
+        if (trace_filename != NULL || self->profiler_overlay) {
+                chips_profiler_start (trace_filename);
+        }
+
+        if (g_variant_dict_contains (options, "convert")) {
+                return convert_models (options);
+        }
+
+        return -1;
+}
+
+static void
+chips_application_open (GApplication  *application,
+                        GFile        **files,
+                        int            number_of_files,
+                        const char    *hint)
+{
+        ChipsApplication *self = CHIPS_APPLICATION (application);
+        int i;
+
+        for (i = 0; i < number_of_files; i++) {
+                open_main_window (self, files[i]);
+        }
+}
+
 static void
 chips_application_activate (GApplication *application)
 {
@@ -83,10 +324,261 @@ chips_application_class_init (ChipsApplicationClass *own_class)
         object_class->finalize = chips_application_finalize;
 
         application_class->activate = chips_application_activate;
+        application_class->handle_local_options = chips_application_handle_local_options;
+        application_class->open = chips_application_open;
+        application_class->shutdown = chips_application_shutdown;
         application_class->startup = chips_application_startup;
 }
 
 static void
 chips_application_init (ChipsApplication *self)
 {
+        self->models = g_hash_table_new_full (g_file_hash,
+                                              (GEqualFunc) g_file_equal,
+                                              NULL,
+                                              (GDestroyNotify) model_entry_free);
+        self->residency_manager = chips_residency_manager_new (CHIPS_RESIDENCY_DEFAULT_BUDGET);
+
+        g_application_add_main_option (G_APPLICATION (self),
+                                       "gpu-memory-budget",
+                                       0,
+                                       G_OPTION_FLAG_NONE,
+                                       G_OPTION_ARG_INT,
+                                       _("How much GPU memory open models may take up"),
+                                       _("MEGABYTES"));
+        g_application_add_main_option (G_APPLICATION (self),
+                                       "occlusion-culling",
+                                       0,
+                                       G_OPTION_FLAG_NONE,
+                                       G_OPTION_ARG_NONE,
+                                       _("Skip drawing parts of models hidden behind other parts"),
+                                       NULL);
+        g_application_add_main_option (G_APPLICATION (self),
+                                       "trace",
+                                       0,
+                                       G_OPTION_FLAG_NONE,
+                                       G_OPTION_ARG_FILENAME,
+                                       _("Save how long loading and drawing took, for chrome://tracing"),
+                                       _("FILE"));
+        g_application_add_main_option (G_APPLICATION (self),
+                                       "profiler-overlay",
+                                       0,
+                                       G_OPTION_FLAG_NONE,
+                                       G_OPTION_ARG_NONE,
+                                       _("Show frame times over the model"),
+                                       NULL);
+        g_application_add_main_option (G_APPLICATION (self),
+                                       "convert",
+                                       0,
+                                       G_OPTION_FLAG_NONE,
+                                       G_OPTION_ARG_NONE,
+                                       _("Process the given models, or directories of them, ahead of time instead of showing them"),
+                                       NULL);
+        g_application_add_main_option (G_APPLICATION (self),
+                                       "output-directory",
+                                       0,
+                                       G_OPTION_FLAG_NONE,
+                                       G_OPTION_ARG_FILENAME,
+                                       _("Where --convert puts mesh files, instead of the model cache"),
+                                       _("DIRECTORY"));
+        g_application_add_main_option (G_APPLICATION (self),
+                                       "jobs",
+                                       0,
+                                       G_OPTION_FLAG_NONE,
+                                       G_OPTION_ARG_INT,
+                                       _("How many models --convert works on at once"),
+                                       _("COUNT"));
+        g_application_add_main_option (G_APPLICATION (self),
+                                       "memory-budget",
+                                       0,
+                                       G_OPTION_FLAG_NONE,
+                                       G_OPTION_ARG_INT,
+                                       _("How much memory models being converted may take up"),
+                                       _("MEGABYTES"));
+}
+
+/* Shared by every window, since they all draw from the same GPU */
+ChipsResidencyManager *
+chips_application_get_residency_manager (ChipsApplication *self)
+{
+        return self->residency_manager;
+}
+
+gboolean
+chips_application_get_occlusion_culling (ChipsApplication *self)
+{
+        return self->occlusion_culling;
+}
+
+gboolean
+chips_application_get_profiler_overlay (ChipsApplication *self)
+{
+        return self->profiler_overlay;
+}
+
+static void
+complete_waiter (ModelWaiter  *waiter,
+                 const GError *error)
+{
+        if (error != NULL) {
+                g_task_return_error (waiter->task, g_error_copy (error));
+        } else {
+                g_task_return_boolean (waiter->task, TRUE);
+        }
+
+        model_waiter_free (waiter);
+}
+
+/* The handler can't be disconnected from inside itself, so the waiter
+ * is only taken off the list here, and finished from an idle
+ */
+static gboolean
+complete_cancelled_waiter (ModelWaiter *waiter)
+{
+        g_autoptr (GError) error = NULL;
+
+        g_cancellable_set_error_if_cancelled (g_task_get_cancellable (waiter->task), &error);
+        complete_waiter (waiter, error);
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+on_waiter_cancelled (GCancellable *cancellable,
+                     ModelWaiter  *waiter)
+{
+        waiter->entry->waiters = g_list_remove (waiter->entry->waiters, waiter);
+        g_idle_add ((GSourceFunc) complete_cancelled_waiter, waiter);
+}
+
+static void
+on_model_initialized (Chips3DModel     *model,
+                      GAsyncResult     *result,
+                      ChipsApplication *self)
+{
+        g_autoptr (GError) error = NULL;
+        ModelEntry *entry = NULL;
+        GList *waiters, *node;
+
+        g_async_initable_init_finish (G_ASYNC_INITABLE (model), result, &error);
+
+        /* The load itself holds a reference on the model, so its entry
+         * is only gone if the registry is
+         */
+        if (self->models != NULL) {
+                entry = g_hash_table_lookup (self->models, chips_3d_model_get_file (model));
+        }
+
+        if (error == NULL) {
+                chips_3d_model_prepare_picking (model);
+                chips_3d_model_watch_file (model);
+        }
+
+        if (entry != NULL) {
+                entry->loaded = TRUE;
+
+                waiters = g_steal_pointer (&entry->waiters);
+
+                for (node = waiters; node != NULL; node = node->next) {
+                        complete_waiter (node->data, error);
+                }
+
+                g_list_free (waiters);
+
+                if (error != NULL) {
+                        g_hash_table_remove (self->models, entry->file);
+                }
+        }
+
+        g_object_unref (self);
+}
+
+/* Returns the model for file, starting to load it if no window has it
+ * open already.  Every window showing the same file gets the same
+ * model, so it's only read and processed once.
+ */
+Chips3DModel *
+chips_application_open_model (ChipsApplication *self,
+                              GFile            *file)
+{
+        ModelEntry *entry;
+
+        entry = g_hash_table_lookup (self->models, file);
+
+        if (entry != NULL) {
+                return g_object_ref (entry->model);
+        }
+
+        entry = g_slice_new0 (ModelEntry);
+        entry->application = self;
+        entry->file = g_object_ref (file);
+        track_model (entry, g_object_new (CHIPS_TYPE_3D_MODEL,
+                                          "file", file,
+                                          NULL));
+        g_hash_table_insert (self->models, entry->file, entry);
+
+        /* Nobody waiting on the load gets to cancel it, since other
+         * windows may still want the model
+         */
+        g_async_initable_init_async (G_ASYNC_INITABLE (entry->model),
+                                     G_PRIORITY_DEFAULT,
+                                     NULL,
+                                     (GAsyncReadyCallback)
+                                     on_model_initialized,
+                                     g_object_ref (self));
+
+        return entry->model;
+}
+
+/* Finishes when the model from chips_application_open_model() is done
+ * loading, however many windows are waiting on it
+ */
+void
+chips_application_wait_for_model (ChipsApplication    *self,
+                                  Chips3DModel        *model,
+                                  GCancellable        *cancellable,
+                                  GAsyncReadyCallback  callback,
+                                  gpointer             user_data)
+{
+        g_autoptr (GTask) task = NULL;
+        ModelWaiter *waiter;
+        ModelEntry *entry;
+
+        task = g_task_new (self, cancellable, callback, user_data);
+        g_task_set_source_tag (task, chips_application_wait_for_model);
+
+        entry = g_hash_table_lookup (self->models, chips_3d_model_get_file (model));
+
+        g_return_if_fail (entry != NULL && entry->model == model);
+
+        if (g_task_return_error_if_cancelled (task)) {
+                return;
+        }
+
+        if (entry->loaded) {
+                g_task_return_boolean (task, TRUE);
+                return;
+        }
+
+        waiter = g_slice_new0 (ModelWaiter);
+        waiter->entry = entry;
+        waiter->task = g_steal_pointer (&task);
+        entry->waiters = g_list_prepend (entry->waiters, waiter);
+
+        if (cancellable != NULL) {
+                waiter->cancelled_id = g_cancellable_connect (cancellable,
+                                                              G_CALLBACK (on_waiter_cancelled),
+                                                              waiter,
+                                                              NULL);
+        }
+}
+
+gboolean
+chips_application_wait_for_model_finish (ChipsApplication  *self,
+                                         GAsyncResult      *result,
+                                         GError           **error)
+{
+        g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+
+        return g_task_propagate_boolean (G_TASK (result), error);
 }
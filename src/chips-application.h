@@ -18,7 +18,27 @@
 #ifndef CHIPS_APPLICATION_H
 #define CHIPS_APPLICATION_H
 
+#include "chips.h"
+#include "chips-3d-model.h"
+#include "chips-residency-manager.h"
+
 #define CHIPS_TYPE_APPLICATION chips_application_get_type ()
 G_DECLARE_FINAL_TYPE (ChipsApplication, chips_application, CHIPS, APPLICATION, GtkApplication);
 
+Chips3DModel *chips_application_open_model            (ChipsApplication     *self,
+                                                       GFile                *file);
+void          chips_application_wait_for_model        (ChipsApplication     *self,
+                                                       Chips3DModel         *model,
+                                                       GCancellable         *cancellable,
+                                                       GAsyncReadyCallback   callback,
+                                                       gpointer              user_data);
+gboolean      chips_application_wait_for_model_finish (ChipsApplication     *self,
+                                                       GAsyncResult         *result,
+                                                       GError              **error);
+
+ChipsResidencyManager *
+              chips_application_get_residency_manager (ChipsApplication     *self);
+gboolean      chips_application_get_occlusion_culling (ChipsApplication     *self);
+gboolean      chips_application_get_profiler_overlay  (ChipsApplication     *self);
+
 #endif /* CHIPS_APPLICATION_H */
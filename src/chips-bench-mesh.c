@@ -0,0 +1,238 @@
+/* chips-bench-mesh.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chips-bench-mesh.h"
+
+#define BINARY_STL_HEADER_SIZE 84
+#define BINARY_STL_TRIANGLE_SIZE 50
+
+static guint64
+get_grid_side (guint64 number_of_triangles)
+{
+        return MAX (1, (guint64) sqrt (number_of_triangles / 2.0));
+}
+
+static void
+get_grid_position (guint64  side,
+                   guint64  row,
+                   guint64  column,
+                   float   *position)
+{
+        float x = (float) column / side;
+        float y = (float) row / side;
+
+        position[0] = x - 0.5;
+        position[1] = y - 0.5;
+        position[2] = 0.05 * sin (x * 4 * G_PI) * cos (y * 4 * G_PI);
+}
+
+static void
+write_stl_vertex (guint8      *record,
+                  const float *position)
+{
+        size_t i;
+
+        for (i = 0; i < 3; i++) {
+                guint32 bits;
+
+                memcpy (&bits, &position[i], sizeof (bits));
+                bits = GUINT32_TO_LE (bits);
+                memcpy (record + i * sizeof (bits), &bits, sizeof (bits));
+        }
+}
+
+static gboolean
+write_binary_stl (GOutputStream  *output_stream,
+                  guint64         side,
+                  GCancellable   *cancellable,
+                  GError        **error)
+{
+        guint8 header[BINARY_STL_HEADER_SIZE] = { 0 };
+        guint8 record[BINARY_STL_TRIANGLE_SIZE] = { 0 };
+        guint64 row, column;
+        guint32 count;
+
+        count = GUINT32_TO_LE ((guint32) (side * side * 2));
+        memcpy (header + 80, &count, sizeof (count));
+
+        if (!g_output_stream_write_all (output_stream, header, sizeof (header), NULL, cancellable, error)) {
+                return FALSE;
+        }
+
+        for (row = 0; row < side; row++) {
+                for (column = 0; column < side; column++) {
+                        float corners[4][3];
+                        size_t i;
+
+                        for (i = 0; i < 4; i++) {
+                                get_grid_position (side, row + (i >> 1), column + (i & 1), corners[i]);
+                        }
+
+                        write_stl_vertex (record + 12, corners[0]);
+                        write_stl_vertex (record + 24, corners[1]);
+                        write_stl_vertex (record + 36, corners[3]);
+
+                        if (!g_output_stream_write_all (output_stream, record, sizeof (record), NULL, cancellable, error)) {
+                                return FALSE;
+                        }
+
+                        write_stl_vertex (record + 12, corners[0]);
+                        write_stl_vertex (record + 24, corners[3]);
+                        write_stl_vertex (record + 36, corners[2]);
+
+                        if (!g_output_stream_write_all (output_stream, record, sizeof (record), NULL, cancellable, error)) {
+                                return FALSE;
+                        }
+                }
+        }
+
+        return TRUE;
+}
+
+static gboolean
+write_obj (GOutputStream  *output_stream,
+           guint64         side,
+           GCancellable   *cancellable,
+           GError        **error)
+{
+        guint64 row, column;
+
+        for (row = 0; row <= side; row++) {
+                for (column = 0; column <= side; column++) {
+                        float position[3];
+
+                        get_grid_position (side, row, column, position);
+
+                        if (!g_output_stream_printf (output_stream, NULL, cancellable, error,
+                                                     "v %f %f %f\n",
+                                                     position[0], position[1], position[2])) {
+                                return FALSE;
+                        }
+                }
+        }
+
+        for (row = 0; row < side; row++) {
+                for (column = 0; column < side; column++) {
+                        guint64 corner = row * (side + 1) + column + 1;
+
+                        if (!g_output_stream_printf (output_stream, NULL, cancellable, error,
+                                                     "f %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT "\n"
+                                                     "f %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT "\n",
+                                                     corner, corner + 1, corner + side + 2,
+                                                     corner, corner + side + 2, corner + side + 1)) {
+                                return FALSE;
+                        }
+                }
+        }
+
+        return TRUE;
+}
+
+gboolean
+chips_bench_mesh_write (GOutputStream         *output_stream,
+                        ChipsBenchMeshFormat   format,
+                        guint64                number_of_triangles,
+                        GCancellable          *cancellable,
+                        GError               **error)
+{
+        g_autoptr (GOutputStream) buffered_stream = NULL;
+        guint64 side;
+        gboolean written;
+
+        side = get_grid_side (number_of_triangles);
+        buffered_stream = g_buffered_output_stream_new_sized (output_stream, 1024 * 1024);
+        g_filter_output_stream_set_close_base_stream (G_FILTER_OUTPUT_STREAM (buffered_stream), FALSE);
+
+        switch (format) {
+                case CHIPS_BENCH_MESH_FORMAT_BINARY_STL:
+                        written = write_binary_stl (buffered_stream, side, cancellable, error);
+                        break;
+                case CHIPS_BENCH_MESH_FORMAT_OBJ:
+                        written = write_obj (buffered_stream, side, cancellable, error);
+                        break;
+                default:
+                        g_assert_not_reached ();
+        }
+
+        if (!written) {
+                return FALSE;
+        }
+
+        return g_output_stream_close (buffered_stream, cancellable, error);
+}
+
+GBytes *
+chips_bench_mesh_generate (ChipsBenchMeshFormat   format,
+                           guint64                number_of_triangles,
+                           GError               **error)
+{
+        g_autoptr (GOutputStream) output_stream = NULL;
+
+        output_stream = g_memory_output_stream_new_resizable ();
+
+        if (!chips_bench_mesh_write (output_stream, format, number_of_triangles, NULL, error)) {
+                return NULL;
+        }
+
+        if (!g_output_stream_close (output_stream, NULL, error)) {
+                return NULL;
+        }
+
+        return g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (output_stream));
+}
+
+/* Writes the mesh straight to a temporary file, so even the biggest
+ * ones never have to fit in memory twice
+ */
+GFile *
+chips_bench_mesh_create (ChipsBenchMeshFormat   format,
+                         guint64                number_of_triangles,
+                         GError               **error)
+{
+        g_autoptr (GFile) file = NULL;
+        g_autoptr (GFileIOStream) stream = NULL;
+        const char *template;
+
+        switch (format) {
+                case CHIPS_BENCH_MESH_FORMAT_BINARY_STL:
+                        template = "chips-bench-XXXXXX.stl";
+                        break;
+                case CHIPS_BENCH_MESH_FORMAT_OBJ:
+                        template = "chips-bench-XXXXXX.obj";
+                        break;
+                default:
+                        g_assert_not_reached ();
+        }
+
+        file = g_file_new_tmp (template, &stream, error);
+
+        if (file == NULL) {
+                return NULL;
+        }
+
+        if (!chips_bench_mesh_write (g_io_stream_get_output_stream (G_IO_STREAM (stream)),
+                                     format,
+                                     number_of_triangles,
+                                     NULL,
+                                     error) ||
+            !g_io_stream_close (G_IO_STREAM (stream), NULL, error)) {
+                g_file_delete (file, NULL, NULL);
+                return NULL;
+        }
+
+        return g_steal_pointer (&file);
+}
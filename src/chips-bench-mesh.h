@@ -0,0 +1,48 @@
+/* chips-bench-mesh.h
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CHIPS_BENCH_MESH_H
+#define CHIPS_BENCH_MESH_H
+
+#include "chips.h"
+
+/* Synthetic models for the benchmarks: a rippled square split into
+ * (about) the requested number of triangles.  The surface is smooth,
+ * so welding, level of detail and culling all have something
+ * realistic to chew on.
+ */
+typedef enum
+{
+        CHIPS_BENCH_MESH_FORMAT_BINARY_STL,
+        CHIPS_BENCH_MESH_FORMAT_OBJ,
+} ChipsBenchMeshFormat;
+
+gboolean chips_bench_mesh_write    (GOutputStream         *output_stream,
+                                    ChipsBenchMeshFormat   format,
+                                    guint64                number_of_triangles,
+                                    GCancellable          *cancellable,
+                                    GError               **error);
+
+GBytes  *chips_bench_mesh_generate (ChipsBenchMeshFormat   format,
+                                    guint64                number_of_triangles,
+                                    GError               **error);
+
+GFile   *chips_bench_mesh_create   (ChipsBenchMeshFormat   format,
+                                    guint64                number_of_triangles,
+                                    GError               **error);
+
+#endif /* CHIPS_BENCH_MESH_H */
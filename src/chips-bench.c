@@ -0,0 +1,741 @@
+/* chips-bench.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <epoxy/egl.h>
+
+#include "chips-3d-model.h"
+#include "chips-bench-mesh.h"
+#include "chips-renderer.h"
+#include "chips-scene.h"
+
+#define VIEWPORT_WIDTH 800
+#define VIEWPORT_HEIGHT 600
+
+static const guint64 mesh_sizes[] = { 10000, 100000, 1000000, 10000000, 50000000 };
+
+/* Tells make check to skip, rather than fail, on machines without GL */
+#define EXIT_STATUS_SKIPPED 77
+
+/* Timings this many milliseconds over the baseline are always put down
+ * to noise, since tiny meshes take next to no time at all
+ */
+#define REGRESSION_NOISE_FLOOR 0.5
+
+typedef struct
+{
+        EGLDisplay   display;
+        EGLSurface   surface;
+        EGLContext   context;
+
+        unsigned int framebuffer_id;
+        unsigned int color_buffer_id;
+        unsigned int depth_buffer_id;
+} BenchContext;
+
+typedef struct
+{
+        guint64 number_of_triangles;
+        int     number_of_instances;
+        double  load_time;
+        double  upload_time;
+        double  frame_time_50th_percentile;
+        double  frame_time_95th_percentile;
+        double  frame_time_99th_percentile;
+        double  draw_call_time_50th_percentile;
+} BenchResult;
+
+static gint64 maximum_number_of_triangles = 1000000;
+static int number_of_frames = 100;
+static int number_of_instances = 1;
+static int number_of_parts = 0;
+static char *output_format = NULL;
+static char *baseline_filename = NULL;
+static double regression_tolerance = 50;
+
+static GOptionEntry options[] = {
+        { "max-triangles", 't', 0, G_OPTION_ARG_INT64, &maximum_number_of_triangles,
+          "Skip meshes with more than this many triangles", "COUNT" },
+        { "frames", 'n', 0, G_OPTION_ARG_INT, &number_of_frames,
+          "Number of frames to time for each mesh", "COUNT" },
+        { "instances", 'i', 0, G_OPTION_ARG_INT, &number_of_instances,
+          "Number of copies of each mesh to draw, laid out in a grid", "COUNT" },
+        { "parts", 'p', 0, G_OPTION_ARG_INT, &number_of_parts,
+          "Draw this many separately loaded copies of each mesh as one scene", "COUNT" },
+        { "format", 'f', 0, G_OPTION_ARG_STRING, &output_format,
+          "Print results as csv or json", "FORMAT" },
+        { "baseline", 'b', 0, G_OPTION_ARG_FILENAME, &baseline_filename,
+          "Fail if slower than the csv results an earlier run saved in FILE", "FILE" },
+        { "tolerance", 0, 0, G_OPTION_ARG_DOUBLE, &regression_tolerance,
+          "How many percent slower than the baseline still passes", "PERCENT" },
+        { NULL }
+};
+
+static double
+get_column (char       **columns,
+            char       **fields,
+            const char  *name)
+{
+        size_t i;
+
+        for (i = 0; columns[i] != NULL; i++) {
+                if (g_strcmp0 (columns[i], name) == 0) {
+                        return g_ascii_strtod (fields[i], NULL);
+                }
+        }
+
+        return 0;
+}
+
+/* Reads back results an earlier run printed as csv.  Measurements are
+ * found by column name, so baselines outlive columns being added.
+ */
+static GArray *
+load_baseline (const char  *filename,
+               GError     **error)
+{
+        g_autofree char *contents = NULL;
+        g_auto (GStrv) lines = NULL;
+        g_auto (GStrv) columns = NULL;
+        g_autoptr (GArray) baseline = NULL;
+        size_t i;
+
+        if (!g_file_get_contents (filename, &contents, NULL, error)) {
+                return NULL;
+        }
+
+        lines = g_strsplit (contents, "\n", -1);
+
+        if (lines[0] == NULL || !g_str_has_prefix (lines[0], "triangles,")) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "%s isn't csv output from chips-bench", filename);
+                return NULL;
+        }
+
+        columns = g_strsplit (lines[0], ",", -1);
+        baseline = g_array_new (FALSE, FALSE, sizeof (BenchResult));
+
+        for (i = 1; lines[i] != NULL; i++) {
+                g_auto (GStrv) fields = NULL;
+                BenchResult result = { 0 };
+
+                if (lines[i][0] == '\0') {
+                        continue;
+                }
+
+                fields = g_strsplit (lines[i], ",", -1);
+
+                if (g_strv_length (fields) != g_strv_length (columns)) {
+                        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                                     "line %zu of %s doesn't match its header",
+                                     i + 1, filename);
+                        return NULL;
+                }
+
+                result.number_of_triangles = get_column (columns, fields, "triangles");
+
+                /* Baselines from before instancing drew a single copy */
+                result.number_of_instances = MAX (get_column (columns, fields, "instances"), 1);
+                result.load_time = get_column (columns, fields, "load_ms");
+                result.upload_time = get_column (columns, fields, "upload_ms");
+                result.frame_time_50th_percentile = get_column (columns, fields, "frame_p50_ms");
+                result.frame_time_95th_percentile = get_column (columns, fields, "frame_p95_ms");
+                result.frame_time_99th_percentile = get_column (columns, fields, "frame_p99_ms");
+                result.draw_call_time_50th_percentile = get_column (columns, fields, "draw_call_p50_ms");
+
+                g_array_append_val (baseline, result);
+        }
+
+        return g_steal_pointer (&baseline);
+}
+
+static gboolean
+is_slower_than_baseline (const BenchResult *result,
+                         const char        *measurement,
+                         double             time,
+                         double             baseline_time)
+{
+        if (time <= baseline_time * (1 + regression_tolerance / 100) + REGRESSION_NOISE_FLOOR) {
+                return FALSE;
+        }
+
+        g_printerr ("%" G_GUINT64_FORMAT " triangle mesh: %s took %.3f ms, baseline is %.3f ms\n",
+                    result->number_of_triangles, measurement, time, baseline_time);
+        return TRUE;
+}
+
+/* The 95th and 99th percentiles are left out, since a handful of frames
+ * is too few for them to hold still from one run to the next
+ */
+static gboolean
+has_regressed (GArray *results,
+               GArray *baseline)
+{
+        gboolean regressed = FALSE;
+        size_t i, j;
+
+        for (i = 0; i < results->len; i++) {
+                BenchResult *result = &g_array_index (results, BenchResult, i);
+
+                for (j = 0; j < baseline->len; j++) {
+                        BenchResult *expected = &g_array_index (baseline, BenchResult, j);
+
+                        if (expected->number_of_triangles != result->number_of_triangles ||
+                            expected->number_of_instances != result->number_of_instances) {
+                                continue;
+                        }
+
+                        regressed |= is_slower_than_baseline (result, "loading",
+                                                              result->load_time,
+                                                              expected->load_time);
+                        regressed |= is_slower_than_baseline (result, "uploading",
+                                                              result->upload_time,
+                                                              expected->upload_time);
+                        regressed |= is_slower_than_baseline (result, "a median frame",
+                                                              result->frame_time_50th_percentile,
+                                                              expected->frame_time_50th_percentile);
+                        regressed |= is_slower_than_baseline (result, "a median draw call",
+                                                              result->draw_call_time_50th_percentile,
+                                                              expected->draw_call_time_50th_percentile);
+                        break;
+                }
+        }
+
+        return regressed;
+}
+
+static gboolean
+check_baseline (GArray  *results,
+                GError **error)
+{
+        g_autoptr (GArray) baseline = NULL;
+
+        baseline = load_baseline (baseline_filename, error);
+
+        if (baseline == NULL) {
+                return FALSE;
+        }
+
+        if (has_regressed (results, baseline)) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                             "slower than the baseline in %s", baseline_filename);
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+static EGLDisplay
+open_display (void)
+{
+        if (epoxy_has_egl_extension (EGL_NO_DISPLAY, "EGL_MESA_platform_surfaceless")) {
+                EGLDisplay display;
+
+                display = eglGetPlatformDisplayEXT (EGL_PLATFORM_SURFACELESS_MESA,
+                                                    EGL_DEFAULT_DISPLAY,
+                                                    NULL);
+
+                if (display != EGL_NO_DISPLAY) {
+                        return display;
+                }
+        }
+
+        return eglGetDisplay (EGL_DEFAULT_DISPLAY);
+}
+
+/* Sets up a GL context that isn't tied to any window, rendering into
+ * a framebuffer object the size of a typical window.  Drivers that
+ * can't make a context current without a surface get a tiny pbuffer.
+ */
+static gboolean
+bench_context_init (BenchContext  *bench_context,
+                    GError       **error)
+{
+        static const EGLint config_attributes[] = {
+                EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+                EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                EGL_NONE
+        };
+        static const EGLint context_attributes[] = {
+                EGL_CONTEXT_MAJOR_VERSION, 3,
+                EGL_CONTEXT_MINOR_VERSION, 3,
+                EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                EGL_NONE
+        };
+        static const EGLint surface_attributes[] = {
+                EGL_WIDTH, 1,
+                EGL_HEIGHT, 1,
+                EGL_NONE
+        };
+        EGLConfig config;
+        EGLint number_of_configs = 0;
+
+        bench_context->display = open_display ();
+
+        if (bench_context->display == EGL_NO_DISPLAY ||
+            !eglInitialize (bench_context->display, NULL, NULL)) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                             "could not open EGL display");
+                return FALSE;
+        }
+
+        if (!eglBindAPI (EGL_OPENGL_API) ||
+            !eglChooseConfig (bench_context->display, config_attributes, &config, 1, &number_of_configs) ||
+            number_of_configs == 0) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                             "EGL display doesn't support desktop OpenGL");
+                return FALSE;
+        }
+
+        bench_context->context = eglCreateContext (bench_context->display,
+                                                   config,
+                                                   EGL_NO_CONTEXT,
+                                                   context_attributes);
+
+        if (bench_context->context == EGL_NO_CONTEXT) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                             "could not create OpenGL 3.3 core context");
+                return FALSE;
+        }
+
+        bench_context->surface = EGL_NO_SURFACE;
+
+        if (!epoxy_has_egl_extension (bench_context->display, "EGL_KHR_surfaceless_context")) {
+                bench_context->surface = eglCreatePbufferSurface (bench_context->display,
+                                                                  config,
+                                                                  surface_attributes);
+        }
+
+        if (!eglMakeCurrent (bench_context->display,
+                             bench_context->surface,
+                             bench_context->surface,
+                             bench_context->context)) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                             "could not make OpenGL context current");
+                return FALSE;
+        }
+
+        glGenRenderbuffers (1, &bench_context->color_buffer_id);
+        glBindRenderbuffer (GL_RENDERBUFFER, bench_context->color_buffer_id);
+        glRenderbufferStorage (GL_RENDERBUFFER, GL_RGBA8, VIEWPORT_WIDTH, VIEWPORT_HEIGHT);
+
+        glGenRenderbuffers (1, &bench_context->depth_buffer_id);
+        glBindRenderbuffer (GL_RENDERBUFFER, bench_context->depth_buffer_id);
+        glRenderbufferStorage (GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, VIEWPORT_WIDTH, VIEWPORT_HEIGHT);
+
+        glGenFramebuffers (1, &bench_context->framebuffer_id);
+        glBindFramebuffer (GL_FRAMEBUFFER, bench_context->framebuffer_id);
+        glFramebufferRenderbuffer (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                   GL_RENDERBUFFER, bench_context->color_buffer_id);
+        glFramebufferRenderbuffer (GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                                   GL_RENDERBUFFER, bench_context->depth_buffer_id);
+
+        if (glCheckFramebufferStatus (GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                             "could not set up offscreen framebuffer");
+                return FALSE;
+        }
+
+        glViewport (0, 0, VIEWPORT_WIDTH, VIEWPORT_HEIGHT);
+
+        return TRUE;
+}
+
+static void
+bench_context_clear (BenchContext *bench_context)
+{
+        if (bench_context->display == EGL_NO_DISPLAY) {
+                return;
+        }
+
+        if (bench_context->color_buffer_id != 0) {
+                glDeleteFramebuffers (1, &bench_context->framebuffer_id);
+                glDeleteRenderbuffers (1, &bench_context->color_buffer_id);
+                glDeleteRenderbuffers (1, &bench_context->depth_buffer_id);
+        }
+
+        if (bench_context->context != EGL_NO_CONTEXT) {
+                eglMakeCurrent (bench_context->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+                eglDestroyContext (bench_context->display, bench_context->context);
+        }
+
+        if (bench_context->surface != EGL_NO_SURFACE) {
+                eglDestroySurface (bench_context->display, bench_context->surface);
+        }
+
+        eglTerminate (bench_context->display);
+}
+
+static void
+init_view (ChipsRenderView *view)
+{
+        graphene_vec3_t front;
+
+        graphene_matrix_init_identity (&view->model_matrix);
+
+        graphene_vec3_init (&view->camera_position, 1.5, 1.0, 5.0);
+        graphene_vec3_negate (graphene_vec3_z_axis (), &front);
+        graphene_vec3_add (&view->camera_position, &front, &front);
+        graphene_vec3_normalize (&front, &front);
+        graphene_matrix_init_look_at (&view->view_matrix,
+                                      &view->camera_position,
+                                      &front,
+                                      graphene_vec3_y_axis ());
+
+        view->near_plane = 1.0;
+        view->far_plane = 10;
+        view->viewport_height = VIEWPORT_HEIGHT;
+        graphene_matrix_init_perspective (&view->projection_matrix,
+                                          45,
+                                          (1.0 * VIEWPORT_WIDTH) / VIEWPORT_HEIGHT,
+                                          view->near_plane,
+                                          view->far_plane);
+}
+
+/* Copies sit side by side in a square grid centered on the original */
+static void
+set_instances (ChipsRenderer *renderer)
+{
+        g_autofree graphene_matrix_t *transforms = NULL;
+        int columns, i;
+
+        transforms = g_new (graphene_matrix_t, number_of_instances);
+        columns = ceil (sqrt (number_of_instances));
+
+        for (i = 0; i < number_of_instances; i++) {
+                graphene_point3d_t offset;
+
+                graphene_point3d_init (&offset,
+                                       1.2f * (i % columns - (columns - 1) / 2.0f),
+                                       1.2f * (i / columns - (columns - 1) / 2.0f),
+                                       0.0f);
+                graphene_matrix_init_translate (&transforms[i], &offset);
+        }
+
+        chips_renderer_set_instances (renderer, transforms, number_of_instances);
+}
+
+static int
+compare_frame_times (const gint64 *a,
+                     const gint64 *b)
+{
+        return (*a > *b) - (*a < *b);
+}
+
+static double
+get_percentile (GArray *sorted_frame_times,
+                double  percentile)
+{
+        size_t index;
+
+        index = MIN (sorted_frame_times->len - 1,
+                     (size_t) (percentile / 100.0 * sorted_frame_times->len));
+
+        return g_array_index (sorted_frame_times, gint64, index) / 1000.0;
+}
+
+typedef void (* DrawFunc) (gpointer               drawable,
+                           const ChipsRenderView *view);
+
+/* The draw call time is only what it takes the CPU to issue the frame,
+ * the frame time also waits for the GPU to draw it
+ */
+static void
+time_frames (DrawFunc     draw_func,
+             gpointer     drawable,
+             BenchResult *result)
+{
+        g_autoptr (GArray) frame_times = NULL;
+        g_autoptr (GArray) draw_call_times = NULL;
+        ChipsRenderView view;
+        int i;
+
+        init_view (&view);
+        frame_times = g_array_sized_new (FALSE, FALSE, sizeof (gint64), number_of_frames);
+        draw_call_times = g_array_sized_new (FALSE, FALSE, sizeof (gint64), number_of_frames);
+
+        for (i = 0; i < number_of_frames; i++) {
+                gint64 start_time, frame_time, draw_call_time;
+
+                start_time = g_get_monotonic_time ();
+                glClearColor (0.5, 0.5, 0.5, 1.0);
+                glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                draw_func (drawable, &view);
+                draw_call_time = g_get_monotonic_time () - start_time;
+                glFinish ();
+                frame_time = g_get_monotonic_time () - start_time;
+
+                g_array_append_val (frame_times, frame_time);
+                g_array_append_val (draw_call_times, draw_call_time);
+        }
+
+        g_array_sort (frame_times, (GCompareFunc) compare_frame_times);
+        result->frame_time_50th_percentile = get_percentile (frame_times, 50);
+        result->frame_time_95th_percentile = get_percentile (frame_times, 95);
+        result->frame_time_99th_percentile = get_percentile (frame_times, 99);
+
+        g_array_sort (draw_call_times, (GCompareFunc) compare_frame_times);
+        result->draw_call_time_50th_percentile = get_percentile (draw_call_times, 50);
+}
+
+/* Each part is loaded separately, so they all count as different
+ * models even though they come from the same file
+ */
+static GPtrArray *
+load_models (GFile        *file,
+             size_t        number_of_models,
+             GError      **error)
+{
+        g_autoptr (GPtrArray) models = NULL;
+        size_t i;
+
+        models = g_ptr_array_new_with_free_func (g_object_unref);
+
+        for (i = 0; i < number_of_models; i++) {
+                Chips3DModel *model;
+
+                model = g_initable_new (CHIPS_TYPE_3D_MODEL,
+                                        NULL,
+                                        error,
+                                        "file", file,
+                                        "use-cache", FALSE,
+                                        NULL);
+
+                if (model == NULL) {
+                        return NULL;
+                }
+
+                g_ptr_array_add (models, model);
+        }
+
+        return g_steal_pointer (&models);
+}
+
+static void
+run_renderer_benchmark (Chips3DModel *model,
+                        BenchResult  *result)
+{
+        g_autoptr (ChipsRenderer) renderer = NULL;
+        gint64 start_time;
+
+        start_time = g_get_monotonic_time ();
+        renderer = chips_renderer_new ();
+        chips_renderer_set_model (renderer, model);
+        chips_renderer_set_model_initialized (renderer);
+        set_instances (renderer);
+        while (chips_renderer_upload (renderer, G_MAXINT64));
+        glFinish ();
+        result->upload_time = (g_get_monotonic_time () - start_time) / 1000.0;
+
+        time_frames ((DrawFunc) chips_renderer_draw, renderer, result);
+}
+
+/* Parts are laid out in a grid like instances are, but every one of
+ * them is a different model
+ */
+static void
+run_scene_benchmark (GPtrArray   *models,
+                     BenchResult *result)
+{
+        g_autoptr (ChipsScene) scene = NULL;
+        gint64 start_time;
+        int columns;
+        guint i;
+
+        columns = ceil (sqrt (models->len));
+
+        start_time = g_get_monotonic_time ();
+        scene = chips_scene_new ();
+
+        for (i = 0; i < models->len; i++) {
+                graphene_matrix_t transform;
+                graphene_point3d_t offset;
+
+                graphene_point3d_init (&offset,
+                                       1.2f * ((int) i % columns - (columns - 1) / 2.0f),
+                                       1.2f * ((int) i / columns - (columns - 1) / 2.0f),
+                                       0.0f);
+                graphene_matrix_init_translate (&transform, &offset);
+                chips_scene_add_part (scene, g_ptr_array_index (models, i), &transform);
+        }
+
+        glFinish ();
+        result->upload_time = (g_get_monotonic_time () - start_time) / 1000.0;
+
+        time_frames ((DrawFunc) chips_scene_draw, scene, result);
+}
+
+/* Loads, uploads and draws the mesh the same way the window does,
+ * except every step waits for the GPU so the timings are honest
+ */
+static gboolean
+run_benchmark (guint64       number_of_triangles,
+               BenchResult  *result,
+               GError      **error)
+{
+        g_autoptr (GFile) file = NULL;
+        g_autoptr (GPtrArray) models = NULL;
+        gint64 start_time;
+
+        file = chips_bench_mesh_create (CHIPS_BENCH_MESH_FORMAT_BINARY_STL, number_of_triangles, error);
+
+        if (file == NULL) {
+                return FALSE;
+        }
+
+        start_time = g_get_monotonic_time ();
+        models = load_models (file, MAX (number_of_parts, 1), error);
+        result->load_time = (g_get_monotonic_time () - start_time) / 1000.0;
+
+        g_file_delete (file, NULL, NULL);
+
+        if (models == NULL) {
+                return FALSE;
+        }
+
+        result->number_of_triangles = chips_3d_model_get_number_of_indices (g_ptr_array_index (models, 0)) / 3;
+
+        if (number_of_parts > 0) {
+                result->number_of_instances = number_of_parts;
+                run_scene_benchmark (models, result);
+        } else {
+                result->number_of_instances = number_of_instances;
+                run_renderer_benchmark (g_ptr_array_index (models, 0), result);
+        }
+
+        return TRUE;
+}
+
+static void
+print_results (GArray   *results,
+               gboolean  as_json)
+{
+        size_t i;
+
+        if (as_json) {
+                g_print ("[\n");
+        } else {
+                g_print ("triangles,instances,load_ms,upload_ms,frame_p50_ms,frame_p95_ms,frame_p99_ms,draw_call_p50_ms\n");
+        }
+
+        for (i = 0; i < results->len; i++) {
+                BenchResult *result = &g_array_index (results, BenchResult, i);
+
+                if (as_json) {
+                        g_print ("  { \"triangles\": %" G_GUINT64_FORMAT ", \"instances\": %d, "
+                                 "\"load_ms\": %.3f, \"upload_ms\": %.3f, "
+                                 "\"frame_p50_ms\": %.3f, \"frame_p95_ms\": %.3f, \"frame_p99_ms\": %.3f, "
+                                 "\"draw_call_p50_ms\": %.3f }%s\n",
+                                 result->number_of_triangles,
+                                 result->number_of_instances,
+                                 result->load_time,
+                                 result->upload_time,
+                                 result->frame_time_50th_percentile,
+                                 result->frame_time_95th_percentile,
+                                 result->frame_time_99th_percentile,
+                                 result->draw_call_time_50th_percentile,
+                                 i + 1 < results->len? "," : "");
+                } else {
+                        g_print ("%" G_GUINT64_FORMAT ",%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+                                 result->number_of_triangles,
+                                 result->number_of_instances,
+                                 result->load_time,
+                                 result->upload_time,
+                                 result->frame_time_50th_percentile,
+                                 result->frame_time_95th_percentile,
+                                 result->frame_time_99th_percentile,
+                                 result->draw_call_time_50th_percentile);
+                }
+        }
+
+        if (as_json) {
+                g_print ("]\n");
+        }
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+        g_autoptr (GOptionContext) option_context = NULL;
+        g_autoptr (GArray) results = NULL;
+        g_autoptr (GError) error = NULL;
+        BenchContext bench_context = { EGL_NO_DISPLAY, EGL_NO_SURFACE, EGL_NO_CONTEXT, 0, 0, 0 };
+        gboolean as_json = FALSE;
+        size_t i;
+        int status = 1;
+
+        option_context = g_option_context_new ("- measure model load, upload and draw times");
+        g_option_context_add_main_entries (option_context, options, NULL);
+
+        if (!g_option_context_parse (option_context, &argc, &argv, &error)) {
+                g_printerr ("%s\n", error->message);
+                return 1;
+        }
+
+        if (output_format != NULL) {
+                if (g_strcmp0 (output_format, "json") == 0) {
+                        as_json = TRUE;
+                } else if (g_strcmp0 (output_format, "csv") != 0) {
+                        g_printerr ("unknown output format '%s'\n", output_format);
+                        return 1;
+                }
+        }
+
+        if (number_of_frames <= 0 || number_of_instances <= 0 || number_of_parts < 0) {
+                g_printerr ("need at least one frame and one instance\n");
+                return 1;
+        }
+
+        if (!bench_context_init (&bench_context, &error)) {
+                g_printerr ("%s\n", error->message);
+                status = EXIT_STATUS_SKIPPED;
+                goto out;
+        }
+
+        results = g_array_new (FALSE, FALSE, sizeof (BenchResult));
+
+        for (i = 0; i < G_N_ELEMENTS (mesh_sizes); i++) {
+                BenchResult result = { 0 };
+
+                if (mesh_sizes[i] > (guint64) maximum_number_of_triangles) {
+                        break;
+                }
+
+                if (!run_benchmark (mesh_sizes[i], &result, &error)) {
+                        g_printerr ("%" G_GUINT64_FORMAT " triangle mesh: %s\n",
+                                    mesh_sizes[i], error->message);
+                        goto out;
+                }
+
+                g_array_append_val (results, result);
+        }
+
+        print_results (results, as_json);
+
+        if (baseline_filename != NULL && !check_baseline (results, &error)) {
+                g_printerr ("%s\n", error->message);
+                goto out;
+        }
+
+        status = 0;
+out:
+        bench_context_clear (&bench_context);
+        g_free (output_format);
+        g_free (baseline_filename);
+
+        return status;
+}
@@ -0,0 +1,89 @@
+/* chips-build-octree.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chips.h"
+#include "chips-octree.h"
+
+static gint64 triangles_per_node = CHIPS_OCTREE_DEFAULT_TRIANGLES_PER_NODE;
+
+static GOptionEntry options[] = {
+        { "triangles-per-node", 't', 0, G_OPTION_ARG_INT64, &triangles_per_node,
+          "Most triangles to put in one node", "COUNT" },
+        { NULL }
+};
+
+static void
+on_progress (guint64  triangles_built,
+             guint64  number_of_triangles,
+             gpointer user_data)
+{
+        g_print ("\r%" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " triangles",
+                 triangles_built, number_of_triangles);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+        g_autoptr (GOptionContext) option_context = NULL;
+        g_autoptr (GError) error = NULL;
+        g_autoptr (GFile) input_file = NULL;
+        g_autofree char *output_directory = NULL;
+
+        option_context = g_option_context_new ("INPUT.stl OUTPUT" CHIPS_OCTREE_SUFFIX " - split a model into an octree that can be viewed without loading it whole");
+        g_option_context_add_main_entries (option_context, options, NULL);
+
+        if (!g_option_context_parse (option_context, &argc, &argv, &error)) {
+                g_printerr ("%s\n", error->message);
+                return 1;
+        }
+
+        if (argc != 3) {
+                g_printerr ("need an input file and an output directory\n");
+                return 1;
+        }
+
+        if (triangles_per_node <= 0) {
+                g_printerr ("need at least one triangle per node\n");
+                return 1;
+        }
+
+        /* The viewer goes by the suffix to tell octrees from models */
+        if (g_str_has_suffix (argv[2], CHIPS_OCTREE_SUFFIX)) {
+                output_directory = g_strdup (argv[2]);
+        } else {
+                output_directory = g_strconcat (argv[2], CHIPS_OCTREE_SUFFIX, NULL);
+        }
+
+        input_file = g_file_new_for_commandline_arg (argv[1]);
+
+        if (!chips_octree_build (input_file,
+                                 output_directory,
+                                 triangles_per_node,
+                                 on_progress,
+                                 NULL,
+                                 NULL,
+                                 &error)) {
+                g_print ("\n");
+                g_printerr ("%s\n", error->message);
+                return 1;
+        }
+
+        g_print ("\nwrote %s\n", output_directory);
+
+        return 0;
+}
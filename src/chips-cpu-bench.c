@@ -0,0 +1,401 @@
+/* chips-cpu-bench.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chips-3d-model.h"
+#include "chips-bench-mesh.h"
+#include "chips-importer.h"
+#include "chips-mesh-optimizer.h"
+#include "chips-parallel.h"
+
+typedef enum
+{
+        KERNEL_PARSE_STL = 0,
+        KERNEL_PARSE_OBJ,
+        KERNEL_WELD,
+        KERNEL_BOUNDS,
+        KERNEL_NORMALS,
+        KERNEL_TRIANGLE_ORDER,
+        KERNEL_VERTEX_FETCH,
+        KERNEL_MODEL_LOAD,
+        NUMBER_OF_KERNELS
+} Kernel;
+
+static const char *kernel_names[NUMBER_OF_KERNELS] = {
+        [KERNEL_PARSE_STL] = "parse-stl",
+        [KERNEL_PARSE_OBJ] = "parse-obj",
+        [KERNEL_WELD] = "weld",
+        [KERNEL_BOUNDS] = "bounds",
+        [KERNEL_NORMALS] = "normals",
+        [KERNEL_TRIANGLE_ORDER] = "triangle-order",
+        [KERNEL_VERTEX_FETCH] = "vertex-fetch",
+        [KERNEL_MODEL_LOAD] = "model-load",
+};
+
+/* The fastest of all the iterations, which is the least disturbed by
+ * whatever else the machine was doing
+ */
+typedef struct
+{
+        gint64 best_time;
+        size_t number_of_bytes;
+        size_t number_of_vertices;
+} KernelTiming;
+
+typedef struct
+{
+        GBytes       *stl_contents;
+        GBytes       *obj_contents;
+        GFile        *stl_file;
+
+        KernelTiming  timings[NUMBER_OF_KERNELS];
+} Benchmark;
+
+static gint64 number_of_triangles = 1000000;
+static int maximum_number_of_threads = 0;
+static int number_of_iterations = 3;
+static char *output_format = NULL;
+
+static GOptionEntry options[] = {
+        { "triangles", 't', 0, G_OPTION_ARG_INT64, &number_of_triangles,
+          "Number of triangles in the generated model", "COUNT" },
+        { "threads", 'j', 0, G_OPTION_ARG_INT, &maximum_number_of_threads,
+          "Largest thread count to measure (default: number of processors)", "COUNT" },
+        { "iterations", 'n', 0, G_OPTION_ARG_INT, &number_of_iterations,
+          "Number of times to run each kernel at each thread count", "COUNT" },
+        { "format", 'f', 0, G_OPTION_ARG_STRING, &output_format,
+          "Print results as csv or json", "FORMAT" },
+        { NULL }
+};
+
+static size_t
+get_mesh_size (const ChipsImportedMesh *mesh)
+{
+        return g_bytes_get_size (mesh->vertex_buffer) + g_bytes_get_size (mesh->vertex_arrangement);
+}
+
+static void
+record_timing (Benchmark *benchmark,
+               Kernel     kernel,
+               gint64     start_time,
+               size_t     number_of_bytes,
+               size_t     number_of_vertices)
+{
+        KernelTiming *timing = &benchmark->timings[kernel];
+        gint64 elapsed_time;
+
+        elapsed_time = MAX (g_get_monotonic_time () - start_time, 1);
+
+        if (timing->best_time == 0 || elapsed_time < timing->best_time) {
+                timing->best_time = elapsed_time;
+        }
+
+        timing->number_of_bytes = number_of_bytes;
+        timing->number_of_vertices = number_of_vertices;
+}
+
+/* Runs the kernels in the order Chips3DModel does, so each one sees
+ * the same input it would while loading a real model
+ */
+static gboolean
+run_mesh_kernels (Benchmark  *benchmark,
+                  GError    **error)
+{
+        ChipsImportedMesh mesh = { 0 };
+        g_autoptr (GBytes) normals = NULL;
+        float minimum[3], maximum[3];
+        size_t number_of_bytes, number_of_vertices;
+        gint64 start_time;
+        gboolean succeeded = FALSE;
+
+        start_time = g_get_monotonic_time ();
+        if (!chips_import_stl (benchmark->stl_contents, &mesh, NULL, NULL, NULL, error)) {
+                goto out;
+        }
+        record_timing (benchmark, KERNEL_PARSE_STL, start_time,
+                       g_bytes_get_size (benchmark->stl_contents), mesh.number_of_vertices);
+
+        number_of_bytes = get_mesh_size (&mesh);
+        number_of_vertices = mesh.number_of_vertices;
+        start_time = g_get_monotonic_time ();
+        if (!chips_mesh_weld_vertices (&mesh, 0.0, NULL, error)) {
+                goto out;
+        }
+        record_timing (benchmark, KERNEL_WELD, start_time, number_of_bytes, number_of_vertices);
+
+        start_time = g_get_monotonic_time ();
+        chips_mesh_compute_bounds (&mesh, minimum, maximum);
+        record_timing (benchmark, KERNEL_BOUNDS, start_time,
+                       g_bytes_get_size (mesh.vertex_buffer), mesh.number_of_vertices);
+
+        start_time = g_get_monotonic_time ();
+        normals = chips_mesh_compute_normals (&mesh, NULL, error);
+        if (normals == NULL) {
+                goto out;
+        }
+        record_timing (benchmark, KERNEL_NORMALS, start_time, get_mesh_size (&mesh), mesh.number_of_vertices);
+
+        start_time = g_get_monotonic_time ();
+        if (!chips_mesh_optimize_triangle_order (&mesh, CHIPS_MESH_VERTEX_CACHE_SIZE, NULL, error)) {
+                goto out;
+        }
+        record_timing (benchmark, KERNEL_TRIANGLE_ORDER, start_time, get_mesh_size (&mesh), mesh.number_of_vertices);
+
+        start_time = g_get_monotonic_time ();
+        if (!chips_mesh_optimize_vertex_fetch (&mesh, NULL, error)) {
+                goto out;
+        }
+        record_timing (benchmark, KERNEL_VERTEX_FETCH, start_time, get_mesh_size (&mesh), mesh.number_of_vertices);
+
+        succeeded = TRUE;
+out:
+        chips_imported_mesh_clear (&mesh);
+
+        return succeeded;
+}
+
+static gboolean
+run_obj_kernel (Benchmark  *benchmark,
+                GError    **error)
+{
+        ChipsImportedMesh mesh = { 0 };
+        gint64 start_time;
+
+        start_time = g_get_monotonic_time ();
+        if (!chips_import_obj (benchmark->obj_contents, &mesh, NULL, NULL, NULL, error)) {
+                return FALSE;
+        }
+        record_timing (benchmark, KERNEL_PARSE_OBJ, start_time,
+                       g_bytes_get_size (benchmark->obj_contents), mesh.number_of_vertices);
+
+        chips_imported_mesh_clear (&mesh);
+
+        return TRUE;
+}
+
+static gboolean
+run_model_load (Benchmark  *benchmark,
+                GError    **error)
+{
+        g_autoptr (Chips3DModel) model = NULL;
+        gint64 start_time;
+
+        start_time = g_get_monotonic_time ();
+        model = g_initable_new (CHIPS_TYPE_3D_MODEL,
+                                NULL,
+                                error,
+                                "file", benchmark->stl_file,
+                                "use-cache", FALSE,
+                                NULL);
+
+        if (model == NULL) {
+                return FALSE;
+        }
+
+        record_timing (benchmark, KERNEL_MODEL_LOAD, start_time,
+                       g_bytes_get_size (benchmark->stl_contents),
+                       chips_3d_model_get_number_of_vertices (model));
+
+        return TRUE;
+}
+
+static gboolean
+run_benchmark (Benchmark     *benchmark,
+               unsigned int   number_of_threads,
+               GError       **error)
+{
+        int i;
+
+        memset (benchmark->timings, 0, sizeof (benchmark->timings));
+        chips_parallel_set_number_of_threads (number_of_threads);
+
+        for (i = 0; i < number_of_iterations; i++) {
+                if (!run_mesh_kernels (benchmark, error)) {
+                        return FALSE;
+                }
+
+                if (!run_obj_kernel (benchmark, error)) {
+                        return FALSE;
+                }
+
+                if (!run_model_load (benchmark, error)) {
+                        return FALSE;
+                }
+        }
+
+        return TRUE;
+}
+
+static void
+print_timings (Benchmark    *benchmark,
+               unsigned int  number_of_threads,
+               gboolean      as_json,
+               gboolean      is_last)
+{
+        Kernel kernel;
+
+        for (kernel = 0; kernel < NUMBER_OF_KERNELS; kernel++) {
+                KernelTiming *timing = &benchmark->timings[kernel];
+                double seconds, megabytes_per_second, vertices_per_second;
+
+                seconds = (double) timing->best_time / G_USEC_PER_SEC;
+                megabytes_per_second = timing->number_of_bytes / (1024.0 * 1024.0) / seconds;
+                vertices_per_second = timing->number_of_vertices / seconds;
+
+                if (as_json) {
+                        g_print ("  { \"kernel\": \"%s\", \"threads\": %u, \"seconds\": %.6f, "
+                                 "\"mb_per_second\": %.1f, \"vertices_per_second\": %.0f }%s\n",
+                                 kernel_names[kernel],
+                                 number_of_threads,
+                                 seconds,
+                                 megabytes_per_second,
+                                 vertices_per_second,
+                                 is_last && kernel + 1 == NUMBER_OF_KERNELS? "" : ",");
+                } else {
+                        g_print ("%s,%u,%.6f,%.1f,%.0f\n",
+                                 kernel_names[kernel],
+                                 number_of_threads,
+                                 seconds,
+                                 megabytes_per_second,
+                                 vertices_per_second);
+                }
+        }
+}
+
+static gboolean
+benchmark_init (Benchmark  *benchmark,
+                GError    **error)
+{
+        benchmark->stl_contents = chips_bench_mesh_generate (CHIPS_BENCH_MESH_FORMAT_BINARY_STL,
+                                                             number_of_triangles,
+                                                             error);
+
+        if (benchmark->stl_contents == NULL) {
+                return FALSE;
+        }
+
+        benchmark->obj_contents = chips_bench_mesh_generate (CHIPS_BENCH_MESH_FORMAT_OBJ,
+                                                             number_of_triangles,
+                                                             error);
+
+        if (benchmark->obj_contents == NULL) {
+                return FALSE;
+        }
+
+        benchmark->stl_file = chips_bench_mesh_create (CHIPS_BENCH_MESH_FORMAT_BINARY_STL,
+                                                       number_of_triangles,
+                                                       error);
+
+        if (benchmark->stl_file == NULL) {
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+static void
+benchmark_clear (Benchmark *benchmark)
+{
+        if (benchmark->stl_file != NULL) {
+                g_file_delete (benchmark->stl_file, NULL, NULL);
+        }
+
+        g_clear_object (&benchmark->stl_file);
+        g_clear_pointer (&benchmark->stl_contents, g_bytes_unref);
+        g_clear_pointer (&benchmark->obj_contents, g_bytes_unref);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+        g_autoptr (GOptionContext) option_context = NULL;
+        g_autoptr (GError) error = NULL;
+        Benchmark benchmark = { 0 };
+        unsigned int number_of_threads;
+        gboolean as_json = FALSE;
+        int status = 1;
+
+        option_context = g_option_context_new ("- measure model processing throughput at each thread count");
+        g_option_context_add_main_entries (option_context, options, NULL);
+
+        if (!g_option_context_parse (option_context, &argc, &argv, &error)) {
+                g_printerr ("%s\n", error->message);
+                return 1;
+        }
+
+        if (output_format != NULL) {
+                if (g_strcmp0 (output_format, "json") == 0) {
+                        as_json = TRUE;
+                } else if (g_strcmp0 (output_format, "csv") != 0) {
+                        g_printerr ("unknown output format '%s'\n", output_format);
+                        return 1;
+                }
+        }
+
+        if (number_of_triangles <= 0 || number_of_iterations <= 0) {
+                g_printerr ("need at least one triangle and one iteration\n");
+                return 1;
+        }
+
+        if (maximum_number_of_threads <= 0) {
+                maximum_number_of_threads = g_get_num_processors ();
+        }
+
+        if (!benchmark_init (&benchmark, &error)) {
+                g_printerr ("%s\n", error->message);
+                goto out;
+        }
+
+        if (as_json) {
+                g_print ("[\n");
+        } else {
+                g_print ("kernel,threads,seconds,mb_per_second,vertices_per_second\n");
+        }
+
+        /* Powers of two show the scaling curve, and the last step is
+         * always the full thread count even if it isn't one
+         */
+        number_of_threads = 1;
+        while (TRUE) {
+                gboolean is_last;
+
+                if (!run_benchmark (&benchmark, number_of_threads, &error)) {
+                        g_printerr ("%u threads: %s\n", number_of_threads, error->message);
+                        goto out;
+                }
+
+                is_last = number_of_threads == (unsigned int) maximum_number_of_threads;
+                print_timings (&benchmark, number_of_threads, as_json, is_last);
+
+                if (is_last) {
+                        break;
+                }
+
+                number_of_threads = MIN (number_of_threads * 2, (unsigned int) maximum_number_of_threads);
+        }
+
+        if (as_json) {
+                g_print ("]\n");
+        }
+
+        status = 0;
+out:
+        benchmark_clear (&benchmark);
+        g_free (output_format);
+
+        return status;
+}
@@ -0,0 +1,362 @@
+/* chips-culling.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chips-culling.h"
+
+#define NO_CHILDREN 0
+
+typedef struct
+{
+        float   center[3];
+        float   extent[3];
+        guint32 first_cluster;
+        guint32 number_of_clusters;
+        guint32 first_child;
+} ChipsBvhNode;
+
+struct _ChipsBvh
+{
+        ChipsIndexRange *ranges;
+        ChipsBox        *cluster_boxes;
+        size_t           number_of_clusters;
+        ChipsBvhNode    *nodes;
+        size_t           number_of_nodes;
+};
+
+typedef void (* ChipsBvhVisitFunc) (const ChipsBvh     *bvh,
+                                    const ChipsBvhNode *node,
+                                    gpointer            user_data);
+
+/* With row vectors, clip coordinates are the position times the columns
+ * of the matrix, so each plane is the w column plus or minus one of the
+ * others
+ */
+void
+chips_frustum_init_from_matrix (ChipsFrustum            *frustum,
+                                const graphene_matrix_t *matrix)
+{
+        float planes[8][4];
+        size_t i, j;
+
+        for (i = 0; i < 6; i++) {
+                float sign = i % 2 == 0? 1.0f : -1.0f;
+                float length;
+
+                for (j = 0; j < 4; j++) {
+                        planes[i][j] = graphene_matrix_get_value (matrix, j, 3) +
+                                       sign * graphene_matrix_get_value (matrix, j, i / 2);
+                }
+
+                length = sqrtf (planes[i][0] * planes[i][0] +
+                                planes[i][1] * planes[i][1] +
+                                planes[i][2] * planes[i][2]);
+
+                if (length > 0.0f) {
+                        for (j = 0; j < 4; j++) {
+                                planes[i][j] /= length;
+                        }
+                }
+        }
+
+        for (i = 6; i < 8; i++) {
+                planes[i][0] = planes[i][1] = planes[i][2] = 0.0f;
+                planes[i][3] = 1.0f;
+        }
+
+        for (i = 0; i < 2; i++) {
+                for (j = 0; j < 4; j++) {
+                        const float *plane = planes[i * 4 + j];
+
+                        frustum->normal_x[i][j] = plane[0];
+                        frustum->normal_y[i][j] = plane[1];
+                        frustum->normal_z[i][j] = plane[2];
+                        frustum->distance[i][j] = plane[3];
+                        frustum->absolute_normal_x[i][j] = fabsf (plane[0]);
+                        frustum->absolute_normal_y[i][j] = fabsf (plane[1]);
+                        frustum->absolute_normal_z[i][j] = fabsf (plane[2]);
+                }
+        }
+}
+
+/* A box is outside if its center is further behind some plane than the
+ * box reaches toward it, and inside if it's that far in front of all of
+ * them
+ */
+ChipsFrustumTest
+chips_frustum_test_box (const ChipsFrustum *frustum,
+                        const float        *center,
+                        const float        *extent)
+{
+        ChipsInt4 outside = { 0 }, intersecting = { 0 };
+        size_t i;
+
+        for (i = 0; i < 2; i++) {
+                ChipsFloat4 distance, reach;
+
+                distance = frustum->normal_x[i] * center[0] +
+                           frustum->normal_y[i] * center[1] +
+                           frustum->normal_z[i] * center[2] +
+                           frustum->distance[i];
+                reach = frustum->absolute_normal_x[i] * extent[0] +
+                        frustum->absolute_normal_y[i] * extent[1] +
+                        frustum->absolute_normal_z[i] * extent[2];
+
+                outside |= distance + reach < 0.0f;
+                intersecting |= distance - reach < 0.0f;
+        }
+
+        if (outside[0] | outside[1] | outside[2] | outside[3]) {
+                return CHIPS_FRUSTUM_OUTSIDE;
+        }
+
+        if (intersecting[0] | intersecting[1] | intersecting[2] | intersecting[3]) {
+                return CHIPS_FRUSTUM_INTERSECTING;
+        }
+
+        return CHIPS_FRUSTUM_INSIDE;
+}
+
+ChipsFrustumTest
+chips_frustum_test_bounds (const ChipsFrustum   *frustum,
+                           const graphene_box_t *bounds)
+{
+        graphene_point3d_t center;
+        graphene_vec3_t size;
+        float center_values[3], extent_values[3];
+
+        graphene_box_get_center (bounds, &center);
+        graphene_box_get_size (bounds, &size);
+
+        center_values[0] = center.x;
+        center_values[1] = center.y;
+        center_values[2] = center.z;
+        extent_values[0] = graphene_vec3_get_x (&size) / 2.0f;
+        extent_values[1] = graphene_vec3_get_y (&size) / 2.0f;
+        extent_values[2] = graphene_vec3_get_z (&size) / 2.0f;
+
+        return chips_frustum_test_box (frustum, center_values, extent_values);
+}
+
+/* The clusters are already in Morton order, so halving the run at each
+ * level of the tree splits it along the longest stretch of the curve
+ */
+static void
+build_node (ChipsBvh               *bvh,
+            size_t                  node_index,
+            const ChipsMeshCluster *clusters,
+            size_t                  first_cluster,
+            size_t                  number_of_clusters)
+{
+        ChipsBvhNode *node = &bvh->nodes[node_index];
+        float minimum[3] = { G_MAXFLOAT, G_MAXFLOAT, G_MAXFLOAT };
+        float maximum[3] = { -G_MAXFLOAT, -G_MAXFLOAT, -G_MAXFLOAT };
+        size_t half, i, k;
+
+        for (i = first_cluster; i < first_cluster + number_of_clusters; i++) {
+                for (k = 0; k < 3; k++) {
+                        minimum[k] = MIN (minimum[k], clusters[i].bounds_minimum[k]);
+                        maximum[k] = MAX (maximum[k], clusters[i].bounds_maximum[k]);
+                }
+        }
+
+        for (k = 0; k < 3; k++) {
+                node->center[k] = (minimum[k] + maximum[k]) / 2.0f;
+                node->extent[k] = (maximum[k] - minimum[k]) / 2.0f;
+        }
+
+        node->first_cluster = first_cluster;
+        node->number_of_clusters = number_of_clusters;
+        node->first_child = NO_CHILDREN;
+
+        if (number_of_clusters == 1) {
+                return;
+        }
+
+        node->first_child = bvh->number_of_nodes;
+        bvh->number_of_nodes += 2;
+
+        half = number_of_clusters / 2;
+        build_node (bvh, node->first_child, clusters, first_cluster, half);
+        build_node (bvh, bvh->nodes[node_index].first_child + 1, clusters, first_cluster + half, number_of_clusters - half);
+}
+
+ChipsBvh *
+chips_bvh_new (const ChipsMeshCluster *clusters,
+               size_t                  number_of_clusters)
+{
+        ChipsBvh *bvh;
+        size_t i, k;
+
+        g_return_val_if_fail (number_of_clusters > 0, NULL);
+
+        bvh = g_new0 (ChipsBvh, 1);
+        bvh->ranges = g_new (ChipsIndexRange, number_of_clusters);
+        bvh->cluster_boxes = g_new (ChipsBox, number_of_clusters);
+        bvh->number_of_clusters = number_of_clusters;
+        bvh->nodes = g_new (ChipsBvhNode, 2 * number_of_clusters - 1);
+        bvh->number_of_nodes = 1;
+
+        for (i = 0; i < number_of_clusters; i++) {
+                bvh->ranges[i].first_index = clusters[i].first_index;
+                bvh->ranges[i].number_of_indices = clusters[i].number_of_indices;
+
+                for (k = 0; k < 3; k++) {
+                        bvh->cluster_boxes[i].center[k] = (clusters[i].bounds_minimum[k] + clusters[i].bounds_maximum[k]) / 2.0f;
+                        bvh->cluster_boxes[i].extent[k] = (clusters[i].bounds_maximum[k] - clusters[i].bounds_minimum[k]) / 2.0f;
+                }
+        }
+
+        build_node (bvh, 0, clusters, 0, number_of_clusters);
+
+        return bvh;
+}
+
+void
+chips_bvh_free (ChipsBvh *bvh)
+{
+        g_free (bvh->ranges);
+        g_free (bvh->cluster_boxes);
+        g_free (bvh->nodes);
+        g_free (bvh);
+}
+
+/* Calls visit_func on the nodes that might be in view, covering each
+ * such cluster once.  Nodes entirely inside the frustum are visited
+ * whole, without testing what's under them.
+ */
+static void
+visit_visible_nodes (const ChipsBvh     *bvh,
+                     const ChipsFrustum *frustum,
+                     ChipsBvhVisitFunc   visit_func,
+                     gpointer            user_data)
+{
+        guint32 stack[64];
+        size_t stack_depth = 0;
+
+        stack[stack_depth++] = 0;
+
+        while (stack_depth > 0) {
+                const ChipsBvhNode *node = &bvh->nodes[stack[--stack_depth]];
+
+                switch (chips_frustum_test_box (frustum, node->center, node->extent)) {
+                        case CHIPS_FRUSTUM_OUTSIDE:
+                                break;
+                        case CHIPS_FRUSTUM_INTERSECTING:
+                                if (node->first_child != NO_CHILDREN) {
+                                        /* Second child first, so the first comes off the stack first */
+                                        stack[stack_depth++] = node->first_child + 1;
+                                        stack[stack_depth++] = node->first_child;
+                                        break;
+                                }
+                                visit_func (bvh, node, user_data);
+                                break;
+                        case CHIPS_FRUSTUM_INSIDE:
+                                visit_func (bvh, node, user_data);
+                                break;
+                }
+        }
+}
+
+/* Neighboring clusters usually sit next to each other in the index
+ * buffer too, so their ranges get merged into one draw
+ */
+void
+chips_index_ranges_append (GArray                *ranges,
+                           const ChipsIndexRange *range)
+{
+        if (ranges->len > 0) {
+                ChipsIndexRange *last_range;
+
+                last_range = &g_array_index (ranges, ChipsIndexRange, ranges->len - 1);
+
+                if (last_range->first_index + last_range->number_of_indices == range->first_index) {
+                        last_range->number_of_indices += range->number_of_indices;
+                        return;
+                }
+        }
+
+        g_array_append_vals (ranges, range, 1);
+}
+
+static void
+add_visible_ranges (const ChipsBvh     *bvh,
+                    const ChipsBvhNode *node,
+                    GArray             *visible_ranges)
+{
+        size_t i;
+
+        for (i = node->first_cluster; i < node->first_cluster + node->number_of_clusters; i++) {
+                chips_index_ranges_append (visible_ranges, &bvh->ranges[i]);
+        }
+}
+
+static void
+add_visible_clusters (const ChipsBvh     *bvh,
+                      const ChipsBvhNode *node,
+                      GArray             *visible_clusters)
+{
+        guint32 i;
+
+        for (i = node->first_cluster; i < node->first_cluster + node->number_of_clusters; i++) {
+                g_array_append_val (visible_clusters, i);
+        }
+}
+
+/* Appends the index ranges of every cluster that might be in view */
+void
+chips_bvh_cull (const ChipsBvh     *bvh,
+                const ChipsFrustum *frustum,
+                GArray             *visible_ranges)
+{
+        visit_visible_nodes (bvh, frustum, (ChipsBvhVisitFunc) add_visible_ranges, visible_ranges);
+}
+
+/* Appends the numbers, as guint32s in increasing order, of every
+ * cluster that might be in view, for callers that keep track of the
+ * clusters individually
+ */
+void
+chips_bvh_cull_clusters (const ChipsBvh     *bvh,
+                         const ChipsFrustum *frustum,
+                         GArray             *visible_clusters)
+{
+        visit_visible_nodes (bvh, frustum, (ChipsBvhVisitFunc) add_visible_clusters, visible_clusters);
+}
+
+size_t
+chips_bvh_get_number_of_clusters (const ChipsBvh *bvh)
+{
+        return bvh->number_of_clusters;
+}
+
+const ChipsIndexRange *
+chips_bvh_get_cluster_range (const ChipsBvh *bvh,
+                             size_t          cluster)
+{
+        g_return_val_if_fail (cluster < bvh->number_of_clusters, NULL);
+
+        return &bvh->ranges[cluster];
+}
+
+const ChipsBox *
+chips_bvh_get_cluster_box (const ChipsBvh *bvh,
+                           size_t          cluster)
+{
+        g_return_val_if_fail (cluster < bvh->number_of_clusters, NULL);
+
+        return &bvh->cluster_boxes[cluster];
+}
@@ -0,0 +1,93 @@
+/* chips-culling.h
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CHIPS_CULLING_H
+#define CHIPS_CULLING_H
+
+#include "chips.h"
+#include "chips-importer.h"
+
+typedef float ChipsFloat4 __attribute__ ((vector_size (16)));
+typedef int   ChipsInt4   __attribute__ ((vector_size (16)));
+
+/* The six clip planes, stored a component at a time so four planes get
+ * tested per instruction.  The last two lanes hold planes every box is
+ * in front of.
+ */
+typedef struct
+{
+        ChipsFloat4 normal_x[2];
+        ChipsFloat4 normal_y[2];
+        ChipsFloat4 normal_z[2];
+        ChipsFloat4 distance[2];
+        ChipsFloat4 absolute_normal_x[2];
+        ChipsFloat4 absolute_normal_y[2];
+        ChipsFloat4 absolute_normal_z[2];
+} ChipsFrustum;
+
+typedef enum
+{
+        CHIPS_FRUSTUM_OUTSIDE,
+        CHIPS_FRUSTUM_INTERSECTING,
+        CHIPS_FRUSTUM_INSIDE,
+} ChipsFrustumTest;
+
+typedef struct
+{
+        guint64 first_index;
+        guint64 number_of_indices;
+} ChipsIndexRange;
+
+/* An axis aligned box, as the tests above take it */
+typedef struct
+{
+        float center[3];
+        float extent[3];
+} ChipsBox;
+
+typedef struct _ChipsBvh ChipsBvh;
+
+void             chips_frustum_init_from_matrix (ChipsFrustum             *frustum,
+                                                 const graphene_matrix_t  *matrix);
+ChipsFrustumTest chips_frustum_test_box         (const ChipsFrustum       *frustum,
+                                                 const float              *center,
+                                                 const float              *extent);
+ChipsFrustumTest chips_frustum_test_bounds      (const ChipsFrustum       *frustum,
+                                                 const graphene_box_t     *bounds);
+
+void             chips_index_ranges_append      (GArray                   *ranges,
+                                                 const ChipsIndexRange    *range);
+
+ChipsBvh        *chips_bvh_new                  (const ChipsMeshCluster   *clusters,
+                                                 size_t                    number_of_clusters);
+void             chips_bvh_free                 (ChipsBvh                 *bvh);
+void             chips_bvh_cull                 (const ChipsBvh           *bvh,
+                                                 const ChipsFrustum       *frustum,
+                                                 GArray                   *visible_ranges);
+void             chips_bvh_cull_clusters        (const ChipsBvh           *bvh,
+                                                 const ChipsFrustum       *frustum,
+                                                 GArray                   *visible_clusters);
+size_t           chips_bvh_get_number_of_clusters (const ChipsBvh         *bvh);
+const ChipsIndexRange *
+                 chips_bvh_get_cluster_range    (const ChipsBvh           *bvh,
+                                                 size_t                    cluster);
+const ChipsBox  *chips_bvh_get_cluster_box      (const ChipsBvh           *bvh,
+                                                 size_t                    cluster);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ChipsBvh, chips_bvh_free);
+
+#endif /* CHIPS_CULLING_H */
@@ -0,0 +1,374 @@
+/* chips-importer-test.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chips-importer.h"
+
+#define BINARY_STL_HEADER_SIZE 84
+
+typedef gboolean (* ImportFunc) (GBytes                   *contents,
+                                 ChipsImportedMesh        *mesh,
+                                 ChipsImportProgressFunc   progress_func,
+                                 gpointer                  user_data,
+                                 GCancellable             *cancellable,
+                                 GError                  **error);
+
+static gboolean
+import_bytes (ImportFunc          import_func,
+              const void         *data,
+              size_t              size,
+              ChipsImportedMesh  *mesh,
+              GError            **error)
+{
+        g_autoptr (GBytes) contents = NULL;
+
+        contents = g_bytes_new_static (data, size);
+
+        return import_func (contents, mesh, NULL, NULL, NULL, error);
+}
+
+static gboolean
+import_text (ImportFunc          import_func,
+             const char         *text,
+             ChipsImportedMesh  *mesh,
+             GError            **error)
+{
+        return import_bytes (import_func, text, strlen (text), mesh, error);
+}
+
+static void
+assert_vertex (const ChipsImportedMesh *mesh,
+               size_t                   vertex,
+               float                    x,
+               float                    y,
+               float                    z)
+{
+        const float *positions;
+
+        g_assert_cmpuint (vertex, <, mesh->number_of_vertices);
+
+        positions = (const float *) g_bytes_get_data (mesh->vertex_buffer, NULL) + vertex * 3;
+        g_assert_cmpfloat (positions[0], ==, x);
+        g_assert_cmpfloat (positions[1], ==, y);
+        g_assert_cmpfloat (positions[2], ==, z);
+}
+
+static void
+assert_indices (const ChipsImportedMesh *mesh,
+                const guint32           *expected_indices,
+                size_t                   number_of_indices)
+{
+        const guint32 *indices;
+        size_t i;
+
+        g_assert_cmpuint (mesh->index_size, ==, sizeof (guint32));
+        g_assert_cmpuint (mesh->number_of_indices, ==, number_of_indices);
+
+        indices = g_bytes_get_data (mesh->vertex_arrangement, NULL);
+
+        for (i = 0; i < number_of_indices; i++) {
+                g_assert_cmpuint (indices[i], ==, expected_indices[i]);
+        }
+}
+
+static void
+assert_import_fails (ImportFunc  import_func,
+                     const char *text)
+{
+        g_autoptr (GError) error = NULL;
+        ChipsImportedMesh mesh = { 0 };
+
+        g_assert_false (import_text (import_func, text, &mesh, &error));
+        g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+}
+
+static void
+test_obj_polygons_are_fanned (void)
+{
+        static const guint32 expected_indices[] = { 0, 1, 2, 0, 2, 3 };
+        g_autoptr (GError) error = NULL;
+        ChipsImportedMesh mesh = { 0 };
+
+        g_assert_true (import_text (chips_import_obj,
+                                    "v 0 0 0\n"
+                                    "v 1 0 0\n"
+                                    "v 1 1 0\n"
+                                    "v 0 1 0\n"
+                                    "f 1/1/1 2/2/2 3/3/3 4/4/4\n",
+                                    &mesh,
+                                    &error));
+        g_assert_no_error (error);
+
+        g_assert_cmpuint (mesh.number_of_vertices, ==, 4);
+        assert_vertex (&mesh, 2, 1, 1, 0);
+        assert_indices (&mesh, expected_indices, G_N_ELEMENTS (expected_indices));
+
+        chips_imported_mesh_clear (&mesh);
+}
+
+/* Relative indices count back from the vertices seen so far, which the
+ * chunk holding the face can't know until the chunks before it are
+ * parsed.  A long comment pushes the face and the vertex before it into
+ * their own chunk.
+ */
+static void
+test_obj_relative_indices_across_chunks (void)
+{
+        static const guint32 expected_indices[] = { 0, 2, 3 };
+        g_autoptr (GString) text = NULL;
+        g_autoptr (GArray) chunks = NULL;
+        g_autoptr (GError) error = NULL;
+        ChipsImportedMesh mesh = { 0 };
+
+        text = g_string_new ("v 0 0 0\n"
+                             "v 1 0 0\n"
+                             "v 1 1 0\n"
+                             "# ");
+
+        while (text->len <= CHIPS_IMPORTER_CHUNK_SIZE) {
+                g_string_append (text, "padding ");
+        }
+
+        g_string_append (text,
+                         "\n"
+                         "v 0 1 0\n"
+                         "f -4 -2 -1\n");
+
+        chunks = chips_importer_split_lines (text->str, text->len, CHIPS_IMPORTER_CHUNK_SIZE);
+        g_assert_cmpuint (chunks->len, ==, 2);
+
+        g_assert_true (import_bytes (chips_import_obj, text->str, text->len, &mesh, &error));
+        g_assert_no_error (error);
+
+        g_assert_cmpuint (mesh.number_of_vertices, ==, 4);
+        assert_vertex (&mesh, 3, 0, 1, 0);
+        assert_indices (&mesh, expected_indices, G_N_ELEMENTS (expected_indices));
+
+        chips_imported_mesh_clear (&mesh);
+}
+
+static void
+test_obj_out_of_range_indices (void)
+{
+        /* Past the last vertex */
+        assert_import_fails (chips_import_obj,
+                             "v 0 0 0\n"
+                             "v 1 0 0\n"
+                             "v 1 1 0\n"
+                             "f 1 2 4\n");
+
+        /* Before the first vertex, counting back */
+        assert_import_fails (chips_import_obj,
+                             "v 0 0 0\n"
+                             "v 1 0 0\n"
+                             "v 1 1 0\n"
+                             "f -4 -2 -1\n");
+
+        /* Indices start at 1 */
+        assert_import_fails (chips_import_obj,
+                             "v 0 0 0\n"
+                             "v 1 0 0\n"
+                             "v 1 1 0\n"
+                             "f 0 1 2\n");
+}
+
+static void
+test_stl_ascii (void)
+{
+        g_autoptr (GError) error = NULL;
+        ChipsImportedMesh mesh = { 0 };
+
+        g_assert_true (import_text (chips_import_stl,
+                                    "solid square\n"
+                                    "  facet normal 0 0 1\n"
+                                    "    outer loop\n"
+                                    "      vertex 0 0 0\n"
+                                    "      vertex 1 0 0\n"
+                                    "      vertex 1 1 0\n"
+                                    "    endloop\n"
+                                    "  endfacet\n"
+                                    "  facet normal 0 0 1\n"
+                                    "    outer loop\n"
+                                    "      vertex 0 0 0\n"
+                                    "      vertex 1 1 0\n"
+                                    "      vertex 0 1.5e0 -0.25\n"
+                                    "    endloop\n"
+                                    "  endfacet\n"
+                                    "endsolid square\n",
+                                    &mesh,
+                                    &error));
+        g_assert_no_error (error);
+
+        g_assert_cmpuint (mesh.number_of_vertices, ==, 6);
+        g_assert_cmpuint (mesh.number_of_indices, ==, 6);
+        assert_vertex (&mesh, 1, 1, 0, 0);
+        assert_vertex (&mesh, 5, 0, 1.5, -0.25);
+
+        chips_imported_mesh_clear (&mesh);
+}
+
+static void
+append_float (GByteArray *data,
+              float       value)
+{
+        guint32 bits;
+
+        memcpy (&bits, &value, sizeof (bits));
+        bits = GUINT32_TO_LE (bits);
+        g_byte_array_append (data, (const guint8 *) &bits, sizeof (bits));
+}
+
+/* Nine corner coordinates per triangle, and padding zero bytes after
+ * the last one
+ */
+static GByteArray *
+create_binary_stl (const char  *header,
+                   const float *corners,
+                   guint32      number_of_triangles,
+                   size_t       padding)
+{
+        GByteArray *data;
+        guint8 header_bytes[BINARY_STL_HEADER_SIZE] = { 0 };
+        guint32 count;
+        guint16 attributes = 0;
+        guint32 i;
+        int j;
+
+        memcpy (header_bytes, header, MIN (strlen (header), 80));
+        count = GUINT32_TO_LE (number_of_triangles);
+        memcpy (header_bytes + 80, &count, sizeof (count));
+
+        data = g_byte_array_new ();
+        g_byte_array_append (data, header_bytes, sizeof (header_bytes));
+
+        for (i = 0; i < number_of_triangles; i++) {
+                for (j = 0; j < 3; j++) {
+                        append_float (data, 0);
+                }
+
+                for (j = 0; j < 9; j++) {
+                        append_float (data, corners[i * 9 + j]);
+                }
+
+                g_byte_array_append (data, (const guint8 *) &attributes, sizeof (attributes));
+        }
+
+        for (i = 0; i < padding; i++) {
+                g_byte_array_append (data, (const guint8 *) "", 1);
+        }
+
+        return data;
+}
+
+static const float binary_corners[] = { 0, 0, 0,   1, 0, 0,   1, 1, 0,
+                                        0, 0, 0,   1, 1, 0,   0, 1, 2 };
+
+/* Plenty of exporters write binary files that start with "solid" too,
+ * so only the size can tell them from ASCII ones
+ */
+static void
+test_stl_binary_with_solid_header (void)
+{
+        g_autoptr (GByteArray) data = NULL;
+        g_autoptr (GError) error = NULL;
+        ChipsImportedMesh mesh = { 0 };
+
+        data = create_binary_stl ("solid exported by something", binary_corners, 2, 0);
+
+        g_assert_true (import_bytes (chips_import_stl, data->data, data->len, &mesh, &error));
+        g_assert_no_error (error);
+
+        g_assert_cmpuint (mesh.number_of_vertices, ==, 6);
+        assert_vertex (&mesh, 2, 1, 1, 0);
+        assert_vertex (&mesh, 5, 0, 1, 2);
+
+        chips_imported_mesh_clear (&mesh);
+}
+
+static void
+test_stl_padded_binary (void)
+{
+        g_autoptr (GByteArray) data = NULL;
+        g_autoptr (GError) error = NULL;
+        ChipsImportedMesh mesh = { 0 };
+
+        data = create_binary_stl ("binary", binary_corners, 2, 13);
+
+        g_assert_true (import_bytes (chips_import_stl, data->data, data->len, &mesh, &error));
+        g_assert_no_error (error);
+
+        g_assert_cmpuint (mesh.number_of_vertices, ==, 6);
+        assert_vertex (&mesh, 5, 0, 1, 2);
+
+        chips_imported_mesh_clear (&mesh);
+}
+
+/* With "solid" up front and the wrong size, the file is taken for
+ * ASCII, and has no facets to speak of, which mustn't load as nothing
+ */
+static void
+test_stl_padded_binary_with_solid_header (void)
+{
+        g_autoptr (GByteArray) data = NULL;
+        g_autoptr (GError) error = NULL;
+        ChipsImportedMesh mesh = { 0 };
+
+        data = create_binary_stl ("solid", binary_corners, 2, 13);
+
+        g_assert_false (import_bytes (chips_import_stl, data->data, data->len, &mesh, &error));
+        g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+}
+
+static void
+test_stl_incomplete_facets (void)
+{
+        assert_import_fails (chips_import_stl,
+                             "solid broken\n"
+                             "  facet normal 0 0 1\n"
+                             "    outer loop\n"
+                             "      vertex 0 0 0\n"
+                             "      vertex 1 0 0\n"
+                             "    endloop\n"
+                             "  endfacet\n"
+                             "endsolid broken\n");
+
+        assert_import_fails (chips_import_stl,
+                             "solid broken\n"
+                             "  facet normal 0 0 1\n"
+                             "    outer loop\n"
+                             "      vertex 0 0\n"
+                             "    endloop\n"
+                             "  endfacet\n"
+                             "endsolid broken\n");
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+        g_test_init (&argc, &argv, NULL);
+
+        g_test_add_func ("/importer/obj/polygons-are-fanned", test_obj_polygons_are_fanned);
+        g_test_add_func ("/importer/obj/relative-indices-across-chunks", test_obj_relative_indices_across_chunks);
+        g_test_add_func ("/importer/obj/out-of-range-indices", test_obj_out_of_range_indices);
+        g_test_add_func ("/importer/stl/ascii", test_stl_ascii);
+        g_test_add_func ("/importer/stl/binary-with-solid-header", test_stl_binary_with_solid_header);
+        g_test_add_func ("/importer/stl/padded-binary", test_stl_padded_binary);
+        g_test_add_func ("/importer/stl/padded-binary-with-solid-header", test_stl_padded_binary_with_solid_header);
+        g_test_add_func ("/importer/stl/incomplete-facets", test_stl_incomplete_facets);
+
+        return g_test_run ();
+}
@@ -0,0 +1,88 @@
+/* chips-importer.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chips-importer.h"
+
+G_STATIC_ASSERT (sizeof (ChipsMeshLevelOfDetail) == 24);
+G_STATIC_ASSERT (sizeof (ChipsMeshCluster) == 40);
+
+void
+chips_imported_mesh_clear (ChipsImportedMesh *mesh)
+{
+        g_clear_pointer (&mesh->vertex_buffer, g_bytes_unref);
+        g_clear_pointer (&mesh->vertex_arrangement, g_bytes_unref);
+        g_clear_pointer (&mesh->levels_of_detail, g_array_unref);
+        g_clear_pointer (&mesh->clusters, g_array_unref);
+        mesh->number_of_vertices = 0;
+        mesh->number_of_indices = 0;
+        mesh->index_size = 0;
+}
+
+size_t
+chips_imported_mesh_get_number_of_levels (const ChipsImportedMesh *mesh)
+{
+        if (mesh->levels_of_detail == NULL) {
+                return 1;
+        }
+
+        return mesh->levels_of_detail->len;
+}
+
+void
+chips_imported_mesh_get_level (const ChipsImportedMesh *mesh,
+                               size_t                   level,
+                               ChipsMeshLevelOfDetail  *level_of_detail)
+{
+        if (mesh->levels_of_detail == NULL) {
+                g_return_if_fail (level == 0);
+
+                memset (level_of_detail, 0, sizeof (*level_of_detail));
+                level_of_detail->number_of_indices = mesh->number_of_indices;
+                return;
+        }
+
+        *level_of_detail = g_array_index (mesh->levels_of_detail, ChipsMeshLevelOfDetail, level);
+}
+
+GArray *
+chips_importer_split_lines (const char *data,
+                            size_t      size,
+                            size_t      chunk_size)
+{
+        GArray *chunks;
+        const char *end = data + size;
+        const char *cursor = data;
+
+        chunks = g_array_new (FALSE, FALSE, sizeof (ChipsTextChunk));
+
+        while (cursor < end) {
+                ChipsTextChunk chunk;
+
+                chunk.start = cursor;
+
+                if ((size_t) (end - cursor) <= chunk_size) {
+                        chunk.end = end;
+                } else {
+                        chunk.end = chips_importer_skip_line (cursor + chunk_size, end);
+                }
+
+                g_array_append_val (chunks, chunk);
+                cursor = chunk.end;
+        }
+
+        return chunks;
+}
@@ -0,0 +1,245 @@
+/* chips-importer.h
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CHIPS_IMPORTER_H
+#define CHIPS_IMPORTER_H
+
+#include "chips.h"
+
+/* Text formats are split into chunks of about this many bytes, each
+ * ending on a line boundary, and the chunks are parsed concurrently
+ */
+#define CHIPS_IMPORTER_CHUNK_SIZE (4 * 1024 * 1024)
+
+typedef void (* ChipsImportProgressFunc) (size_t   bytes_processed,
+                                          size_t   vertices_processed,
+                                          gpointer user_data);
+
+/* A run of the index buffer that draws the whole model at some level
+ * of detail.  error is how far, in model units, the run may stray from
+ * the full detail surface.  Stored as-is in mesh files.
+ */
+typedef struct
+{
+        guint64 first_index;
+        guint64 number_of_indices;
+        float   error;
+        guint32 reserved;
+} ChipsMeshLevelOfDetail;
+
+/* A spatially coherent run of triangles within one level of detail,
+ * and the box around them.  Stored as-is in mesh files.
+ */
+typedef struct
+{
+        guint64 first_index;
+        guint32 number_of_indices;
+        guint32 level;
+        float   bounds_minimum[3];
+        float   bounds_maximum[3];
+} ChipsMeshCluster;
+
+typedef struct
+{
+        GBytes *vertex_buffer;
+        size_t  number_of_vertices;
+        GBytes *vertex_arrangement;
+        size_t  number_of_indices;
+        size_t  index_size;
+
+        /* NULL means the index buffer is a single level */
+        GArray *levels_of_detail;
+
+        /* NULL until chips_mesh_build_clusters runs */
+        GArray *clusters;
+} ChipsImportedMesh;
+
+typedef struct
+{
+        const char *start;
+        const char *end;
+} ChipsTextChunk;
+
+void     chips_imported_mesh_clear                (ChipsImportedMesh        *mesh);
+size_t   chips_imported_mesh_get_number_of_levels (const ChipsImportedMesh  *mesh);
+void     chips_imported_mesh_get_level            (const ChipsImportedMesh  *mesh,
+                                                   size_t                    level,
+                                                   ChipsMeshLevelOfDetail   *level_of_detail);
+
+GArray  *chips_importer_split_lines               (const char               *data,
+                                                   size_t                    size,
+                                                   size_t                    chunk_size);
+
+gboolean chips_import_obj                         (GBytes                   *contents,
+                                                   ChipsImportedMesh        *mesh,
+                                                   ChipsImportProgressFunc   progress_func,
+                                                   gpointer                  user_data,
+                                                   GCancellable             *cancellable,
+                                                   GError                  **error);
+
+gboolean chips_import_stl                         (GBytes                   *contents,
+                                                   ChipsImportedMesh        *mesh,
+                                                   ChipsImportProgressFunc   progress_func,
+                                                   gpointer                  user_data,
+                                                   GCancellable             *cancellable,
+                                                   GError                  **error);
+
+static inline const char *
+chips_importer_skip_blanks (const char *cursor,
+                            const char *end)
+{
+        while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r')) {
+                cursor++;
+        }
+
+        return cursor;
+}
+
+static inline const char *
+chips_importer_skip_line (const char *cursor,
+                          const char *end)
+{
+        const char *newline;
+
+        newline = memchr (cursor, '\n', end - cursor);
+
+        if (newline == NULL) {
+                return end;
+        }
+
+        return newline + 1;
+}
+
+/* Parses a decimal floating point number without going through the
+ * locale machinery of strtod.  Plain mantissas of up to 19 digits are
+ * accumulated in an integer and scaled once, which covers everything
+ * CAD exporters write; anything else (very long mantissas, inf, nan)
+ * falls back to g_ascii_strtod.
+ */
+static inline gboolean
+chips_importer_parse_float (const char **cursor,
+                            const char  *end,
+                            float       *value)
+{
+        static const double powers_of_ten[] = {
+                1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+                1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+                1e21, 1e22
+        };
+        const char *position = *cursor;
+        gboolean negative = FALSE;
+        guint64 mantissa = 0;
+        int number_of_digits = 0;
+        int exponent = 0;
+        double result;
+
+        position = chips_importer_skip_blanks (position, end);
+
+        if (position < end && (*position == '-' || *position == '+')) {
+                negative = *position == '-';
+                position++;
+        }
+
+        while (position < end && g_ascii_isdigit (*position)) {
+                if (number_of_digits < 19) {
+                        mantissa = mantissa * 10 + (*position - '0');
+                        number_of_digits++;
+                } else {
+                        exponent++;
+                }
+                position++;
+        }
+
+        if (position < end && *position == '.') {
+                position++;
+
+                while (position < end && g_ascii_isdigit (*position)) {
+                        if (number_of_digits < 19) {
+                                mantissa = mantissa * 10 + (*position - '0');
+                                number_of_digits++;
+                                exponent--;
+                        }
+                        position++;
+                }
+        }
+
+        if (number_of_digits == 0) {
+                char buffer[64];
+                const char *start;
+                char *parse_end;
+                size_t length;
+
+                start = chips_importer_skip_blanks (*cursor, end);
+                length = MIN ((size_t) (end - start), sizeof (buffer) - 1);
+                memcpy (buffer, start, length);
+                buffer[length] = '\0';
+
+                result = g_ascii_strtod (buffer, &parse_end);
+
+                if (parse_end == buffer) {
+                        return FALSE;
+                }
+
+                *value = result;
+                *cursor = start + (parse_end - buffer);
+                return TRUE;
+        }
+
+        if (position < end && (*position == 'e' || *position == 'E')) {
+                gboolean negative_exponent = FALSE;
+                int explicit_exponent = 0;
+
+                position++;
+
+                if (position < end && (*position == '-' || *position == '+')) {
+                        negative_exponent = *position == '-';
+                        position++;
+                }
+
+                while (position < end && g_ascii_isdigit (*position)) {
+                        if (explicit_exponent < 10000) {
+                                explicit_exponent = explicit_exponent * 10 + (*position - '0');
+                        }
+                        position++;
+                }
+
+                exponent += negative_exponent? -explicit_exponent : explicit_exponent;
+        }
+
+        result = mantissa;
+
+        if (exponent < 0) {
+                while (exponent < -22) {
+                        result /= powers_of_ten[22];
+                        exponent += 22;
+                }
+                result /= powers_of_ten[-exponent];
+        } else if (exponent > 0) {
+                while (exponent > 22) {
+                        result *= powers_of_ten[22];
+                        exponent -= 22;
+                }
+                result *= powers_of_ten[exponent];
+        }
+
+        *value = negative? -result : result;
+        *cursor = position;
+
+        return TRUE;
+}
+
+#endif /* CHIPS_IMPORTER_H */
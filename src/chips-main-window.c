@@ -17,6 +17,13 @@
  */
 #include "chips-main-window.h"
 #include "chips-3d-model.h"
+#include "chips-application.h"
+#include "chips-octree.h"
+#include "chips-octree-renderer.h"
+#include "chips-point-cloud.h"
+#include "chips-point-cloud-renderer.h"
+#include "chips-profiler.h"
+#include "chips-renderer.h"
 
 struct _ChipsMainWindow
 {
@@ -24,9 +31,22 @@ struct _ChipsMainWindow
 
         GtkWidget *gl_area;
 
+        /* Frame times, shown over the model with --profiler-overlay */
+        GtkWidget *profiler_label;
+        guint profiler_label_update_id;
+        ChipsGpuTimer *gpu_timer;
+
+        GFile *file;
         Chips3DModel *model;
         GCancellable *model_init_cancellable;
 
+        /* The model whose geometry is going to the GPU.  It's drawn as
+         * it arrives, before model gets set to it.
+         */
+        Chips3DModel *streaming_model;
+        guint64 vertices_available;
+        guint64 indices_available;
+
         graphene_vec3_t camera_position;
         graphene_vec3_t camera_focal_point;
         graphene_vec3_t camera_up_direction;
@@ -36,59 +56,57 @@ struct _ChipsMainWindow
         float near_plane;
         float far_plane;
 
-        unsigned int vertex_array_id;
+        graphene_matrix_t model_matrix;
+        graphene_matrix_t view_matrix;
+        graphene_matrix_t projection_matrix;
 
-        unsigned int vertex_buffer_id;
-        unsigned int vertex_arrangement_id;
+        /* Around everything shown, after the model matrix, so the near
+         * and far planes can hug it
+         */
+        graphene_sphere_t bounding_sphere;
 
-        unsigned int shader_program_id;
-        unsigned int vertex_shader_id;
-        unsigned int fragment_shader_id;
+        /* Where each copy of the model goes, or NULL for just one */
+        GArray *instance_transforms;
 
-        unsigned int position_attribute_id;
+        ChipsRenderer *renderer;
 
-        graphene_matrix_t model_matrix;
-        unsigned int model_matrix_id;
+        /* Set instead of model for files too big to load whole */
+        ChipsOctree *octree;
+        ChipsOctreeRenderer *octree_renderer;
 
-        graphene_matrix_t view_matrix;
-        unsigned int view_matrix_id;
-
-        graphene_matrix_t projection_matrix;
-        unsigned int projection_matrix_id;
+        /* Set instead of model for point clouds */
+        ChipsPointCloud *point_cloud;
+        ChipsPointCloudRenderer *point_cloud_renderer;
 
         unsigned int model_loaded : 1;
+        unsigned int bounding_sphere_valid : 1;
 };
 
 G_DEFINE_TYPE (ChipsMainWindow, chips_main_window, GTK_TYPE_WINDOW);
 
-typedef enum
-{
-        CHIPS_VERTEX_SHADER = GL_VERTEX_SHADER,
-        CHIPS_FRAGMENT_SHADER = GL_FRAGMENT_SHADER
-} ChipsShaderType;
-
-static const char *vertex_shader =
-"#version 330\n"
-"in vec3 position;\n"
-"out vec3 color;\n"
-"uniform mat4 model_matrix;\n"
-"uniform mat4 view_matrix;\n"
-"uniform mat4 projection_matrix;\n"
-"void\n"
-"main ()\n"
-"{\n"
-"        gl_Position = projection_matrix * view_matrix * model_matrix * vec4 (position, 1.0);\n"
-"        color = vec3 (1.0 - gl_Position.z/10.0, 1.0 - gl_Position.z/10.0, 1.0 - gl_Position.z/10.0);\n"
-"}\n";
-
-static const char *fragment_shader =
-"#version 330\n"
-"in vec3 color;\n"
-"out vec4 fragment_color;\n"
-"void main ()\n"
-"{\n"
-"        fragment_color = vec4 (color, 1.0);\n"
-"}\n";
+enum
+{
+        PROP_FILE = 1,
+        NUMBER_OF_PROPERTIES
+};
+
+static GParamSpec *properties[NUMBER_OF_PROPERTIES];
+
+static void start_loading_model (ChipsMainWindow *self);
+
+/* How long each frame may spend uploading geometry */
+#define UPLOAD_TIME_BUDGET (G_USEC_PER_SEC / 250)
+
+/* How often the profiler overlay catches up, in milliseconds */
+#define PROFILER_LABEL_UPDATE_INTERVAL 500
+
+/* Depth precision runs out when the near plane is too much closer than
+ * the far one, so it's kept at least this fraction of the way out
+ */
+#define MINIMUM_NEAR_TO_FAR_RATIO (1.0f / 10000.0f)
+
+/* Where the camera looks at things from, relative to their center */
+static const float viewing_direction[] = { 1.5f, 1.0f, 5.0f };
 
 static void
 chips_main_window_dispose (GObject *object)
@@ -98,7 +116,15 @@ chips_main_window_dispose (GObject *object)
         g_cancellable_cancel (self->model_init_cancellable);
         g_clear_object (&self->model_init_cancellable);
 
+        if (self->profiler_label_update_id != 0) {
+                g_source_remove (self->profiler_label_update_id);
+                self->profiler_label_update_id = 0;
+        }
+
         g_clear_object (&self->model);
+        g_clear_object (&self->streaming_model);
+        g_clear_object (&self->point_cloud);
+        g_clear_object (&self->file);
         G_OBJECT_CLASS (chips_main_window_parent_class)->dispose (object);
 }
 
@@ -107,9 +133,58 @@ chips_main_window_finalize (GObject *object)
 {
         ChipsMainWindow *self = CHIPS_MAIN_WINDOW (object);
 
+        g_clear_pointer (&self->instance_transforms, g_array_unref);
+        g_clear_pointer (&self->octree, chips_octree_free);
+
         G_OBJECT_CLASS (chips_main_window_parent_class)->finalize (object);
 }
 
+static void
+chips_main_window_constructed (GObject *object)
+{
+        ChipsMainWindow *self = CHIPS_MAIN_WINDOW (object);
+
+        G_OBJECT_CLASS (chips_main_window_parent_class)->constructed (object);
+
+        start_loading_model (self);
+}
+
+static void
+chips_main_window_set_property (GObject      *object,
+                                guint         property_id,
+                                const GValue *value,
+                                GParamSpec   *param_spec)
+{
+        ChipsMainWindow *self = CHIPS_MAIN_WINDOW (object);
+
+        switch (property_id) {
+                case PROP_FILE:
+                        self->file = g_value_dup_object (value);
+                        break;
+                default:
+                        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, param_spec);
+                        break;
+        }
+}
+
+static void
+chips_main_window_get_property (GObject    *object,
+                                guint       property_id,
+                                GValue     *value,
+                                GParamSpec *param_spec)
+{
+        ChipsMainWindow *self = CHIPS_MAIN_WINDOW (object);
+
+        switch (property_id) {
+                case PROP_FILE:
+                        g_value_set_object (value, self->file);
+                        break;
+                default:
+                        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, param_spec);
+                        break;
+        }
+}
+
 static void
 chips_main_window_class_init (ChipsMainWindowClass *own_class)
 {
@@ -117,6 +192,19 @@ chips_main_window_class_init (ChipsMainWindowClass *own_class)
 
         object_class->dispose = chips_main_window_dispose;
         object_class->finalize = chips_main_window_finalize;
+        object_class->constructed = chips_main_window_constructed;
+        object_class->set_property = chips_main_window_set_property;
+        object_class->get_property = chips_main_window_get_property;
+
+        properties[PROP_FILE] = g_param_spec_object ("file",
+                                                     "File",
+                                                     "File of the model shown in the window",
+                                                     G_TYPE_FILE,
+                                                     G_PARAM_READWRITE |
+                                                     G_PARAM_CONSTRUCT_ONLY |
+                                                     G_PARAM_STATIC_STRINGS);
+
+        g_object_class_install_properties (object_class, NUMBER_OF_PROPERTIES, properties);
 }
 
 static gboolean
@@ -134,196 +222,311 @@ initialize_gl (ChipsMainWindow  *self,
                 return FALSE;
         }
 
-        glEnable (GL_DEPTH_TEST);
-        glEnable (GL_CULL_FACE);
-
         return TRUE;
 }
 
-static gboolean
-load_shader (ChipsMainWindow *self,
-             ChipsShaderType  shader_type,
-             const char      *shader,
-             unsigned int    *shader_id)
+static void
+place_camera (ChipsMainWindow       *self,
+              const graphene_vec3_t *position,
+              const graphene_vec3_t *focal_point)
 {
-        int compile_status;
+        self->camera_position = *position;
+        self->camera_focal_point = *focal_point;
+        self->camera_up_direction = *graphene_vec3_y_axis ();
+
+        graphene_matrix_init_look_at (&self->view_matrix,
+                                      &self->camera_position,
+                                      &self->camera_focal_point,
+                                      &self->camera_up_direction);
+}
 
-        *shader_id = glCreateShader (shader_type);
-        glShaderSource (*shader_id, 1, &shader, NULL);
-        glCompileShader (*shader_id);
+/* Pulls the near and far planes in as close around the bounding sphere
+ * as they go, which has to happen whenever the camera or what it's
+ * looking at moves
+ */
+static void
+fit_depth_range (ChipsMainWindow *self)
+{
+        GtkAllocation gl_area_allocation;
+
+        gtk_widget_get_allocation (self->gl_area, &gl_area_allocation);
+        self->aspect_ratio = (1.0 * gl_area_allocation.width) / MAX (gl_area_allocation.height, 1);
 
-        glGetShaderiv (*shader_id, GL_COMPILE_STATUS, &compile_status);
+        if (self->bounding_sphere_valid) {
+                graphene_point3d_t center;
+                graphene_vec3_t center_vector, offset;
+                float distance, radius;
 
-        if (!compile_status) {
-                char compile_log[4096];
+                graphene_sphere_get_center (&self->bounding_sphere, &center);
+                graphene_point3d_to_vec3 (&center, &center_vector);
+                radius = graphene_sphere_get_radius (&self->bounding_sphere);
 
-                glGetShaderInfoLog (*shader_id, sizeof (compile_log), NULL, compile_log);
-                g_warning ("failed to compile shader: '%s'\n%s",
-                           shader, compile_log);
+                graphene_vec3_subtract (&self->camera_position, &center_vector, &offset);
+                distance = graphene_vec3_length (&offset);
+
+                self->far_plane = MAX (distance + radius, G_MINFLOAT);
+                self->near_plane = MAX (distance - radius, self->far_plane * MINIMUM_NEAR_TO_FAR_RATIO);
         }
 
-        return compile_status;
+        graphene_matrix_init_perspective (&self->projection_matrix,
+                                          self->field_of_view,
+                                          self->aspect_ratio,
+                                          self->near_plane,
+                                          self->far_plane);
 }
 
 static void
-place_camera (ChipsMainWindow   *self,
-              float              x,
-              float              y,
-              float              z,
-              graphene_matrix_t *view_matrix)
+load_matrices (ChipsMainWindow *self)
 {
-        graphene_vec3_t position, direction, front;
-        const graphene_vec3_t *top;
+        graphene_vec3_t position, focal_point;
 
-        graphene_vec3_init (&position, x, y, z);
+        graphene_matrix_init_identity (&self->model_matrix);
 
-        graphene_vec3_negate (graphene_vec3_z_axis (), &direction);
-        graphene_vec3_add (&position, &direction, &front);
-        graphene_vec3_normalize (&front, &front);
+        graphene_vec3_init (&position, viewing_direction[0], viewing_direction[1], viewing_direction[2]);
+        graphene_vec3_init (&focal_point, 0.0f, 0.0f, 0.0f);
+        place_camera (self, &position, &focal_point);
 
-        top = graphene_vec3_y_axis ();
+        self->field_of_view = 45;
+        self->near_plane = 1.0;
+        self->far_plane = 10;
+        self->bounding_sphere_valid = FALSE;
 
-        graphene_matrix_init_look_at (view_matrix,
-                                      &position,
-                                      &front,
-                                      top);
+        fit_depth_range (self);
 }
 
+/* Backs the camera away from the center of sphere, along the viewing
+ * direction, until all of the sphere fits in view
+ */
 static void
-load_matrices (ChipsMainWindow *self)
+frame_bounding_sphere (ChipsMainWindow         *self,
+                       const graphene_sphere_t *sphere)
 {
-        GtkAllocation gl_area_allocation;
+        graphene_point3d_t center;
+        graphene_vec3_t focal_point, direction, position;
+        float half_field_of_view, radius, distance;
 
-        graphene_matrix_init_identity (&self->model_matrix);
+        graphene_sphere_get_center (sphere, &center);
+        graphene_point3d_to_vec3 (&center, &focal_point);
+        radius = graphene_sphere_get_radius (sphere);
 
-        place_camera (self, 1.5, 1.0, 5.0, &self->view_matrix);
+        if (radius <= 0.0f) {
+                radius = 1.0f;
+        }
 
-        gtk_widget_get_allocation (self->gl_area, &gl_area_allocation);
+        /* The field of view is vertical, and windows are usually wider
+         * than they are tall, but not always
+         */
+        half_field_of_view = self->field_of_view * G_PI / 360.0f;
 
-        self->field_of_view = 45;
-        self->aspect_ratio = (1.0 * gl_area_allocation.width) / gl_area_allocation.height;
-        self->near_plane = 1.0;
-        self->far_plane = 10;
+        if (self->aspect_ratio < 1.0f) {
+                half_field_of_view = atanf (tanf (half_field_of_view) * self->aspect_ratio);
+        }
 
-        graphene_matrix_init_perspective (&self->projection_matrix,
-                                          self->field_of_view,
-                                          self->aspect_ratio,
-                                          self->near_plane,
-                                          self->far_plane);
+        distance = radius / sinf (half_field_of_view);
+
+        graphene_vec3_init (&direction, viewing_direction[0], viewing_direction[1], viewing_direction[2]);
+        graphene_vec3_normalize (&direction, &direction);
+        graphene_vec3_scale (&direction, distance, &direction);
+        graphene_vec3_add (&focal_point, &direction, &position);
+
+        place_camera (self, &position, &focal_point);
+
+        self->bounding_sphere = *sphere;
+        self->bounding_sphere_valid = TRUE;
+
+        fit_depth_range (self);
 }
 
+/* The sphere around every copy of the model, as placed by the instance
+ * transforms
+ */
 static void
-load_vertices (ChipsMainWindow *self)
+get_model_bounding_sphere (ChipsMainWindow   *self,
+                           Chips3DModel      *model,
+                           graphene_sphere_t *sphere)
 {
-        size_t vertex_arrangement_size;
+        graphene_sphere_t model_sphere;
+        graphene_point3d_t model_center, minimum, maximum, center;
+        graphene_box_t centers;
+        float model_radius, radius = 0.0f;
+        size_t i;
+
+        chips_3d_model_get_bounding_sphere (model, &model_sphere);
+
+        if (self->instance_transforms == NULL) {
+                *sphere = model_sphere;
+                return;
+        }
 
-        glGenVertexArrays(1, &self->vertex_array_id);
-        glBindVertexArray(self->vertex_array_id);
+        graphene_sphere_get_center (&model_sphere, &model_center);
+        model_radius = graphene_sphere_get_radius (&model_sphere);
 
-        glGenBuffers (1, &self->vertex_buffer_id);
-        glBindBuffer (GL_ARRAY_BUFFER, self->vertex_buffer_id);
+        graphene_point3d_init (&minimum, G_MAXFLOAT, G_MAXFLOAT, G_MAXFLOAT);
+        graphene_point3d_init (&maximum, -G_MAXFLOAT, -G_MAXFLOAT, -G_MAXFLOAT);
 
-        glBufferData (GL_ARRAY_BUFFER,
-                      chips_3d_model_get_vertex_buffer_size (self->model),
-                      chips_3d_model_get_vertex_buffer (self->model),
-                      GL_STATIC_DRAW);
+        for (i = 0; i < self->instance_transforms->len; i++) {
+                const graphene_matrix_t *transform = &g_array_index (self->instance_transforms, graphene_matrix_t, i);
 
-        vertex_arrangement_size = chips_3d_model_get_number_of_vertices (self->model) * sizeof (unsigned int);
-        glGenBuffers (1, &self->vertex_arrangement_id);
-        glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, self->vertex_arrangement_id);
-        glBufferData (GL_ELEMENT_ARRAY_BUFFER,
-                      vertex_arrangement_size,
-                      chips_3d_model_get_vertex_arrangement (self->model),
-                      GL_STATIC_DRAW);
+                graphene_matrix_transform_point3d (transform, &model_center, &center);
 
+                minimum.x = MIN (minimum.x, center.x);
+                minimum.y = MIN (minimum.y, center.y);
+                minimum.z = MIN (minimum.z, center.z);
+                maximum.x = MAX (maximum.x, center.x);
+                maximum.y = MAX (maximum.y, center.y);
+                maximum.z = MAX (maximum.z, center.z);
+        }
+
+        graphene_box_init (&centers, &minimum, &maximum);
+        graphene_box_get_center (&centers, &model_center);
+
+        for (i = 0; i < self->instance_transforms->len; i++) {
+                const graphene_matrix_t *transform = &g_array_index (self->instance_transforms, graphene_matrix_t, i);
+                float scale;
+
+                graphene_matrix_transform_point3d (transform, &model_center, &center);
+                scale = MAX (graphene_matrix_get_x_scale (transform),
+                             MAX (graphene_matrix_get_y_scale (transform),
+                                  graphene_matrix_get_z_scale (transform)));
+
+                radius = MAX (radius, graphene_point3d_distance (&model_center, &center, NULL) + model_radius * scale);
+        }
+
+        graphene_sphere_init (sphere, &model_center, radius);
 }
 
 static void
-load_shaders (ChipsMainWindow *self)
+load_model_if_ready (ChipsMainWindow *self)
 {
-        load_shader (self,
-                     CHIPS_VERTEX_SHADER,
-                     vertex_shader,
-                     &self->vertex_shader_id);
-        load_shader (self,
-                     CHIPS_FRAGMENT_SHADER,
-                     fragment_shader,
-                     &self->fragment_shader_id);
+        graphene_sphere_t sphere;
+
+        if (self->streaming_model == NULL || self->vertices_available == 0 || self->model_loaded) {
+                return;
+        }
 
-        self->shader_program_id = glCreateProgram ();
-        glAttachShader (self->shader_program_id,
-                        self->vertex_shader_id);
-        glAttachShader (self->shader_program_id,
-                        self->fragment_shader_id);
+        if (self->renderer == NULL) {
+                return;
+        }
 
-        glBindFragDataLocation (self->shader_program_id,
-                                0,
-                                "fragment_color");
-        glLinkProgram (self->shader_program_id);
-        glUseProgram (self->shader_program_id);
+        gtk_gl_area_make_current (GTK_GL_AREA (self->gl_area));
+
+        load_matrices (self);
+        get_model_bounding_sphere (self, self->streaming_model, &sphere);
+        frame_bounding_sphere (self, &sphere);
 
-        self->position_attribute_id = glGetAttribLocation (self->shader_program_id, "position");
-        self->model_matrix_id = glGetUniformLocation (self->shader_program_id, "model_matrix");
-        self->view_matrix_id = glGetUniformLocation (self->shader_program_id, "view_matrix");
-        self->projection_matrix_id = glGetUniformLocation (self->shader_program_id, "projection_matrix");
+        chips_renderer_set_model (self->renderer, self->streaming_model);
+        chips_renderer_add_geometry (self->renderer, self->vertices_available, self->indices_available);
+
+        if (self->model != NULL) {
+                chips_renderer_set_model_initialized (self->renderer);
+        }
+
+        self->model_loaded = TRUE;
+
+        gtk_gl_area_queue_render (GTK_GL_AREA (self->gl_area));
 }
 
+/* Octrees and point clouds can be in any units, anywhere, so they get
+ * scaled and moved to where a normal model would be
+ */
 static void
-upload_model_to_shaders (ChipsMainWindow *self)
+fit_bounds_in_view (ChipsMainWindow      *self,
+                    const graphene_box_t *bounds)
 {
-        glEnableVertexAttribArray (self->position_attribute_id);
-        glVertexAttribPointer (self->position_attribute_id,
-                               3,
-                               GL_FLOAT,
-                               GL_FALSE,
-                               chips_3d_model_get_vertex_buffer_get_stride (self->model),
-                               (void *)
-                               chips_3d_model_get_vertex_buffer_get_offset (self->model));
+        graphene_point3d_t center, origin = { 0 };
+        graphene_vec3_t size;
+        graphene_sphere_t sphere;
+        float largest_size, scale = 1.0f;
+
+        graphene_box_get_center (bounds, &center);
+        graphene_point3d_scale (&center, -1.0f, &center);
+        graphene_box_get_size (bounds, &size);
+        largest_size = MAX (graphene_vec3_get_x (&size), MAX (graphene_vec3_get_y (&size), graphene_vec3_get_z (&size)));
+
+        graphene_matrix_init_translate (&self->model_matrix, &center);
+
+        if (largest_size > 0.0f) {
+                scale = 2.0f / largest_size;
+                graphene_matrix_scale (&self->model_matrix, scale, scale, scale);
+        }
 
+        graphene_sphere_init (&sphere, &origin, graphene_vec3_length (&size) * scale / 2.0f);
+        frame_bounding_sphere (self, &sphere);
 }
 
 static void
-upload_matrix_to_shaders (ChipsMainWindow   *self,
-                          unsigned int       matrix_id,
-                          graphene_matrix_t *matrix)
+fit_octree_in_view (ChipsMainWindow *self)
 {
-        float matrix_values[16];
+        const ChipsOctreeNode *root;
+        graphene_point3d_t minimum, maximum;
+        graphene_box_t bounds;
 
-        graphene_matrix_to_float (matrix, matrix_values);
-        glUniformMatrix4fv(matrix_id,
-                           1,
-                           GL_FALSE,
-                           matrix_values);
+        root = chips_octree_get_node (self->octree, 0);
+
+        graphene_point3d_init (&minimum, root->bounds_minimum[0], root->bounds_minimum[1], root->bounds_minimum[2]);
+        graphene_point3d_init (&maximum, root->bounds_maximum[0], root->bounds_maximum[1], root->bounds_maximum[2]);
+        graphene_box_init (&bounds, &minimum, &maximum);
+
+        fit_bounds_in_view (self, &bounds);
 }
 
 static void
-upload_data_to_shaders (ChipsMainWindow *self)
+load_octree_if_ready (ChipsMainWindow *self)
 {
-        upload_model_to_shaders (self);
-        upload_matrix_to_shaders (self,
-                                  self->model_matrix_id,
-                                  &self->model_matrix);
-        upload_matrix_to_shaders (self,
-                                  self->view_matrix_id,
-                                  &self->view_matrix);
-        upload_matrix_to_shaders (self,
-                                  self->projection_matrix_id,
-                                  &self->projection_matrix);
+        if (self->octree == NULL || self->octree_renderer != NULL) {
+                return;
+        }
+
+        if (!gtk_widget_get_realized (self->gl_area)) {
+                return;
+        }
+
+        gtk_gl_area_make_current (GTK_GL_AREA (self->gl_area));
+
+        load_matrices (self);
+        fit_octree_in_view (self);
+
+        self->octree_renderer = chips_octree_renderer_new (self->octree, CHIPS_OCTREE_RENDERER_DEFAULT_POOL_SIZE);
+
+        gtk_gl_area_queue_render (GTK_GL_AREA (self->gl_area));
 }
 
 static void
-load_model_if_ready (ChipsMainWindow *self)
+load_point_cloud_if_ready (ChipsMainWindow *self)
 {
-        if (self->model == NULL || self->model_loaded) {
+        graphene_box_t bounds;
+
+        if (self->point_cloud == NULL || self->point_cloud_renderer != NULL) {
                 return;
         }
 
+        if (!gtk_widget_get_realized (self->gl_area)) {
+                return;
+        }
+
+        gtk_gl_area_make_current (GTK_GL_AREA (self->gl_area));
+
         load_matrices (self);
-        load_vertices (self);
-        load_shaders (self);
-        upload_data_to_shaders (self);
+        chips_point_cloud_get_bounds (self->point_cloud, &bounds);
+        fit_bounds_in_view (self, &bounds);
 
-        self->model_loaded = TRUE;
+        self->point_cloud_renderer = chips_point_cloud_renderer_new (self->point_cloud);
+
+        gtk_gl_area_queue_render (GTK_GL_AREA (self->gl_area));
+}
+
+static ChipsResidencyManager *
+get_residency_manager (void)
+{
+        return chips_application_get_residency_manager (CHIPS_APPLICATION (g_application_get_default ()));
+}
+
+static void
+evict_renderer (ChipsRenderer   *renderer,
+                ChipsMainWindow *self)
+{
+        gtk_gl_area_make_current (GTK_GL_AREA (self->gl_area));
+        chips_renderer_evict (renderer);
 }
 
 static void
@@ -335,7 +538,24 @@ on_gl_area_realized (ChipsMainWindow *self)
                 g_error ("%s", error->message);
         }
 
+        self->gpu_timer = chips_gpu_timer_new ();
+        self->renderer = chips_renderer_new ();
+        chips_renderer_set_occlusion_culling (self->renderer,
+                                              chips_application_get_occlusion_culling (CHIPS_APPLICATION (g_application_get_default ())));
+        chips_residency_manager_add_renderer (get_residency_manager (),
+                                              self->renderer,
+                                              (ChipsResidencyEvictFunc) evict_renderer,
+                                              self);
+
+        if (self->instance_transforms != NULL) {
+                chips_renderer_set_instances (self->renderer,
+                                              (const graphene_matrix_t *) self->instance_transforms->data,
+                                              self->instance_transforms->len);
+        }
+
         load_model_if_ready (self);
+        load_octree_if_ready (self);
+        load_point_cloud_if_ready (self);
 }
 
 static void
@@ -347,51 +567,452 @@ on_gl_area_unrealized (ChipsMainWindow *self)
                 g_warning ("%s", error->message);
                 return;
         }
+
+        if (self->renderer != NULL) {
+                chips_residency_manager_remove_renderer (get_residency_manager (), self->renderer);
+        }
+
+        g_clear_pointer (&self->renderer, chips_renderer_free);
+        g_clear_pointer (&self->octree_renderer, chips_octree_renderer_free);
+        g_clear_pointer (&self->point_cloud_renderer, chips_point_cloud_renderer_free);
+        g_clear_pointer (&self->gpu_timer, chips_gpu_timer_free);
+        self->model_loaded = FALSE;
+}
+
+static void
+get_render_view (ChipsMainWindow *self,
+                 ChipsRenderView *view)
+{
+        view->model_matrix = self->model_matrix;
+        view->view_matrix = self->view_matrix;
+        view->projection_matrix = self->projection_matrix;
+        view->camera_position = self->camera_position;
+        view->near_plane = self->near_plane;
+        view->far_plane = self->far_plane;
+        view->viewport_height = gtk_widget_get_allocated_height (self->gl_area) *
+                                gtk_widget_get_scale_factor (self->gl_area);
 }
 
 static gboolean
-on_gl_area_render (ChipsMainWindow *self)
+upload_geometry (ChipsMainWindow *self)
+{
+        gint64 span_start;
+        gboolean more_to_upload;
+
+        span_start = chips_profiler_begin_span ();
+
+        if (self->point_cloud_renderer != NULL) {
+                more_to_upload = chips_point_cloud_renderer_upload (self->point_cloud_renderer, UPLOAD_TIME_BUDGET);
+        } else {
+                more_to_upload = chips_renderer_upload (self->renderer, UPLOAD_TIME_BUDGET);
+        }
+
+        chips_profiler_end_span (span_start, "frame", "upload");
+
+        return more_to_upload;
+}
+
+static gboolean
+draw_frame (ChipsMainWindow *self)
 {
+        ChipsRenderView view;
+
         glClearColor (0.5, 0.5, 0.5, 1.0);
         glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        if (self->model == NULL) {
+        if (self->octree_renderer != NULL) {
+                fit_depth_range (self);
+                get_render_view (self, &view);
+
+                if (chips_octree_renderer_draw (self->octree_renderer, &view)) {
+                        gtk_gl_area_queue_render (GTK_GL_AREA (self->gl_area));
+                }
+
+                return TRUE;
+        }
+
+        if (self->point_cloud_renderer != NULL) {
+                if (upload_geometry (self)) {
+                        gtk_gl_area_queue_render (GTK_GL_AREA (self->gl_area));
+                }
+
+                fit_depth_range (self);
+                get_render_view (self, &view);
+                chips_point_cloud_renderer_draw (self->point_cloud_renderer, &view);
+
+                return TRUE;
+        }
+
+        if (!self->model_loaded) {
                 return FALSE;
         }
 
-        glDrawElements (GL_TRIANGLES,
-                        chips_3d_model_get_number_of_vertices (self->model),
-                        GL_UNSIGNED_INT,
-                        0);
+        fit_depth_range (self);
+
+        if (upload_geometry (self)) {
+                gtk_gl_area_queue_render (GTK_GL_AREA (self->gl_area));
+        }
+
+        get_render_view (self, &view);
+
+        chips_renderer_draw (self->renderer, &view);
+
+        if (chips_renderer_has_pending_occlusion_tests (self->renderer)) {
+                gtk_gl_area_queue_render (GTK_GL_AREA (self->gl_area));
+        }
+
+        chips_residency_manager_renderer_drawn (get_residency_manager (), self->renderer);
 
         return TRUE;
 }
 
+/* The GPU time of earlier frames comes in as the GPU gets done with
+ * them, so the timer is checked every frame
+ */
+static gboolean
+on_gl_area_render (ChipsMainWindow *self)
+{
+        gint64 frame_start;
+        gboolean drawn;
+
+        frame_start = chips_profiler_begin_span ();
+
+        chips_gpu_timer_collect (self->gpu_timer);
+        chips_gpu_timer_begin (self->gpu_timer, "frame");
+        drawn = draw_frame (self);
+        chips_gpu_timer_end (self->gpu_timer);
+
+        chips_profiler_add_frame (frame_start);
+
+        return drawn;
+}
+
+static gboolean
+update_profiler_label (ChipsMainWindow *self)
+{
+        g_autofree char *text = NULL;
+        ChipsFrameStatistics statistics;
+
+        chips_profiler_get_frame_statistics (&statistics);
+
+        text = g_strdup_printf (_("CPU %.2f ms (median %.2f, 99%% %.2f)\n"
+                                  "GPU %.2f ms (median %.2f, 99%% %.2f)\n"
+                                  "%" G_GUINT64_FORMAT " frames"),
+                                statistics.last_cpu_time,
+                                statistics.median_cpu_time,
+                                statistics.slowest_percentile_cpu_time,
+                                statistics.last_gpu_time,
+                                statistics.median_gpu_time,
+                                statistics.slowest_percentile_gpu_time,
+                                statistics.number_of_frames);
+        gtk_label_set_text (GTK_LABEL (self->profiler_label), text);
+
+        return G_SOURCE_CONTINUE;
+}
+
+static void
+on_3d_model_progress (ChipsMainWindow *self,
+                      guint64          bytes_processed,
+                      guint64          bytes_total,
+                      guint64          vertices_processed)
+{
+        g_autofree char *title = NULL;
+        int percent_done;
+
+        if (bytes_total == 0) {
+                return;
+        }
+
+        percent_done = (100 * MIN (bytes_processed, bytes_total)) / bytes_total;
+        title = g_strdup_printf (_("Chips — Loading (%d%%)"), percent_done);
+        gtk_window_set_title (GTK_WINDOW (self), title);
+}
+
+static void
+on_3d_model_geometry_available (ChipsMainWindow *self,
+                                guint64          vertices_available,
+                                guint64          indices_available,
+                                Chips3DModel    *model)
+{
+        if (model != self->streaming_model) {
+                return;
+        }
+
+        self->vertices_available = vertices_available;
+        self->indices_available = indices_available;
+
+        if (!self->model_loaded) {
+                load_model_if_ready (self);
+                return;
+        }
+
+        chips_renderer_add_geometry (self->renderer, vertices_available, indices_available);
+        gtk_gl_area_queue_render (GTK_GL_AREA (self->gl_area));
+}
+
+static void on_3d_model_replaced (ChipsMainWindow *self,
+                                  Chips3DModel    *replacement,
+                                  Chips3DModel    *model);
+
+static void
+watch_for_replacement (ChipsMainWindow *self)
+{
+        g_signal_connect_object (self->model,
+                                 "replaced",
+                                 G_CALLBACK (on_3d_model_replaced),
+                                 self,
+                                 G_CONNECT_SWAPPED);
+}
+
+/* The file changed on disk and got loaded again.  Whatever geometry
+ * didn't change stays on the GPU, and the camera stays where it is, so
+ * edits can be looked at from the same spot.
+ */
+static void
+on_3d_model_replaced (ChipsMainWindow *self,
+                      Chips3DModel    *replacement,
+                      Chips3DModel    *model)
+{
+        if (model != self->model) {
+                return;
+        }
+
+        g_signal_handlers_disconnect_by_data (model, self);
+
+        g_set_object (&self->streaming_model, replacement);
+        g_set_object (&self->model, replacement);
+        self->vertices_available = chips_3d_model_get_number_of_vertices (replacement);
+        self->indices_available = chips_3d_model_get_number_of_indices (replacement);
+
+        watch_for_replacement (self);
+
+        if (!self->model_loaded) {
+                load_model_if_ready (self);
+                return;
+        }
+
+        gtk_gl_area_make_current (GTK_GL_AREA (self->gl_area));
+        chips_renderer_replace_model (self->renderer, replacement);
+
+        get_model_bounding_sphere (self, replacement, &self->bounding_sphere);
+
+        gtk_gl_area_queue_render (GTK_GL_AREA (self->gl_area));
+}
+
+static void
+finish_loading_model (ChipsMainWindow *self,
+                      const GError    *error)
+{
+        if (error != NULL) {
+                /* Cancelled loads were either superseded or the window is
+                 * going away, so self can't be touched
+                 */
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                        g_warning ("failed to load model: %s", error->message);
+                        gtk_window_set_title (GTK_WINDOW (self), _("Chips"));
+                }
+
+                return;
+        }
+
+        g_signal_handlers_disconnect_by_data (self->streaming_model, self);
+        gtk_window_set_title (GTK_WINDOW (self), _("Chips"));
+
+        g_set_object (&self->model, self->streaming_model);
+        self->vertices_available = chips_3d_model_get_number_of_vertices (self->model);
+        self->indices_available = chips_3d_model_get_number_of_indices (self->model);
+
+        g_clear_object (&self->model_init_cancellable);
+
+        watch_for_replacement (self);
+
+        if (!self->model_loaded) {
+                load_model_if_ready (self);
+                return;
+        }
+
+        chips_renderer_set_model_initialized (self->renderer);
+
+        /* The sphere the model was framed with was only an estimate, and
+         * now the depth range can be fit to the real one
+         */
+        get_model_bounding_sphere (self, self->model, &self->bounding_sphere);
+
+        gtk_gl_area_queue_render (GTK_GL_AREA (self->gl_area));
+}
+
 static void
-on_3d_model_initialized (GAsyncInitable  *initable,
-                         GAsyncResult    *result,
-                         ChipsMainWindow *self)
+on_3d_model_initialized (ChipsApplication *application,
+                         GAsyncResult     *result,
+                         ChipsMainWindow  *self)
 {
-        GObject *model;
         g_autoptr (GError) error = NULL;
 
-        model = g_async_initable_new_finish (initable, result, &error);
+        chips_application_wait_for_model_finish (application, result, &error);
+        finish_loading_model (self, error);
+}
+
+static void
+on_cube_initialized (Chips3DModel    *model,
+                     GAsyncResult    *result,
+                     ChipsMainWindow *self)
+{
+        g_autoptr (GError) error = NULL;
 
-        if (model == NULL) {
-                g_warning ("failed to load model: %s", error->message);
+        g_async_initable_init_finish (G_ASYNC_INITABLE (model), result, &error);
+        finish_loading_model (self, error);
+}
+
+/* Only the index is read up front.  The nodes stream in as the view
+ * needs them.
+ */
+static void
+open_octree (ChipsMainWindow *self,
+             const char      *directory)
+{
+        g_autoptr (GError) error = NULL;
+
+        self->octree = chips_octree_open (directory, &error);
+
+        if (self->octree == NULL) {
+                g_warning ("failed to open octree: %s", error->message);
                 return;
         }
 
-        self->model = CHIPS_3D_MODEL (model);
+        load_octree_if_ready (self);
+}
 
+static void
+on_point_cloud_initialized (ChipsPointCloud *point_cloud,
+                            GAsyncResult    *result,
+                            ChipsMainWindow *self)
+{
+        g_autoptr (GError) error = NULL;
+
+        if (!g_async_initable_init_finish (G_ASYNC_INITABLE (point_cloud), result, &error)) {
+                /* Cancelled loads mean the window is going away, so
+                 * self can't be touched
+                 */
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                        g_warning ("failed to load point cloud: %s", error->message);
+                        gtk_window_set_title (GTK_WINDOW (self), _("Chips"));
+                }
+
+                return;
+        }
+
+        gtk_window_set_title (GTK_WINDOW (self), _("Chips"));
         g_clear_object (&self->model_init_cancellable);
 
-        load_model_if_ready (self);
+        g_set_object (&self->point_cloud, point_cloud);
+        load_point_cloud_if_ready (self);
+}
+
+/* Point clouds aren't shared between windows like models, since
+ * they're usually too big to have open more than once anyway
+ */
+static void
+start_loading_point_cloud (ChipsMainWindow *self)
+{
+        g_autoptr (ChipsPointCloud) point_cloud = NULL;
+
+        self->model_init_cancellable = g_cancellable_new ();
+
+        point_cloud = g_object_new (CHIPS_TYPE_POINT_CLOUD,
+                                    "file", self->file,
+                                    NULL);
+
+        gtk_window_set_title (GTK_WINDOW (self), _("Chips — Loading"));
+
+        g_async_initable_init_async (G_ASYNC_INITABLE (point_cloud),
+                                     G_PRIORITY_DEFAULT,
+                                     self->model_init_cancellable,
+                                     (GAsyncReadyCallback)
+                                     on_point_cloud_initialized,
+                                     self);
+}
+
+/* The model comes from the application, so a file that's open in
+ * another window isn't loaded again, and this window just picks up
+ * wherever that load has gotten to
+ */
+static void
+start_loading_model (ChipsMainWindow *self)
+{
+        ChipsApplication *application;
+        g_autoptr (Chips3DModel) model = NULL;
+        g_autofree char *filename = NULL;
+
+        if (self->model_init_cancellable != NULL) {
+                g_cancellable_cancel (self->model_init_cancellable);
+                g_clear_object (&self->model_init_cancellable);
+        }
+
+        if (self->file != NULL) {
+                filename = g_file_get_path (self->file);
+        }
+
+        if (filename != NULL && chips_octree_is_octree (filename)) {
+                open_octree (self, filename);
+                return;
+        }
+
+        if (filename != NULL && g_str_has_suffix (filename, CHIPS_POINT_CLOUD_SUFFIX)) {
+                start_loading_point_cloud (self);
+                return;
+        }
+
+        self->model_init_cancellable = g_cancellable_new ();
+
+        application = CHIPS_APPLICATION (g_application_get_default ());
+
+        /* The cube isn't in any file, so it isn't shared */
+        if (self->file == NULL) {
+                model = g_object_new (CHIPS_TYPE_3D_MODEL, NULL);
+        } else {
+                model = chips_application_open_model (application, self->file);
+        }
+
+        g_set_object (&self->streaming_model, model);
+        chips_3d_model_get_geometry_available (model,
+                                               &self->vertices_available,
+                                               &self->indices_available);
+
+        g_signal_connect_object (model,
+                                 "geometry-available",
+                                 G_CALLBACK (on_3d_model_geometry_available),
+                                 self,
+                                 G_CONNECT_SWAPPED);
+
+        g_signal_connect_object (model,
+                                 "progress",
+                                 G_CALLBACK (on_3d_model_progress),
+                                 self,
+                                 G_CONNECT_SWAPPED);
+
+        if (self->file == NULL) {
+                g_async_initable_init_async (G_ASYNC_INITABLE (model),
+                                             G_PRIORITY_DEFAULT,
+                                             self->model_init_cancellable,
+                                             (GAsyncReadyCallback)
+                                             on_cube_initialized,
+                                             self);
+                return;
+        }
+
+        chips_application_wait_for_model (application,
+                                          model,
+                                          self->model_init_cancellable,
+                                          (GAsyncReadyCallback)
+                                          on_3d_model_initialized,
+                                          self);
 }
 
 static void
 chips_main_window_init (ChipsMainWindow *self)
 {
+        GtkWidget *overlay;
+
         gtk_window_set_title (GTK_WINDOW (self), _("Chips"));
         gtk_window_set_default_size (GTK_WINDOW (self), 800, 600);
 
@@ -412,16 +1033,56 @@ chips_main_window_init (ChipsMainWindow *self)
                                   G_CALLBACK (on_gl_area_render),
                                   self);
 
-        gtk_container_add (GTK_CONTAINER (self), self->gl_area);
+        overlay = gtk_overlay_new ();
+        gtk_container_add (GTK_CONTAINER (overlay), self->gl_area);
+        gtk_container_add (GTK_CONTAINER (self), overlay);
+
+        if (chips_application_get_profiler_overlay (CHIPS_APPLICATION (g_application_get_default ()))) {
+                self->profiler_label = gtk_label_new (NULL);
+                gtk_widget_set_halign (self->profiler_label, GTK_ALIGN_START);
+                gtk_widget_set_valign (self->profiler_label, GTK_ALIGN_START);
+                gtk_widget_set_margin_start (self->profiler_label, 6);
+                gtk_widget_set_margin_top (self->profiler_label, 6);
+                gtk_overlay_add_overlay (GTK_OVERLAY (overlay), self->profiler_label);
+                gtk_widget_show (self->profiler_label);
+
+                self->profiler_label_update_id = g_timeout_add (PROFILER_LABEL_UPDATE_INTERVAL,
+                                                                (GSourceFunc) update_profiler_label,
+                                                                self);
+        }
 
         gtk_widget_show (self->gl_area);
+        gtk_widget_show (overlay);
+}
 
-        self->model_init_cancellable = g_cancellable_new ();
-        g_async_initable_new_async (CHIPS_TYPE_3D_MODEL,
-                                    G_PRIORITY_DEFAULT,
-                                    self->model_init_cancellable,
-                                    (GAsyncReadyCallback)
-                                    on_3d_model_initialized,
-                                    self,
-                                    NULL);
+/* Shows a copy of the model at each of the transforms, all drawn
+ * together, for laying out arrays of the same part
+ */
+void
+chips_main_window_set_instances (ChipsMainWindow         *self,
+                                 const graphene_matrix_t *transforms,
+                                 size_t                   number_of_transforms)
+{
+        g_return_if_fail (CHIPS_IS_MAIN_WINDOW (self));
+        g_return_if_fail (number_of_transforms > 0);
+
+        g_clear_pointer (&self->instance_transforms, g_array_unref);
+        self->instance_transforms = g_array_sized_new (FALSE, FALSE, sizeof (graphene_matrix_t), number_of_transforms);
+        g_array_append_vals (self->instance_transforms, transforms, number_of_transforms);
+
+        if (self->renderer == NULL) {
+                return;
+        }
+
+        gtk_gl_area_make_current (GTK_GL_AREA (self->gl_area));
+        chips_renderer_set_instances (self->renderer, transforms, number_of_transforms);
+
+        if (self->model_loaded) {
+                graphene_sphere_t sphere;
+
+                get_model_bounding_sphere (self, self->streaming_model, &sphere);
+                frame_bounding_sphere (self, &sphere);
+        }
+
+        gtk_gl_area_queue_render (GTK_GL_AREA (self->gl_area));
 }
@@ -21,4 +21,8 @@
 #define CHIPS_TYPE_MAIN_WINDOW chips_main_window_get_type ()
 G_DECLARE_FINAL_TYPE (ChipsMainWindow, chips_main_window, CHIPS, MAIN_WINDOW, GtkWindow);
 
+void chips_main_window_set_instances (ChipsMainWindow         *self,
+                                      const graphene_matrix_t *transforms,
+                                      size_t                   number_of_transforms);
+
 #endif /* CHIPS_MAIN_WINDOW_H */
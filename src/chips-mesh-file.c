@@ -0,0 +1,282 @@
+/* chips-mesh-file.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chips-mesh-file.h"
+
+G_STATIC_ASSERT (sizeof (ChipsMeshFileHeader) == 64);
+G_STATIC_ASSERT (sizeof (ChipsMeshFileSection) == 24);
+
+#define ALIGN_OFFSET(offset) ((((offset) + CHIPS_MESH_FILE_SECTION_ALIGNMENT - 1) / CHIPS_MESH_FILE_SECTION_ALIGNMENT) * CHIPS_MESH_FILE_SECTION_ALIGNMENT)
+
+struct _ChipsMeshFile
+{
+        GMappedFile               *mapped_file;
+        GBytes                    *bytes;
+        const ChipsMeshFileHeader *header;
+        const ChipsMeshFileSection *sections;
+};
+
+static gboolean
+validate_mesh_file (ChipsMeshFile  *mesh_file,
+                    const char     *filename,
+                    GError        **error)
+{
+        const char *data;
+        size_t size;
+        size_t table_size;
+        guint32 i;
+
+        data = g_bytes_get_data (mesh_file->bytes, &size);
+
+        if (size < sizeof (ChipsMeshFileHeader)) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "'%s' is too short to be a mesh file", filename);
+                return FALSE;
+        }
+
+        mesh_file->header = (const ChipsMeshFileHeader *) data;
+
+        if (memcmp (mesh_file->header->magic, CHIPS_MESH_FILE_MAGIC, sizeof (mesh_file->header->magic)) != 0) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "'%s' is not a mesh file", filename);
+                return FALSE;
+        }
+
+        if (mesh_file->header->version != CHIPS_MESH_FILE_VERSION) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                             "'%s' has unsupported mesh file version %u",
+                             filename, mesh_file->header->version);
+                return FALSE;
+        }
+
+        table_size = (size_t) mesh_file->header->number_of_sections * sizeof (ChipsMeshFileSection);
+
+        if (table_size > size - sizeof (ChipsMeshFileHeader)) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "'%s' has a truncated section table", filename);
+                return FALSE;
+        }
+
+        mesh_file->sections = (const ChipsMeshFileSection *) (data + sizeof (ChipsMeshFileHeader));
+
+        for (i = 0; i < mesh_file->header->number_of_sections; i++) {
+                const ChipsMeshFileSection *section = &mesh_file->sections[i];
+
+                if (section->offset % CHIPS_MESH_FILE_SECTION_ALIGNMENT != 0 ||
+                    section->offset > size ||
+                    section->size > size - section->offset) {
+                        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                                     "'%s' has a malformed section %u", filename, i);
+                        return FALSE;
+                }
+        }
+
+        return TRUE;
+}
+
+ChipsMeshFile *
+chips_mesh_file_open (const char  *filename,
+                      GError     **error)
+{
+        g_autoptr (ChipsMeshFile) mesh_file = NULL;
+
+        /* Sections are handed out as pointers into the mapping, so the
+         * on-disk byte order has to be the native one
+         */
+#if G_BYTE_ORDER != G_LITTLE_ENDIAN
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                     "mesh files can only be loaded on little endian machines");
+        return NULL;
+#endif
+
+        mesh_file = g_slice_new0 (ChipsMeshFile);
+        mesh_file->mapped_file = g_mapped_file_new (filename, FALSE, error);
+
+        if (mesh_file->mapped_file == NULL) {
+                return NULL;
+        }
+
+        mesh_file->bytes = g_mapped_file_get_bytes (mesh_file->mapped_file);
+
+        if (!validate_mesh_file (mesh_file, filename, error)) {
+                return NULL;
+        }
+
+        return g_steal_pointer (&mesh_file);
+}
+
+void
+chips_mesh_file_free (ChipsMeshFile *mesh_file)
+{
+        g_clear_pointer (&mesh_file->bytes, g_bytes_unref);
+        g_clear_pointer (&mesh_file->mapped_file, g_mapped_file_unref);
+        g_slice_free (ChipsMeshFile, mesh_file);
+}
+
+const ChipsMeshFileHeader *
+chips_mesh_file_get_header (ChipsMeshFile *mesh_file)
+{
+        return mesh_file->header;
+}
+
+size_t
+chips_mesh_file_get_size (ChipsMeshFile *mesh_file)
+{
+        return g_bytes_get_size (mesh_file->bytes);
+}
+
+GBytes *
+chips_mesh_file_get_section (ChipsMeshFile        *mesh_file,
+                             ChipsMeshSectionType  type)
+{
+        guint32 i;
+
+        for (i = 0; i < mesh_file->header->number_of_sections; i++) {
+                const ChipsMeshFileSection *section = &mesh_file->sections[i];
+
+                if (section->type != type) {
+                        continue;
+                }
+
+                /* Shares the mapping, doesn't copy */
+                return g_bytes_new_from_bytes (mesh_file->bytes,
+                                               section->offset,
+                                               section->size);
+        }
+
+        return NULL;
+}
+
+static gboolean
+write_padding (GOutputStream  *stream,
+               size_t          size,
+               GCancellable   *cancellable,
+               GError        **error)
+{
+        static const guint8 zeroes[CHIPS_MESH_FILE_SECTION_ALIGNMENT] = { 0 };
+
+        if (size == 0) {
+                return TRUE;
+        }
+
+        return g_output_stream_write_all (stream, zeroes, size, NULL, cancellable, error);
+}
+
+static gboolean
+write_sections (GOutputStream              *stream,
+                const ChipsMeshFileHeader  *header,
+                const ChipsMeshFileSection *table,
+                const ChipsMeshSection     *sections,
+                size_t                      number_of_sections,
+                GCancellable               *cancellable,
+                GError                    **error)
+{
+        guint64 offset;
+        size_t i;
+
+        if (!g_output_stream_write_all (stream, header, sizeof (ChipsMeshFileHeader), NULL, cancellable, error)) {
+                return FALSE;
+        }
+
+        if (!g_output_stream_write_all (stream, table, number_of_sections * sizeof (ChipsMeshFileSection), NULL, cancellable, error)) {
+                return FALSE;
+        }
+
+        offset = sizeof (ChipsMeshFileHeader) + number_of_sections * sizeof (ChipsMeshFileSection);
+
+        for (i = 0; i < number_of_sections; i++) {
+                const void *data;
+                size_t size;
+
+                if (!write_padding (stream, table[i].offset - offset, cancellable, error)) {
+                        return FALSE;
+                }
+
+                data = g_bytes_get_data (sections[i].data, &size);
+
+                if (!g_output_stream_write_all (stream, data, size, NULL, cancellable, error)) {
+                        return FALSE;
+                }
+
+                offset = table[i].offset + size;
+        }
+
+        return TRUE;
+}
+
+gboolean
+chips_mesh_file_save (const char                 *filename,
+                      const ChipsMeshFileHeader  *header,
+                      const ChipsMeshSection     *sections,
+                      size_t                      number_of_sections,
+                      GCancellable               *cancellable,
+                      GError                    **error)
+{
+        g_autoptr (GFile) file = NULL;
+        g_autoptr (GFileOutputStream) stream = NULL;
+        g_autofree ChipsMeshFileSection *table = NULL;
+        ChipsMeshFileHeader file_header;
+        guint64 offset;
+        size_t i;
+
+        file_header = *header;
+        memcpy (file_header.magic, CHIPS_MESH_FILE_MAGIC, sizeof (file_header.magic));
+        file_header.version = CHIPS_MESH_FILE_VERSION;
+        file_header.number_of_sections = number_of_sections;
+
+        table = g_new0 (ChipsMeshFileSection, number_of_sections);
+        offset = ALIGN_OFFSET (sizeof (ChipsMeshFileHeader) + number_of_sections * sizeof (ChipsMeshFileSection));
+
+        for (i = 0; i < number_of_sections; i++) {
+                table[i].type = sections[i].type;
+                table[i].offset = offset;
+                table[i].size = g_bytes_get_size (sections[i].data);
+
+                offset = ALIGN_OFFSET (offset + table[i].size);
+        }
+
+        file = g_file_new_for_path (filename);
+
+        /* Written next to the destination and renamed over it on close,
+         * so readers that have the old file mapped are unaffected
+         */
+        stream = g_file_replace (file, NULL, FALSE, G_FILE_CREATE_REPLACE_DESTINATION, cancellable, error);
+
+        if (stream == NULL) {
+                return FALSE;
+        }
+
+        if (!write_sections (G_OUTPUT_STREAM (stream), &file_header, table, sections, number_of_sections, cancellable, error)) {
+                g_autoptr (GCancellable) abandon_cancellable = NULL;
+
+                /* Closing with a cancelled cancellable discards the
+                 * temporary file instead of moving it into place
+                 */
+                abandon_cancellable = g_cancellable_new ();
+                g_cancellable_cancel (abandon_cancellable);
+                g_output_stream_close (G_OUTPUT_STREAM (stream), abandon_cancellable, NULL);
+                return FALSE;
+        }
+
+        return g_output_stream_close (G_OUTPUT_STREAM (stream), cancellable, error);
+}
+
+gboolean
+chips_mesh_file_is_mesh_file (const char *filename)
+{
+        return g_str_has_suffix (filename, CHIPS_MESH_FILE_SUFFIX);
+}
@@ -0,0 +1,95 @@
+/* chips-mesh-file.h
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CHIPS_MESH_FILE_H
+#define CHIPS_MESH_FILE_H
+
+#include "chips.h"
+
+/* Native on-disk mesh format.  Everything is little endian.  The file
+ * starts with a ChipsMeshFileHeader, followed by a table of
+ * ChipsMeshFileSection entries.  Each section's payload starts on a
+ * CHIPS_MESH_FILE_SECTION_ALIGNMENT boundary, so once the file is mapped
+ * the payloads can be handed to GL as-is.
+ */
+#define CHIPS_MESH_FILE_MAGIC "CHIPSMSH"
+#define CHIPS_MESH_FILE_VERSION 1
+#define CHIPS_MESH_FILE_SECTION_ALIGNMENT 4096
+#define CHIPS_MESH_FILE_SUFFIX ".chipsmesh"
+
+typedef enum
+{
+        CHIPS_MESH_SECTION_VERTICES = 1,
+        CHIPS_MESH_SECTION_VERTEX_ARRANGEMENT = 2,
+        CHIPS_MESH_SECTION_VERTEX_FORMAT = 3,
+        CHIPS_MESH_SECTION_LEVELS_OF_DETAIL = 4,
+        CHIPS_MESH_SECTION_CLUSTERS = 5,
+} ChipsMeshSectionType;
+
+typedef struct
+{
+        char    magic[8];
+        guint32 version;
+        guint32 number_of_sections;
+
+        guint64 number_of_vertices;
+        guint64 number_of_indices;
+
+        guint32 vertex_stride;
+        guint32 index_size;
+
+        /* All zeros in files written before bounds were recorded */
+        float   bounds_minimum[3];
+        float   bounds_maximum[3];
+} ChipsMeshFileHeader;
+
+typedef struct
+{
+        guint32 type;
+        guint32 flags;
+        guint64 offset;
+        guint64 size;
+} ChipsMeshFileSection;
+
+typedef struct
+{
+        ChipsMeshSectionType  type;
+        GBytes               *data;
+} ChipsMeshSection;
+
+typedef struct _ChipsMeshFile ChipsMeshFile;
+
+ChipsMeshFile             *chips_mesh_file_open        (const char                 *filename,
+                                                        GError                    **error);
+void                       chips_mesh_file_free        (ChipsMeshFile              *mesh_file);
+const ChipsMeshFileHeader *chips_mesh_file_get_header  (ChipsMeshFile              *mesh_file);
+GBytes                    *chips_mesh_file_get_section (ChipsMeshFile              *mesh_file,
+                                                        ChipsMeshSectionType        type);
+size_t                     chips_mesh_file_get_size    (ChipsMeshFile              *mesh_file);
+
+gboolean                   chips_mesh_file_save        (const char                 *filename,
+                                                        const ChipsMeshFileHeader  *header,
+                                                        const ChipsMeshSection     *sections,
+                                                        size_t                      number_of_sections,
+                                                        GCancellable               *cancellable,
+                                                        GError                    **error);
+
+gboolean                   chips_mesh_file_is_mesh_file (const char                *filename);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ChipsMeshFile, chips_mesh_file_free);
+
+#endif /* CHIPS_MESH_FILE_H */
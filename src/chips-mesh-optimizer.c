@@ -0,0 +1,1184 @@
+/* chips-mesh-optimizer.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chips-mesh-optimizer.h"
+#include "chips-parallel.h"
+
+#define INDICES_PER_CHUNK 262144
+#define VERTICES_PER_CHUNK 65536
+#define CLUSTERS_PER_CHUNK 256
+#define TRIANGLES_PER_CHUNK 65536
+#define VERTICES_PER_CANCELLATION_CHECK 65536
+#define TRIANGLES_PER_CANCELLATION_CHECK 65536
+#define EMPTY_SLOT G_MAXUINT32
+#define NO_VERTEX G_MAXSIZE
+
+typedef struct
+{
+        gint64 x, y, z;
+} VertexKey;
+
+typedef struct
+{
+        guint32       *indices;
+        const guint32 *remap;
+} RemapJob;
+
+typedef struct
+{
+        const guint32 *indices;
+        guint16       *compact_indices;
+} CompactJob;
+
+typedef struct
+{
+        size_t index;
+        double centroid[3];
+        double normal[3];
+        double area;
+        double sort_key;
+} ClusterInfo;
+
+typedef struct
+{
+        const float   *positions;
+        const guint32 *indices;
+        GArray        *cluster_starts;
+        ClusterInfo   *clusters;
+} OverdrawJob;
+
+typedef struct
+{
+        const float   *positions;
+        float         *new_positions;
+        const guint32 *remap;
+} FetchJob;
+
+typedef struct
+{
+        size_t first_index;
+        size_t number_of_indices;
+} IndexRange;
+
+typedef struct
+{
+        const float      *positions;
+        guint32          *indices;
+        const IndexRange *ranges;
+        size_t            cache_size;
+} TriangleOrderJob;
+
+typedef struct
+{
+        const float *positions;
+        guint32     *all_indices;
+        guint32     *indices;
+        guint64     *keys;
+        GArray      *clusters;
+        float        minimum[3];
+        float        extent[3];
+} ClusterJob;
+
+static inline guint32
+get_index (gconstpointer indices,
+           size_t        index_size,
+           size_t        i)
+{
+        if (index_size == sizeof (guint16)) {
+                return ((const guint16 *) indices)[i];
+        }
+
+        return ((const guint32 *) indices)[i];
+}
+
+static inline guint64
+mix_bits (guint64 bits)
+{
+        bits ^= bits >> 33;
+        bits *= G_GUINT64_CONSTANT (0xff51afd7ed558ccd);
+        bits ^= bits >> 33;
+        bits *= G_GUINT64_CONSTANT (0xc4ceb9fe1a85ec53);
+        bits ^= bits >> 33;
+
+        return bits;
+}
+
+static inline gint64
+get_coordinate_key (float value,
+                    float inverse_epsilon)
+{
+        guint32 bits;
+
+        if (inverse_epsilon > 0.0f) {
+                double cell;
+
+                cell = floor ((double) value * inverse_epsilon);
+
+                if (isnan (cell)) {
+                        return 0;
+                }
+
+                return (gint64) CLAMP (cell, -9.0e18, 9.0e18);
+        }
+
+        /* Compare exactly, except that -0 and +0 are the same place */
+        if (value == 0.0f) {
+                value = 0.0f;
+        }
+
+        memcpy (&bits, &value, sizeof (bits));
+
+        return bits;
+}
+
+static inline void
+get_vertex_key (const float *position,
+                float        inverse_epsilon,
+                VertexKey   *key)
+{
+        key->x = get_coordinate_key (position[0], inverse_epsilon);
+        key->y = get_coordinate_key (position[1], inverse_epsilon);
+        key->z = get_coordinate_key (position[2], inverse_epsilon);
+}
+
+static inline guint64
+hash_vertex_key (const VertexKey *key)
+{
+        return mix_bits ((guint64) key->x ^ mix_bits ((guint64) key->y ^ mix_bits ((guint64) key->z)));
+}
+
+static void
+remap_index_range (size_t    start,
+                   size_t    end,
+                   RemapJob *job)
+{
+        size_t i;
+
+        for (i = start; i < end; i++) {
+                job->indices[i] = job->remap[job->indices[i]];
+        }
+}
+
+/* Merges vertices that share a position (or, with a non-zero epsilon,
+ * fall in the same epsilon sized grid cell) using an open addressing
+ * hash table, then rewrites the index stream to refer to the survivors.
+ *
+ * Unique vertices are compacted toward the front of the vertex buffer
+ * in place.  That's safe because the nth unique vertex is never found
+ * after the nth vertex, and the table holds unique ids rather than
+ * original vertex numbers, so lookups only ever read compacted entries.
+ */
+gboolean
+chips_mesh_weld_vertices (ChipsImportedMesh  *mesh,
+                          float               epsilon,
+                          GCancellable       *cancellable,
+                          GError            **error)
+{
+        g_autofree guint32 *slots = NULL;
+        g_autofree guint32 *remap = NULL;
+        float *positions;
+        guint32 *indices;
+        size_t positions_size, indices_size;
+        size_t number_of_slots;
+        size_t number_of_unique_vertices = 0;
+        size_t slot_mask;
+        float inverse_epsilon;
+        RemapJob job;
+        size_t i;
+
+        g_return_val_if_fail (mesh->index_size == sizeof (guint32), FALSE);
+
+        if (mesh->number_of_vertices == 0) {
+                return TRUE;
+        }
+
+        inverse_epsilon = epsilon > 0.0f? 1.0f / epsilon : 0.0f;
+
+        number_of_slots = 1;
+        while (number_of_slots < mesh->number_of_vertices * 2) {
+                number_of_slots *= 2;
+        }
+        slot_mask = number_of_slots - 1;
+
+        slots = g_new (guint32, number_of_slots);
+        memset (slots, 0xff, number_of_slots * sizeof (guint32));
+        remap = g_new (guint32, mesh->number_of_vertices);
+
+        positions = g_bytes_unref_to_data (g_steal_pointer (&mesh->vertex_buffer), &positions_size);
+
+        for (i = 0; i < mesh->number_of_vertices; i++) {
+                VertexKey key;
+                size_t slot;
+
+                if (i % VERTICES_PER_CANCELLATION_CHECK == 0 &&
+                    g_cancellable_set_error_if_cancelled (cancellable, error)) {
+                        mesh->vertex_buffer = g_bytes_new_take (positions, positions_size);
+                        return FALSE;
+                }
+
+                get_vertex_key (positions + i * 3, inverse_epsilon, &key);
+                slot = hash_vertex_key (&key) & slot_mask;
+
+                while (slots[slot] != EMPTY_SLOT) {
+                        VertexKey existing_key;
+
+                        get_vertex_key (positions + (size_t) slots[slot] * 3, inverse_epsilon, &existing_key);
+
+                        if (existing_key.x == key.x && existing_key.y == key.y && existing_key.z == key.z) {
+                                break;
+                        }
+
+                        slot = (slot + 1) & slot_mask;
+                }
+
+                if (slots[slot] != EMPTY_SLOT) {
+                        remap[i] = slots[slot];
+                        continue;
+                }
+
+                if (number_of_unique_vertices != i) {
+                        memcpy (positions + number_of_unique_vertices * 3,
+                                positions + i * 3,
+                                3 * sizeof (float));
+                }
+
+                slots[slot] = number_of_unique_vertices;
+                remap[i] = number_of_unique_vertices;
+                number_of_unique_vertices++;
+        }
+
+        g_clear_pointer (&slots, g_free);
+
+        positions = g_realloc (positions, number_of_unique_vertices * 3 * sizeof (float));
+        mesh->vertex_buffer = g_bytes_new_take (positions, number_of_unique_vertices * 3 * sizeof (float));
+        mesh->number_of_vertices = number_of_unique_vertices;
+
+        indices = g_bytes_unref_to_data (g_steal_pointer (&mesh->vertex_arrangement), &indices_size);
+        mesh->vertex_arrangement = g_bytes_new_take (indices, indices_size);
+
+        job.indices = indices;
+        job.remap = remap;
+
+        return chips_parallel_for (mesh->number_of_indices,
+                                   INDICES_PER_CHUNK,
+                                   (ChipsParallelFunc) remap_index_range,
+                                   &job,
+                                   cancellable,
+                                   error);
+}
+
+/* Tipsify (Sander, Nehab and Barczak, "Fast Triangle Reordering for
+ * Vertex Locality and Reduced Overdraw").  Triangles are emitted as fans
+ * around a focus vertex, and the next focus is picked from the vertices
+ * just emitted, preferring ones that will still be in the cache once
+ * their remaining triangles are emitted.  When no such vertex is left
+ * the walk jumps elsewhere in the mesh, and each of those jumps starts a
+ * new cluster for the overdraw pass.
+ */
+static size_t
+get_next_focus_vertex (const GArray  *candidates,
+                       const guint32 *live_triangle_counts,
+                       const guint32 *cache_times,
+                       guint32        timestamp,
+                       size_t         cache_size)
+{
+        size_t best_vertex = NO_VERTEX;
+        gint64 best_priority = -1;
+        size_t i;
+
+        for (i = 0; i < candidates->len; i++) {
+                guint32 vertex = g_array_index (candidates, guint32, i);
+                gint64 priority = 0;
+                guint32 age;
+
+                if (live_triangle_counts[vertex] == 0) {
+                        continue;
+                }
+
+                age = timestamp - cache_times[vertex];
+
+                if (age + 2 * (gint64) live_triangle_counts[vertex] <= (gint64) cache_size) {
+                        priority = age;
+                }
+
+                if (priority > best_priority) {
+                        best_priority = priority;
+                        best_vertex = vertex;
+                }
+        }
+
+        return best_vertex;
+}
+
+static size_t
+skip_dead_end (GArray        *dead_end,
+               const guint32 *live_triangle_counts,
+               size_t         number_of_vertices,
+               size_t        *scan_cursor)
+{
+        while (dead_end->len > 0) {
+                guint32 vertex = g_array_index (dead_end, guint32, dead_end->len - 1);
+
+                g_array_set_size (dead_end, dead_end->len - 1);
+
+                if (live_triangle_counts[vertex] > 0) {
+                        return vertex;
+                }
+        }
+
+        while (*scan_cursor < number_of_vertices) {
+                if (live_triangle_counts[*scan_cursor] > 0) {
+                        return *scan_cursor;
+                }
+
+                (*scan_cursor)++;
+        }
+
+        return NO_VERTEX;
+}
+
+static gboolean
+order_triangles_for_cache (const guint32  *indices,
+                           size_t          number_of_triangles,
+                           size_t          number_of_vertices,
+                           size_t          cache_size,
+                           guint32        *ordered_indices,
+                           GArray         *cluster_starts,
+                           GCancellable   *cancellable,
+                           GError        **error)
+{
+        g_autofree guint32 *live_triangle_counts = NULL;
+        g_autofree size_t *adjacency_offsets = NULL;
+        g_autofree guint32 *adjacency = NULL;
+        g_autofree guint32 *cache_times = NULL;
+        g_autofree guint8 *emitted = NULL;
+        g_autoptr (GArray) dead_end = NULL;
+        g_autoptr (GArray) candidates = NULL;
+        size_t number_of_emitted_triangles = 0;
+        size_t scan_cursor = 0;
+        size_t vertex;
+        guint32 timestamp;
+        size_t i;
+
+        live_triangle_counts = g_new0 (guint32, number_of_vertices);
+        adjacency_offsets = g_new (size_t, number_of_vertices + 1);
+        adjacency = g_new (guint32, number_of_triangles * 3);
+        cache_times = g_new0 (guint32, number_of_vertices);
+        emitted = g_new0 (guint8, number_of_triangles);
+        dead_end = g_array_new (FALSE, FALSE, sizeof (guint32));
+        candidates = g_array_new (FALSE, FALSE, sizeof (guint32));
+
+        for (i = 0; i < number_of_triangles * 3; i++) {
+                live_triangle_counts[indices[i]]++;
+        }
+
+        adjacency_offsets[0] = 0;
+        for (i = 0; i < number_of_vertices; i++) {
+                adjacency_offsets[i + 1] = adjacency_offsets[i] + live_triangle_counts[i];
+        }
+
+        for (i = 0; i < number_of_triangles * 3; i++) {
+                guint32 index = indices[i];
+                size_t fill = adjacency_offsets[index + 1] - live_triangle_counts[index];
+
+                adjacency[fill] = i / 3;
+                live_triangle_counts[index]--;
+        }
+
+        for (i = 0; i < number_of_triangles * 3; i++) {
+                live_triangle_counts[indices[i]]++;
+        }
+
+        timestamp = cache_size + 1;
+        vertex = skip_dead_end (dead_end, live_triangle_counts, number_of_vertices, &scan_cursor);
+
+        if (vertex != NO_VERTEX) {
+                g_array_append_val (cluster_starts, number_of_emitted_triangles);
+        }
+
+        while (vertex != NO_VERTEX) {
+                g_array_set_size (candidates, 0);
+
+                for (i = adjacency_offsets[vertex]; i < adjacency_offsets[vertex + 1]; i++) {
+                        guint32 triangle = adjacency[i];
+                        size_t j;
+
+                        if (emitted[triangle]) {
+                                continue;
+                        }
+
+                        for (j = 0; j < 3; j++) {
+                                guint32 corner = indices[(size_t) triangle * 3 + j];
+
+                                ordered_indices[number_of_emitted_triangles * 3 + j] = corner;
+                                g_array_append_val (dead_end, corner);
+                                g_array_append_val (candidates, corner);
+                                live_triangle_counts[corner]--;
+
+                                if (timestamp - cache_times[corner] > cache_size) {
+                                        cache_times[corner] = timestamp;
+                                        timestamp++;
+                                }
+                        }
+
+                        emitted[triangle] = TRUE;
+                        number_of_emitted_triangles++;
+
+                        if (number_of_emitted_triangles % TRIANGLES_PER_CANCELLATION_CHECK == 0 &&
+                            g_cancellable_set_error_if_cancelled (cancellable, error)) {
+                                return FALSE;
+                        }
+                }
+
+                vertex = get_next_focus_vertex (candidates, live_triangle_counts, cache_times, timestamp, cache_size);
+
+                if (vertex == NO_VERTEX) {
+                        vertex = skip_dead_end (dead_end, live_triangle_counts, number_of_vertices, &scan_cursor);
+
+                        if (vertex != NO_VERTEX) {
+                                g_array_append_val (cluster_starts, number_of_emitted_triangles);
+                        }
+                }
+        }
+
+        g_array_append_val (cluster_starts, number_of_emitted_triangles);
+
+        return TRUE;
+}
+
+static void
+measure_cluster_range (size_t       start,
+                       size_t       end,
+                       OverdrawJob *job)
+{
+        size_t i, j;
+
+        for (i = start; i < end; i++) {
+                size_t first_triangle = g_array_index (job->cluster_starts, size_t, i);
+                size_t last_triangle = g_array_index (job->cluster_starts, size_t, i + 1);
+                ClusterInfo *cluster = &job->clusters[i];
+
+                memset (cluster, 0, sizeof (*cluster));
+                cluster->index = i;
+
+                for (j = first_triangle; j < last_triangle; j++) {
+                        const float *a = job->positions + (size_t) job->indices[j * 3] * 3;
+                        const float *b = job->positions + (size_t) job->indices[j * 3 + 1] * 3;
+                        const float *c = job->positions + (size_t) job->indices[j * 3 + 2] * 3;
+                        double normal[3], area;
+                        size_t k;
+
+                        normal[0] = (double) (b[1] - a[1]) * (c[2] - a[2]) - (double) (b[2] - a[2]) * (c[1] - a[1]);
+                        normal[1] = (double) (b[2] - a[2]) * (c[0] - a[0]) - (double) (b[0] - a[0]) * (c[2] - a[2]);
+                        normal[2] = (double) (b[0] - a[0]) * (c[1] - a[1]) - (double) (b[1] - a[1]) * (c[0] - a[0]);
+                        area = sqrt (normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+
+                        for (k = 0; k < 3; k++) {
+                                cluster->centroid[k] += area * (a[k] + b[k] + c[k]) / 3.0;
+                                cluster->normal[k] += normal[k];
+                        }
+                        cluster->area += area;
+                }
+        }
+}
+
+static int
+compare_clusters (const ClusterInfo *a,
+                  const ClusterInfo *b)
+{
+        if (a->sort_key != b->sort_key) {
+                return a->sort_key > b->sort_key? -1 : 1;
+        }
+
+        return a->index < b->index? -1 : a->index > b->index;
+}
+
+/* Clusters that face away from the middle of the model are the ones
+ * most likely to be in front of the rest of it, so drawing them first
+ * lets depth testing reject more of what comes after.  The order within
+ * each cluster is left alone to keep the cache locality from above.
+ */
+static void
+order_clusters_for_overdraw (const float   *positions,
+                             const guint32 *indices,
+                             GArray        *cluster_starts,
+                             guint32       *ordered_indices)
+{
+        g_autofree ClusterInfo *clusters = NULL;
+        OverdrawJob job;
+        size_t number_of_clusters;
+        double mesh_centroid[3] = { 0.0, 0.0, 0.0 };
+        double mesh_area = 0.0;
+        size_t output_triangle = 0;
+        size_t i, k;
+
+        number_of_clusters = cluster_starts->len - 1;
+        clusters = g_new (ClusterInfo, number_of_clusters);
+
+        job.positions = positions;
+        job.indices = indices;
+        job.cluster_starts = cluster_starts;
+        job.clusters = clusters;
+
+        chips_parallel_for (number_of_clusters, CLUSTERS_PER_CHUNK,
+                            (ChipsParallelFunc) measure_cluster_range,
+                            &job,
+                            NULL,
+                            NULL);
+
+        for (i = 0; i < number_of_clusters; i++) {
+                for (k = 0; k < 3; k++) {
+                        mesh_centroid[k] += clusters[i].centroid[k];
+                }
+                mesh_area += clusters[i].area;
+        }
+
+        for (k = 0; k < 3; k++) {
+                mesh_centroid[k] = mesh_area > 0.0? mesh_centroid[k] / mesh_area : 0.0;
+        }
+
+        for (i = 0; i < number_of_clusters; i++) {
+                ClusterInfo *cluster = &clusters[i];
+                double length, sort_key = 0.0;
+
+                length = sqrt (cluster->normal[0] * cluster->normal[0] +
+                               cluster->normal[1] * cluster->normal[1] +
+                               cluster->normal[2] * cluster->normal[2]);
+
+                if (cluster->area > 0.0 && length > 0.0) {
+                        for (k = 0; k < 3; k++) {
+                                sort_key += (cluster->centroid[k] / cluster->area - mesh_centroid[k]) * cluster->normal[k];
+                        }
+                        sort_key /= length;
+                }
+
+                cluster->sort_key = sort_key;
+        }
+
+        qsort (clusters, number_of_clusters, sizeof (ClusterInfo),
+               (int (*) (const void *, const void *)) compare_clusters);
+
+        for (i = 0; i < number_of_clusters; i++) {
+                size_t first_triangle = g_array_index (cluster_starts, size_t, clusters[i].index);
+                size_t last_triangle = g_array_index (cluster_starts, size_t, clusters[i].index + 1);
+
+                memcpy (ordered_indices + output_triangle * 3,
+                        indices + first_triangle * 3,
+                        (last_triangle - first_triangle) * 3 * sizeof (guint32));
+                output_triangle += last_triangle - first_triangle;
+        }
+}
+
+static int
+compare_indices (const guint32 *a,
+                 const guint32 *b)
+{
+        return *a < *b? -1 : *a > *b;
+}
+
+/* Runs of the index buffer only use a small part of the vertex buffer,
+ * so the cache ordering works on vertex numbers local to the run to keep
+ * its bookkeeping proportional to the run's size
+ */
+static void
+optimize_triangle_range (const float *positions,
+                         guint32     *indices,
+                         size_t       number_of_indices,
+                         size_t       cache_size)
+{
+        g_autofree guint32 *unique_vertices = NULL;
+        g_autofree guint32 *local_indices = NULL;
+        g_autofree guint32 *cache_ordered_indices = NULL;
+        g_autoptr (GArray) cluster_starts = NULL;
+        size_t number_of_triangles, number_of_unique_vertices = 0;
+        size_t i;
+
+        number_of_triangles = number_of_indices / 3;
+
+        if (number_of_triangles == 0) {
+                return;
+        }
+
+        unique_vertices = g_memdup (indices, number_of_triangles * 3 * sizeof (guint32));
+        qsort (unique_vertices, number_of_triangles * 3, sizeof (guint32),
+               (int (*) (const void *, const void *)) compare_indices);
+
+        for (i = 0; i < number_of_triangles * 3; i++) {
+                if (number_of_unique_vertices == 0 ||
+                    unique_vertices[number_of_unique_vertices - 1] != unique_vertices[i]) {
+                        unique_vertices[number_of_unique_vertices++] = unique_vertices[i];
+                }
+        }
+
+        local_indices = g_new (guint32, number_of_triangles * 3);
+
+        for (i = 0; i < number_of_triangles * 3; i++) {
+                const guint32 *unique_vertex;
+
+                unique_vertex = bsearch (&indices[i], unique_vertices, number_of_unique_vertices, sizeof (guint32),
+                                         (int (*) (const void *, const void *)) compare_indices);
+                local_indices[i] = unique_vertex - unique_vertices;
+        }
+
+        cache_ordered_indices = g_new (guint32, number_of_triangles * 3);
+        cluster_starts = g_array_new (FALSE, FALSE, sizeof (size_t));
+
+        order_triangles_for_cache (local_indices,
+                                   number_of_triangles,
+                                   number_of_unique_vertices,
+                                   cache_size,
+                                   cache_ordered_indices,
+                                   cluster_starts,
+                                   NULL,
+                                   NULL);
+
+        for (i = 0; i < number_of_triangles * 3; i++) {
+                cache_ordered_indices[i] = unique_vertices[cache_ordered_indices[i]];
+        }
+
+        order_clusters_for_overdraw (positions,
+                                     cache_ordered_indices,
+                                     cluster_starts,
+                                     indices);
+}
+
+static void
+optimize_triangle_ranges (size_t             start,
+                          size_t             end,
+                          TriangleOrderJob  *job)
+{
+        size_t i;
+
+        for (i = start; i < end; i++) {
+                optimize_triangle_range (job->positions,
+                                         job->indices + job->ranges[i].first_index,
+                                         job->ranges[i].number_of_indices,
+                                         job->cache_size);
+        }
+}
+
+/* Reorders triangles so the post-transform vertex cache hits more
+ * often, then reorders the resulting clusters to cut down on overdraw.
+ * Each spatial cluster (or, before there are any, each level of detail)
+ * is ordered on its own, so culling can still skip whole clusters.
+ */
+gboolean
+chips_mesh_optimize_triangle_order (ChipsImportedMesh  *mesh,
+                                    size_t              cache_size,
+                                    GCancellable       *cancellable,
+                                    GError            **error)
+{
+        g_autofree IndexRange *ranges = NULL;
+        TriangleOrderJob job;
+        size_t number_of_ranges;
+        size_t i;
+
+        g_return_val_if_fail (mesh->index_size == sizeof (guint32), FALSE);
+
+        if (mesh->clusters != NULL) {
+                number_of_ranges = mesh->clusters->len;
+                ranges = g_new (IndexRange, number_of_ranges);
+
+                for (i = 0; i < number_of_ranges; i++) {
+                        ranges[i].first_index = g_array_index (mesh->clusters, ChipsMeshCluster, i).first_index;
+                        ranges[i].number_of_indices = g_array_index (mesh->clusters, ChipsMeshCluster, i).number_of_indices;
+                }
+        } else {
+                number_of_ranges = chips_imported_mesh_get_number_of_levels (mesh);
+                ranges = g_new (IndexRange, number_of_ranges);
+
+                for (i = 0; i < number_of_ranges; i++) {
+                        ChipsMeshLevelOfDetail level;
+
+                        chips_imported_mesh_get_level (mesh, i, &level);
+                        ranges[i].first_index = level.first_index;
+                        ranges[i].number_of_indices = level.number_of_indices;
+                }
+        }
+
+        job.positions = g_bytes_get_data (mesh->vertex_buffer, NULL);
+        job.indices = (guint32 *) g_bytes_get_data (mesh->vertex_arrangement, NULL);
+        job.ranges = ranges;
+        job.cache_size = cache_size;
+
+        return chips_parallel_for (number_of_ranges, 1,
+                                   (ChipsParallelFunc) optimize_triangle_ranges,
+                                   &job,
+                                   cancellable,
+                                   error);
+}
+
+static guint32
+spread_bits (guint32 value)
+{
+        value &= 0x3ff;
+        value = (value | (value << 16)) & 0x030000ff;
+        value = (value | (value << 8)) & 0x0300f00f;
+        value = (value | (value << 4)) & 0x030c30c3;
+        value = (value | (value << 2)) & 0x09249249;
+
+        return value;
+}
+
+static void
+compute_morton_key_range (size_t      start,
+                          size_t      end,
+                          ClusterJob *job)
+{
+        size_t i, j;
+
+        for (i = start; i < end; i++) {
+                const guint32 *corners = job->indices + i * 3;
+                guint32 cell[3];
+
+                for (j = 0; j < 3; j++) {
+                        float centroid, normalized;
+
+                        centroid = (job->positions[(size_t) corners[0] * 3 + j] +
+                                    job->positions[(size_t) corners[1] * 3 + j] +
+                                    job->positions[(size_t) corners[2] * 3 + j]) / 3.0f;
+                        normalized = job->extent[j] > 0.0f? (centroid - job->minimum[j]) / job->extent[j] : 0.0f;
+                        cell[j] = CLAMP (normalized * 1023.0f, 0.0f, 1023.0f);
+                }
+
+                job->keys[i] = ((guint64) (spread_bits (cell[0]) | spread_bits (cell[1]) << 1 | spread_bits (cell[2]) << 2) << 32) | i;
+        }
+}
+
+static int
+compare_keys (const guint64 *a,
+              const guint64 *b)
+{
+        return *a < *b? -1 : *a > *b;
+}
+
+static void
+measure_cluster_bounds_range (size_t      start,
+                              size_t      end,
+                              ClusterJob *job)
+{
+        size_t i, j, k;
+
+        for (i = start; i < end; i++) {
+                ChipsMeshCluster *cluster = &g_array_index (job->clusters, ChipsMeshCluster, i);
+                const guint32 *indices = job->all_indices + cluster->first_index;
+
+                for (k = 0; k < 3; k++) {
+                        cluster->bounds_minimum[k] = G_MAXFLOAT;
+                        cluster->bounds_maximum[k] = -G_MAXFLOAT;
+                }
+
+                for (j = 0; j < cluster->number_of_indices; j++) {
+                        const float *position = job->positions + (size_t) indices[j] * 3;
+
+                        for (k = 0; k < 3; k++) {
+                                cluster->bounds_minimum[k] = MIN (cluster->bounds_minimum[k], position[k]);
+                                cluster->bounds_maximum[k] = MAX (cluster->bounds_maximum[k], position[k]);
+                        }
+                }
+        }
+}
+
+/* Sorts the triangles of each level along a Morton curve through their
+ * centroids and cuts the result into clusters of triangles_per_cluster,
+ * so each cluster covers a compact part of the model that can be culled
+ * as a unit
+ */
+gboolean
+chips_mesh_build_clusters (ChipsImportedMesh  *mesh,
+                           size_t              triangles_per_cluster,
+                           GCancellable       *cancellable,
+                           GError            **error)
+{
+        g_autoptr (GArray) clusters = NULL;
+        ClusterJob job = { 0 };
+        float maximum[3];
+        size_t number_of_levels;
+        size_t i, j;
+
+        g_return_val_if_fail (mesh->index_size == sizeof (guint32), FALSE);
+        g_return_val_if_fail (triangles_per_cluster > 0, FALSE);
+
+        clusters = g_array_new (FALSE, FALSE, sizeof (ChipsMeshCluster));
+
+        job.positions = g_bytes_get_data (mesh->vertex_buffer, NULL);
+        job.all_indices = (guint32 *) g_bytes_get_data (mesh->vertex_arrangement, NULL);
+        job.clusters = clusters;
+
+        chips_mesh_compute_bounds (mesh, job.minimum, maximum);
+
+        for (j = 0; j < 3; j++) {
+                job.extent[j] = maximum[j] - job.minimum[j];
+        }
+
+        number_of_levels = chips_imported_mesh_get_number_of_levels (mesh);
+
+        for (i = 0; i < number_of_levels; i++) {
+                g_autofree guint64 *keys = NULL;
+                g_autofree guint32 *sorted_indices = NULL;
+                ChipsMeshLevelOfDetail level;
+                size_t number_of_triangles;
+
+                chips_imported_mesh_get_level (mesh, i, &level);
+                number_of_triangles = level.number_of_indices / 3;
+
+                keys = g_new (guint64, number_of_triangles);
+                job.indices = job.all_indices + level.first_index;
+                job.keys = keys;
+
+                if (!chips_parallel_for (number_of_triangles,
+                                         TRIANGLES_PER_CHUNK,
+                                         (ChipsParallelFunc) compute_morton_key_range,
+                                         &job,
+                                         cancellable,
+                                         error)) {
+                        return FALSE;
+                }
+
+                qsort (keys, number_of_triangles, sizeof (guint64),
+                       (int (*) (const void *, const void *)) compare_keys);
+
+                sorted_indices = g_new (guint32, number_of_triangles * 3);
+
+                for (j = 0; j < number_of_triangles; j++) {
+                        size_t triangle = keys[j] & G_MAXUINT32;
+
+                        memcpy (sorted_indices + j * 3, job.indices + triangle * 3, 3 * sizeof (guint32));
+                }
+
+                memcpy (job.indices, sorted_indices, number_of_triangles * 3 * sizeof (guint32));
+
+                for (j = 0; j < number_of_triangles; j += triangles_per_cluster) {
+                        ChipsMeshCluster cluster = { 0 };
+
+                        cluster.first_index = level.first_index + j * 3;
+                        cluster.number_of_indices = MIN (triangles_per_cluster, number_of_triangles - j) * 3;
+                        cluster.level = i;
+                        g_array_append_val (clusters, cluster);
+                }
+        }
+
+        if (!chips_parallel_for (clusters->len,
+                                 CLUSTERS_PER_CHUNK,
+                                 (ChipsParallelFunc) measure_cluster_bounds_range,
+                                 &job,
+                                 cancellable,
+                                 error)) {
+                return FALSE;
+        }
+
+        g_clear_pointer (&mesh->clusters, g_array_unref);
+        mesh->clusters = g_steal_pointer (&clusters);
+
+        return TRUE;
+}
+
+static void
+move_vertex_range (size_t     start,
+                   size_t     end,
+                   FetchJob  *job)
+{
+        size_t i;
+
+        for (i = start; i < end; i++) {
+                if (job->remap[i] == EMPTY_SLOT) {
+                        continue;
+                }
+
+                memcpy (job->new_positions + (size_t) job->remap[i] * 3,
+                        job->positions + i * 3,
+                        3 * sizeof (float));
+        }
+}
+
+/* Renumbers vertices in the order the index stream first uses them, so
+ * the GPU reads the vertex buffer mostly front to back.  Vertices that
+ * nothing refers to are dropped.
+ */
+gboolean
+chips_mesh_optimize_vertex_fetch (ChipsImportedMesh  *mesh,
+                                  GCancellable       *cancellable,
+                                  GError            **error)
+{
+        g_autofree guint32 *remap = NULL;
+        float *new_positions;
+        guint32 *indices;
+        size_t number_of_used_vertices = 0;
+        FetchJob fetch_job;
+        RemapJob remap_job;
+        size_t i;
+
+        g_return_val_if_fail (mesh->index_size == sizeof (guint32), FALSE);
+
+        remap = g_new (guint32, mesh->number_of_vertices);
+        memset (remap, 0xff, mesh->number_of_vertices * sizeof (guint32));
+
+        indices = (guint32 *) g_bytes_get_data (mesh->vertex_arrangement, NULL);
+
+        for (i = 0; i < mesh->number_of_indices; i++) {
+                if (remap[indices[i]] == EMPTY_SLOT) {
+                        remap[indices[i]] = number_of_used_vertices;
+                        number_of_used_vertices++;
+                }
+        }
+
+        new_positions = g_new (float, number_of_used_vertices * 3);
+
+        fetch_job.positions = g_bytes_get_data (mesh->vertex_buffer, NULL);
+        fetch_job.new_positions = new_positions;
+        fetch_job.remap = remap;
+
+        if (!chips_parallel_for (mesh->number_of_vertices,
+                                 VERTICES_PER_CHUNK,
+                                 (ChipsParallelFunc) move_vertex_range,
+                                 &fetch_job,
+                                 cancellable,
+                                 error)) {
+                g_free (new_positions);
+                return FALSE;
+        }
+
+        remap_job.indices = indices;
+        remap_job.remap = remap;
+
+        /* The index buffer is rewritten in place, so past this point the
+         * vertex buffer has to be swapped even if we get cancelled
+         */
+        chips_parallel_for (mesh->number_of_indices,
+                            INDICES_PER_CHUNK,
+                            (ChipsParallelFunc) remap_index_range,
+                            &remap_job,
+                            NULL,
+                            NULL);
+
+        g_bytes_unref (mesh->vertex_buffer);
+        mesh->vertex_buffer = g_bytes_new_take (new_positions,
+                                                number_of_used_vertices * 3 * sizeof (float));
+        mesh->number_of_vertices = number_of_used_vertices;
+
+        return TRUE;
+}
+
+static void
+normalize_normal_range (size_t  start,
+                        size_t  end,
+                        float  *normals)
+{
+        size_t i;
+
+        for (i = start; i < end; i++) {
+                float *normal = normals + i * 3;
+                float length;
+
+                length = sqrtf (normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+
+                if (length > 0.0f) {
+                        normal[0] /= length;
+                        normal[1] /= length;
+                        normal[2] /= length;
+                } else {
+                        normal[2] = 1.0f;
+                }
+        }
+}
+
+/* Returns one unit normal per vertex, averaged from the faces around
+ * it and weighted by their area in the full detail level.  None of the
+ * importers keep the normals a file comes with, since welding would have
+ * to respect them.
+ */
+GBytes *
+chips_mesh_compute_normals (const ChipsImportedMesh  *mesh,
+                            GCancellable             *cancellable,
+                            GError                  **error)
+{
+        ChipsMeshLevelOfDetail level;
+        const float *positions;
+        const guint8 *indices;
+        float *normals;
+        size_t number_of_triangles;
+        size_t i;
+
+        chips_imported_mesh_get_level (mesh, 0, &level);
+
+        positions = g_bytes_get_data (mesh->vertex_buffer, NULL);
+        indices = (const guint8 *) g_bytes_get_data (mesh->vertex_arrangement, NULL) + level.first_index * mesh->index_size;
+        number_of_triangles = level.number_of_indices / 3;
+
+        normals = g_new0 (float, mesh->number_of_vertices * 3);
+
+        for (i = 0; i < number_of_triangles; i++) {
+                guint32 corners[3];
+                const float *a, *b, *c;
+                float face_normal[3];
+                size_t j;
+
+                if (i % TRIANGLES_PER_CANCELLATION_CHECK == 0 &&
+                    g_cancellable_set_error_if_cancelled (cancellable, error)) {
+                        g_free (normals);
+                        return NULL;
+                }
+
+                for (j = 0; j < 3; j++) {
+                        corners[j] = get_index (indices, mesh->index_size, i * 3 + j);
+                }
+
+                a = positions + (size_t) corners[0] * 3;
+                b = positions + (size_t) corners[1] * 3;
+                c = positions + (size_t) corners[2] * 3;
+
+                face_normal[0] = (b[1] - a[1]) * (c[2] - a[2]) - (b[2] - a[2]) * (c[1] - a[1]);
+                face_normal[1] = (b[2] - a[2]) * (c[0] - a[0]) - (b[0] - a[0]) * (c[2] - a[2]);
+                face_normal[2] = (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+
+                for (j = 0; j < 3; j++) {
+                        float *normal = normals + (size_t) corners[j] * 3;
+
+                        normal[0] += face_normal[0];
+                        normal[1] += face_normal[1];
+                        normal[2] += face_normal[2];
+                }
+        }
+
+        if (!chips_parallel_for (mesh->number_of_vertices,
+                                 VERTICES_PER_CHUNK,
+                                 (ChipsParallelFunc) normalize_normal_range,
+                                 normals,
+                                 cancellable,
+                                 error)) {
+                g_free (normals);
+                return NULL;
+        }
+
+        return g_bytes_new_take (normals, mesh->number_of_vertices * 3 * sizeof (float));
+}
+
+static void
+compact_index_range (size_t      start,
+                     size_t      end,
+                     CompactJob *job)
+{
+        size_t i;
+
+        for (i = start; i < end; i++) {
+                job->compact_indices[i] = job->indices[i];
+        }
+}
+
+/* Switches the index stream to 16 bits when every vertex can be
+ * addressed with one, halving its size
+ */
+gboolean
+chips_mesh_compact_indices (ChipsImportedMesh  *mesh,
+                            GCancellable       *cancellable,
+                            GError            **error)
+{
+        CompactJob job;
+        guint16 *compact_indices;
+
+        if (mesh->index_size != sizeof (guint32) || mesh->number_of_vertices >= 65536) {
+                return TRUE;
+        }
+
+        compact_indices = g_new (guint16, mesh->number_of_indices);
+
+        job.indices = g_bytes_get_data (mesh->vertex_arrangement, NULL);
+        job.compact_indices = compact_indices;
+
+        if (!chips_parallel_for (mesh->number_of_indices,
+                                 INDICES_PER_CHUNK,
+                                 (ChipsParallelFunc) compact_index_range,
+                                 &job,
+                                 cancellable,
+                                 error)) {
+                g_free (compact_indices);
+                return FALSE;
+        }
+
+        g_bytes_unref (mesh->vertex_arrangement);
+        mesh->vertex_arrangement = g_bytes_new_take (compact_indices,
+                                                     mesh->number_of_indices * sizeof (guint16));
+        mesh->index_size = sizeof (guint16);
+
+        return TRUE;
+}
+
+void
+chips_mesh_compute_bounds (const ChipsImportedMesh *mesh,
+                           float                   *minimum,
+                           float                   *maximum)
+{
+        const float *positions;
+        size_t i, j;
+
+        positions = g_bytes_get_data (mesh->vertex_buffer, NULL);
+
+        for (j = 0; j < 3; j++) {
+                minimum[j] = mesh->number_of_vertices > 0? G_MAXFLOAT : 0.0f;
+                maximum[j] = mesh->number_of_vertices > 0? -G_MAXFLOAT : 0.0f;
+        }
+
+        for (i = 0; i < mesh->number_of_vertices; i++) {
+                for (j = 0; j < 3; j++) {
+                        minimum[j] = MIN (minimum[j], positions[i * 3 + j]);
+                        maximum[j] = MAX (maximum[j], positions[i * 3 + j]);
+                }
+        }
+}
+
+/* Simulates a FIFO post-transform cache over the full detail level.
+ * The average cache miss ratio is transformed vertices per triangle
+ * (0.5 is ideal for big regular meshes, 3 is the worst case) and the
+ * average transform to vertex ratio is transformed vertices per unique
+ * vertex (1 is ideal).
+ */
+void
+chips_mesh_analyze_vertex_cache (const ChipsImportedMesh     *mesh,
+                                 size_t                       cache_size,
+                                 ChipsVertexCacheStatistics  *statistics)
+{
+        g_autofree guint32 *cache_times = NULL;
+        ChipsMeshLevelOfDetail level;
+        const guint8 *indices;
+        guint32 timestamp;
+        size_t number_of_transforms = 0;
+        size_t i;
+
+        memset (statistics, 0, sizeof (*statistics));
+        chips_imported_mesh_get_level (mesh, 0, &level);
+
+        if (level.number_of_indices < 3 || mesh->number_of_vertices == 0) {
+                return;
+        }
+
+        cache_times = g_new0 (guint32, mesh->number_of_vertices);
+        indices = (const guint8 *) g_bytes_get_data (mesh->vertex_arrangement, NULL) + level.first_index * mesh->index_size;
+        timestamp = cache_size + 1;
+
+        for (i = 0; i < level.number_of_indices; i++) {
+                guint32 index = get_index (indices, mesh->index_size, i);
+
+                if (timestamp - cache_times[index] > cache_size) {
+                        cache_times[index] = timestamp;
+                        timestamp++;
+                        number_of_transforms++;
+                }
+        }
+
+        statistics->average_cache_miss_ratio = (double) number_of_transforms / (level.number_of_indices / 3);
+        statistics->average_transform_to_vertex_ratio = (double) number_of_transforms / mesh->number_of_vertices;
+}
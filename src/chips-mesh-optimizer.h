@@ -0,0 +1,70 @@
+/* chips-mesh-optimizer.h
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CHIPS_MESH_OPTIMIZER_H
+#define CHIPS_MESH_OPTIMIZER_H
+
+#include "chips.h"
+#include "chips-importer.h"
+
+/* Roughly the number of post-transform vertices current GPUs keep
+ * around; the orderings aren't very sensitive to the exact value
+ */
+#define CHIPS_MESH_VERTEX_CACHE_SIZE 16
+
+typedef struct
+{
+        double average_cache_miss_ratio;
+        double average_transform_to_vertex_ratio;
+} ChipsVertexCacheStatistics;
+
+gboolean chips_mesh_weld_vertices           (ChipsImportedMesh           *mesh,
+                                             float                        epsilon,
+                                             GCancellable                *cancellable,
+                                             GError                     **error);
+
+gboolean chips_mesh_build_clusters          (ChipsImportedMesh           *mesh,
+                                             size_t                       triangles_per_cluster,
+                                             GCancellable                *cancellable,
+                                             GError                     **error);
+
+gboolean chips_mesh_optimize_triangle_order (ChipsImportedMesh           *mesh,
+                                             size_t                       cache_size,
+                                             GCancellable                *cancellable,
+                                             GError                     **error);
+
+gboolean chips_mesh_optimize_vertex_fetch   (ChipsImportedMesh           *mesh,
+                                             GCancellable                *cancellable,
+                                             GError                     **error);
+
+GBytes  *chips_mesh_compute_normals         (const ChipsImportedMesh     *mesh,
+                                             GCancellable                *cancellable,
+                                             GError                     **error);
+
+gboolean chips_mesh_compact_indices         (ChipsImportedMesh           *mesh,
+                                             GCancellable                *cancellable,
+                                             GError                     **error);
+
+void     chips_mesh_compute_bounds          (const ChipsImportedMesh     *mesh,
+                                             float                       *minimum,
+                                             float                       *maximum);
+
+void     chips_mesh_analyze_vertex_cache    (const ChipsImportedMesh     *mesh,
+                                             size_t                       cache_size,
+                                             ChipsVertexCacheStatistics  *statistics);
+
+#endif /* CHIPS_MESH_OPTIMIZER_H */
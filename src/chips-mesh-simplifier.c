@@ -0,0 +1,574 @@
+/* chips-mesh-simplifier.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chips-mesh-simplifier.h"
+
+#define NO_VERTEX G_MAXUINT32
+
+/* Each pass collapses at most this fraction of the edges it could, so
+ * later collapses get to see the quadrics of earlier ones
+ */
+#define COLLAPSES_PER_PASS_FRACTION 0.2
+
+/* A level that doesn't get at least this much smaller than the one
+ * before it isn't worth keeping
+ */
+#define MINIMUM_REDUCTION 0.85
+
+typedef struct
+{
+        double a2, ab, ac, ad;
+        double b2, bc, bd;
+        double c2, cd;
+        double d2;
+        double weight;
+} Quadric;
+
+typedef struct
+{
+        guint32 from;
+        guint32 to;
+        double  cost;
+} Collapse;
+
+typedef struct
+{
+        const float *positions;
+        size_t       number_of_vertices;
+
+        guint32     *indices;
+        size_t       number_of_indices;
+
+        Quadric     *quadrics;
+        guint8      *locked;
+        guint32     *remap;
+        guint8      *touched;
+
+        size_t      *adjacency_offsets;
+        guint32     *adjacency;
+} Simplifier;
+
+static void
+quadric_add (Quadric       *quadric,
+             const Quadric *other)
+{
+        quadric->a2 += other->a2;
+        quadric->ab += other->ab;
+        quadric->ac += other->ac;
+        quadric->ad += other->ad;
+        quadric->b2 += other->b2;
+        quadric->bc += other->bc;
+        quadric->bd += other->bd;
+        quadric->c2 += other->c2;
+        quadric->cd += other->cd;
+        quadric->d2 += other->d2;
+        quadric->weight += other->weight;
+}
+
+static void
+quadric_add_plane (Quadric      *quadric,
+                   const double *normal,
+                   double        distance,
+                   double        weight)
+{
+        quadric->a2 += weight * normal[0] * normal[0];
+        quadric->ab += weight * normal[0] * normal[1];
+        quadric->ac += weight * normal[0] * normal[2];
+        quadric->ad += weight * normal[0] * distance;
+        quadric->b2 += weight * normal[1] * normal[1];
+        quadric->bc += weight * normal[1] * normal[2];
+        quadric->bd += weight * normal[1] * distance;
+        quadric->c2 += weight * normal[2] * normal[2];
+        quadric->cd += weight * normal[2] * distance;
+        quadric->d2 += weight * distance * distance;
+        quadric->weight += weight;
+}
+
+/* Area weighted mean of the squared distances from the point to the
+ * planes that went into the quadric
+ */
+static double
+quadric_evaluate (const Quadric *quadric,
+                  const float   *position)
+{
+        double x = position[0], y = position[1], z = position[2];
+        double value;
+
+        value = quadric->a2 * x * x + quadric->b2 * y * y + quadric->c2 * z * z +
+                2.0 * (quadric->ab * x * y + quadric->ac * x * z + quadric->bc * y * z) +
+                2.0 * (quadric->ad * x + quadric->bd * y + quadric->cd * z) +
+                quadric->d2;
+
+        if (quadric->weight <= 0.0) {
+                return 0.0;
+        }
+
+        return MAX (value, 0.0) / quadric->weight;
+}
+
+static void
+compute_triangle_normal (const float *a,
+                         const float *b,
+                         const float *c,
+                         double      *normal)
+{
+        double ab[3], ac[3];
+        size_t i;
+
+        for (i = 0; i < 3; i++) {
+                ab[i] = (double) b[i] - a[i];
+                ac[i] = (double) c[i] - a[i];
+        }
+
+        normal[0] = ab[1] * ac[2] - ab[2] * ac[1];
+        normal[1] = ab[2] * ac[0] - ab[0] * ac[2];
+        normal[2] = ab[0] * ac[1] - ab[1] * ac[0];
+}
+
+static const float *
+get_position (Simplifier *simplifier,
+              guint32     vertex)
+{
+        return simplifier->positions + (size_t) vertex * 3;
+}
+
+static void
+build_adjacency (Simplifier *simplifier)
+{
+        size_t i;
+
+        memset (simplifier->adjacency_offsets, 0, (simplifier->number_of_vertices + 1) * sizeof (size_t));
+
+        for (i = 0; i < simplifier->number_of_indices; i++) {
+                simplifier->adjacency_offsets[simplifier->indices[i] + 1]++;
+        }
+
+        for (i = 0; i < simplifier->number_of_vertices; i++) {
+                simplifier->adjacency_offsets[i + 1] += simplifier->adjacency_offsets[i];
+        }
+
+        /* Filling advances each vertex's offset to the start of the next
+         * vertex's run, so shift them back afterward
+         */
+        for (i = 0; i < simplifier->number_of_indices; i++) {
+                guint32 vertex = simplifier->indices[i];
+
+                simplifier->adjacency[simplifier->adjacency_offsets[vertex]] = i / 3;
+                simplifier->adjacency_offsets[vertex]++;
+        }
+
+        for (i = simplifier->number_of_vertices; i > 0; i--) {
+                simplifier->adjacency_offsets[i] = simplifier->adjacency_offsets[i - 1];
+        }
+        simplifier->adjacency_offsets[0] = 0;
+}
+
+static gboolean
+triangle_has_vertex (Simplifier *simplifier,
+                     guint32     triangle,
+                     guint32     vertex)
+{
+        const guint32 *corners = simplifier->indices + (size_t) triangle * 3;
+
+        return corners[0] == vertex || corners[1] == vertex || corners[2] == vertex;
+}
+
+static size_t
+count_shared_triangles (Simplifier *simplifier,
+                        guint32     vertex,
+                        guint32     other_vertex)
+{
+        size_t count = 0;
+        size_t i;
+
+        for (i = simplifier->adjacency_offsets[vertex]; i < simplifier->adjacency_offsets[vertex + 1]; i++) {
+                if (triangle_has_vertex (simplifier, simplifier->adjacency[i], other_vertex)) {
+                        count++;
+                }
+        }
+
+        return count;
+}
+
+/* Collapsing a vertex on an open edge would eat into the outline of the
+ * model, so those stay put.  Only the full detail mesh gets looked at;
+ * collapses never open up new edges.
+ */
+static void
+lock_border_vertices (Simplifier *simplifier)
+{
+        size_t i, j;
+
+        for (i = 0; i < simplifier->number_of_indices; i += 3) {
+                for (j = 0; j < 3; j++) {
+                        guint32 vertex = simplifier->indices[i + j];
+                        guint32 next_vertex = simplifier->indices[i + (j + 1) % 3];
+
+                        if (count_shared_triangles (simplifier, vertex, next_vertex) == 1) {
+                                simplifier->locked[vertex] = TRUE;
+                                simplifier->locked[next_vertex] = TRUE;
+                        }
+                }
+        }
+}
+
+static void
+compute_quadrics (Simplifier *simplifier)
+{
+        size_t i, j;
+
+        memset (simplifier->quadrics, 0, simplifier->number_of_vertices * sizeof (Quadric));
+
+        for (i = 0; i < simplifier->number_of_indices; i += 3) {
+                const float *a = get_position (simplifier, simplifier->indices[i]);
+                const float *b = get_position (simplifier, simplifier->indices[i + 1]);
+                const float *c = get_position (simplifier, simplifier->indices[i + 2]);
+                double normal[3], length, distance;
+                Quadric quadric = { 0 };
+
+                compute_triangle_normal (a, b, c, normal);
+                length = sqrt (normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+
+                if (length == 0.0) {
+                        continue;
+                }
+
+                for (j = 0; j < 3; j++) {
+                        normal[j] /= length;
+                }
+
+                distance = -(normal[0] * a[0] + normal[1] * a[1] + normal[2] * a[2]);
+                quadric_add_plane (&quadric, normal, distance, length / 2.0);
+
+                for (j = 0; j < 3; j++) {
+                        quadric_add (&simplifier->quadrics[simplifier->indices[i + j]], &quadric);
+                }
+        }
+}
+
+static double
+get_collapse_cost (Simplifier *simplifier,
+                   guint32     from,
+                   guint32     to)
+{
+        Quadric quadric = simplifier->quadrics[from];
+
+        quadric_add (&quadric, &simplifier->quadrics[to]);
+
+        return quadric_evaluate (&quadric, get_position (simplifier, to));
+}
+
+/* Moving a vertex onto its neighbor shouldn't turn any of the triangles
+ * that survive inside out
+ */
+static gboolean
+collapse_flips_triangles (Simplifier *simplifier,
+                          guint32     from,
+                          guint32     to)
+{
+        size_t i, j;
+
+        for (i = simplifier->adjacency_offsets[from]; i < simplifier->adjacency_offsets[from + 1]; i++) {
+                guint32 triangle = simplifier->adjacency[i];
+                const guint32 *corners = simplifier->indices + (size_t) triangle * 3;
+                const float *positions[3], *moved_positions[3];
+                double normal[3], moved_normal[3];
+
+                if (triangle_has_vertex (simplifier, triangle, to)) {
+                        continue;
+                }
+
+                for (j = 0; j < 3; j++) {
+                        positions[j] = get_position (simplifier, corners[j]);
+                        moved_positions[j] = corners[j] == from? get_position (simplifier, to) : positions[j];
+                }
+
+                compute_triangle_normal (positions[0], positions[1], positions[2], normal);
+                compute_triangle_normal (moved_positions[0], moved_positions[1], moved_positions[2], moved_normal);
+
+                if (normal[0] * moved_normal[0] + normal[1] * moved_normal[1] + normal[2] * moved_normal[2] <= 0.0) {
+                        return TRUE;
+                }
+        }
+
+        return FALSE;
+}
+
+static void
+touch_neighborhood (Simplifier *simplifier,
+                    guint32     vertex)
+{
+        size_t i, j;
+
+        for (i = simplifier->adjacency_offsets[vertex]; i < simplifier->adjacency_offsets[vertex + 1]; i++) {
+                const guint32 *corners = simplifier->indices + (size_t) simplifier->adjacency[i] * 3;
+
+                for (j = 0; j < 3; j++) {
+                        simplifier->touched[corners[j]] = TRUE;
+                }
+        }
+}
+
+static int
+compare_collapses (const Collapse *a,
+                   const Collapse *b)
+{
+        if (a->cost != b->cost) {
+                return a->cost < b->cost? -1 : 1;
+        }
+
+        return a->from < b->from? -1 : a->from > b->from;
+}
+
+static GArray *
+find_collapses (Simplifier *simplifier)
+{
+        GArray *collapses;
+        size_t i, j;
+
+        collapses = g_array_new (FALSE, FALSE, sizeof (Collapse));
+
+        for (i = 0; i < simplifier->number_of_indices; i += 3) {
+                for (j = 0; j < 3; j++) {
+                        guint32 vertex = simplifier->indices[i + j];
+                        guint32 next_vertex = simplifier->indices[i + (j + 1) % 3];
+                        Collapse collapse;
+                        double cost, reverse_cost;
+
+                        /* Each inner edge shows up once per side, so only
+                         * take it from one of them
+                         */
+                        if (vertex > next_vertex) {
+                                continue;
+                        }
+
+                        cost = simplifier->locked[vertex]? G_MAXDOUBLE : get_collapse_cost (simplifier, vertex, next_vertex);
+                        reverse_cost = simplifier->locked[next_vertex]? G_MAXDOUBLE : get_collapse_cost (simplifier, next_vertex, vertex);
+
+                        if (cost == G_MAXDOUBLE && reverse_cost == G_MAXDOUBLE) {
+                                continue;
+                        }
+
+                        if (cost <= reverse_cost) {
+                                collapse.from = vertex;
+                                collapse.to = next_vertex;
+                                collapse.cost = cost;
+                        } else {
+                                collapse.from = next_vertex;
+                                collapse.to = vertex;
+                                collapse.cost = reverse_cost;
+                        }
+
+                        g_array_append_val (collapses, collapse);
+                }
+        }
+
+        g_array_sort (collapses, (GCompareFunc) compare_collapses);
+
+        return collapses;
+}
+
+/* Rewrites the index buffer with the pass's collapses applied and
+ * degenerate triangles dropped
+ */
+static void
+apply_collapses (Simplifier *simplifier)
+{
+        size_t number_of_indices = 0;
+        size_t i;
+
+        for (i = 0; i < simplifier->number_of_indices; i += 3) {
+                guint32 a = simplifier->remap[simplifier->indices[i]];
+                guint32 b = simplifier->remap[simplifier->indices[i + 1]];
+                guint32 c = simplifier->remap[simplifier->indices[i + 2]];
+
+                if (a == b || b == c || a == c) {
+                        continue;
+                }
+
+                simplifier->indices[number_of_indices++] = a;
+                simplifier->indices[number_of_indices++] = b;
+                simplifier->indices[number_of_indices++] = c;
+        }
+
+        simplifier->number_of_indices = number_of_indices;
+
+        for (i = 0; i < simplifier->number_of_vertices; i++) {
+                simplifier->remap[i] = i;
+        }
+}
+
+/* Quadric error metric simplification (Garland and Heckbert) using half
+ * edge collapses, so the simplified triangles only refer to vertices
+ * that already exist and every level can share one vertex buffer.
+ * Simplifies indices in place, and returns the largest distance error
+ * the collapses introduced.
+ */
+static gboolean
+simplify (Simplifier    *simplifier,
+          size_t         target_number_of_indices,
+          float         *simplification_error,
+          GCancellable  *cancellable,
+          GError       **error)
+{
+        double largest_cost = 0.0;
+        size_t i;
+
+        for (i = 0; i < simplifier->number_of_vertices; i++) {
+                simplifier->remap[i] = i;
+        }
+
+        build_adjacency (simplifier);
+        compute_quadrics (simplifier);
+
+        while (simplifier->number_of_indices > target_number_of_indices) {
+                g_autoptr (GArray) collapses = NULL;
+                size_t indices_to_remove, indices_removed = 0;
+                size_t collapse_limit, number_of_collapses = 0;
+
+                if (g_cancellable_set_error_if_cancelled (cancellable, error)) {
+                        return FALSE;
+                }
+
+                collapses = find_collapses (simplifier);
+                memset (simplifier->touched, 0, simplifier->number_of_vertices);
+
+                indices_to_remove = simplifier->number_of_indices - target_number_of_indices;
+                collapse_limit = MAX (collapses->len * COLLAPSES_PER_PASS_FRACTION, 1);
+
+                for (i = 0; i < collapses->len && number_of_collapses < collapse_limit && indices_removed < indices_to_remove; i++) {
+                        Collapse *collapse = &g_array_index (collapses, Collapse, i);
+
+                        if (simplifier->touched[collapse->from] || simplifier->touched[collapse->to]) {
+                                continue;
+                        }
+
+                        if (collapse_flips_triangles (simplifier, collapse->from, collapse->to)) {
+                                continue;
+                        }
+
+                        indices_removed += 3 * count_shared_triangles (simplifier, collapse->from, collapse->to);
+
+                        touch_neighborhood (simplifier, collapse->from);
+                        simplifier->remap[collapse->from] = collapse->to;
+                        quadric_add (&simplifier->quadrics[collapse->to], &simplifier->quadrics[collapse->from]);
+                        largest_cost = MAX (largest_cost, collapse->cost);
+                        number_of_collapses++;
+                }
+
+                if (number_of_collapses == 0) {
+                        break;
+                }
+
+                apply_collapses (simplifier);
+                build_adjacency (simplifier);
+        }
+
+        *simplification_error = sqrt (largest_cost);
+
+        return TRUE;
+}
+
+/* Appends progressively coarser versions of the mesh to its index
+ * buffer, each about half the size of the one before, until they get
+ * down to minimum_number_of_triangles or stop shrinking
+ */
+gboolean
+chips_mesh_build_levels_of_detail (ChipsImportedMesh  *mesh,
+                                   size_t              minimum_number_of_triangles,
+                                   GCancellable       *cancellable,
+                                   GError            **error)
+{
+        g_autoptr (GArray) levels_of_detail = NULL;
+        g_autoptr (GArray) indices = NULL;
+        Simplifier simplifier = { 0 };
+        ChipsMeshLevelOfDetail level = { 0 };
+        gboolean succeeded = FALSE;
+
+        g_return_val_if_fail (mesh->index_size == sizeof (guint32), FALSE);
+        g_return_val_if_fail (mesh->levels_of_detail == NULL, FALSE);
+
+        levels_of_detail = g_array_new (FALSE, FALSE, sizeof (ChipsMeshLevelOfDetail));
+        indices = g_array_sized_new (FALSE, FALSE, sizeof (guint32), mesh->number_of_indices * 2);
+
+        g_array_append_vals (indices, g_bytes_get_data (mesh->vertex_arrangement, NULL), mesh->number_of_indices);
+
+        level.number_of_indices = mesh->number_of_indices - mesh->number_of_indices % 3;
+        g_array_append_val (levels_of_detail, level);
+
+        simplifier.positions = g_bytes_get_data (mesh->vertex_buffer, NULL);
+        simplifier.number_of_vertices = mesh->number_of_vertices;
+        simplifier.indices = g_new (guint32, level.number_of_indices);
+        simplifier.number_of_indices = level.number_of_indices;
+        simplifier.quadrics = g_new (Quadric, mesh->number_of_vertices);
+        simplifier.locked = g_new0 (guint8, mesh->number_of_vertices);
+        simplifier.remap = g_new (guint32, mesh->number_of_vertices);
+        simplifier.touched = g_new (guint8, mesh->number_of_vertices);
+        simplifier.adjacency_offsets = g_new (size_t, mesh->number_of_vertices + 1);
+        simplifier.adjacency = g_new (guint32, level.number_of_indices);
+
+        memcpy (simplifier.indices, indices->data, level.number_of_indices * sizeof (guint32));
+
+        build_adjacency (&simplifier);
+        lock_border_vertices (&simplifier);
+
+        while (levels_of_detail->len < CHIPS_MESH_MAX_LEVELS_OF_DETAIL &&
+               simplifier.number_of_indices / 3 > minimum_number_of_triangles) {
+                size_t number_of_indices = simplifier.number_of_indices;
+                float simplification_error;
+
+                if (!simplify (&simplifier,
+                               MAX (number_of_indices / 6, minimum_number_of_triangles) * 3,
+                               &simplification_error,
+                               cancellable,
+                               error)) {
+                        goto out;
+                }
+
+                if (simplifier.number_of_indices > number_of_indices * MINIMUM_REDUCTION) {
+                        break;
+                }
+
+                /* Each level is simplified from the one before, so its
+                 * errors stack up
+                 */
+                level.first_index = indices->len;
+                level.number_of_indices = simplifier.number_of_indices;
+                level.error += simplification_error;
+
+                g_array_append_vals (indices, simplifier.indices, simplifier.number_of_indices);
+                g_array_append_val (levels_of_detail, level);
+        }
+
+        g_bytes_unref (mesh->vertex_arrangement);
+        mesh->number_of_indices = indices->len;
+        mesh->vertex_arrangement = g_bytes_new_take (g_array_free (g_steal_pointer (&indices), FALSE),
+                                                     mesh->number_of_indices * sizeof (guint32));
+        mesh->levels_of_detail = g_steal_pointer (&levels_of_detail);
+
+        succeeded = TRUE;
+out:
+        g_free (simplifier.indices);
+        g_free (simplifier.quadrics);
+        g_free (simplifier.locked);
+        g_free (simplifier.remap);
+        g_free (simplifier.touched);
+        g_free (simplifier.adjacency_offsets);
+        g_free (simplifier.adjacency);
+
+        return succeeded;
+}
@@ -0,0 +1,192 @@
+/* chips-model-cache.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chips-model-cache.h"
+#include "chips-mesh-file.h"
+
+#include <glib/gstdio.h>
+
+/* Bump whenever importing or processing changes what ends up in the
+ * processed mesh, so stale entries stop matching
+ */
+#define CHIPS_MODEL_CACHE_VERSION 1
+
+typedef struct
+{
+        char    *filename;
+        guint64  size;
+        gint64   last_used_time;
+} CacheEntry;
+
+static char *
+get_cache_directory (void)
+{
+        return g_build_filename (g_get_user_cache_dir (), "chips", "models", NULL);
+}
+
+/* Hashing the contents of a multi-gigabyte model would cost a good
+ * part of what importing it does, so the source is identified by where
+ * it is, how big it is and when it last changed instead
+ */
+char *
+chips_model_cache_compute_key (GFile         *file,
+                               float          weld_epsilon,
+                               gboolean       quantize_vertices,
+                               GCancellable  *cancellable,
+                               GError       **error)
+{
+        g_autoptr (GFileInfo) info = NULL;
+        g_autoptr (GChecksum) checksum = NULL;
+        g_autofree char *uri = NULL;
+        guint64 description[6];
+
+        info = g_file_query_info (file,
+                                  G_FILE_ATTRIBUTE_STANDARD_SIZE ","
+                                  G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+                                  G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+                                  G_FILE_QUERY_INFO_NONE,
+                                  cancellable,
+                                  error);
+
+        if (info == NULL) {
+                return NULL;
+        }
+
+        uri = g_file_get_uri (file);
+
+        description[0] = CHIPS_MODEL_CACHE_VERSION;
+        description[1] = CHIPS_MESH_FILE_VERSION;
+        description[2] = g_file_info_get_size (info);
+        description[3] = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+        description[4] = g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+        description[5] = quantize_vertices? 1 : 0;
+
+        checksum = g_checksum_new (G_CHECKSUM_SHA256);
+        g_checksum_update (checksum, (const guchar *) uri, strlen (uri) + 1);
+        g_checksum_update (checksum, (const guchar *) description, sizeof (description));
+        g_checksum_update (checksum, (const guchar *) &weld_epsilon, sizeof (weld_epsilon));
+
+        return g_strdup (g_checksum_get_string (checksum));
+}
+
+char *
+chips_model_cache_get_filename (const char *key)
+{
+        g_autofree char *directory = NULL;
+        g_autofree char *basename = NULL;
+
+        directory = get_cache_directory ();
+        basename = g_strconcat (key, CHIPS_MESH_FILE_SUFFIX, NULL);
+
+        return g_build_filename (directory, basename, NULL);
+}
+
+/* Returns the file holding the processed model, or NULL if it isn't
+ * cached.  Hits get their modification time bumped, which is what
+ * eviction goes by.
+ */
+char *
+chips_model_cache_lookup (const char *key)
+{
+        g_autofree char *filename = NULL;
+
+        filename = chips_model_cache_get_filename (key);
+
+        if (g_utime (filename, NULL) < 0) {
+                return NULL;
+        }
+
+        return g_steal_pointer (&filename);
+}
+
+void
+chips_model_cache_remove (const char *key)
+{
+        g_autofree char *filename = NULL;
+
+        filename = chips_model_cache_get_filename (key);
+        g_unlink (filename);
+}
+
+static int
+compare_entries (const CacheEntry *a,
+                 const CacheEntry *b)
+{
+        return a->last_used_time < b->last_used_time? -1 : a->last_used_time > b->last_used_time;
+}
+
+static void
+clear_entry (CacheEntry *entry)
+{
+        g_free (entry->filename);
+}
+
+/* Removes the least recently used entries until the rest fit in
+ * maximum_size.  Only finished mesh files are considered, so files
+ * another instance is still writing are left alone.
+ */
+void
+chips_model_cache_trim (guint64 maximum_size)
+{
+        g_autofree char *directory_name = NULL;
+        g_autoptr (GDir) directory = NULL;
+        g_autoptr (GArray) entries = NULL;
+        const char *name;
+        guint64 total_size = 0;
+        size_t i;
+
+        directory_name = get_cache_directory ();
+        directory = g_dir_open (directory_name, 0, NULL);
+
+        if (directory == NULL) {
+                return;
+        }
+
+        entries = g_array_new (FALSE, FALSE, sizeof (CacheEntry));
+        g_array_set_clear_func (entries, (GDestroyNotify) clear_entry);
+
+        while ((name = g_dir_read_name (directory)) != NULL) {
+                CacheEntry entry;
+                GStatBuf status;
+
+                if (!chips_mesh_file_is_mesh_file (name)) {
+                        continue;
+                }
+
+                entry.filename = g_build_filename (directory_name, name, NULL);
+
+                if (g_stat (entry.filename, &status) < 0) {
+                        g_free (entry.filename);
+                        continue;
+                }
+
+                entry.size = status.st_size;
+                entry.last_used_time = status.st_mtime;
+                total_size += entry.size;
+                g_array_append_val (entries, entry);
+        }
+
+        g_array_sort (entries, (GCompareFunc) compare_entries);
+
+        for (i = 0; i < entries->len && total_size > maximum_size; i++) {
+                CacheEntry *entry = &g_array_index (entries, CacheEntry, i);
+
+                if (g_unlink (entry->filename) == 0) {
+                        total_size -= entry->size;
+                }
+        }
+}
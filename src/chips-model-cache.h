@@ -0,0 +1,39 @@
+/* chips-model-cache.h
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CHIPS_MODEL_CACHE_H
+#define CHIPS_MODEL_CACHE_H
+
+#include "chips.h"
+
+/* Imported models are kept, fully processed, as mesh files under the
+ * user's cache directory.  Once the cache grows past this, the least
+ * recently opened ones go.
+ */
+#define CHIPS_MODEL_CACHE_MAXIMUM_SIZE ((guint64) 2 * 1024 * 1024 * 1024)
+
+char     *chips_model_cache_compute_key (GFile         *file,
+                                         float          weld_epsilon,
+                                         gboolean       quantize_vertices,
+                                         GCancellable  *cancellable,
+                                         GError       **error);
+char     *chips_model_cache_get_filename (const char   *key);
+char     *chips_model_cache_lookup      (const char    *key);
+void      chips_model_cache_remove      (const char    *key);
+void      chips_model_cache_trim        (guint64        maximum_size);
+
+#endif /* CHIPS_MODEL_CACHE_H */
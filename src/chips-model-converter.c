@@ -0,0 +1,431 @@
+/* chips-model-converter.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chips-model-converter.h"
+#include "chips-3d-model.h"
+#include "chips-mesh-file.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+/* One model to convert, and how it went */
+typedef struct
+{
+        GFile   *input_file;
+        char    *output_filename;
+        guint64  input_size;
+} ChipsConversion;
+
+struct _ChipsModelConverter
+{
+        char         *output_directory;
+        unsigned int  number_of_jobs;
+        guint64       memory_budget;
+
+        GPtrArray    *conversions;
+
+        /* Conversions only start while their memory estimate fits in
+         * what the others in progress leave of the budget
+         */
+        GMutex        lock;
+        GCond         memory_released_condition;
+        guint64       memory_in_use;
+
+        guint64       bytes_converted;
+        unsigned int  number_converted;
+        unsigned int  number_failed;
+};
+
+/* Importing and processing a model takes a few times its file size,
+ * counting the mapped file, the imported mesh and the buffers it ends
+ * up in
+ */
+#define MEMORY_PER_INPUT_BYTE 4
+
+/* Without a budget, conversions get this fraction of physical memory */
+#define DEFAULT_MEMORY_FRACTION 2
+
+/* Used if physical memory can't be found out */
+#define FALLBACK_MEMORY_BUDGET ((guint64) 4 * 1024 * 1024 * 1024)
+
+/* Only files with these suffixes are picked up from directories.
+ * Files given by name are tried whatever they're called.
+ */
+static const char *model_suffixes[] = { ".obj", ".stl" };
+
+static void
+chips_conversion_free (ChipsConversion *conversion)
+{
+        g_object_unref (conversion->input_file);
+        g_free (conversion->output_filename);
+        g_slice_free (ChipsConversion, conversion);
+}
+
+static guint64
+get_default_memory_budget (void)
+{
+        long number_of_pages, page_size;
+
+        number_of_pages = sysconf (_SC_PHYS_PAGES);
+        page_size = sysconf (_SC_PAGESIZE);
+
+        if (number_of_pages <= 0 || page_size <= 0) {
+                return FALLBACK_MEMORY_BUDGET;
+        }
+
+        return (guint64) number_of_pages * page_size / DEFAULT_MEMORY_FRACTION;
+}
+
+/* Converted models go in output_directory as mesh files, or, if it's
+ * NULL, in the model cache, where opening the original finds them.
+ * number_of_jobs and memory_budget can be 0 for one job per processor
+ * and half of physical memory.
+ */
+ChipsModelConverter *
+chips_model_converter_new (const char   *output_directory,
+                           unsigned int  number_of_jobs,
+                           guint64       memory_budget)
+{
+        ChipsModelConverter *converter;
+
+        converter = g_slice_new0 (ChipsModelConverter);
+        converter->output_directory = g_strdup (output_directory);
+        converter->number_of_jobs = number_of_jobs > 0? number_of_jobs : (unsigned int) g_get_num_processors ();
+        converter->memory_budget = memory_budget > 0? memory_budget : get_default_memory_budget ();
+        converter->conversions = g_ptr_array_new_with_free_func ((GDestroyNotify) chips_conversion_free);
+        g_mutex_init (&converter->lock);
+        g_cond_init (&converter->memory_released_condition);
+
+        return converter;
+}
+
+void
+chips_model_converter_free (ChipsModelConverter *converter)
+{
+        g_mutex_clear (&converter->lock);
+        g_cond_clear (&converter->memory_released_condition);
+        g_clear_pointer (&converter->conversions, g_ptr_array_unref);
+        g_free (converter->output_directory);
+        g_slice_free (ChipsModelConverter, converter);
+}
+
+static gboolean
+has_model_suffix (const char *name)
+{
+        g_autofree char *folded_name = g_ascii_strdown (name, -1);
+        size_t i;
+
+        for (i = 0; i < G_N_ELEMENTS (model_suffixes); i++) {
+                if (g_str_has_suffix (folded_name, model_suffixes[i])) {
+                        return TRUE;
+                }
+        }
+
+        return FALSE;
+}
+
+/* Where in the output directory the model at relative_path goes, with
+ * its suffix swapped for the mesh file one
+ */
+static char *
+get_output_filename (ChipsModelConverter *converter,
+                     const char          *relative_path)
+{
+        g_autofree char *path = g_build_filename (converter->output_directory, relative_path, NULL);
+        char *basename, *suffix;
+
+        basename = strrchr (path, G_DIR_SEPARATOR);
+        suffix = strrchr (basename != NULL? basename : path, '.');
+
+        if (suffix != NULL && suffix != basename + 1) {
+                *suffix = '\0';
+        }
+
+        return g_strconcat (path, CHIPS_MESH_FILE_SUFFIX, NULL);
+}
+
+static void
+add_conversion (ChipsModelConverter *converter,
+                GFile               *input_file,
+                const char          *relative_path,
+                guint64              input_size)
+{
+        ChipsConversion *conversion;
+
+        conversion = g_slice_new0 (ChipsConversion);
+        conversion->input_file = g_object_ref (input_file);
+        conversion->input_size = input_size;
+
+        if (converter->output_directory != NULL) {
+                conversion->output_filename = get_output_filename (converter, relative_path);
+        }
+
+        g_ptr_array_add (converter->conversions, conversion);
+}
+
+/* Symbolic links aren't followed, so a link back up the tree can't
+ * make this go around forever
+ */
+static gboolean
+add_directory (ChipsModelConverter  *converter,
+               GFile                *root,
+               GFile                *directory,
+               GError              **error)
+{
+        g_autoptr (GFileEnumerator) enumerator = NULL;
+
+        enumerator = g_file_enumerate_children (directory,
+                                                G_FILE_ATTRIBUTE_STANDARD_NAME ","
+                                                G_FILE_ATTRIBUTE_STANDARD_TYPE ","
+                                                G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                                                G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                                NULL,
+                                                error);
+
+        if (enumerator == NULL) {
+                return FALSE;
+        }
+
+        while (TRUE) {
+                GFileInfo *info;
+                GFile *child;
+                g_autofree char *relative_path = NULL;
+
+                if (!g_file_enumerator_iterate (enumerator, &info, &child, NULL, error)) {
+                        return FALSE;
+                }
+
+                if (info == NULL) {
+                        break;
+                }
+
+                switch (g_file_info_get_file_type (info)) {
+                        case G_FILE_TYPE_DIRECTORY:
+                                if (!add_directory (converter, root, child, error)) {
+                                        return FALSE;
+                                }
+                                break;
+                        case G_FILE_TYPE_REGULAR:
+                                if (!has_model_suffix (g_file_info_get_name (info))) {
+                                        break;
+                                }
+
+                                relative_path = g_file_get_relative_path (root, child);
+                                add_conversion (converter, child, relative_path, g_file_info_get_size (info));
+                                break;
+                        default:
+                                break;
+                }
+        }
+
+        return TRUE;
+}
+
+/* Adds a model file, or every model file under a directory */
+gboolean
+chips_model_converter_add_path (ChipsModelConverter  *converter,
+                                const char           *path,
+                                GError              **error)
+{
+        g_autoptr (GFile) file = NULL;
+        g_autoptr (GFileInfo) info = NULL;
+        g_autofree char *basename = NULL;
+
+        file = g_file_new_for_commandline_arg (path);
+        info = g_file_query_info (file,
+                                  G_FILE_ATTRIBUTE_STANDARD_TYPE ","
+                                  G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                                  G_FILE_QUERY_INFO_NONE,
+                                  NULL,
+                                  error);
+
+        if (info == NULL) {
+                return FALSE;
+        }
+
+        if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY) {
+                return add_directory (converter, file, file, error);
+        }
+
+        basename = g_file_get_basename (file);
+        add_conversion (converter, file, basename, g_file_info_get_size (info));
+
+        return TRUE;
+}
+
+static guint64
+reserve_memory (ChipsModelConverter *converter,
+                guint64              estimate)
+{
+        g_mutex_lock (&converter->lock);
+
+        /* A model too big for the budget still gets converted, just
+         * with nothing else going on
+         */
+        while (converter->memory_in_use > 0 &&
+               converter->memory_in_use + estimate > converter->memory_budget) {
+                g_cond_wait (&converter->memory_released_condition, &converter->lock);
+        }
+
+        converter->memory_in_use += estimate;
+        g_mutex_unlock (&converter->lock);
+
+        return estimate;
+}
+
+static void
+release_memory (ChipsModelConverter *converter,
+                guint64              estimate)
+{
+        g_mutex_lock (&converter->lock);
+        converter->memory_in_use -= estimate;
+        g_cond_broadcast (&converter->memory_released_condition);
+        g_mutex_unlock (&converter->lock);
+}
+
+static gboolean
+convert (ChipsConversion  *conversion,
+         GError          **error)
+{
+        g_autoptr (Chips3DModel) model = NULL;
+        g_autofree char *directory = NULL;
+
+        model = g_initable_new (CHIPS_TYPE_3D_MODEL,
+                                NULL,
+                                error,
+                                "file", conversion->input_file,
+                                "use-cache", conversion->output_filename == NULL,
+                                NULL);
+
+        if (model == NULL) {
+                return FALSE;
+        }
+
+        if (conversion->output_filename == NULL) {
+                return TRUE;
+        }
+
+        directory = g_path_get_dirname (conversion->output_filename);
+
+        if (g_mkdir_with_parents (directory, 0755) < 0) {
+                int saved_errno = errno;
+
+                g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                             "couldn't create '%s': %s", directory, g_strerror (saved_errno));
+                return FALSE;
+        }
+
+        return chips_3d_model_save (model, conversion->output_filename, NULL, error);
+}
+
+static void
+convert_in_thread (ChipsConversion     *conversion,
+                   ChipsModelConverter *converter)
+{
+        g_autoptr (GError) error = NULL;
+        g_autofree char *name = NULL;
+        guint64 memory_reserved;
+        gint64 start_time;
+        double seconds;
+        gboolean converted;
+
+        memory_reserved = reserve_memory (converter, conversion->input_size * MEMORY_PER_INPUT_BYTE);
+
+        start_time = g_get_monotonic_time ();
+        converted = convert (conversion, &error);
+        seconds = (g_get_monotonic_time () - start_time) / (double) G_USEC_PER_SEC;
+
+        release_memory (converter, memory_reserved);
+
+        name = g_file_get_parse_name (conversion->input_file);
+
+        g_mutex_lock (&converter->lock);
+        if (converted) {
+                converter->number_converted++;
+                converter->bytes_converted += conversion->input_size;
+
+                g_print ("%s: %.2f s, %.1f MB/s\n",
+                         name,
+                         seconds,
+                         conversion->input_size / (1024.0 * 1024.0) / MAX (seconds, 1e-6));
+        } else {
+                converter->number_failed++;
+
+                g_printerr ("%s: %s\n", name, error->message);
+        }
+        g_mutex_unlock (&converter->lock);
+}
+
+static int
+compare_conversions_by_size (ChipsConversion **a,
+                             ChipsConversion **b)
+{
+        if ((*a)->input_size == (*b)->input_size) {
+                return 0;
+        }
+
+        return (*a)->input_size > (*b)->input_size? -1 : 1;
+}
+
+/* Converts everything added, printing how long each model took as it
+ * finishes, and a total at the end.  Returns FALSE if any model
+ * couldn't be converted.
+ */
+gboolean
+chips_model_converter_run (ChipsModelConverter *converter)
+{
+        g_autoptr (GError) error = NULL;
+        GThreadPool *thread_pool;
+        gint64 start_time;
+        double seconds;
+        size_t i;
+
+        /* The biggest go first, so no big one is left running alone at
+         * the end while every other thread sits idle
+         */
+        g_ptr_array_sort (converter->conversions, (GCompareFunc) compare_conversions_by_size);
+
+        thread_pool = g_thread_pool_new ((GFunc) convert_in_thread,
+                                         converter,
+                                         converter->number_of_jobs,
+                                         TRUE,
+                                         &error);
+
+        if (thread_pool == NULL) {
+                g_printerr ("%s\n", error->message);
+                return FALSE;
+        }
+
+        start_time = g_get_monotonic_time ();
+
+        for (i = 0; i < converter->conversions->len; i++) {
+                g_thread_pool_push (thread_pool, g_ptr_array_index (converter->conversions, i), NULL);
+        }
+
+        g_thread_pool_free (thread_pool, FALSE, TRUE);
+
+        seconds = (g_get_monotonic_time () - start_time) / (double) G_USEC_PER_SEC;
+
+        g_print ("converted %u of %u models in %.2f s, %.1f MB/s\n",
+                 converter->number_converted,
+                 converter->conversions->len,
+                 seconds,
+                 converter->bytes_converted / (1024.0 * 1024.0) / MAX (seconds, 1e-6));
+
+        return converter->number_failed == 0;
+}
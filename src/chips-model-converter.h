@@ -0,0 +1,40 @@
+/* chips-model-converter.h
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CHIPS_MODEL_CONVERTER_H
+#define CHIPS_MODEL_CONVERTER_H
+
+#include "chips.h"
+
+/* Runs many models through the import and processing pipeline at once,
+ * without a display, so a whole library can be prepared ahead of time
+ */
+typedef struct _ChipsModelConverter ChipsModelConverter;
+
+ChipsModelConverter *chips_model_converter_new      (const char           *output_directory,
+                                                     unsigned int          number_of_jobs,
+                                                     guint64               memory_budget);
+void                 chips_model_converter_free     (ChipsModelConverter  *converter);
+
+gboolean             chips_model_converter_add_path (ChipsModelConverter  *converter,
+                                                     const char           *path,
+                                                     GError              **error);
+gboolean             chips_model_converter_run      (ChipsModelConverter  *converter);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ChipsModelConverter, chips_model_converter_free);
+
+#endif /* CHIPS_MODEL_CONVERTER_H */
@@ -0,0 +1,322 @@
+/* chips-obj-importer.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chips-importer.h"
+#include "chips-parallel.h"
+
+/* Negative (relative) face indices can't be resolved until we know how
+ * many vertices the chunks before this one have, so they're stored
+ * biased far below zero and fixed up when the chunks are merged
+ */
+#define RELATIVE_INDEX_BIAS ((gint64) 1 << 40)
+
+typedef struct
+{
+        ChipsTextChunk  text;
+
+        GArray         *positions;
+        GArray         *indices;
+
+        size_t          vertex_offset;
+        size_t          index_offset;
+} ObjChunk;
+
+typedef struct
+{
+        ObjChunk                *chunks;
+        size_t                   number_of_chunks;
+
+        ChipsImportProgressFunc  progress_func;
+        gpointer                 user_data;
+
+        float                   *vertex_buffer;
+        guint32                 *vertex_arrangement;
+        size_t                   number_of_vertices;
+
+        volatile int             has_syntax_error;
+        volatile int             has_bad_index;
+} ObjImport;
+
+static gboolean
+is_blank (char character)
+{
+        return character == ' ' || character == '\t';
+}
+
+static const char *
+parse_face (ObjChunk   *chunk,
+            const char *cursor,
+            const char *end)
+{
+        gint64 first_index = 0, previous_index = 0;
+        size_t number_of_corners = 0;
+
+        while (TRUE) {
+                gint64 value = 0, index;
+                gboolean negative = FALSE;
+                gboolean has_digits = FALSE;
+
+                cursor = chips_importer_skip_blanks (cursor, end);
+
+                if (cursor >= end || *cursor == '\n' || *cursor == '#') {
+                        break;
+                }
+
+                if (*cursor == '-') {
+                        negative = TRUE;
+                        cursor++;
+                }
+
+                while (cursor < end && g_ascii_isdigit (*cursor)) {
+                        if (value >= RELATIVE_INDEX_BIAS / 2) {
+                                return NULL;
+                        }
+
+                        value = value * 10 + (*cursor - '0');
+                        has_digits = TRUE;
+                        cursor++;
+                }
+
+                if (!has_digits || value == 0) {
+                        return NULL;
+                }
+
+                /* Skip texture coordinate and normal references */
+                while (cursor < end && !is_blank (*cursor) && *cursor != '\r' && *cursor != '\n') {
+                        cursor++;
+                }
+
+                if (negative) {
+                        index = (gint64) (chunk->positions->len / 3) - value - RELATIVE_INDEX_BIAS;
+                } else {
+                        index = value - 1;
+                }
+
+                if (number_of_corners == 0) {
+                        first_index = index;
+                } else if (number_of_corners >= 2) {
+                        g_array_append_val (chunk->indices, first_index);
+                        g_array_append_val (chunk->indices, previous_index);
+                        g_array_append_val (chunk->indices, index);
+                }
+
+                previous_index = index;
+                number_of_corners++;
+        }
+
+        return cursor;
+}
+
+static gboolean
+parse_chunk (ObjChunk *chunk)
+{
+        const char *cursor = chunk->text.start;
+        const char *end = chunk->text.end;
+
+        while (cursor < end) {
+                cursor = chips_importer_skip_blanks (cursor, end);
+
+                if (end - cursor > 2 && cursor[0] == 'v' && is_blank (cursor[1])) {
+                        float position[3];
+                        size_t i;
+
+                        cursor += 2;
+
+                        for (i = 0; i < G_N_ELEMENTS (position); i++) {
+                                if (!chips_importer_parse_float (&cursor, end, &position[i])) {
+                                        return FALSE;
+                                }
+                        }
+
+                        g_array_append_vals (chunk->positions, position, G_N_ELEMENTS (position));
+                } else if (end - cursor > 2 && cursor[0] == 'f' && is_blank (cursor[1])) {
+                        cursor = parse_face (chunk, cursor + 2, end);
+
+                        if (cursor == NULL) {
+                                return FALSE;
+                        }
+                }
+
+                cursor = chips_importer_skip_line (cursor, end);
+        }
+
+        return TRUE;
+}
+
+static void
+parse_chunks (size_t     start,
+              size_t     end,
+              ObjImport *import)
+{
+        size_t i;
+
+        for (i = start; i < end; i++) {
+                ObjChunk *chunk = &import->chunks[i];
+
+                if (!parse_chunk (chunk)) {
+                        g_atomic_int_set (&import->has_syntax_error, TRUE);
+                }
+
+                if (import->progress_func != NULL) {
+                        import->progress_func (chunk->text.end - chunk->text.start,
+                                               chunk->positions->len / 3,
+                                               import->user_data);
+                }
+        }
+}
+
+static void
+merge_chunks (size_t     start,
+              size_t     end,
+              ObjImport *import)
+{
+        size_t i, j;
+
+        for (i = start; i < end; i++) {
+                ObjChunk *chunk = &import->chunks[i];
+                const gint64 *indices = (const gint64 *) chunk->indices->data;
+
+                if (chunk->positions->len > 0) {
+                        memcpy (import->vertex_buffer + chunk->vertex_offset * 3,
+                                chunk->positions->data,
+                                chunk->positions->len * sizeof (float));
+                }
+
+                for (j = 0; j < chunk->indices->len; j++) {
+                        gint64 index = indices[j];
+
+                        if (index < 0) {
+                                index += RELATIVE_INDEX_BIAS + chunk->vertex_offset;
+                        }
+
+                        if (index < 0 || (guint64) index >= import->number_of_vertices) {
+                                g_atomic_int_set (&import->has_bad_index, TRUE);
+                                index = 0;
+                        }
+
+                        import->vertex_arrangement[chunk->index_offset + j] = index;
+                }
+
+                g_clear_pointer (&chunk->positions, g_array_unref);
+                g_clear_pointer (&chunk->indices, g_array_unref);
+        }
+}
+
+static void
+clear_chunks (ObjImport *import)
+{
+        size_t i;
+
+        for (i = 0; i < import->number_of_chunks; i++) {
+                g_clear_pointer (&import->chunks[i].positions, g_array_unref);
+                g_clear_pointer (&import->chunks[i].indices, g_array_unref);
+        }
+
+        g_clear_pointer (&import->chunks, g_free);
+}
+
+gboolean
+chips_import_obj (GBytes                   *contents,
+                  ChipsImportedMesh        *mesh,
+                  ChipsImportProgressFunc   progress_func,
+                  gpointer                  user_data,
+                  GCancellable             *cancellable,
+                  GError                  **error)
+{
+        g_autoptr (GArray) text_chunks = NULL;
+        ObjImport import = { 0 };
+        const char *data;
+        size_t size;
+        size_t number_of_indices = 0;
+        size_t i;
+        gboolean succeeded = FALSE;
+
+        data = g_bytes_get_data (contents, &size);
+        text_chunks = chips_importer_split_lines (data, size, CHIPS_IMPORTER_CHUNK_SIZE);
+
+        import.number_of_chunks = text_chunks->len;
+        import.chunks = g_new0 (ObjChunk, import.number_of_chunks);
+        import.progress_func = progress_func;
+        import.user_data = user_data;
+
+        for (i = 0; i < import.number_of_chunks; i++) {
+                import.chunks[i].text = g_array_index (text_chunks, ChipsTextChunk, i);
+                import.chunks[i].positions = g_array_new (FALSE, FALSE, sizeof (float));
+                import.chunks[i].indices = g_array_new (FALSE, FALSE, sizeof (gint64));
+        }
+
+        if (!chips_parallel_for (import.number_of_chunks, 1,
+                                 (ChipsParallelFunc) parse_chunks,
+                                 &import,
+                                 cancellable,
+                                 error)) {
+                goto out;
+        }
+
+        if (import.has_syntax_error) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "malformed vertex or face statement");
+                goto out;
+        }
+
+        for (i = 0; i < import.number_of_chunks; i++) {
+                import.chunks[i].vertex_offset = import.number_of_vertices;
+                import.chunks[i].index_offset = number_of_indices;
+
+                import.number_of_vertices += import.chunks[i].positions->len / 3;
+                number_of_indices += import.chunks[i].indices->len;
+        }
+
+        if (import.number_of_vertices > G_MAXUINT32 || number_of_indices > G_MAXUINT32) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                             "model has too many vertices");
+                goto out;
+        }
+
+        import.vertex_buffer = g_new (float, import.number_of_vertices * 3);
+        import.vertex_arrangement = g_new (guint32, number_of_indices);
+
+        mesh->vertex_buffer = g_bytes_new_take (import.vertex_buffer,
+                                                import.number_of_vertices * 3 * sizeof (float));
+        mesh->number_of_vertices = import.number_of_vertices;
+        mesh->vertex_arrangement = g_bytes_new_take (import.vertex_arrangement,
+                                                     number_of_indices * sizeof (guint32));
+        mesh->number_of_indices = number_of_indices;
+        mesh->index_size = sizeof (guint32);
+
+        if (!chips_parallel_for (import.number_of_chunks, 1,
+                                 (ChipsParallelFunc) merge_chunks,
+                                 &import,
+                                 cancellable,
+                                 error)) {
+                chips_imported_mesh_clear (mesh);
+                goto out;
+        }
+
+        if (import.has_bad_index) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "face refers to a vertex that doesn't exist");
+                chips_imported_mesh_clear (mesh);
+                goto out;
+        }
+
+        succeeded = TRUE;
+out:
+        clear_chunks (&import);
+
+        return succeeded;
+}
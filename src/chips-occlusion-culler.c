@@ -0,0 +1,325 @@
+/* chips-occlusion-culler.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chips-occlusion-culler.h"
+
+typedef struct
+{
+        unsigned int query_id;
+        unsigned int pending : 1;
+        unsigned int visible : 1;
+} ChipsOcclusionState;
+
+struct _ChipsOcclusionCuller
+{
+        ChipsShaderProgram *program;
+
+        unsigned int vertex_array_id;
+        unsigned int box_vertex_buffer_id;
+        unsigned int box_index_buffer_id;
+        GLenum       query_target;
+
+        GArray *objects;
+        size_t  number_of_pending_tests;
+        guint   frame;
+
+        graphene_point3d_t camera_position;
+        float              near_plane;
+
+        unsigned int visibility_changed : 1;
+};
+
+/* Visible objects rarely disappear from one frame to the next, so they
+ * only get tested again every few frames, a different few for each
+ * object so the queries are spread out
+ */
+#define VISIBLE_RETEST_INTERVAL 8
+
+/* The corners of a unit cube, stretched over each box by its position
+ * encoding
+ */
+static const float box_corners[] = {
+        0.0f, 0.0f, 0.0f,
+        1.0f, 0.0f, 0.0f,
+        0.0f, 1.0f, 0.0f,
+        1.0f, 1.0f, 0.0f,
+        0.0f, 0.0f, 1.0f,
+        1.0f, 0.0f, 1.0f,
+        0.0f, 1.0f, 1.0f,
+        1.0f, 1.0f, 1.0f,
+};
+
+static const guint8 box_triangles[] = {
+        0, 2, 1, 1, 2, 3,
+        4, 5, 6, 5, 7, 6,
+        0, 1, 4, 1, 5, 4,
+        2, 6, 3, 3, 6, 7,
+        0, 4, 2, 2, 4, 6,
+        1, 3, 5, 3, 7, 5,
+};
+
+/* Needs the same current GL context as the renderer drawing the
+ * objects.  The boxes go through the same program, placed by the first
+ * transform in instance_buffer_id, with whatever matrices the program
+ * was last given.
+ */
+ChipsOcclusionCuller *
+chips_occlusion_culler_new (ChipsShaderProgram *program,
+                            unsigned int        instance_buffer_id)
+{
+        ChipsOcclusionCuller *culler;
+        int position_id;
+
+        culler = g_slice_new0 (ChipsOcclusionCuller);
+        culler->program = program;
+        culler->objects = g_array_new (FALSE, TRUE, sizeof (ChipsOcclusionState));
+
+        /* Whether any sample passed is all that matters, and can come
+         * back sooner than how many did
+         */
+        if (epoxy_gl_version () >= 33 || epoxy_has_gl_extension ("GL_ARB_occlusion_query2")) {
+                culler->query_target = GL_ANY_SAMPLES_PASSED;
+        } else {
+                culler->query_target = GL_SAMPLES_PASSED;
+        }
+
+        glGenVertexArrays (1, &culler->vertex_array_id);
+        glBindVertexArray (culler->vertex_array_id);
+
+        glGenBuffers (1, &culler->box_vertex_buffer_id);
+        glBindBuffer (GL_ARRAY_BUFFER, culler->box_vertex_buffer_id);
+        glBufferData (GL_ARRAY_BUFFER, sizeof (box_corners), box_corners, GL_STATIC_DRAW);
+
+        position_id = program->vertex_attribute_ids[CHIPS_VERTEX_ATTRIBUTE_POSITION];
+        glEnableVertexAttribArray (position_id);
+        glVertexAttribPointer (position_id, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+
+        glGenBuffers (1, &culler->box_index_buffer_id);
+        glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, culler->box_index_buffer_id);
+        glBufferData (GL_ELEMENT_ARRAY_BUFFER, sizeof (box_triangles), box_triangles, GL_STATIC_DRAW);
+
+        glBindBuffer (GL_ARRAY_BUFFER, instance_buffer_id);
+        chips_shader_program_bind_instances (program, CHIPS_INSTANCE_TRANSFORM_SIZE, 0, FALSE);
+
+        return culler;
+}
+
+static void
+delete_queries (ChipsOcclusionCuller *culler)
+{
+        size_t i;
+
+        for (i = 0; i < culler->objects->len; i++) {
+                ChipsOcclusionState *state = &g_array_index (culler->objects, ChipsOcclusionState, i);
+
+                if (state->query_id != 0) {
+                        glDeleteQueries (1, &state->query_id);
+                }
+        }
+
+        culler->number_of_pending_tests = 0;
+}
+
+void
+chips_occlusion_culler_free (ChipsOcclusionCuller *culler)
+{
+        delete_queries (culler);
+
+        glDeleteBuffers (1, &culler->box_vertex_buffer_id);
+        glDeleteBuffers (1, &culler->box_index_buffer_id);
+        glDeleteVertexArrays (1, &culler->vertex_array_id);
+
+        g_clear_pointer (&culler->objects, g_array_unref);
+
+        g_slice_free (ChipsOcclusionCuller, culler);
+}
+
+/* Forgets everything about the old objects.  Until they've been
+ * tested, the new ones all count as visible.
+ */
+void
+chips_occlusion_culler_reset (ChipsOcclusionCuller *culler,
+                              size_t                number_of_objects)
+{
+        size_t i;
+
+        delete_queries (culler);
+
+        g_array_set_size (culler->objects, 0);
+        g_array_set_size (culler->objects, number_of_objects);
+
+        for (i = 0; i < number_of_objects; i++) {
+                g_array_index (culler->objects, ChipsOcclusionState, i).visible = TRUE;
+        }
+
+        culler->visibility_changed = TRUE;
+}
+
+/* Picks up the answers to whichever queries the GPU has gotten to, never
+ * waiting on the rest.  Returns whether any object changed visibility
+ * since the last call.
+ */
+gboolean
+chips_occlusion_culler_collect_results (ChipsOcclusionCuller *culler)
+{
+        gboolean visibility_changed = culler->visibility_changed;
+        size_t i;
+
+        culler->visibility_changed = FALSE;
+
+        for (i = 0; i < culler->objects->len && culler->number_of_pending_tests > 0; i++) {
+                ChipsOcclusionState *state = &g_array_index (culler->objects, ChipsOcclusionState, i);
+                GLuint available, samples_passed;
+
+                if (!state->pending) {
+                        continue;
+                }
+
+                glGetQueryObjectuiv (state->query_id, GL_QUERY_RESULT_AVAILABLE, &available);
+
+                if (!available) {
+                        continue;
+                }
+
+                glGetQueryObjectuiv (state->query_id, GL_QUERY_RESULT, &samples_passed);
+
+                if (state->visible != (samples_passed != 0)) {
+                        state->visible = samples_passed != 0;
+                        visibility_changed = TRUE;
+                }
+
+                state->pending = FALSE;
+                culler->number_of_pending_tests--;
+        }
+
+        return visibility_changed;
+}
+
+gboolean
+chips_occlusion_culler_is_visible (ChipsOcclusionCuller *culler,
+                                   size_t                object)
+{
+        g_return_val_if_fail (object < culler->objects->len, TRUE);
+
+        return g_array_index (culler->objects, ChipsOcclusionState, object).visible;
+}
+
+gboolean
+chips_occlusion_culler_has_pending_tests (ChipsOcclusionCuller *culler)
+{
+        return culler->number_of_pending_tests > 0;
+}
+
+/* Should come after everything that could hide the objects has been
+ * drawn.  camera_position is in the same space as the boxes, which
+ * nothing within near_plane of can be tested, since the near plane would
+ * clip away the faces of the box in front of it.
+ */
+void
+chips_occlusion_culler_begin_tests (ChipsOcclusionCuller     *culler,
+                                    const graphene_point3d_t *camera_position,
+                                    float                     near_plane)
+{
+        culler->camera_position = *camera_position;
+        culler->near_plane = near_plane;
+        culler->frame++;
+
+        glBindVertexArray (culler->vertex_array_id);
+
+        glColorMask (GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask (GL_FALSE);
+        glDisable (GL_CULL_FACE);
+}
+
+static gboolean
+box_contains_camera (ChipsOcclusionCuller *culler,
+                     const ChipsBox       *box)
+{
+        float camera_position[3] = {
+                culler->camera_position.x,
+                culler->camera_position.y,
+                culler->camera_position.z
+        };
+        size_t k;
+
+        for (k = 0; k < 3; k++) {
+                if (fabsf (camera_position[k] - box->center[k]) > box->extent[k] + culler->near_plane) {
+                        return FALSE;
+                }
+        }
+
+        return TRUE;
+}
+
+/* Queues a test of the box around object, unless one is still out, or
+ * the object was visible and isn't due for another look
+ */
+void
+chips_occlusion_culler_test_box (ChipsOcclusionCuller *culler,
+                                 size_t                object,
+                                 const ChipsBox       *box)
+{
+        ChipsOcclusionState *state;
+        ChipsVertexFormat box_format = { 0 };
+        size_t k;
+
+        g_return_if_fail (object < culler->objects->len);
+
+        state = &g_array_index (culler->objects, ChipsOcclusionState, object);
+
+        if (state->pending) {
+                return;
+        }
+
+        if (state->visible && (culler->frame + object) % VISIBLE_RETEST_INTERVAL != 0) {
+                return;
+        }
+
+        if (box_contains_camera (culler, box)) {
+                if (!state->visible) {
+                        state->visible = TRUE;
+                        culler->visibility_changed = TRUE;
+                }
+                return;
+        }
+
+        for (k = 0; k < 3; k++) {
+                box_format.position_offset[k] = box->center[k] - box->extent[k];
+                box_format.position_scale[k] = 2.0f * box->extent[k];
+        }
+
+        chips_shader_program_set_position_encoding (culler->program, &box_format);
+
+        if (state->query_id == 0) {
+                glGenQueries (1, &state->query_id);
+        }
+
+        glBeginQuery (culler->query_target, state->query_id);
+        glDrawElements (GL_TRIANGLES, G_N_ELEMENTS (box_triangles), GL_UNSIGNED_BYTE, NULL);
+        glEndQuery (culler->query_target);
+
+        state->pending = TRUE;
+        culler->number_of_pending_tests++;
+}
+
+void
+chips_occlusion_culler_end_tests (ChipsOcclusionCuller *culler)
+{
+        glColorMask (GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthMask (GL_TRUE);
+        glEnable (GL_CULL_FACE);
+}
@@ -0,0 +1,53 @@
+/* chips-occlusion-culler.h
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CHIPS_OCCLUSION_CULLER_H
+#define CHIPS_OCCLUSION_CULLER_H
+
+#include "chips.h"
+#include "chips-culling.h"
+#include "chips-shader-program.h"
+
+/* Keeps track of which of a set of objects something else got drawn in
+ * front of, by drawing their bounding boxes against the depth buffer
+ * with occlusion queries.  The answers come back a frame or more late,
+ * so what was visible last time is what gets drawn now.
+ */
+typedef struct _ChipsOcclusionCuller ChipsOcclusionCuller;
+
+ChipsOcclusionCuller *chips_occlusion_culler_new               (ChipsShaderProgram       *program,
+                                                                unsigned int              instance_buffer_id);
+void                  chips_occlusion_culler_free              (ChipsOcclusionCuller     *culler);
+
+void                  chips_occlusion_culler_reset             (ChipsOcclusionCuller     *culler,
+                                                                size_t                    number_of_objects);
+gboolean              chips_occlusion_culler_collect_results   (ChipsOcclusionCuller     *culler);
+gboolean              chips_occlusion_culler_is_visible        (ChipsOcclusionCuller     *culler,
+                                                                size_t                    object);
+gboolean              chips_occlusion_culler_has_pending_tests (ChipsOcclusionCuller     *culler);
+
+void                  chips_occlusion_culler_begin_tests       (ChipsOcclusionCuller     *culler,
+                                                                const graphene_point3d_t *camera_position,
+                                                                float                     near_plane);
+void                  chips_occlusion_culler_test_box          (ChipsOcclusionCuller     *culler,
+                                                                size_t                    object,
+                                                                const ChipsBox           *box);
+void                  chips_occlusion_culler_end_tests         (ChipsOcclusionCuller     *culler);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ChipsOcclusionCuller, chips_occlusion_culler_free);
+
+#endif /* CHIPS_OCCLUSION_CULLER_H */
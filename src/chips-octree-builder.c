@@ -0,0 +1,781 @@
+/* chips-octree-builder.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chips-octree.h"
+#include "chips-3d-model.h"
+#include "chips-importer.h"
+#include "chips-mesh-optimizer.h"
+#include "chips-mesh-simplifier.h"
+
+#include <errno.h>
+#include <string.h>
+#include <glib/gstdio.h>
+
+#define BINARY_STL_HEADER_SIZE 84
+#define BINARY_STL_TRIANGLE_SIZE 50
+
+/* Past this, a node that's still too big is kept as a leaf anyway,
+ * which only happens with piles of triangles in the same spot
+ */
+#define MAXIMUM_DEPTH 20
+
+/* Each node hands this fraction of its size up to its parent, so the
+ * eight children together make a parent about as big as a leaf
+ */
+#define PROXY_FRACTION 8
+
+#define SINK_BUFFER_SIZE (1024 * 1024)
+
+typedef struct
+{
+        char                          *directory;
+        size_t                         triangles_per_node;
+        GArray                        *nodes;
+        guint                          next_partition_id;
+
+        guint64                        triangles_built;
+        guint64                        number_of_triangles;
+        ChipsOctreeBuildProgressFunc   progress_func;
+        gpointer                       user_data;
+
+        GCancellable                  *cancellable;
+} OctreeBuilder;
+
+/* Binary STL is the one format where the triangles can be read
+ * straight out of a mapping without parsing the whole file first, so
+ * the input and every intermediate file use it
+ */
+typedef struct
+{
+        GMappedFile  *mapped_file;
+        const guint8 *triangles;
+        guint32       number_of_triangles;
+} TriangleSource;
+
+typedef struct
+{
+        char          *filename;
+        GOutputStream *file_stream;
+        GOutputStream *stream;
+        guint32        number_of_triangles;
+} TriangleSink;
+
+static gboolean
+triangle_source_open (TriangleSource  *source,
+                      const char      *filename,
+                      GError         **error)
+{
+        const guint8 *data;
+        size_t size;
+        guint32 number_of_triangles;
+
+        source->mapped_file = g_mapped_file_new (filename, FALSE, error);
+
+        if (source->mapped_file == NULL) {
+                return FALSE;
+        }
+
+        data = (const guint8 *) g_mapped_file_get_contents (source->mapped_file);
+        size = g_mapped_file_get_length (source->mapped_file);
+
+        if (size >= BINARY_STL_HEADER_SIZE) {
+                memcpy (&number_of_triangles, data + 80, sizeof (number_of_triangles));
+                number_of_triangles = GUINT32_FROM_LE (number_of_triangles);
+        }
+
+        if (size < BINARY_STL_HEADER_SIZE ||
+            size != BINARY_STL_HEADER_SIZE + (guint64) number_of_triangles * BINARY_STL_TRIANGLE_SIZE) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                             "'%s' is not a binary STL file", filename);
+                return FALSE;
+        }
+
+        source->triangles = data + BINARY_STL_HEADER_SIZE;
+        source->number_of_triangles = number_of_triangles;
+
+        return TRUE;
+}
+
+static void
+triangle_source_clear (TriangleSource *source)
+{
+        g_clear_pointer (&source->mapped_file, g_mapped_file_unref);
+        source->triangles = NULL;
+        source->number_of_triangles = 0;
+}
+
+static void
+triangle_source_get_triangle (const TriangleSource *source,
+                              size_t                triangle,
+                              float                 vertices[9])
+{
+        /* Past the facet normal, and unaligned, since records are 50
+         * bytes long
+         */
+        memcpy (vertices,
+                source->triangles + triangle * BINARY_STL_TRIANGLE_SIZE + 3 * sizeof (float),
+                9 * sizeof (float));
+
+#if G_BYTE_ORDER != G_LITTLE_ENDIAN
+        {
+                size_t i;
+
+                for (i = 0; i < 9; i++) {
+                        guint32 bits;
+
+                        memcpy (&bits, &vertices[i], sizeof (bits));
+                        bits = GUINT32_SWAP_LE_BE (bits);
+                        memcpy (&vertices[i], &bits, sizeof (bits));
+                }
+        }
+#endif
+}
+
+static gboolean
+triangle_sink_open (OctreeBuilder  *builder,
+                    TriangleSink   *sink,
+                    GError        **error)
+{
+        g_autofree char *basename = NULL;
+        g_autoptr (GFile) file = NULL;
+        guint8 header[BINARY_STL_HEADER_SIZE] = { 0 };
+
+        basename = g_strdup_printf ("partition-%u.stl", builder->next_partition_id++);
+        sink->filename = g_build_filename (builder->directory, basename, NULL);
+
+        file = g_file_new_for_path (sink->filename);
+        sink->file_stream = G_OUTPUT_STREAM (g_file_replace (file, NULL, FALSE, G_FILE_CREATE_NONE, builder->cancellable, error));
+
+        if (sink->file_stream == NULL) {
+                return FALSE;
+        }
+
+        sink->stream = g_buffered_output_stream_new_sized (sink->file_stream, SINK_BUFFER_SIZE);
+        sink->number_of_triangles = 0;
+
+        /* The triangle count gets filled in on close */
+        return g_output_stream_write_all (sink->stream, header, sizeof (header), NULL, builder->cancellable, error);
+}
+
+static gboolean
+triangle_sink_add_triangle (TriangleSink  *sink,
+                            const float    vertices[9],
+                            GCancellable  *cancellable,
+                            GError       **error)
+{
+        guint8 record[BINARY_STL_TRIANGLE_SIZE] = { 0 };
+        size_t i;
+
+        if (sink->number_of_triangles == G_MAXUINT32) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                             "too many triangles for one STL file");
+                return FALSE;
+        }
+
+        for (i = 0; i < 9; i++) {
+                guint32 bits;
+
+                memcpy (&bits, &vertices[i], sizeof (bits));
+                bits = GUINT32_TO_LE (bits);
+                memcpy (record + (3 + i) * sizeof (float), &bits, sizeof (bits));
+        }
+
+        sink->number_of_triangles++;
+
+        return g_output_stream_write_all (sink->stream, record, sizeof (record), NULL, cancellable, error);
+}
+
+static gboolean
+triangle_sink_close (TriangleSink  *sink,
+                     GCancellable  *cancellable,
+                     GError       **error)
+{
+        guint32 number_of_triangles;
+
+        if (!g_output_stream_flush (sink->stream, cancellable, error)) {
+                return FALSE;
+        }
+
+        if (!g_seekable_seek (G_SEEKABLE (sink->file_stream), 80, G_SEEK_SET, cancellable, error)) {
+                return FALSE;
+        }
+
+        number_of_triangles = GUINT32_TO_LE (sink->number_of_triangles);
+
+        if (!g_output_stream_write_all (sink->file_stream,
+                                        &number_of_triangles,
+                                        sizeof (number_of_triangles),
+                                        NULL,
+                                        cancellable,
+                                        error)) {
+                return FALSE;
+        }
+
+        return g_output_stream_close (sink->stream, cancellable, error);
+}
+
+/* Deletes the file too, unless keep_file says otherwise */
+static void
+triangle_sink_clear (TriangleSink *sink,
+                     gboolean      keep_file)
+{
+        if (sink->stream != NULL && !g_output_stream_is_closed (sink->stream)) {
+                g_output_stream_close (sink->stream, NULL, NULL);
+        }
+
+        if (sink->filename != NULL && !keep_file) {
+                g_unlink (sink->filename);
+        }
+
+        g_clear_object (&sink->stream);
+        g_clear_object (&sink->file_stream);
+        g_clear_pointer (&sink->filename, g_free);
+}
+
+/* Takes triangles, nine floats each, down to at most
+ * maximum_number_of_triangles, or as close as simplification gets,
+ * with the same simplifier that builds levels of detail for models
+ */
+static GArray *
+simplify_triangles (GArray        *triangles,
+                    size_t         maximum_number_of_triangles,
+                    float         *simplification_error,
+                    GCancellable  *cancellable,
+                    GError       **error)
+{
+        ChipsImportedMesh mesh = { 0 };
+        ChipsMeshLevelOfDetail level = { 0 };
+        const guint8 *indices;
+        const float *positions;
+        guint32 *arrangement;
+        GArray *simplified;
+        size_t number_of_triangles, i;
+
+        number_of_triangles = triangles->len / 9;
+        *simplification_error = 0.0f;
+
+        if (number_of_triangles <= maximum_number_of_triangles) {
+                simplified = g_array_sized_new (FALSE, FALSE, sizeof (float), triangles->len);
+                g_array_append_vals (simplified, triangles->data, triangles->len);
+                return simplified;
+        }
+
+        arrangement = g_new (guint32, number_of_triangles * 3);
+
+        for (i = 0; i < number_of_triangles * 3; i++) {
+                arrangement[i] = i;
+        }
+
+        mesh.vertex_buffer = g_bytes_new (triangles->data, triangles->len * sizeof (float));
+        mesh.number_of_vertices = number_of_triangles * 3;
+        mesh.vertex_arrangement = g_bytes_new_take (arrangement, number_of_triangles * 3 * sizeof (guint32));
+        mesh.number_of_indices = number_of_triangles * 3;
+        mesh.index_size = sizeof (guint32);
+
+        if (!chips_mesh_weld_vertices (&mesh, 0.0f, cancellable, error) ||
+            !chips_mesh_build_levels_of_detail (&mesh, maximum_number_of_triangles, cancellable, error)) {
+                chips_imported_mesh_clear (&mesh);
+                return NULL;
+        }
+
+        /* Levels get coarser as they go, so the first one small enough
+         * is the most faithful one that fits
+         */
+        for (i = 0; i < chips_imported_mesh_get_number_of_levels (&mesh); i++) {
+                chips_imported_mesh_get_level (&mesh, i, &level);
+
+                if (level.number_of_indices / 3 <= maximum_number_of_triangles) {
+                        break;
+                }
+        }
+
+        positions = g_bytes_get_data (mesh.vertex_buffer, NULL);
+        indices = (const guint8 *) g_bytes_get_data (mesh.vertex_arrangement, NULL) + level.first_index * mesh.index_size;
+
+        simplified = g_array_sized_new (FALSE, FALSE, sizeof (float), level.number_of_indices * 3);
+
+        for (i = 0; i < level.number_of_indices; i++) {
+                guint32 index;
+
+                if (mesh.index_size == sizeof (guint16)) {
+                        index = ((const guint16 *) indices)[i];
+                } else {
+                        index = ((const guint32 *) indices)[i];
+                }
+
+                g_array_append_vals (simplified, positions + index * 3, 3);
+        }
+
+        *simplification_error = level.error;
+
+        chips_imported_mesh_clear (&mesh);
+
+        return simplified;
+}
+
+/* Runs the node's triangles through the same processing as any model
+ * that gets opened, and saves the result where the viewer looks for it
+ */
+static gboolean
+save_node_mesh (OctreeBuilder  *builder,
+                const char     *filename,
+                guint32         node_index,
+                GError        **error)
+{
+        g_autoptr (GFile) file = NULL;
+        g_autoptr (Chips3DModel) model = NULL;
+        g_autofree char *mesh_filename = NULL;
+        const ChipsMeshLevelOfDetail *level_of_detail;
+        ChipsOctreeNode *node;
+        graphene_box_t bounds;
+        graphene_point3d_t minimum, maximum;
+
+        file = g_file_new_for_path (filename);
+        model = g_initable_new (CHIPS_TYPE_3D_MODEL,
+                                builder->cancellable,
+                                error,
+                                "file", file,
+                                "use-cache", FALSE,
+                                NULL);
+
+        if (model == NULL) {
+                return FALSE;
+        }
+
+        mesh_filename = chips_octree_get_node_filename (builder->directory, node_index);
+
+        if (!chips_3d_model_save (model, mesh_filename, builder->cancellable, error)) {
+                return FALSE;
+        }
+
+        chips_3d_model_get_bounds (model, &bounds);
+        graphene_box_get_min (&bounds, &minimum);
+        graphene_box_get_max (&bounds, &maximum);
+        level_of_detail = chips_3d_model_get_level_of_detail (model, 0);
+
+        node = &g_array_index (builder->nodes, ChipsOctreeNode, node_index);
+        node->bounds_minimum[0] = minimum.x;
+        node->bounds_minimum[1] = minimum.y;
+        node->bounds_minimum[2] = minimum.z;
+        node->bounds_maximum[0] = maximum.x;
+        node->bounds_maximum[1] = maximum.y;
+        node->bounds_maximum[2] = maximum.z;
+        node->number_of_vertices = chips_3d_model_get_number_of_vertices (model);
+        node->number_of_indices = level_of_detail->number_of_indices;
+        node->vertex_stride = chips_3d_model_get_vertex_buffer_get_stride (model);
+        node->index_size = chips_3d_model_get_index_size (model);
+
+        return TRUE;
+}
+
+static GArray *
+read_triangles (const TriangleSource *source)
+{
+        GArray *triangles;
+        size_t i;
+
+        triangles = g_array_sized_new (FALSE, FALSE, sizeof (float), (size_t) source->number_of_triangles * 9);
+        g_array_set_size (triangles, (size_t) source->number_of_triangles * 9);
+
+        for (i = 0; i < source->number_of_triangles; i++) {
+                triangle_source_get_triangle (source, i, &g_array_index (triangles, float, i * 9));
+        }
+
+        return triangles;
+}
+
+static gboolean
+write_triangles (OctreeBuilder  *builder,
+                 GArray         *triangles,
+                 TriangleSink   *sink,
+                 GError        **error)
+{
+        size_t i;
+
+        if (!triangle_sink_open (builder, sink, error)) {
+                return FALSE;
+        }
+
+        for (i = 0; i < triangles->len; i += 9) {
+                if (!triangle_sink_add_triangle (sink, &g_array_index (triangles, float, i), builder->cancellable, error)) {
+                        return FALSE;
+                }
+        }
+
+        return triangle_sink_close (sink, builder->cancellable, error);
+}
+
+static void
+report_triangles_built (OctreeBuilder *builder,
+                        guint64        number_of_triangles)
+{
+        builder->triangles_built += number_of_triangles;
+
+        if (builder->progress_func != NULL) {
+                builder->progress_func (builder->triangles_built,
+                                        builder->number_of_triangles,
+                                        builder->user_data);
+        }
+}
+
+static gboolean build_node (OctreeBuilder   *builder,
+                            const char      *filename,
+                            gboolean         is_partition,
+                            const float      cube_minimum[3],
+                            float            cube_size,
+                            guint            depth,
+                            guint32         *node_index,
+                            GArray         **proxy,
+                            float           *proxy_error,
+                            GError         **error);
+
+/* Sends each triangle to the child its centroid falls in, through
+ * files, so only a buffer's worth of each child is in memory at once
+ */
+static gboolean
+partition_triangles (OctreeBuilder         *builder,
+                     const TriangleSource  *source,
+                     const float            cube_minimum[3],
+                     float                  half_size,
+                     TriangleSink           sinks[8],
+                     GError               **error)
+{
+        size_t i, j;
+
+        for (i = 0; i < 8; i++) {
+                if (!triangle_sink_open (builder, &sinks[i], error)) {
+                        return FALSE;
+                }
+        }
+
+        for (i = 0; i < source->number_of_triangles; i++) {
+                float vertices[9];
+                int octant = 0;
+
+                triangle_source_get_triangle (source, i, vertices);
+
+                for (j = 0; j < 3; j++) {
+                        float centroid = (vertices[j] + vertices[j + 3] + vertices[j + 6]) / 3.0f;
+
+                        if (centroid >= cube_minimum[j] + half_size) {
+                                octant |= 1 << j;
+                        }
+                }
+
+                if (!triangle_sink_add_triangle (&sinks[octant], vertices, builder->cancellable, error)) {
+                        return FALSE;
+                }
+        }
+
+        for (i = 0; i < 8; i++) {
+                if (!triangle_sink_close (&sinks[i], builder->cancellable, error)) {
+                        return FALSE;
+                }
+        }
+
+        return TRUE;
+}
+
+/* Builds the children first, then the node itself out of what the
+ * children hand up
+ */
+static gboolean
+build_interior_node (OctreeBuilder   *builder,
+                     TriangleSource  *source,
+                     const float      cube_minimum[3],
+                     float            cube_size,
+                     guint            depth,
+                     guint32          node_index,
+                     GArray         **triangles,
+                     float           *error_under_node,
+                     GError         **error)
+{
+        TriangleSink sinks[8] = { { 0 } };
+        float half_size = cube_size / 2.0f;
+        gboolean built = FALSE;
+        size_t i, j;
+
+        if (!partition_triangles (builder, source, cube_minimum, half_size, sinks, error)) {
+                goto out;
+        }
+
+        triangle_source_clear (source);
+
+        *triangles = g_array_new (FALSE, FALSE, sizeof (float));
+        *error_under_node = 0.0f;
+
+        for (i = 0; i < 8; i++) {
+                g_autoptr (GArray) proxy = NULL;
+                float child_minimum[3], proxy_error;
+                guint32 child_index;
+                ChipsOctreeNode *child;
+
+                if (sinks[i].number_of_triangles == 0) {
+                        continue;
+                }
+
+                for (j = 0; j < 3; j++) {
+                        child_minimum[j] = cube_minimum[j] + ((i & (1 << j))? half_size : 0.0f);
+                }
+
+                if (!build_node (builder,
+                                 sinks[i].filename,
+                                 TRUE,
+                                 child_minimum,
+                                 half_size,
+                                 depth + 1,
+                                 &child_index,
+                                 &proxy,
+                                 &proxy_error,
+                                 error)) {
+                        goto out;
+                }
+
+                child = &g_array_index (builder->nodes, ChipsOctreeNode, child_index);
+                *error_under_node = MAX (*error_under_node, child->error + proxy_error);
+
+                g_array_index (builder->nodes, ChipsOctreeNode, node_index).children[i] = child_index;
+                g_array_append_vals (*triangles, proxy->data, proxy->len);
+        }
+
+        built = TRUE;
+out:
+        for (i = 0; i < 8; i++) {
+                triangle_sink_clear (&sinks[i], FALSE);
+        }
+
+        return built;
+}
+
+/* Builds the node for the triangles in filename, which is deleted
+ * afterward if it's one of the builder's own partition files.  The
+ * node's triangles, simplified for its parent, go in proxy.
+ */
+static gboolean
+build_node (OctreeBuilder   *builder,
+            const char      *filename,
+            gboolean         is_partition,
+            const float      cube_minimum[3],
+            float            cube_size,
+            guint            depth,
+            guint32         *node_index,
+            GArray         **proxy,
+            float           *proxy_error,
+            GError         **error)
+{
+        TriangleSource source = { 0 };
+        TriangleSink sink = { 0 };
+        g_autoptr (GArray) triangles = NULL;
+        float node_error = 0.0f;
+        gboolean built = FALSE;
+
+        if (g_cancellable_set_error_if_cancelled (builder->cancellable, error)) {
+                return FALSE;
+        }
+
+        if (!triangle_source_open (&source, filename, error)) {
+                goto out;
+        }
+
+        *node_index = builder->nodes->len;
+        g_array_set_size (builder->nodes, builder->nodes->len + 1);
+
+        if (source.number_of_triangles <= builder->triangles_per_node || depth >= MAXIMUM_DEPTH) {
+                triangles = read_triangles (&source);
+                report_triangles_built (builder, source.number_of_triangles);
+
+                if (!save_node_mesh (builder, filename, *node_index, error)) {
+                        goto out;
+                }
+        } else {
+                if (!build_interior_node (builder,
+                                          &source,
+                                          cube_minimum,
+                                          cube_size,
+                                          depth,
+                                          *node_index,
+                                          &triangles,
+                                          &node_error,
+                                          error)) {
+                        goto out;
+                }
+
+                if (!write_triangles (builder, triangles, &sink, error) ||
+                    !save_node_mesh (builder, sink.filename, *node_index, error)) {
+                        goto out;
+                }
+        }
+
+        g_array_index (builder->nodes, ChipsOctreeNode, *node_index).error = node_error;
+
+        *proxy = simplify_triangles (triangles,
+                                     MAX (builder->triangles_per_node / PROXY_FRACTION, 1),
+                                     proxy_error,
+                                     builder->cancellable,
+                                     error);
+
+        built = *proxy != NULL;
+out:
+        triangle_source_clear (&source);
+        triangle_sink_clear (&sink, FALSE);
+
+        if (is_partition) {
+                g_unlink (filename);
+        }
+
+        return built;
+}
+
+static gboolean
+write_index (OctreeBuilder  *builder,
+             GError        **error)
+{
+        g_autofree char *filename = NULL;
+        g_autoptr (GByteArray) index = NULL;
+        ChipsOctreeHeader header = { { 0 } };
+
+        memcpy (header.magic, CHIPS_OCTREE_MAGIC, sizeof (header.magic));
+        header.version = CHIPS_OCTREE_VERSION;
+        header.number_of_nodes = builder->nodes->len;
+
+        index = g_byte_array_new ();
+        g_byte_array_append (index, (const guint8 *) &header, sizeof (header));
+        g_byte_array_append (index,
+                             (const guint8 *) builder->nodes->data,
+                             builder->nodes->len * sizeof (ChipsOctreeNode));
+
+        filename = g_build_filename (builder->directory, CHIPS_OCTREE_INDEX_FILENAME, NULL);
+
+        return g_file_set_contents (filename, (const char *) index->data, index->len, error);
+}
+
+/* The root covers a cube around the whole model, so every level of the
+ * tree splits all three axes evenly
+ */
+static void
+compute_root_cube (const TriangleSource *source,
+                   float                 cube_minimum[3],
+                   float                *cube_size)
+{
+        float minimum[3] = { G_MAXFLOAT, G_MAXFLOAT, G_MAXFLOAT };
+        float maximum[3] = { -G_MAXFLOAT, -G_MAXFLOAT, -G_MAXFLOAT };
+        size_t i, j;
+
+        for (i = 0; i < source->number_of_triangles; i++) {
+                float vertices[9];
+
+                triangle_source_get_triangle (source, i, vertices);
+
+                for (j = 0; j < 9; j++) {
+                        minimum[j % 3] = MIN (minimum[j % 3], vertices[j]);
+                        maximum[j % 3] = MAX (maximum[j % 3], vertices[j]);
+                }
+        }
+
+        *cube_size = 0.0f;
+
+        for (j = 0; j < 3; j++) {
+                cube_minimum[j] = minimum[j];
+                *cube_size = MAX (*cube_size, maximum[j] - minimum[j]);
+        }
+}
+
+/* Splits a binary STL file into an octree of mesh files in directory,
+ * with at most about triangles_per_node triangles in each node.  Only
+ * a handful of nodes are ever in memory at once, so the input can be
+ * far bigger than memory.
+ */
+gboolean
+chips_octree_build (GFile                         *input_file,
+                    const char                    *directory,
+                    size_t                         triangles_per_node,
+                    ChipsOctreeBuildProgressFunc   progress_func,
+                    gpointer                       user_data,
+                    GCancellable                  *cancellable,
+                    GError                       **error)
+{
+        OctreeBuilder builder = { 0 };
+        TriangleSource source = { 0 };
+        g_autofree char *filename = NULL;
+        g_autoptr (GArray) proxy = NULL;
+        float cube_minimum[3], cube_size, proxy_error;
+        guint32 root_index;
+        gboolean built = FALSE;
+
+        g_return_val_if_fail (triangles_per_node > 0, FALSE);
+
+        filename = g_file_get_path (input_file);
+
+        if (filename == NULL) {
+                g_autofree char *name = g_file_get_parse_name (input_file);
+
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                             "'%s' isn't a local file", name);
+                return FALSE;
+        }
+
+        if (!triangle_source_open (&source, filename, error)) {
+                return FALSE;
+        }
+
+        if (source.number_of_triangles == 0) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "'%s' has no triangles", filename);
+                triangle_source_clear (&source);
+                return FALSE;
+        }
+
+        compute_root_cube (&source, cube_minimum, &cube_size);
+
+        builder.directory = g_strdup (directory);
+        builder.triangles_per_node = triangles_per_node;
+        builder.nodes = g_array_new (FALSE, TRUE, sizeof (ChipsOctreeNode));
+        builder.number_of_triangles = source.number_of_triangles;
+        builder.progress_func = progress_func;
+        builder.user_data = user_data;
+        builder.cancellable = cancellable;
+
+        triangle_source_clear (&source);
+
+        if (g_mkdir_with_parents (directory, 0755) < 0) {
+                int saved_errno = errno;
+
+                g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                             "couldn't create '%s': %s", directory, g_strerror (saved_errno));
+                goto out;
+        }
+
+        if (!build_node (&builder,
+                         filename,
+                         FALSE,
+                         cube_minimum,
+                         cube_size,
+                         0,
+                         &root_index,
+                         &proxy,
+                         &proxy_error,
+                         error)) {
+                goto out;
+        }
+
+        built = write_index (&builder, error);
+out:
+        g_array_unref (builder.nodes);
+        g_free (builder.directory);
+
+        return built;
+}
@@ -0,0 +1,654 @@
+/* chips-octree-renderer.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chips-octree-renderer.h"
+#include "chips-culling.h"
+#include "chips-shader-program.h"
+
+#include <string.h>
+
+/* The pool always has room for at least this many nodes, even if that
+ * means going over the requested size
+ */
+#define MINIMUM_NUMBER_OF_SLOTS 16
+
+/* Node files are read on worker threads, and a few at a time keeps
+ * the disk busy without piling up models waiting for a slot
+ */
+#define MAXIMUM_LOADS_IN_FLIGHT 4
+
+#define NO_SLOT G_MAXUINT32
+#define NO_NODE G_MAXUINT32
+
+typedef enum
+{
+        NODE_STATE_UNLOADED = 0,
+        NODE_STATE_LOADING,
+        NODE_STATE_RESIDENT,
+        NODE_STATE_FAILED,
+} NodeState;
+
+typedef struct
+{
+        NodeState state;
+        guint32   slot;
+} NodeResidency;
+
+/* A fixed size piece of the vertex buffer and of the index buffer,
+ * holding one node's full detail geometry
+ */
+typedef struct
+{
+        guint32           node;
+        guint64           last_used_frame;
+        ChipsVertexFormat format;
+        guint32           number_of_indices;
+        guint32           index_size;
+} Slot;
+
+typedef struct
+{
+        guint32 node;
+        float   priority;
+} NodeRequest;
+
+typedef struct
+{
+        ChipsOctreeRenderer *renderer;
+        guint32              node;
+        Chips3DModel        *model;
+} NodeLoad;
+
+struct _ChipsOctreeRenderer
+{
+        ChipsOctree *octree;
+        NodeResidency *nodes;
+
+        Slot *slots;
+        guint32 number_of_slots;
+        size_t vertex_slot_size;
+        size_t index_slot_size;
+
+        unsigned int vertex_array_id;
+        unsigned int vertex_buffer_id;
+        unsigned int index_buffer_id;
+        unsigned int instance_buffer_id;
+        ChipsShaderProgram *program;
+
+        /* Counts draws, so slots not touched by the current one can
+         * be told apart from ones that are on screen
+         */
+        guint64 frame;
+
+        GArray *requests;
+        GQueue *loaded_nodes;
+        guint loads_in_flight;
+        GCancellable *cancellable;
+
+        float last_view[3 * 16];
+        int last_viewport_height;
+
+        /* Set when the view needs more nodes than fit in the pool, so
+         * the same ones don't get loaded and thrown away every frame
+         */
+        unsigned int pool_exhausted : 1;
+};
+
+static size_t
+round_up_to_multiple (size_t size,
+                      size_t multiple)
+{
+        return (size + multiple - 1) / multiple * multiple;
+}
+
+static void
+get_node_bounds (const ChipsOctreeNode *node,
+                 graphene_box_t        *bounds)
+{
+        graphene_point3d_t minimum, maximum;
+
+        graphene_point3d_init (&minimum, node->bounds_minimum[0], node->bounds_minimum[1], node->bounds_minimum[2]);
+        graphene_point3d_init (&maximum, node->bounds_maximum[0], node->bounds_maximum[1], node->bounds_maximum[2]);
+        graphene_box_init (bounds, &minimum, &maximum);
+}
+
+static gboolean
+is_leaf (const ChipsOctreeNode *node)
+{
+        size_t i;
+
+        for (i = 0; i < G_N_ELEMENTS (node->children); i++) {
+                if (node->children[i] != 0) {
+                        return FALSE;
+                }
+        }
+
+        return TRUE;
+}
+
+/* Every slot is big enough for the biggest node, so any node can go
+ * in any slot and the pool never fragments.  The octree doesn't have
+ * to stay around after this, but it's kept for its nodes.
+ *
+ * Needs a current GL context, which has to stay current for every
+ * other call, chips_octree_renderer_free included
+ */
+ChipsOctreeRenderer *
+chips_octree_renderer_new (ChipsOctree *octree,
+                           guint64      pool_size)
+{
+        ChipsOctreeRenderer *renderer;
+        size_t number_of_nodes, i;
+        guint64 slot_size;
+        float identity[16];
+        graphene_matrix_t identity_matrix;
+
+        renderer = g_slice_new0 (ChipsOctreeRenderer);
+        renderer->octree = octree;
+
+        number_of_nodes = chips_octree_get_number_of_nodes (octree);
+        renderer->nodes = g_new0 (NodeResidency, number_of_nodes);
+
+        for (i = 0; i < number_of_nodes; i++) {
+                const ChipsOctreeNode *node = chips_octree_get_node (octree, i);
+
+                renderer->nodes[i].slot = NO_SLOT;
+                renderer->vertex_slot_size = MAX (renderer->vertex_slot_size,
+                                                  (size_t) node->number_of_vertices * node->vertex_stride);
+                renderer->index_slot_size = MAX (renderer->index_slot_size,
+                                                 (size_t) node->number_of_indices * node->index_size);
+        }
+
+        /* Vertex attributes and indices both want to start on at least
+         * a four byte boundary
+         */
+        renderer->vertex_slot_size = round_up_to_multiple (MAX (renderer->vertex_slot_size, 1), 16);
+        renderer->index_slot_size = round_up_to_multiple (MAX (renderer->index_slot_size, 1), 4);
+
+        slot_size = renderer->vertex_slot_size + renderer->index_slot_size;
+        renderer->number_of_slots = MAX (pool_size / slot_size, MINIMUM_NUMBER_OF_SLOTS);
+        renderer->number_of_slots = MIN (renderer->number_of_slots, number_of_nodes);
+        renderer->slots = g_new0 (Slot, renderer->number_of_slots);
+
+        for (i = 0; i < renderer->number_of_slots; i++) {
+                renderer->slots[i].node = NO_NODE;
+        }
+
+        renderer->requests = g_array_new (FALSE, FALSE, sizeof (NodeRequest));
+        renderer->loaded_nodes = g_queue_new ();
+        renderer->cancellable = g_cancellable_new ();
+
+        glGenVertexArrays (1, &renderer->vertex_array_id);
+        glBindVertexArray (renderer->vertex_array_id);
+
+        renderer->program = chips_shader_program_new ();
+
+        glGenBuffers (1, &renderer->vertex_buffer_id);
+        glBindBuffer (GL_ARRAY_BUFFER, renderer->vertex_buffer_id);
+        glBufferData (GL_ARRAY_BUFFER, (GLsizeiptr) renderer->vertex_slot_size * renderer->number_of_slots, NULL, GL_DYNAMIC_DRAW);
+
+        glGenBuffers (1, &renderer->index_buffer_id);
+        glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, renderer->index_buffer_id);
+        glBufferData (GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr) renderer->index_slot_size * renderer->number_of_slots, NULL, GL_DYNAMIC_DRAW);
+
+        /* The whole tree is one copy of one model */
+        graphene_matrix_init_identity (&identity_matrix);
+        graphene_matrix_to_float (&identity_matrix, identity);
+
+        glGenBuffers (1, &renderer->instance_buffer_id);
+        glBindBuffer (GL_ARRAY_BUFFER, renderer->instance_buffer_id);
+        glBufferData (GL_ARRAY_BUFFER, sizeof (identity), identity, GL_STATIC_DRAW);
+        chips_shader_program_bind_instances (renderer->program, CHIPS_INSTANCE_TRANSFORM_SIZE, 0, FALSE);
+
+        return renderer;
+}
+
+static void
+node_load_free (NodeLoad *load)
+{
+        g_clear_object (&load->model);
+        g_slice_free (NodeLoad, load);
+}
+
+void
+chips_octree_renderer_free (ChipsOctreeRenderer *renderer)
+{
+        /* Loads still running finish on their own and see they were
+         * cancelled, so they never look at the renderer again
+         */
+        g_cancellable_cancel (renderer->cancellable);
+        g_clear_object (&renderer->cancellable);
+
+        g_queue_free_full (renderer->loaded_nodes, (GDestroyNotify) node_load_free);
+        g_array_unref (renderer->requests);
+
+        chips_shader_program_free (renderer->program);
+
+        glDeleteBuffers (1, &renderer->vertex_buffer_id);
+        glDeleteBuffers (1, &renderer->index_buffer_id);
+        glDeleteBuffers (1, &renderer->instance_buffer_id);
+        glDeleteVertexArrays (1, &renderer->vertex_array_id);
+
+        g_free (renderer->slots);
+        g_free (renderer->nodes);
+
+        g_slice_free (ChipsOctreeRenderer, renderer);
+}
+
+static void
+on_node_loaded (Chips3DModel *model,
+                GAsyncResult *result,
+                NodeLoad     *load)
+{
+        g_autoptr (GError) error = NULL;
+        ChipsOctreeRenderer *renderer;
+
+        if (!g_async_initable_init_finish (G_ASYNC_INITABLE (model), result, &error)) {
+                if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                        node_load_free (load);
+                        return;
+                }
+
+                renderer = load->renderer;
+                renderer->loads_in_flight--;
+
+                g_warning ("couldn't load octree node %u: %s", load->node, error->message);
+                renderer->nodes[load->node].state = NODE_STATE_FAILED;
+                node_load_free (load);
+                return;
+        }
+
+        renderer = load->renderer;
+        renderer->loads_in_flight--;
+
+        /* Goes up on the next draw, when the GL context is current */
+        g_queue_push_tail (renderer->loaded_nodes, load);
+}
+
+static void
+load_node (ChipsOctreeRenderer *renderer,
+           guint32              node)
+{
+        g_autofree char *filename = NULL;
+        g_autoptr (GFile) file = NULL;
+        NodeLoad *load;
+
+        filename = chips_octree_get_node_filename (chips_octree_get_directory (renderer->octree), node);
+        file = g_file_new_for_path (filename);
+
+        load = g_slice_new0 (NodeLoad);
+        load->renderer = renderer;
+        load->node = node;
+        load->model = g_object_new (CHIPS_TYPE_3D_MODEL,
+                                    "file", file,
+                                    "use-cache", FALSE,
+                                    NULL);
+
+        renderer->nodes[node].state = NODE_STATE_LOADING;
+        renderer->loads_in_flight++;
+
+        g_async_initable_init_async (G_ASYNC_INITABLE (load->model),
+                                     G_PRIORITY_DEFAULT,
+                                     renderer->cancellable,
+                                     (GAsyncReadyCallback)
+                                     on_node_loaded,
+                                     load);
+}
+
+/* A free slot, or else the one longest off screen.  Slots drawn from
+ * this frame are never taken.
+ */
+static guint32
+find_slot (ChipsOctreeRenderer *renderer)
+{
+        guint32 slot = NO_SLOT;
+        guint32 i;
+
+        for (i = 0; i < renderer->number_of_slots; i++) {
+                if (renderer->slots[i].node == NO_NODE) {
+                        return i;
+                }
+
+                if (renderer->slots[i].last_used_frame == renderer->frame) {
+                        continue;
+                }
+
+                if (slot == NO_SLOT || renderer->slots[i].last_used_frame < renderer->slots[slot].last_used_frame) {
+                        slot = i;
+                }
+        }
+
+        if (slot != NO_SLOT) {
+                NodeResidency *evicted = &renderer->nodes[renderer->slots[slot].node];
+
+                evicted->state = NODE_STATE_UNLOADED;
+                evicted->slot = NO_SLOT;
+                renderer->slots[slot].node = NO_NODE;
+        }
+
+        return slot;
+}
+
+static gboolean
+upload_node (ChipsOctreeRenderer  *renderer,
+             NodeLoad             *load,
+             GError              **error)
+{
+        const ChipsMeshLevelOfDetail *level_of_detail;
+        const guint8 *indices;
+        size_t vertex_buffer_size, index_buffer_size, index_size;
+        guint32 slot;
+        Slot *slot_data;
+
+        level_of_detail = chips_3d_model_get_level_of_detail (load->model, 0);
+        index_size = chips_3d_model_get_index_size (load->model);
+        vertex_buffer_size = chips_3d_model_get_vertex_buffer_size (load->model);
+        index_buffer_size = level_of_detail->number_of_indices * index_size;
+
+        if (vertex_buffer_size > renderer->vertex_slot_size || index_buffer_size > renderer->index_slot_size) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "node is bigger than the octree index says");
+                return FALSE;
+        }
+
+        slot = find_slot (renderer);
+
+        if (slot == NO_SLOT) {
+                renderer->pool_exhausted = TRUE;
+                renderer->nodes[load->node].state = NODE_STATE_UNLOADED;
+                return TRUE;
+        }
+
+        if (!chips_3d_model_hold_geometry (load->model, error)) {
+                return FALSE;
+        }
+
+        indices = (const guint8 *) chips_3d_model_get_vertex_arrangement (load->model) +
+                  level_of_detail->first_index * index_size;
+
+        glBindVertexArray (renderer->vertex_array_id);
+
+        glBindBuffer (GL_ARRAY_BUFFER, renderer->vertex_buffer_id);
+        glBufferSubData (GL_ARRAY_BUFFER,
+                         (GLintptr) slot * renderer->vertex_slot_size,
+                         vertex_buffer_size,
+                         chips_3d_model_get_vertex_buffer (load->model));
+
+        glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, renderer->index_buffer_id);
+        glBufferSubData (GL_ELEMENT_ARRAY_BUFFER,
+                         (GLintptr) slot * renderer->index_slot_size,
+                         index_buffer_size,
+                         indices);
+
+        chips_3d_model_release_geometry (load->model);
+
+        slot_data = &renderer->slots[slot];
+        slot_data->node = load->node;
+        slot_data->last_used_frame = renderer->frame;
+        slot_data->format = *chips_3d_model_get_vertex_format (load->model);
+        slot_data->number_of_indices = level_of_detail->number_of_indices;
+        slot_data->index_size = index_size;
+
+        renderer->nodes[load->node].state = NODE_STATE_RESIDENT;
+        renderer->nodes[load->node].slot = slot;
+
+        return TRUE;
+}
+
+static void
+upload_loaded_nodes (ChipsOctreeRenderer *renderer)
+{
+        NodeLoad *load;
+
+        while ((load = g_queue_pop_head (renderer->loaded_nodes)) != NULL) {
+                g_autoptr (GError) error = NULL;
+
+                if (!upload_node (renderer, load, &error)) {
+                        g_warning ("couldn't upload octree node %u: %s", load->node, error->message);
+                        renderer->nodes[load->node].state = NODE_STATE_FAILED;
+                }
+
+                node_load_free (load);
+        }
+}
+
+/* Each node's geometry sits at the start of its slot, so the vertex
+ * attributes get pointed there before drawing it
+ */
+static void
+draw_node (ChipsOctreeRenderer *renderer,
+           guint32              node)
+{
+        guint32 slot = renderer->nodes[node].slot;
+        const Slot *slot_data = &renderer->slots[slot];
+        ChipsVertexFormat format;
+        size_t i;
+
+        format = slot_data->format;
+
+        for (i = 0; i < CHIPS_NUMBER_OF_VERTEX_ATTRIBUTES; i++) {
+                format.attributes[i].offset += slot * renderer->vertex_slot_size;
+        }
+
+        chips_shader_program_bind_vertex_format (renderer->program, &format);
+        chips_shader_program_set_position_encoding (renderer->program, &slot_data->format);
+
+        glDrawElements (GL_TRIANGLES,
+                        slot_data->number_of_indices,
+                        slot_data->index_size == sizeof (guint16)? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+                        (const void *) (uintptr_t) (slot * renderer->index_slot_size));
+}
+
+static void
+request_node (ChipsOctreeRenderer   *renderer,
+              const ChipsRenderView *view,
+              guint32                node,
+              const graphene_box_t  *bounds)
+{
+        NodeRequest request;
+
+        if (renderer->nodes[node].state != NODE_STATE_UNLOADED) {
+                return;
+        }
+
+        /* Nearer nodes first, since they cover more of the screen */
+        request.node = node;
+        request.priority = 1.0f / chips_render_view_get_acceptable_error (view, bounds);
+        g_array_append_val (renderer->requests, request);
+}
+
+static void
+mark_used (ChipsOctreeRenderer *renderer,
+           guint32              node)
+{
+        renderer->slots[renderer->nodes[node].slot].last_used_frame = renderer->frame;
+}
+
+/* Draws a resident node, or its children if it's too coarse for how
+ * close it is and they're all there to replace it.  Until they are,
+ * the node stands in for them.
+ */
+static void
+draw_subtree (ChipsOctreeRenderer   *renderer,
+              const ChipsRenderView *view,
+              const ChipsFrustum    *frustum,
+              guint32                node_index)
+{
+        const ChipsOctreeNode *node = chips_octree_get_node (renderer->octree, node_index);
+        graphene_box_t bounds;
+        gboolean children_in_view[8] = { FALSE };
+        gboolean children_missing = FALSE;
+        size_t i;
+
+        mark_used (renderer, node_index);
+
+        get_node_bounds (node, &bounds);
+
+        if (is_leaf (node) || node->error <= chips_render_view_get_acceptable_error (view, &bounds)) {
+                draw_node (renderer, node_index);
+                return;
+        }
+
+        for (i = 0; i < G_N_ELEMENTS (node->children); i++) {
+                guint32 child = node->children[i];
+                graphene_box_t child_bounds;
+
+                if (child == 0) {
+                        continue;
+                }
+
+                get_node_bounds (chips_octree_get_node (renderer->octree, child), &child_bounds);
+
+                if (chips_frustum_test_bounds (frustum, &child_bounds) == CHIPS_FRUSTUM_OUTSIDE) {
+                        continue;
+                }
+
+                children_in_view[i] = TRUE;
+
+                if (renderer->nodes[child].state != NODE_STATE_RESIDENT) {
+                        request_node (renderer, view, child, &child_bounds);
+                        children_missing = TRUE;
+                }
+        }
+
+        if (children_missing) {
+                for (i = 0; i < G_N_ELEMENTS (node->children); i++) {
+                        if (children_in_view[i] && renderer->nodes[node->children[i]].state == NODE_STATE_RESIDENT) {
+                                mark_used (renderer, node->children[i]);
+                        }
+                }
+
+                draw_node (renderer, node_index);
+                return;
+        }
+
+        for (i = 0; i < G_N_ELEMENTS (node->children); i++) {
+                if (children_in_view[i]) {
+                        draw_subtree (renderer, view, frustum, node->children[i]);
+                }
+        }
+}
+
+static int
+compare_requests (const NodeRequest *a,
+                  const NodeRequest *b)
+{
+        if (a->priority > b->priority) {
+                return -1;
+        }
+
+        if (a->priority < b->priority) {
+                return 1;
+        }
+
+        return 0;
+}
+
+static void
+start_requested_loads (ChipsOctreeRenderer *renderer)
+{
+        size_t i;
+
+        g_array_sort (renderer->requests, (GCompareFunc) compare_requests);
+
+        for (i = 0; i < renderer->requests->len; i++) {
+                if (renderer->loads_in_flight >= MAXIMUM_LOADS_IN_FLIGHT) {
+                        break;
+                }
+
+                load_node (renderer, g_array_index (renderer->requests, NodeRequest, i).node);
+        }
+}
+
+static gboolean
+view_changed (ChipsOctreeRenderer   *renderer,
+              const ChipsRenderView *view)
+{
+        float matrices[3 * 16];
+        gboolean changed;
+
+        graphene_matrix_to_float (&view->model_matrix, matrices);
+        graphene_matrix_to_float (&view->view_matrix, matrices + 16);
+        graphene_matrix_to_float (&view->projection_matrix, matrices + 32);
+
+        changed = memcmp (matrices, renderer->last_view, sizeof (matrices)) != 0 ||
+                  view->viewport_height != renderer->last_viewport_height;
+
+        memcpy (renderer->last_view, matrices, sizeof (matrices));
+        renderer->last_viewport_height = view->viewport_height;
+
+        return changed;
+}
+
+/* Draws what's resident, and asks for whatever would make the next
+ * frame look better.  Returns TRUE while nodes are still coming in,
+ * so the caller should draw again soon.
+ */
+gboolean
+chips_octree_renderer_draw (ChipsOctreeRenderer   *renderer,
+                            const ChipsRenderView *view)
+{
+        graphene_matrix_t model_view_matrix, model_view_projection_matrix;
+        ChipsFrustum frustum;
+        graphene_box_t root_bounds;
+
+        renderer->frame++;
+
+        if (view_changed (renderer, view)) {
+                renderer->pool_exhausted = FALSE;
+        }
+
+        glBindVertexArray (renderer->vertex_array_id);
+        glBindBuffer (GL_ARRAY_BUFFER, renderer->vertex_buffer_id);
+
+        chips_shader_program_set_matrices (renderer->program,
+                                           &view->model_matrix,
+                                           &view->view_matrix,
+                                           &view->projection_matrix);
+        chips_shader_program_set_depth_range (renderer->program,
+                                              view->near_plane,
+                                              view->far_plane);
+
+        graphene_matrix_multiply (&view->model_matrix, &view->view_matrix, &model_view_matrix);
+        graphene_matrix_multiply (&model_view_matrix, &view->projection_matrix, &model_view_projection_matrix);
+        chips_frustum_init_from_matrix (&frustum, &model_view_projection_matrix);
+
+        g_array_set_size (renderer->requests, 0);
+
+        get_node_bounds (chips_octree_get_node (renderer->octree, 0), &root_bounds);
+
+        if (chips_frustum_test_bounds (&frustum, &root_bounds) != CHIPS_FRUSTUM_OUTSIDE) {
+                if (renderer->nodes[0].state == NODE_STATE_RESIDENT) {
+                        draw_subtree (renderer, view, &frustum, 0);
+                } else {
+                        request_node (renderer, view, 0, &root_bounds);
+                }
+        }
+
+        /* After drawing, so the nodes just drawn count as in use and
+         * don't get their slots taken
+         */
+        upload_loaded_nodes (renderer);
+
+        if (!renderer->pool_exhausted) {
+                start_requested_loads (renderer);
+        }
+
+        return renderer->loads_in_flight > 0 ||
+               !g_queue_is_empty (renderer->loaded_nodes) ||
+               (!renderer->pool_exhausted && renderer->requests->len > 0);
+}
@@ -0,0 +1,42 @@
+/* chips-octree-renderer.h
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CHIPS_OCTREE_RENDERER_H
+#define CHIPS_OCTREE_RENDERER_H
+
+#include "chips.h"
+#include "chips-octree.h"
+#include "chips-renderer.h"
+
+/* Roughly what a mid-range GPU can spare for one model */
+#define CHIPS_OCTREE_RENDERER_DEFAULT_POOL_SIZE (G_GUINT64_CONSTANT (256) * 1024 * 1024)
+
+/* Draws an octree by streaming in just the nodes the view needs, at
+ * the detail it needs, into a fixed pool of GPU memory
+ */
+typedef struct _ChipsOctreeRenderer ChipsOctreeRenderer;
+
+ChipsOctreeRenderer *chips_octree_renderer_new  (ChipsOctree           *octree,
+                                                 guint64                pool_size);
+void                 chips_octree_renderer_free (ChipsOctreeRenderer   *renderer);
+
+gboolean             chips_octree_renderer_draw (ChipsOctreeRenderer   *renderer,
+                                                 const ChipsRenderView *view);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ChipsOctreeRenderer, chips_octree_renderer_free);
+
+#endif /* CHIPS_OCTREE_RENDERER_H */
@@ -0,0 +1,178 @@
+/* chips-octree.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chips-octree.h"
+#include "chips-mesh-file.h"
+
+G_STATIC_ASSERT (sizeof (ChipsOctreeHeader) == 16);
+G_STATIC_ASSERT (sizeof (ChipsOctreeNode) == 76);
+
+struct _ChipsOctree
+{
+        char                  *directory;
+        GBytes                *index;
+        const ChipsOctreeNode *nodes;
+        size_t                 number_of_nodes;
+};
+
+gboolean
+chips_octree_is_octree (const char *directory)
+{
+        g_autofree char *index_filename = NULL;
+
+        if (!g_str_has_suffix (directory, CHIPS_OCTREE_SUFFIX)) {
+                return FALSE;
+        }
+
+        index_filename = g_build_filename (directory, CHIPS_OCTREE_INDEX_FILENAME, NULL);
+
+        return g_file_test (index_filename, G_FILE_TEST_IS_REGULAR);
+}
+
+char *
+chips_octree_get_node_filename (const char *directory,
+                                size_t      node)
+{
+        g_autofree char *basename = NULL;
+
+        basename = g_strdup_printf ("%" G_GSIZE_FORMAT "%s", node, CHIPS_MESH_FILE_SUFFIX);
+
+        return g_build_filename (directory, basename, NULL);
+}
+
+/* Children always come after their parent, which keeps a corrupt index
+ * from sending a walk down the tree around in circles
+ */
+static gboolean
+validate_index (ChipsOctree  *octree,
+                const char   *filename,
+                GError      **error)
+{
+        const ChipsOctreeHeader *header;
+        const char *data;
+        size_t size, i, j;
+
+        data = g_bytes_get_data (octree->index, &size);
+
+        if (size < sizeof (ChipsOctreeHeader)) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "'%s' is too short to be an octree index", filename);
+                return FALSE;
+        }
+
+        header = (const ChipsOctreeHeader *) data;
+
+        if (memcmp (header->magic, CHIPS_OCTREE_MAGIC, sizeof (header->magic)) != 0) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "'%s' is not an octree index", filename);
+                return FALSE;
+        }
+
+        if (header->version != CHIPS_OCTREE_VERSION) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                             "'%s' has unsupported octree version %u",
+                             filename, header->version);
+                return FALSE;
+        }
+
+        if (header->number_of_nodes == 0 ||
+            (size - sizeof (ChipsOctreeHeader)) / sizeof (ChipsOctreeNode) != header->number_of_nodes ||
+            (size - sizeof (ChipsOctreeHeader)) % sizeof (ChipsOctreeNode) != 0) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "'%s' has a truncated node table", filename);
+                return FALSE;
+        }
+
+        octree->nodes = (const ChipsOctreeNode *) (data + sizeof (ChipsOctreeHeader));
+        octree->number_of_nodes = header->number_of_nodes;
+
+        for (i = 0; i < octree->number_of_nodes; i++) {
+                const ChipsOctreeNode *node = &octree->nodes[i];
+
+                if (node->index_size != sizeof (guint16) && node->index_size != sizeof (guint32)) {
+                        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                                     "'%s' has a node with a malformed index size", filename);
+                        return FALSE;
+                }
+
+                for (j = 0; j < G_N_ELEMENTS (node->children); j++) {
+                        if (node->children[j] != 0 &&
+                            (node->children[j] <= i || node->children[j] >= octree->number_of_nodes)) {
+                                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                                             "'%s' has a node with a child that doesn't exist", filename);
+                                return FALSE;
+                        }
+                }
+        }
+
+        return TRUE;
+}
+
+ChipsOctree *
+chips_octree_open (const char  *directory,
+                   GError     **error)
+{
+        g_autoptr (ChipsOctree) octree = NULL;
+        g_autofree char *filename = NULL;
+        char *contents;
+        size_t size;
+
+        filename = g_build_filename (directory, CHIPS_OCTREE_INDEX_FILENAME, NULL);
+
+        if (!g_file_get_contents (filename, &contents, &size, error)) {
+                return NULL;
+        }
+
+        octree = g_slice_new0 (ChipsOctree);
+        octree->directory = g_strdup (directory);
+        octree->index = g_bytes_new_take (contents, size);
+
+        if (!validate_index (octree, filename, error)) {
+                return NULL;
+        }
+
+        return g_steal_pointer (&octree);
+}
+
+void
+chips_octree_free (ChipsOctree *octree)
+{
+        g_clear_pointer (&octree->index, g_bytes_unref);
+        g_free (octree->directory);
+        g_slice_free (ChipsOctree, octree);
+}
+
+const char *
+chips_octree_get_directory (ChipsOctree *octree)
+{
+        return octree->directory;
+}
+
+size_t
+chips_octree_get_number_of_nodes (ChipsOctree *octree)
+{
+        return octree->number_of_nodes;
+}
+
+const ChipsOctreeNode *
+chips_octree_get_node (ChipsOctree *octree,
+                       size_t       node)
+{
+        g_return_val_if_fail (node < octree->number_of_nodes, NULL);
+
+        return &octree->nodes[node];
+}
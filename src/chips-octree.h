@@ -0,0 +1,94 @@
+/* chips-octree.h
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CHIPS_OCTREE_H
+#define CHIPS_OCTREE_H
+
+#include "chips.h"
+
+/* Models too big to load whole are split up ahead of time into a
+ * directory holding an octree of mesh files, one per node.  Leaves
+ * have the full detail triangles that fall in them, and every other
+ * node has a simplified version of what's under it, so any cut through
+ * the tree draws the whole model.  The index file in the directory
+ * starts with a ChipsOctreeHeader followed by the nodes, root first,
+ * each node coming before its children.  Like mesh files, everything
+ * is little endian.
+ */
+#define CHIPS_OCTREE_MAGIC "CHIPSOCT"
+#define CHIPS_OCTREE_VERSION 1
+#define CHIPS_OCTREE_SUFFIX ".chipsoctree"
+#define CHIPS_OCTREE_INDEX_FILENAME "index"
+
+/* Small enough that a node loads in a frame or two, big enough that
+ * a view rarely needs more than a few hundred of them
+ */
+#define CHIPS_OCTREE_DEFAULT_TRIANGLES_PER_NODE 65536
+
+typedef struct
+{
+        char    magic[8];
+        guint32 version;
+        guint32 number_of_nodes;
+} ChipsOctreeHeader;
+
+/* error is how far, in model units, the node may stray from the full
+ * detail surface under it, which is 0 for leaves.  The counts describe
+ * the full detail level of the node's mesh file.  A child of 0 means
+ * there's none, since the root can't be anyone's child.
+ */
+typedef struct
+{
+        float   bounds_minimum[3];
+        float   bounds_maximum[3];
+        float   error;
+        guint32 children[8];
+        guint32 number_of_vertices;
+        guint32 number_of_indices;
+        guint32 vertex_stride;
+        guint32 index_size;
+} ChipsOctreeNode;
+
+typedef void (* ChipsOctreeBuildProgressFunc) (guint64  triangles_built,
+                                               guint64  number_of_triangles,
+                                               gpointer user_data);
+
+typedef struct _ChipsOctree ChipsOctree;
+
+gboolean               chips_octree_build                  (GFile                         *input_file,
+                                                            const char                    *directory,
+                                                            size_t                         triangles_per_node,
+                                                            ChipsOctreeBuildProgressFunc   progress_func,
+                                                            gpointer                       user_data,
+                                                            GCancellable                  *cancellable,
+                                                            GError                       **error);
+
+gboolean               chips_octree_is_octree              (const char                    *directory);
+ChipsOctree           *chips_octree_open                   (const char                    *directory,
+                                                            GError                       **error);
+void                   chips_octree_free                   (ChipsOctree                   *octree);
+
+size_t                 chips_octree_get_number_of_nodes    (ChipsOctree                   *octree);
+const ChipsOctreeNode *chips_octree_get_node               (ChipsOctree                   *octree,
+                                                            size_t                         node);
+const char            *chips_octree_get_directory          (ChipsOctree                   *octree);
+char                  *chips_octree_get_node_filename      (const char                    *directory,
+                                                            size_t                         node);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ChipsOctree, chips_octree_free);
+
+#endif /* CHIPS_OCTREE_H */
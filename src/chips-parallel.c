@@ -0,0 +1,180 @@
+/* chips-parallel.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chips-parallel.h"
+
+typedef struct
+{
+        ChipsParallelFunc  func;
+        gpointer           user_data;
+        GCancellable      *cancellable;
+
+        size_t             number_of_items;
+        size_t             chunk_size;
+        int                number_of_chunks;
+
+        volatile int       next_chunk;
+        volatile int       reference_count;
+
+        GMutex             lock;
+        GCond              finished_condition;
+        int                number_of_chunks_finished;
+} ChipsParallelJob;
+
+static GThreadPool *worker_pool;
+static volatile int thread_limit;
+
+static void
+chips_parallel_job_unref (ChipsParallelJob *job)
+{
+        if (!g_atomic_int_dec_and_test (&job->reference_count)) {
+                return;
+        }
+
+        g_mutex_clear (&job->lock);
+        g_cond_clear (&job->finished_condition);
+        g_slice_free (ChipsParallelJob, job);
+}
+
+/* Both the pool workers and the calling thread pull chunks off the same
+ * counter, so the job finishes even if every worker is busy elsewhere.
+ */
+static void
+run_chunks (ChipsParallelJob *job)
+{
+        int chunk;
+
+        while ((chunk = g_atomic_int_add (&job->next_chunk, 1)) < job->number_of_chunks) {
+                if (!g_cancellable_is_cancelled (job->cancellable)) {
+                        size_t start, end;
+
+                        start = chunk * job->chunk_size;
+                        end = MIN (start + job->chunk_size, job->number_of_items);
+
+                        job->func (start, end, job->user_data);
+                }
+
+                g_mutex_lock (&job->lock);
+                job->number_of_chunks_finished++;
+                if (job->number_of_chunks_finished == job->number_of_chunks) {
+                        g_cond_broadcast (&job->finished_condition);
+                }
+                g_mutex_unlock (&job->lock);
+        }
+}
+
+static void
+on_worker_pool_job (ChipsParallelJob *job,
+                    gpointer          pool_data)
+{
+        run_chunks (job);
+        chips_parallel_job_unref (job);
+}
+
+static GThreadPool *
+get_worker_pool (void)
+{
+        static gsize initialized = 0;
+
+        if (g_once_init_enter (&initialized)) {
+                worker_pool = g_thread_pool_new ((GFunc) on_worker_pool_job,
+                                                 NULL,
+                                                 MAX (g_get_num_processors () - 1, 1),
+                                                 FALSE,
+                                                 NULL);
+                g_once_init_leave (&initialized, 1);
+        }
+
+        return worker_pool;
+}
+
+unsigned int
+chips_parallel_get_number_of_threads (void)
+{
+        int limit;
+
+        limit = g_atomic_int_get (&thread_limit);
+
+        if (limit > 0) {
+                return limit;
+        }
+
+        return g_get_num_processors ();
+}
+
+void
+chips_parallel_set_number_of_threads (unsigned int number_of_threads)
+{
+        g_atomic_int_set (&thread_limit, number_of_threads);
+}
+
+gboolean
+chips_parallel_for (size_t              number_of_items,
+                    size_t              chunk_size,
+                    ChipsParallelFunc   func,
+                    gpointer            user_data,
+                    GCancellable       *cancellable,
+                    GError            **error)
+{
+        ChipsParallelJob *job;
+        unsigned int number_of_helpers;
+        unsigned int i;
+
+        if (g_cancellable_set_error_if_cancelled (cancellable, error)) {
+                return FALSE;
+        }
+
+        if (number_of_items == 0) {
+                return TRUE;
+        }
+
+        chunk_size = MAX (chunk_size, 1);
+
+        job = g_slice_new0 (ChipsParallelJob);
+        job->func = func;
+        job->user_data = user_data;
+        job->cancellable = cancellable;
+        job->number_of_items = number_of_items;
+        job->chunk_size = chunk_size;
+        job->number_of_chunks = (number_of_items + chunk_size - 1) / chunk_size;
+        job->reference_count = 1;
+        g_mutex_init (&job->lock);
+        g_cond_init (&job->finished_condition);
+
+        number_of_helpers = MIN (chips_parallel_get_number_of_threads (), job->number_of_chunks) - 1;
+
+        for (i = 0; i < number_of_helpers; i++) {
+                g_atomic_int_inc (&job->reference_count);
+                g_thread_pool_push (get_worker_pool (), job, NULL);
+        }
+
+        run_chunks (job);
+
+        g_mutex_lock (&job->lock);
+        while (job->number_of_chunks_finished < job->number_of_chunks) {
+                g_cond_wait (&job->finished_condition, &job->lock);
+        }
+        g_mutex_unlock (&job->lock);
+
+        chips_parallel_job_unref (job);
+
+        if (g_cancellable_set_error_if_cancelled (cancellable, error)) {
+                return FALSE;
+        }
+
+        return TRUE;
+}
@@ -0,0 +1,40 @@
+/* chips-parallel.h
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CHIPS_PARALLEL_H
+#define CHIPS_PARALLEL_H
+
+#include "chips.h"
+
+/* Processes items [start, end) of a larger range.  Called concurrently
+ * from several threads, each with a disjoint range.
+ */
+typedef void (* ChipsParallelFunc) (size_t   start,
+                                    size_t   end,
+                                    gpointer user_data);
+
+gboolean     chips_parallel_for                  (size_t              number_of_items,
+                                                  size_t              chunk_size,
+                                                  ChipsParallelFunc   func,
+                                                  gpointer            user_data,
+                                                  GCancellable       *cancellable,
+                                                  GError            **error);
+
+unsigned int chips_parallel_get_number_of_threads (void);
+void         chips_parallel_set_number_of_threads (unsigned int number_of_threads);
+
+#endif /* CHIPS_PARALLEL_H */
@@ -0,0 +1,268 @@
+/* chips-point-cloud-renderer.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chips-point-cloud-renderer.h"
+#include "chips-culling.h"
+#include "chips-shader-program.h"
+
+struct _ChipsPointCloudRenderer
+{
+        ChipsPointCloud *point_cloud;
+        guint64 point_budget;
+
+        /* Blocks go up whole and in order, so everything before this
+         * one can be drawn
+         */
+        size_t blocks_uploaded;
+
+        unsigned int vertex_array_id;
+        unsigned int point_buffer_id;
+        unsigned int instance_buffer_id;
+        ChipsShaderProgram *program;
+
+        GArray *draw_firsts;
+        GArray *draw_counts;
+        GArray *wanted_points;
+};
+
+/* How many points a pixel of screen should get, so surfaces close up
+ * look solid instead of sparse
+ */
+#define POINTS_PER_PIXEL 1.0f
+
+/* Even a block far away gets enough points to keep its shape */
+#define MINIMUM_POINTS_PER_BLOCK 64
+
+/* How much of the point buffer goes up in one call */
+#define UPLOAD_SLICE_SIZE (1024 * 1024)
+
+/* Needs a current GL context, which has to stay current for every
+ * other call, chips_point_cloud_renderer_free included
+ */
+ChipsPointCloudRenderer *
+chips_point_cloud_renderer_new (ChipsPointCloud *point_cloud)
+{
+        ChipsPointCloudRenderer *renderer;
+        const ChipsVertexFormat *format;
+        graphene_matrix_t identity_matrix;
+        float identity[16];
+
+        renderer = g_slice_new0 (ChipsPointCloudRenderer);
+        renderer->point_cloud = g_object_ref (point_cloud);
+        renderer->point_budget = CHIPS_POINT_CLOUD_RENDERER_DEFAULT_POINT_BUDGET;
+        renderer->draw_firsts = g_array_new (FALSE, FALSE, sizeof (GLint));
+        renderer->draw_counts = g_array_new (FALSE, FALSE, sizeof (GLsizei));
+        renderer->wanted_points = g_array_new (FALSE, FALSE, sizeof (float));
+
+        format = chips_point_cloud_get_vertex_format (point_cloud);
+
+        glEnable (GL_DEPTH_TEST);
+
+        glGenVertexArrays (1, &renderer->vertex_array_id);
+        glBindVertexArray (renderer->vertex_array_id);
+
+        renderer->program = chips_shader_program_new ();
+
+        glGenBuffers (1, &renderer->point_buffer_id);
+        glBindBuffer (GL_ARRAY_BUFFER, renderer->point_buffer_id);
+        glBufferData (GL_ARRAY_BUFFER,
+                      (GLsizeiptr) chips_point_cloud_get_number_of_points (point_cloud) * format->stride,
+                      NULL,
+                      GL_STATIC_DRAW);
+        chips_shader_program_bind_vertex_format (renderer->program, format);
+
+        graphene_matrix_init_identity (&identity_matrix);
+        graphene_matrix_to_float (&identity_matrix, identity);
+
+        glGenBuffers (1, &renderer->instance_buffer_id);
+        glBindBuffer (GL_ARRAY_BUFFER, renderer->instance_buffer_id);
+        glBufferData (GL_ARRAY_BUFFER, sizeof (identity), identity, GL_STATIC_DRAW);
+        chips_shader_program_bind_instances (renderer->program, CHIPS_INSTANCE_TRANSFORM_SIZE, 0, FALSE);
+
+        return renderer;
+}
+
+void
+chips_point_cloud_renderer_free (ChipsPointCloudRenderer *renderer)
+{
+        chips_shader_program_free (renderer->program);
+
+        glDeleteBuffers (1, &renderer->point_buffer_id);
+        glDeleteBuffers (1, &renderer->instance_buffer_id);
+        glDeleteVertexArrays (1, &renderer->vertex_array_id);
+
+        g_clear_object (&renderer->point_cloud);
+        g_clear_pointer (&renderer->draw_firsts, g_array_unref);
+        g_clear_pointer (&renderer->draw_counts, g_array_unref);
+        g_clear_pointer (&renderer->wanted_points, g_array_unref);
+
+        g_slice_free (ChipsPointCloudRenderer, renderer);
+}
+
+/* The most points drawn in one frame, however many the view could
+ * use.  Past it, every block gets proportionally fewer.
+ */
+void
+chips_point_cloud_renderer_set_point_budget (ChipsPointCloudRenderer *renderer,
+                                             guint64                  point_budget)
+{
+        renderer->point_budget = MAX (point_budget, 1);
+}
+
+/* Uploads as many blocks as fit in time_budget microseconds, always at
+ * least one.  Returns whether there's more to come.
+ */
+gboolean
+chips_point_cloud_renderer_upload (ChipsPointCloudRenderer *renderer,
+                                   gint64                   time_budget)
+{
+        const ChipsPointCloudBlock *blocks;
+        const guint8 *points;
+        size_t number_of_blocks, stride;
+        gint64 deadline;
+
+        blocks = chips_point_cloud_get_blocks (renderer->point_cloud, &number_of_blocks);
+
+        if (renderer->blocks_uploaded >= number_of_blocks) {
+                return FALSE;
+        }
+
+        points = chips_point_cloud_get_points (renderer->point_cloud);
+        stride = chips_point_cloud_get_vertex_format (renderer->point_cloud)->stride;
+        deadline = g_get_monotonic_time () + time_budget;
+
+        glBindBuffer (GL_ARRAY_BUFFER, renderer->point_buffer_id);
+
+        do {
+                size_t first_block = renderer->blocks_uploaded;
+                size_t size = 0;
+
+                while (renderer->blocks_uploaded < number_of_blocks && size < UPLOAD_SLICE_SIZE) {
+                        size += blocks[renderer->blocks_uploaded].number_of_points * stride;
+                        renderer->blocks_uploaded++;
+                }
+
+                glBufferSubData (GL_ARRAY_BUFFER,
+                                 blocks[first_block].first_point * stride,
+                                 size,
+                                 points + blocks[first_block].first_point * stride);
+        } while (renderer->blocks_uploaded < number_of_blocks && g_get_monotonic_time () < deadline);
+
+        return renderer->blocks_uploaded < number_of_blocks;
+}
+
+/* How many of the block's points it takes to cover the pixels it
+ * covers on screen
+ */
+static float
+get_wanted_points (const ChipsRenderView      *view,
+                   const ChipsPointCloudBlock *block,
+                   const graphene_box_t       *bounds)
+{
+        graphene_vec3_t size;
+        float pixel_size, diagonal_in_pixels;
+
+        pixel_size = chips_render_view_get_acceptable_error (view, bounds);
+        graphene_box_get_size (bounds, &size);
+        diagonal_in_pixels = graphene_vec3_length (&size) / pixel_size;
+
+        return CLAMP (diagonal_in_pixels * diagonal_in_pixels / 2.0f * POINTS_PER_PIXEL,
+                      MIN (MINIMUM_POINTS_PER_BLOCK, block->number_of_points),
+                      block->number_of_points);
+}
+
+/* Each block draws a run from its start, as long as its size on
+ * screen calls for, and all the runs go in one call.  When that adds
+ * up to more than the budget, every run gets scaled down together, so
+ * the whole cloud just gets sparser instead of parts of it dropping
+ * out.
+ */
+void
+chips_point_cloud_renderer_draw (ChipsPointCloudRenderer *renderer,
+                                 const ChipsRenderView   *view)
+{
+        const ChipsPointCloudBlock *blocks;
+        graphene_matrix_t model_view_matrix, model_view_projection_matrix;
+        ChipsFrustum frustum;
+        size_t number_of_blocks, i;
+        float total_points = 0.0f, scale = 1.0f;
+
+        blocks = chips_point_cloud_get_blocks (renderer->point_cloud, &number_of_blocks);
+
+        graphene_matrix_multiply (&view->model_matrix, &view->view_matrix, &model_view_matrix);
+        graphene_matrix_multiply (&model_view_matrix, &view->projection_matrix, &model_view_projection_matrix);
+        chips_frustum_init_from_matrix (&frustum, &model_view_projection_matrix);
+
+        g_array_set_size (renderer->draw_firsts, 0);
+        g_array_set_size (renderer->draw_counts, 0);
+        g_array_set_size (renderer->wanted_points, 0);
+
+        for (i = 0; i < renderer->blocks_uploaded; i++) {
+                graphene_point3d_t minimum, maximum;
+                graphene_box_t bounds;
+                GLint first;
+                float block_points;
+
+                graphene_point3d_init (&minimum, blocks[i].bounds_minimum[0], blocks[i].bounds_minimum[1], blocks[i].bounds_minimum[2]);
+                graphene_point3d_init (&maximum, blocks[i].bounds_maximum[0], blocks[i].bounds_maximum[1], blocks[i].bounds_maximum[2]);
+                graphene_box_init (&bounds, &minimum, &maximum);
+
+                if (chips_frustum_test_bounds (&frustum, &bounds) == CHIPS_FRUSTUM_OUTSIDE) {
+                        continue;
+                }
+
+                block_points = get_wanted_points (view, &blocks[i], &bounds);
+                total_points += block_points;
+
+                first = blocks[i].first_point;
+                g_array_append_val (renderer->draw_firsts, first);
+                g_array_append_val (renderer->wanted_points, block_points);
+        }
+
+        if (renderer->draw_firsts->len == 0) {
+                return;
+        }
+
+        if (total_points > renderer->point_budget) {
+                scale = renderer->point_budget / total_points;
+        }
+
+        g_array_set_size (renderer->draw_counts, renderer->wanted_points->len);
+
+        for (i = 0; i < renderer->wanted_points->len; i++) {
+                float block_points = g_array_index (renderer->wanted_points, float, i);
+
+                g_array_index (renderer->draw_counts, GLsizei, i) = MAX ((GLsizei) (block_points * scale), 1);
+        }
+
+        glBindVertexArray (renderer->vertex_array_id);
+
+        chips_shader_program_set_matrices (renderer->program,
+                                           &view->model_matrix,
+                                           &view->view_matrix,
+                                           &view->projection_matrix);
+        chips_shader_program_set_depth_range (renderer->program,
+                                              view->near_plane,
+                                              view->far_plane);
+        chips_shader_program_set_position_encoding (renderer->program,
+                                                    chips_point_cloud_get_vertex_format (renderer->point_cloud));
+
+        glMultiDrawArrays (GL_POINTS,
+                           (const GLint *) renderer->draw_firsts->data,
+                           (const GLsizei *) renderer->draw_counts->data,
+                           renderer->draw_firsts->len);
+}
@@ -0,0 +1,43 @@
+/* chips-point-cloud-renderer.h
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CHIPS_POINT_CLOUD_RENDERER_H
+#define CHIPS_POINT_CLOUD_RENDERER_H
+
+#include "chips.h"
+#include "chips-point-cloud.h"
+#include "chips-renderer.h"
+
+/* About what a mid-range GPU draws in a few milliseconds */
+#define CHIPS_POINT_CLOUD_RENDERER_DEFAULT_POINT_BUDGET 4000000
+
+typedef struct _ChipsPointCloudRenderer ChipsPointCloudRenderer;
+
+ChipsPointCloudRenderer *chips_point_cloud_renderer_new              (ChipsPointCloud         *point_cloud);
+void                     chips_point_cloud_renderer_free             (ChipsPointCloudRenderer *renderer);
+
+void                     chips_point_cloud_renderer_set_point_budget (ChipsPointCloudRenderer *renderer,
+                                                                      guint64                  point_budget);
+
+gboolean                 chips_point_cloud_renderer_upload           (ChipsPointCloudRenderer *renderer,
+                                                                      gint64                   time_budget);
+void                     chips_point_cloud_renderer_draw             (ChipsPointCloudRenderer *renderer,
+                                                                      const ChipsRenderView   *view);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ChipsPointCloudRenderer, chips_point_cloud_renderer_free);
+
+#endif /* CHIPS_POINT_CLOUD_RENDERER_H */
@@ -0,0 +1,864 @@
+/* chips-point-cloud.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chips-point-cloud.h"
+#include "chips-parallel.h"
+
+#include <string.h>
+
+static void initable_iface_init       (GInitableIface      *initable_iface);
+static void async_initable_iface_init (GAsyncInitableIface *async_initable_iface);
+
+struct _ChipsPointCloud
+{
+        GObject parent_object;
+
+        GFile *file;
+
+        ChipsVertexFormat vertex_format;
+        GBytes *points;
+        guint64 number_of_points;
+        GArray *blocks;
+};
+
+G_DEFINE_TYPE_WITH_CODE (ChipsPointCloud, chips_point_cloud, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (G_TYPE_INITABLE, initable_iface_init)
+                         G_IMPLEMENT_INTERFACE (G_TYPE_ASYNC_INITABLE, async_initable_iface_init));
+
+enum
+{
+        PROP_FILE = 1,
+        NUMBER_OF_PROPERTIES
+};
+
+static GParamSpec *properties[NUMBER_OF_PROPERTIES];
+
+#define POINTS_PER_CHUNK 65536
+#define BLOCKS_PER_CHUNK 16
+
+/* Anything longer isn't a header anyone wrote by hand or tool */
+#define MAXIMUM_HEADER_SIZE (64 * 1024)
+
+/* Each quantized coordinate is 16 bits, so the three of them
+ * interleave into a 48 bit Morton code, sorted 16 bits at a time
+ */
+#define BITS_PER_COORDINATE 16
+#define RADIX_BITS 16
+#define RADIX_SIZE (1 << RADIX_BITS)
+
+typedef enum
+{
+        PLY_TYPE_INT8 = 0,
+        PLY_TYPE_UINT8,
+        PLY_TYPE_INT16,
+        PLY_TYPE_UINT16,
+        PLY_TYPE_INT32,
+        PLY_TYPE_UINT32,
+        PLY_TYPE_FLOAT32,
+        PLY_TYPE_FLOAT64,
+        NUMBER_OF_PLY_TYPES
+} PlyType;
+
+static const struct
+{
+        const char *name;
+        const char *sized_name;
+        size_t      size;
+} ply_types[NUMBER_OF_PLY_TYPES] = {
+        [PLY_TYPE_INT8] = { "char", "int8", 1 },
+        [PLY_TYPE_UINT8] = { "uchar", "uint8", 1 },
+        [PLY_TYPE_INT16] = { "short", "int16", 2 },
+        [PLY_TYPE_UINT16] = { "ushort", "uint16", 2 },
+        [PLY_TYPE_INT32] = { "int", "int32", 4 },
+        [PLY_TYPE_UINT32] = { "uint", "uint32", 4 },
+        [PLY_TYPE_FLOAT32] = { "float", "float32", 4 },
+        [PLY_TYPE_FLOAT64] = { "double", "float64", 8 },
+};
+
+/* Where the positions are in the vertex element of a binary little
+ * endian PLY file.  Every other property is skipped over.
+ */
+typedef struct
+{
+        const guint8 *vertices;
+        guint64       number_of_vertices;
+        size_t        vertex_size;
+        size_t        position_offsets[3];
+        PlyType       position_types[3];
+} PlyVertices;
+
+typedef struct
+{
+        const PlyVertices *vertices;
+
+        GMutex             bounds_lock;
+        double             minimum[3];
+        double             maximum[3];
+
+        guint64           *codes;
+        guint16           *points;
+        ChipsPointCloudBlock *blocks;
+        size_t             number_of_blocks;
+        const ChipsVertexFormat *format;
+} PointCloudJob;
+
+static gboolean
+parse_ply_type (const char *name,
+                PlyType    *type)
+{
+        size_t i;
+
+        for (i = 0; i < NUMBER_OF_PLY_TYPES; i++) {
+                if (strcmp (name, ply_types[i].name) == 0 ||
+                    strcmp (name, ply_types[i].sized_name) == 0) {
+                        *type = i;
+                        return TRUE;
+                }
+        }
+
+        return FALSE;
+}
+
+static double
+read_ply_value (const guint8 *data,
+                PlyType       type)
+{
+        switch (type) {
+                case PLY_TYPE_INT8:
+                        return (gint8) data[0];
+                case PLY_TYPE_UINT8:
+                        return data[0];
+                case PLY_TYPE_INT16: {
+                        guint16 value;
+                        memcpy (&value, data, sizeof (value));
+                        return (gint16) GUINT16_FROM_LE (value);
+                }
+                case PLY_TYPE_UINT16: {
+                        guint16 value;
+                        memcpy (&value, data, sizeof (value));
+                        return GUINT16_FROM_LE (value);
+                }
+                case PLY_TYPE_INT32: {
+                        guint32 value;
+                        memcpy (&value, data, sizeof (value));
+                        return (gint32) GUINT32_FROM_LE (value);
+                }
+                case PLY_TYPE_UINT32: {
+                        guint32 value;
+                        memcpy (&value, data, sizeof (value));
+                        return GUINT32_FROM_LE (value);
+                }
+                case PLY_TYPE_FLOAT32: {
+                        guint32 bits;
+                        float value;
+                        memcpy (&bits, data, sizeof (bits));
+                        bits = GUINT32_FROM_LE (bits);
+                        memcpy (&value, &bits, sizeof (value));
+                        return value;
+                }
+                case PLY_TYPE_FLOAT64: {
+                        guint64 bits;
+                        double value;
+                        memcpy (&bits, data, sizeof (bits));
+                        bits = GUINT64_FROM_LE (bits);
+                        memcpy (&value, &bits, sizeof (value));
+                        return value;
+                }
+                default:
+                        break;
+        }
+
+        return 0.0;
+}
+
+static void
+get_ply_position (const PlyVertices *vertices,
+                  guint64            vertex,
+                  double             position[3])
+{
+        const guint8 *data = vertices->vertices + vertex * vertices->vertex_size;
+        size_t i;
+
+        for (i = 0; i < 3; i++) {
+                position[i] = read_ply_value (data + vertices->position_offsets[i], vertices->position_types[i]);
+        }
+}
+
+/* Only the vertex element matters, and it has to come first, since
+ * skipping an element with list properties means reading all of it.
+ * Anything after it, like faces, is ignored.
+ */
+static gboolean
+parse_ply_header (const char   *data,
+                  size_t        size,
+                  PlyVertices  *vertices,
+                  GError      **error)
+{
+        g_autofree char *header = NULL;
+        g_auto (GStrv) lines = NULL;
+        const char *end_of_header;
+        size_t header_size, i, j;
+        gboolean found_format = FALSE, in_vertex_element = FALSE, found_vertex_element = FALSE;
+        gboolean found_positions[3] = { FALSE, FALSE, FALSE };
+
+        if (size < 4 || memcmp (data, "ply", 3) != 0 || (data[3] != '\n' && data[3] != '\r')) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "not a PLY file");
+                return FALSE;
+        }
+
+        end_of_header = g_strstr_len (data, MIN (size, MAXIMUM_HEADER_SIZE), "end_header");
+
+        if (end_of_header == NULL) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "PLY header doesn't end");
+                return FALSE;
+        }
+
+        end_of_header = memchr (end_of_header, '\n', data + size - end_of_header);
+
+        if (end_of_header == NULL) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "PLY header doesn't end");
+                return FALSE;
+        }
+
+        header_size = end_of_header + 1 - data;
+        header = g_strndup (data, header_size);
+        lines = g_strsplit (header, "\n", -1);
+
+        memset (vertices, 0, sizeof (*vertices));
+
+        for (i = 0; lines[i] != NULL; i++) {
+                g_auto (GStrv) words = NULL;
+
+                g_strstrip (lines[i]);
+                words = g_strsplit_set (lines[i], " \t", -1);
+
+                if (g_strcmp0 (words[0], "format") == 0) {
+                        if (g_strcmp0 (words[1], "binary_little_endian") != 0) {
+                                g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                                             "only binary little endian PLY files are supported");
+                                return FALSE;
+                        }
+
+                        found_format = TRUE;
+                } else if (g_strcmp0 (words[0], "element") == 0) {
+                        if (found_vertex_element) {
+                                break;
+                        }
+
+                        if (g_strcmp0 (words[1], "vertex") != 0 || words[2] == NULL) {
+                                g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                                             "PLY files have to start with vertices");
+                                return FALSE;
+                        }
+
+                        vertices->number_of_vertices = g_ascii_strtoull (words[2], NULL, 10);
+                        in_vertex_element = TRUE;
+                        found_vertex_element = TRUE;
+                } else if (g_strcmp0 (words[0], "property") == 0 && in_vertex_element) {
+                        PlyType type;
+
+                        if (g_strcmp0 (words[1], "list") == 0) {
+                                g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                                             "PLY vertices can't have list properties");
+                                return FALSE;
+                        }
+
+                        if (words[1] == NULL || words[2] == NULL || !parse_ply_type (words[1], &type)) {
+                                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                                             "bad PLY property '%s'", lines[i]);
+                                return FALSE;
+                        }
+
+                        for (j = 0; j < 3; j++) {
+                                const char *axis_names[] = { "x", "y", "z" };
+
+                                if (strcmp (words[2], axis_names[j]) == 0) {
+                                        vertices->position_offsets[j] = vertices->vertex_size;
+                                        vertices->position_types[j] = type;
+                                        found_positions[j] = TRUE;
+                                }
+                        }
+
+                        vertices->vertex_size += ply_types[type].size;
+                }
+        }
+
+        if (!found_format) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "PLY file has no format");
+                return FALSE;
+        }
+
+        if (!found_positions[0] || !found_positions[1] || !found_positions[2]) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "PLY file has no vertex positions");
+                return FALSE;
+        }
+
+        if (vertices->number_of_vertices > (size - header_size) / vertices->vertex_size) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "PLY file is truncated");
+                return FALSE;
+        }
+
+        vertices->vertices = (const guint8 *) data + header_size;
+
+        return TRUE;
+}
+
+static void
+measure_point_range (size_t         start,
+                     size_t         end,
+                     PointCloudJob *job)
+{
+        double minimum[3] = { G_MAXDOUBLE, G_MAXDOUBLE, G_MAXDOUBLE };
+        double maximum[3] = { -G_MAXDOUBLE, -G_MAXDOUBLE, -G_MAXDOUBLE };
+        size_t i, j;
+
+        for (i = start; i < end; i++) {
+                double position[3];
+
+                get_ply_position (job->vertices, i, position);
+
+                for (j = 0; j < 3; j++) {
+                        minimum[j] = MIN (minimum[j], position[j]);
+                        maximum[j] = MAX (maximum[j], position[j]);
+                }
+        }
+
+        g_mutex_lock (&job->bounds_lock);
+        for (j = 0; j < 3; j++) {
+                job->minimum[j] = MIN (job->minimum[j], minimum[j]);
+                job->maximum[j] = MAX (job->maximum[j], maximum[j]);
+        }
+        g_mutex_unlock (&job->bounds_lock);
+}
+
+/* Spreads the bits of a coordinate out to every third bit */
+static guint64
+spread_bits (guint64 value)
+{
+        value &= 0xffff;
+        value = (value | (value << 16)) & G_GUINT64_CONSTANT (0x0000ff0000ff);
+        value = (value | (value << 8)) & G_GUINT64_CONSTANT (0x00f00f00f00f);
+        value = (value | (value << 4)) & G_GUINT64_CONSTANT (0x0c30c30c30c3);
+        value = (value | (value << 2)) & G_GUINT64_CONSTANT (0x249249249249);
+
+        return value;
+}
+
+static guint16
+compact_bits (guint64 value)
+{
+        value &= G_GUINT64_CONSTANT (0x249249249249);
+        value = (value | (value >> 2)) & G_GUINT64_CONSTANT (0x0c30c30c30c3);
+        value = (value | (value >> 4)) & G_GUINT64_CONSTANT (0x00f00f00f00f);
+        value = (value | (value >> 8)) & G_GUINT64_CONSTANT (0x0000ff0000ff);
+        value = (value | (value >> 16)) & 0xffff;
+
+        return value;
+}
+
+/* The Morton code holds all three quantized coordinates, so sorting
+ * the codes sorts the points, and nothing else needs to be kept
+ */
+static void
+quantize_point_range (size_t         start,
+                      size_t         end,
+                      PointCloudJob *job)
+{
+        size_t i, j;
+
+        for (i = start; i < end; i++) {
+                double position[3];
+                guint64 code = 0;
+
+                get_ply_position (job->vertices, i, position);
+
+                for (j = 0; j < 3; j++) {
+                        double size = job->maximum[j] - job->minimum[j];
+                        double normalized = size > 0.0? (position[j] - job->minimum[j]) / size : 0.0;
+                        guint64 quantized = (guint64) (CLAMP (normalized, 0.0, 1.0) * 65535.0 + 0.5);
+
+                        code |= spread_bits (quantized) << j;
+                }
+
+                job->codes[i] = code;
+        }
+}
+
+/* Least significant digit first, so each pass keeps the order of the
+ * one before it.  There are an odd number of passes, so the sorted
+ * codes end up in scratch.
+ */
+static gboolean
+sort_codes (guint64       *codes,
+            guint64       *scratch,
+            size_t         number_of_codes,
+            GCancellable  *cancellable,
+            GError       **error)
+{
+        g_autofree size_t *counts = NULL;
+        size_t shift, i;
+
+        counts = g_new (size_t, RADIX_SIZE);
+
+        for (shift = 0; shift < 3 * BITS_PER_COORDINATE; shift += RADIX_BITS) {
+                size_t total = 0;
+                guint64 *swap;
+
+                if (g_cancellable_set_error_if_cancelled (cancellable, error)) {
+                        return FALSE;
+                }
+
+                memset (counts, 0, RADIX_SIZE * sizeof (size_t));
+
+                for (i = 0; i < number_of_codes; i++) {
+                        counts[(codes[i] >> shift) & (RADIX_SIZE - 1)]++;
+                }
+
+                for (i = 0; i < RADIX_SIZE; i++) {
+                        size_t count = counts[i];
+
+                        counts[i] = total;
+                        total += count;
+                }
+
+                for (i = 0; i < number_of_codes; i++) {
+                        scratch[counts[(codes[i] >> shift) & (RADIX_SIZE - 1)]++] = codes[i];
+                }
+
+                swap = codes;
+                codes = scratch;
+                scratch = swap;
+        }
+
+        G_STATIC_ASSERT ((3 * BITS_PER_COORDINATE / RADIX_BITS) % 2 == 1);
+
+        return TRUE;
+}
+
+static guint32
+reverse_bits (guint32 value,
+              guint   number_of_bits)
+{
+        guint32 reversed = 0;
+        guint i;
+
+        for (i = 0; i < number_of_bits; i++) {
+                reversed = (reversed << 1) | ((value >> i) & 1);
+        }
+
+        return reversed;
+}
+
+/* Visiting a block in bit reversed order takes every other point,
+ * then every fourth in between, and so on, so any prefix is an even
+ * sample of the whole block
+ */
+static void
+build_block_range (size_t         start,
+                   size_t         end,
+                   PointCloudJob *job)
+{
+        guint number_of_bits = g_bit_storage (CHIPS_POINT_CLOUD_POINTS_PER_BLOCK - 1);
+        size_t i, j, k;
+
+        for (i = start; i < end; i++) {
+                ChipsPointCloudBlock *block = &job->blocks[i];
+                const guint64 *codes = job->codes + block->first_point;
+                guint16 *points = job->points + block->first_point * 4;
+                guint16 minimum[3] = { G_MAXUINT16, G_MAXUINT16, G_MAXUINT16 };
+                guint16 maximum[3] = { 0, 0, 0 };
+                size_t point = 0;
+
+                for (j = 0; j < CHIPS_POINT_CLOUD_POINTS_PER_BLOCK; j++) {
+                        guint32 source = reverse_bits (j, number_of_bits);
+
+                        if (source >= block->number_of_points) {
+                                continue;
+                        }
+
+                        for (k = 0; k < 3; k++) {
+                                guint16 coordinate = compact_bits (codes[source] >> k);
+
+                                points[point * 4 + k] = coordinate;
+                                minimum[k] = MIN (minimum[k], coordinate);
+                                maximum[k] = MAX (maximum[k], coordinate);
+                        }
+
+                        points[point * 4 + 3] = 0;
+                        point++;
+                }
+
+                for (k = 0; k < 3; k++) {
+                        block->bounds_minimum[k] = job->format->position_offset[k] +
+                                                   minimum[k] / 65535.0f * job->format->position_scale[k];
+                        block->bounds_maximum[k] = job->format->position_offset[k] +
+                                                   maximum[k] / 65535.0f * job->format->position_scale[k];
+                }
+        }
+}
+
+/* Reads the file through a mapping, a chunk of points at a time, and
+ * never keeps more than the quantized points and their sort scratch
+ * space, 16 bytes a point, in memory
+ */
+static gboolean
+load_point_cloud (ChipsPointCloud  *self,
+                  GCancellable     *cancellable,
+                  GError          **error)
+{
+        g_autofree char *filename = NULL;
+        g_autoptr (GMappedFile) mapped_file = NULL;
+        PlyVertices vertices;
+        PointCloudJob job = { 0 };
+        guint64 *scratch = NULL;
+        size_t number_of_blocks, i;
+        gboolean loaded = FALSE;
+
+        if (self->file == NULL) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                             "point clouds need a file");
+                return FALSE;
+        }
+
+        filename = g_file_get_path (self->file);
+
+        if (filename == NULL) {
+                g_autofree char *name = g_file_get_parse_name (self->file);
+
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                             "'%s' isn't a local file", name);
+                return FALSE;
+        }
+
+        mapped_file = g_mapped_file_new (filename, FALSE, error);
+
+        if (mapped_file == NULL) {
+                return FALSE;
+        }
+
+        if (!parse_ply_header (g_mapped_file_get_contents (mapped_file),
+                               g_mapped_file_get_length (mapped_file),
+                               &vertices,
+                               error)) {
+                return FALSE;
+        }
+
+        if (vertices.number_of_vertices == 0) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "'%s' has no points", filename);
+                return FALSE;
+        }
+
+        job.vertices = &vertices;
+        g_mutex_init (&job.bounds_lock);
+
+        for (i = 0; i < 3; i++) {
+                job.minimum[i] = G_MAXDOUBLE;
+                job.maximum[i] = -G_MAXDOUBLE;
+        }
+
+        if (!chips_parallel_for (vertices.number_of_vertices,
+                                 POINTS_PER_CHUNK,
+                                 (ChipsParallelFunc) measure_point_range,
+                                 &job,
+                                 cancellable,
+                                 error)) {
+                goto out;
+        }
+
+        chips_vertex_format_init (&self->vertex_format,
+                                  CHIPS_VERTEX_ENCODING_NORMALIZED_SHORT,
+                                  CHIPS_VERTEX_ENCODING_NONE,
+                                  CHIPS_VERTEX_ENCODING_NONE);
+
+        for (i = 0; i < 3; i++) {
+                self->vertex_format.position_offset[i] = job.minimum[i];
+                self->vertex_format.position_scale[i] = job.maximum[i] - job.minimum[i];
+        }
+
+        job.format = &self->vertex_format;
+        job.codes = g_new (guint64, vertices.number_of_vertices);
+
+        if (!chips_parallel_for (vertices.number_of_vertices,
+                                 POINTS_PER_CHUNK,
+                                 (ChipsParallelFunc) quantize_point_range,
+                                 &job,
+                                 cancellable,
+                                 error)) {
+                goto out;
+        }
+
+        g_clear_pointer (&mapped_file, g_mapped_file_unref);
+
+        scratch = g_new (guint64, vertices.number_of_vertices);
+
+        if (!sort_codes (job.codes, scratch, vertices.number_of_vertices, cancellable, error)) {
+                goto out;
+        }
+
+        /* The unsorted codes aren't needed anymore, and each quantized
+         * point takes the same 8 bytes a code did
+         */
+        G_STATIC_ASSERT (4 * sizeof (guint16) == sizeof (guint64));
+        job.points = (guint16 *) job.codes;
+        job.codes = scratch;
+        scratch = NULL;
+
+        number_of_blocks = (vertices.number_of_vertices + CHIPS_POINT_CLOUD_POINTS_PER_BLOCK - 1) /
+                           CHIPS_POINT_CLOUD_POINTS_PER_BLOCK;
+        self->blocks = g_array_sized_new (FALSE, TRUE, sizeof (ChipsPointCloudBlock), number_of_blocks);
+        g_array_set_size (self->blocks, number_of_blocks);
+
+        job.blocks = (ChipsPointCloudBlock *) self->blocks->data;
+        job.number_of_blocks = number_of_blocks;
+
+        for (i = 0; i < number_of_blocks; i++) {
+                job.blocks[i].first_point = (guint64) i * CHIPS_POINT_CLOUD_POINTS_PER_BLOCK;
+                job.blocks[i].number_of_points = MIN (CHIPS_POINT_CLOUD_POINTS_PER_BLOCK,
+                                                      vertices.number_of_vertices - job.blocks[i].first_point);
+        }
+
+        if (!chips_parallel_for (number_of_blocks,
+                                 BLOCKS_PER_CHUNK,
+                                 (ChipsParallelFunc) build_block_range,
+                                 &job,
+                                 cancellable,
+                                 error)) {
+                goto out;
+        }
+
+        self->points = g_bytes_new_take (job.points, vertices.number_of_vertices * self->vertex_format.stride);
+        self->number_of_points = vertices.number_of_vertices;
+        job.points = NULL;
+
+        loaded = TRUE;
+out:
+        if (!loaded) {
+                g_clear_pointer (&self->blocks, g_array_unref);
+        }
+
+        g_mutex_clear (&job.bounds_lock);
+        g_free (job.codes);
+        g_free (job.points);
+        g_free (scratch);
+
+        return loaded;
+}
+
+static gboolean
+initable_init (GInitable     *initable,
+               GCancellable  *cancellable,
+               GError       **error)
+{
+        ChipsPointCloud *self = CHIPS_POINT_CLOUD (initable);
+
+        return load_point_cloud (self, cancellable, error);
+}
+
+static void
+initable_iface_init (GInitableIface *initable_iface)
+{
+        initable_iface->init = initable_init;
+}
+
+static void
+load_point_cloud_in_thread (GTask           *task,
+                            ChipsPointCloud *self,
+                            gpointer         task_data,
+                            GCancellable    *cancellable)
+{
+        GError *error = NULL;
+
+        if (!load_point_cloud (self, cancellable, &error)) {
+                g_task_return_error (task, error);
+                return;
+        }
+
+        g_task_return_boolean (task, TRUE);
+}
+
+static void
+async_initable_init_async (GAsyncInitable      *initable,
+                           int                  io_priority,
+                           GCancellable        *cancellable,
+                           GAsyncReadyCallback  callback,
+                           gpointer             user_data)
+{
+        ChipsPointCloud *self = CHIPS_POINT_CLOUD (initable);
+        g_autoptr (GTask) task = NULL;
+
+        task = g_task_new (self, cancellable, callback, user_data);
+        g_task_set_source_tag (task, async_initable_init_async);
+        g_task_set_priority (task, io_priority);
+
+        g_task_run_in_thread (task, (GTaskThreadFunc) load_point_cloud_in_thread);
+}
+
+static gboolean
+async_initable_init_finish (GAsyncInitable  *initable,
+                            GAsyncResult    *result,
+                            GError         **error)
+{
+        g_return_val_if_fail (g_task_is_valid (result, initable), FALSE);
+
+        return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+static void
+async_initable_iface_init (GAsyncInitableIface *async_initable_iface)
+{
+        async_initable_iface->init_async = async_initable_init_async;
+        async_initable_iface->init_finish = async_initable_init_finish;
+}
+
+static void
+chips_point_cloud_dispose (GObject *object)
+{
+        ChipsPointCloud *self = CHIPS_POINT_CLOUD (object);
+
+        g_clear_pointer (&self->points, g_bytes_unref);
+        g_clear_pointer (&self->blocks, g_array_unref);
+        g_clear_object (&self->file);
+
+        G_OBJECT_CLASS (chips_point_cloud_parent_class)->dispose (object);
+}
+
+static void
+chips_point_cloud_set_property (GObject      *object,
+                                guint         property_id,
+                                const GValue *value,
+                                GParamSpec   *param_spec)
+{
+        ChipsPointCloud *self = CHIPS_POINT_CLOUD (object);
+
+        switch (property_id) {
+                case PROP_FILE:
+                        self->file = g_value_dup_object (value);
+                        break;
+                default:
+                        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, param_spec);
+                        break;
+        }
+}
+
+static void
+chips_point_cloud_get_property (GObject    *object,
+                                guint       property_id,
+                                GValue     *value,
+                                GParamSpec *param_spec)
+{
+        ChipsPointCloud *self = CHIPS_POINT_CLOUD (object);
+
+        switch (property_id) {
+                case PROP_FILE:
+                        g_value_set_object (value, self->file);
+                        break;
+                default:
+                        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, param_spec);
+                        break;
+        }
+}
+
+static void
+chips_point_cloud_class_init (ChipsPointCloudClass *own_class)
+{
+        GObjectClass *object_class = G_OBJECT_CLASS (own_class);
+
+        object_class->dispose = chips_point_cloud_dispose;
+        object_class->set_property = chips_point_cloud_set_property;
+        object_class->get_property = chips_point_cloud_get_property;
+
+        properties[PROP_FILE] = g_param_spec_object ("file",
+                                                     "File",
+                                                     "PLY file the points are loaded from",
+                                                     G_TYPE_FILE,
+                                                     G_PARAM_READWRITE |
+                                                     G_PARAM_CONSTRUCT_ONLY |
+                                                     G_PARAM_STATIC_STRINGS);
+
+        g_object_class_install_properties (object_class, NUMBER_OF_PROPERTIES, properties);
+}
+
+static void
+chips_point_cloud_init (ChipsPointCloud *self)
+{
+}
+
+GFile *
+chips_point_cloud_get_file (ChipsPointCloud *self)
+{
+        return self->file;
+}
+
+const ChipsVertexFormat *
+chips_point_cloud_get_vertex_format (ChipsPointCloud *self)
+{
+        return &self->vertex_format;
+}
+
+gconstpointer
+chips_point_cloud_get_points (ChipsPointCloud *self)
+{
+        if (self->points == NULL) {
+                return NULL;
+        }
+
+        return g_bytes_get_data (self->points, NULL);
+}
+
+guint64
+chips_point_cloud_get_number_of_points (ChipsPointCloud *self)
+{
+        return self->number_of_points;
+}
+
+const ChipsPointCloudBlock *
+chips_point_cloud_get_blocks (ChipsPointCloud *self,
+                              size_t          *number_of_blocks)
+{
+        if (self->blocks == NULL) {
+                *number_of_blocks = 0;
+                return NULL;
+        }
+
+        *number_of_blocks = self->blocks->len;
+
+        return (const ChipsPointCloudBlock *) self->blocks->data;
+}
+
+void
+chips_point_cloud_get_bounds (ChipsPointCloud *self,
+                              graphene_box_t  *bounds)
+{
+        graphene_point3d_t minimum, maximum;
+
+        graphene_point3d_init (&minimum,
+                               self->vertex_format.position_offset[0],
+                               self->vertex_format.position_offset[1],
+                               self->vertex_format.position_offset[2]);
+        graphene_point3d_init (&maximum,
+                               self->vertex_format.position_offset[0] + self->vertex_format.position_scale[0],
+                               self->vertex_format.position_offset[1] + self->vertex_format.position_scale[1],
+                               self->vertex_format.position_offset[2] + self->vertex_format.position_scale[2]);
+        graphene_box_init (bounds, &minimum, &maximum);
+}
@@ -0,0 +1,56 @@
+/* chips-point-cloud.h
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CHIPS_POINT_CLOUD_H
+#define CHIPS_POINT_CLOUD_H
+
+#include "chips.h"
+#include "chips-vertex-format.h"
+
+#define CHIPS_POINT_CLOUD_SUFFIX ".ply"
+
+/* Points are stored in blocks of consecutive points along a Morton
+ * curve, so each block covers a compact part of space.  Within a block
+ * the points are shuffled so that any run from the start of the block
+ * is spread evenly over all of it, which makes a shorter run a coarser
+ * level of detail.
+ */
+#define CHIPS_POINT_CLOUD_POINTS_PER_BLOCK 16384
+
+typedef struct
+{
+        guint64 first_point;
+        guint32 number_of_points;
+        guint32 reserved;
+        float   bounds_minimum[3];
+        float   bounds_maximum[3];
+} ChipsPointCloudBlock;
+
+#define CHIPS_TYPE_POINT_CLOUD chips_point_cloud_get_type ()
+G_DECLARE_FINAL_TYPE (ChipsPointCloud, chips_point_cloud, CHIPS, POINT_CLOUD, GObject);
+
+GFile                      *chips_point_cloud_get_file             (ChipsPointCloud *self);
+
+const ChipsVertexFormat    *chips_point_cloud_get_vertex_format    (ChipsPointCloud *self);
+gconstpointer               chips_point_cloud_get_points           (ChipsPointCloud *self);
+guint64                     chips_point_cloud_get_number_of_points (ChipsPointCloud *self);
+const ChipsPointCloudBlock *chips_point_cloud_get_blocks           (ChipsPointCloud *self,
+                                                                    size_t          *number_of_blocks);
+void                        chips_point_cloud_get_bounds           (ChipsPointCloud *self,
+                                                                    graphene_box_t  *bounds);
+
+#endif /* CHIPS_POINT_CLOUD_H */
@@ -0,0 +1,448 @@
+/* chips-profiler.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chips-profiler.h"
+
+/* Where each span happened.  Names and categories aren't copied, so
+ * they have to be string literals.
+ */
+typedef struct
+{
+        const char *category;
+        const char *name;
+        gint64      start_time;
+        gint64      duration;
+        guint       thread_number;
+} ChipsProfilerSpan;
+
+/* Frame times go in buckets this wide, with everything past the last
+ * bucket in it
+ */
+#define FRAME_TIME_BUCKET_WIDTH 0.25
+#define NUMBER_OF_FRAME_TIME_BUCKETS 400
+
+/* GPU spans are drawn on a track of their own */
+#define GPU_THREAD_NUMBER 0
+
+typedef enum
+{
+        CHIPS_FRAME_TIME_CPU = 0,
+        CHIPS_FRAME_TIME_GPU,
+        CHIPS_NUMBER_OF_FRAME_TIMES
+} ChipsFrameTime;
+
+typedef struct
+{
+        GMutex   lock;
+        char    *trace_filename;
+        GArray  *spans;
+        gint64   start_time;
+        guint    frame_time_histograms[CHIPS_NUMBER_OF_FRAME_TIMES][NUMBER_OF_FRAME_TIME_BUCKETS];
+        double   last_frame_times[CHIPS_NUMBER_OF_FRAME_TIMES];
+        guint64  number_of_frames[CHIPS_NUMBER_OF_FRAME_TIMES];
+} ChipsProfiler;
+
+static ChipsProfiler profiler;
+static volatile int running;
+static volatile int next_thread_number = GPU_THREAD_NUMBER + 1;
+static GPrivate thread_number;
+
+/* Starts keeping track of spans and frames, writing them to
+ * trace_filename, if it isn't NULL, when profiling stops.  Turning the
+ * profiler on costs a clock read per span, and nothing while it's off.
+ */
+void
+chips_profiler_start (const char *trace_filename)
+{
+        if (g_atomic_int_get (&running)) {
+                return;
+        }
+
+        g_mutex_init (&profiler.lock);
+        profiler.trace_filename = g_strdup (trace_filename);
+        profiler.spans = g_array_new (FALSE, FALSE, sizeof (ChipsProfilerSpan));
+        profiler.start_time = g_get_monotonic_time ();
+
+        g_atomic_int_set (&running, TRUE);
+}
+
+gboolean
+chips_profiler_is_running (void)
+{
+        return g_atomic_int_get (&running);
+}
+
+/* Returns when the span starts, to pass to chips_profiler_end_span(),
+ * or 0 if the profiler isn't running
+ */
+gint64
+chips_profiler_begin_span (void)
+{
+        if (!g_atomic_int_get (&running)) {
+                return 0;
+        }
+
+        return g_get_monotonic_time ();
+}
+
+static guint
+get_thread_number (void)
+{
+        guint number = GPOINTER_TO_UINT (g_private_get (&thread_number));
+
+        if (number == 0) {
+                number = g_atomic_int_add (&next_thread_number, 1);
+                g_private_set (&thread_number, GUINT_TO_POINTER (number));
+        }
+
+        return number;
+}
+
+static void
+add_span (const char *category,
+          const char *name,
+          gint64      start_time,
+          gint64      duration,
+          guint       thread)
+{
+        ChipsProfilerSpan span;
+
+        span.category = category;
+        span.name = name;
+        span.start_time = start_time;
+        span.duration = duration;
+        span.thread_number = thread;
+
+        /* Profiling may have stopped since the caller checked */
+        g_mutex_lock (&profiler.lock);
+        if (profiler.spans != NULL) {
+                g_array_append_val (profiler.spans, span);
+        }
+        g_mutex_unlock (&profiler.lock);
+}
+
+void
+chips_profiler_end_span (gint64      start_time,
+                         const char *category,
+                         const char *name)
+{
+        if (start_time == 0 || !g_atomic_int_get (&running)) {
+                return;
+        }
+
+        add_span (category, name, start_time, g_get_monotonic_time () - start_time, get_thread_number ());
+}
+
+static void
+add_frame_time (ChipsFrameTime frame_time,
+                double         milliseconds)
+{
+        size_t bucket;
+
+        bucket = MIN ((size_t) (milliseconds / FRAME_TIME_BUCKET_WIDTH), NUMBER_OF_FRAME_TIME_BUCKETS - 1);
+
+        g_mutex_lock (&profiler.lock);
+        profiler.frame_time_histograms[frame_time][bucket]++;
+        profiler.last_frame_times[frame_time] = milliseconds;
+        profiler.number_of_frames[frame_time]++;
+        g_mutex_unlock (&profiler.lock);
+}
+
+/* Records a frame that started drawing at start_time, which should come
+ * from chips_profiler_begin_span(), and ends now
+ */
+void
+chips_profiler_add_frame (gint64 start_time)
+{
+        if (start_time == 0 || !g_atomic_int_get (&running)) {
+                return;
+        }
+
+        chips_profiler_end_span (start_time, "frame", "frame");
+        add_frame_time (CHIPS_FRAME_TIME_CPU, (g_get_monotonic_time () - start_time) / 1000.0);
+}
+
+/* The upper edge of the bucket the given fraction of frames fit under */
+static double
+get_percentile (ChipsFrameTime frame_time,
+                double         fraction)
+{
+        const guint *histogram = profiler.frame_time_histograms[frame_time];
+        guint64 count = 0, wanted;
+        size_t bucket;
+
+        if (profiler.number_of_frames[frame_time] == 0) {
+                return 0.0;
+        }
+
+        wanted = MAX ((guint64) ceil (profiler.number_of_frames[frame_time] * fraction), 1);
+
+        for (bucket = 0; bucket < NUMBER_OF_FRAME_TIME_BUCKETS - 1; bucket++) {
+                count += histogram[bucket];
+
+                if (count >= wanted) {
+                        break;
+                }
+        }
+
+        return (bucket + 1) * FRAME_TIME_BUCKET_WIDTH;
+}
+
+void
+chips_profiler_get_frame_statistics (ChipsFrameStatistics *statistics)
+{
+        memset (statistics, 0, sizeof (*statistics));
+
+        if (!g_atomic_int_get (&running)) {
+                return;
+        }
+
+        g_mutex_lock (&profiler.lock);
+        statistics->last_cpu_time = profiler.last_frame_times[CHIPS_FRAME_TIME_CPU];
+        statistics->last_gpu_time = profiler.last_frame_times[CHIPS_FRAME_TIME_GPU];
+        statistics->median_cpu_time = get_percentile (CHIPS_FRAME_TIME_CPU, 0.5);
+        statistics->median_gpu_time = get_percentile (CHIPS_FRAME_TIME_GPU, 0.5);
+        statistics->slowest_percentile_cpu_time = get_percentile (CHIPS_FRAME_TIME_CPU, 0.99);
+        statistics->slowest_percentile_gpu_time = get_percentile (CHIPS_FRAME_TIME_GPU, 0.99);
+        statistics->number_of_frames = profiler.number_of_frames[CHIPS_FRAME_TIME_CPU];
+        g_mutex_unlock (&profiler.lock);
+}
+
+static void
+append_histogram (GString        *trace,
+                  ChipsFrameTime  frame_time)
+{
+        size_t bucket, last_bucket = 0;
+
+        for (bucket = 0; bucket < NUMBER_OF_FRAME_TIME_BUCKETS; bucket++) {
+                if (profiler.frame_time_histograms[frame_time][bucket] != 0) {
+                        last_bucket = bucket;
+                }
+        }
+
+        g_string_append (trace, "[");
+
+        for (bucket = 0; bucket <= last_bucket; bucket++) {
+                g_string_append_printf (trace, "%s%u",
+                                        bucket > 0? ", " : "",
+                                        profiler.frame_time_histograms[frame_time][bucket]);
+        }
+
+        g_string_append (trace, "]");
+}
+
+/* In the Chrome trace event format, which chrome://tracing, Perfetto
+ * and speedscope all open.  Timestamps are microseconds since profiling
+ * started, and the frame time histograms go along as extra data.
+ */
+static gboolean
+write_trace (GError **error)
+{
+        g_autoptr (GString) trace = NULL;
+        size_t i;
+
+        trace = g_string_new ("{\n\"traceEvents\": [\n");
+
+        g_string_append_printf (trace,
+                                "{ \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                                "\"args\": { \"name\": \"GPU\" } }",
+                                GPU_THREAD_NUMBER);
+
+        for (i = 0; i < profiler.spans->len; i++) {
+                const ChipsProfilerSpan *span = &g_array_index (profiler.spans, ChipsProfilerSpan, i);
+
+                g_string_append_printf (trace,
+                                        ",\n{ \"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", "
+                                        "\"ts\": %" G_GINT64_FORMAT ", \"dur\": %" G_GINT64_FORMAT ", "
+                                        "\"pid\": 1, \"tid\": %u }",
+                                        span->name,
+                                        span->category,
+                                        span->start_time - profiler.start_time,
+                                        span->duration,
+                                        span->thread_number);
+        }
+
+        g_string_append_printf (trace,
+                                "\n],\n\"otherData\": {\n"
+                                "\"frame_time_bucket_width_ms\": %g,\n"
+                                "\"cpu_frame_time_histogram\": ",
+                                FRAME_TIME_BUCKET_WIDTH);
+        append_histogram (trace, CHIPS_FRAME_TIME_CPU);
+        g_string_append (trace, ",\n\"gpu_frame_time_histogram\": ");
+        append_histogram (trace, CHIPS_FRAME_TIME_GPU);
+        g_string_append (trace, "\n}\n}\n");
+
+        return g_file_set_contents (profiler.trace_filename, trace->str, trace->len, error);
+}
+
+/* Writes out the trace, if there's supposed to be one, and forgets
+ * everything recorded
+ */
+void
+chips_profiler_stop (void)
+{
+        if (!g_atomic_int_get (&running)) {
+                return;
+        }
+
+        g_atomic_int_set (&running, FALSE);
+
+        g_mutex_lock (&profiler.lock);
+        if (profiler.trace_filename != NULL) {
+                g_autoptr (GError) error = NULL;
+
+                if (!write_trace (&error)) {
+                        g_warning ("couldn't write trace: %s", error->message);
+                }
+        }
+
+        g_clear_pointer (&profiler.trace_filename, g_free);
+        g_clear_pointer (&profiler.spans, g_array_unref);
+        memset (profiler.frame_time_histograms, 0, sizeof (profiler.frame_time_histograms));
+        memset (profiler.last_frame_times, 0, sizeof (profiler.last_frame_times));
+        memset (profiler.number_of_frames, 0, sizeof (profiler.number_of_frames));
+        g_mutex_unlock (&profiler.lock);
+}
+
+/* Enough queries for the GPU to run a few frames behind */
+#define NUMBER_OF_TIMER_QUERIES 8
+
+typedef struct
+{
+        unsigned int query_id;
+        const char  *name;
+        gint64       start_time;
+} ChipsTimerQuery;
+
+struct _ChipsGpuTimer
+{
+        ChipsTimerQuery queries[NUMBER_OF_TIMER_QUERIES];
+        size_t          first_pending;
+        size_t          number_pending;
+
+        unsigned int    supported : 1;
+        unsigned int    measuring : 1;
+};
+
+/* Needs a current GL context, which has to stay current for every
+ * other call, chips_gpu_timer_free included
+ */
+ChipsGpuTimer *
+chips_gpu_timer_new (void)
+{
+        ChipsGpuTimer *timer;
+        size_t i;
+
+        timer = g_slice_new0 (ChipsGpuTimer);
+        timer->supported = epoxy_gl_version () >= 33 || epoxy_has_gl_extension ("GL_ARB_timer_query");
+
+        if (!timer->supported) {
+                return timer;
+        }
+
+        for (i = 0; i < NUMBER_OF_TIMER_QUERIES; i++) {
+                glGenQueries (1, &timer->queries[i].query_id);
+        }
+
+        return timer;
+}
+
+void
+chips_gpu_timer_free (ChipsGpuTimer *timer)
+{
+        size_t i;
+
+        if (timer->supported) {
+                for (i = 0; i < NUMBER_OF_TIMER_QUERIES; i++) {
+                        glDeleteQueries (1, &timer->queries[i].query_id);
+                }
+        }
+
+        g_slice_free (ChipsGpuTimer, timer);
+}
+
+/* Only one measurement can be going at once.  If the GPU has fallen so
+ * far behind that every query is still out, this one is skipped.
+ */
+void
+chips_gpu_timer_begin (ChipsGpuTimer *timer,
+                       const char    *name)
+{
+        ChipsTimerQuery *query;
+
+        if (!timer->supported || !chips_profiler_is_running ()) {
+                return;
+        }
+
+        g_return_if_fail (!timer->measuring);
+
+        if (timer->number_pending == NUMBER_OF_TIMER_QUERIES) {
+                return;
+        }
+
+        query = &timer->queries[(timer->first_pending + timer->number_pending) % NUMBER_OF_TIMER_QUERIES];
+        query->name = name;
+        query->start_time = g_get_monotonic_time ();
+
+        glBeginQuery (GL_TIME_ELAPSED, query->query_id);
+        timer->measuring = TRUE;
+}
+
+void
+chips_gpu_timer_end (ChipsGpuTimer *timer)
+{
+        if (!timer->measuring) {
+                return;
+        }
+
+        glEndQuery (GL_TIME_ELAPSED);
+        timer->measuring = FALSE;
+        timer->number_pending++;
+}
+
+/* Records the measurements the GPU has finished, oldest first, and
+ * stops at the first that isn't, rather than waiting on it.  GPU spans
+ * are placed at the time their commands were issued, since there's no
+ * telling when the GPU got to them.
+ */
+void
+chips_gpu_timer_collect (ChipsGpuTimer *timer)
+{
+        while (timer->number_pending > 0) {
+                ChipsTimerQuery *query = &timer->queries[timer->first_pending];
+                GLuint available;
+                GLuint64 elapsed;
+
+                glGetQueryObjectuiv (query->query_id, GL_QUERY_RESULT_AVAILABLE, &available);
+
+                if (!available) {
+                        break;
+                }
+
+                glGetQueryObjectui64v (query->query_id, GL_QUERY_RESULT, &elapsed);
+
+                timer->first_pending = (timer->first_pending + 1) % NUMBER_OF_TIMER_QUERIES;
+                timer->number_pending--;
+
+                if (!chips_profiler_is_running ()) {
+                        continue;
+                }
+
+                add_span ("gpu", query->name, query->start_time, elapsed / 1000, GPU_THREAD_NUMBER);
+                add_frame_time (CHIPS_FRAME_TIME_GPU, elapsed / 1000000.0);
+        }
+}
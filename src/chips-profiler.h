@@ -0,0 +1,61 @@
+/* chips-profiler.h
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CHIPS_PROFILER_H
+#define CHIPS_PROFILER_H
+
+#include "chips.h"
+
+/* How long frames took, on the CPU and the GPU, in milliseconds */
+typedef struct
+{
+        double last_cpu_time;
+        double last_gpu_time;
+        double median_cpu_time;
+        double median_gpu_time;
+        double slowest_percentile_cpu_time;
+        double slowest_percentile_gpu_time;
+        guint64 number_of_frames;
+} ChipsFrameStatistics;
+
+/* Measures time spent on the GPU by everything drawn between begin and
+ * end, without waiting for the answer.  Each GL context needs its own.
+ */
+typedef struct _ChipsGpuTimer ChipsGpuTimer;
+
+void           chips_profiler_start                (const char           *trace_filename);
+void           chips_profiler_stop                 (void);
+gboolean       chips_profiler_is_running           (void);
+
+gint64         chips_profiler_begin_span           (void);
+void           chips_profiler_end_span             (gint64                start_time,
+                                                    const char           *category,
+                                                    const char           *name);
+
+void           chips_profiler_add_frame            (gint64                start_time);
+void           chips_profiler_get_frame_statistics (ChipsFrameStatistics *statistics);
+
+ChipsGpuTimer *chips_gpu_timer_new                 (void);
+void           chips_gpu_timer_free                (ChipsGpuTimer        *timer);
+void           chips_gpu_timer_begin               (ChipsGpuTimer        *timer,
+                                                    const char           *name);
+void           chips_gpu_timer_end                 (ChipsGpuTimer        *timer);
+void           chips_gpu_timer_collect             (ChipsGpuTimer        *timer);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ChipsGpuTimer, chips_gpu_timer_free);
+
+#endif /* CHIPS_PROFILER_H */
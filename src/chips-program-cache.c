@@ -0,0 +1,185 @@
+/* chips-program-cache.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chips-program-cache.h"
+
+#include <glib/gstdio.h>
+
+#define PROGRAM_CACHE_MAGIC "CHIPSPRG"
+
+typedef struct
+{
+        char    magic[8];
+        guint32 binary_format;
+        guint32 reserved;
+} ProgramCacheHeader;
+
+gboolean
+chips_program_cache_is_supported (void)
+{
+        int number_of_formats = 0;
+
+        if (epoxy_gl_version () < 41 && !epoxy_has_gl_extension ("GL_ARB_get_program_binary")) {
+                return FALSE;
+        }
+
+        glGetIntegerv (GL_NUM_PROGRAM_BINARY_FORMATS, &number_of_formats);
+
+        return number_of_formats > 0;
+}
+
+/* Binaries are only good for the driver that made them, so the driver
+ * is part of the key along with the sources
+ */
+char *
+chips_program_cache_compute_key (const char * const *sources,
+                                 size_t              number_of_sources)
+{
+        g_autoptr (GChecksum) checksum = NULL;
+        const char *driver_strings[3];
+        size_t i;
+
+        checksum = g_checksum_new (G_CHECKSUM_SHA256);
+
+        for (i = 0; i < number_of_sources; i++) {
+                g_checksum_update (checksum, (const guchar *) sources[i], strlen (sources[i]) + 1);
+        }
+
+        driver_strings[0] = (const char *) glGetString (GL_VENDOR);
+        driver_strings[1] = (const char *) glGetString (GL_RENDERER);
+        driver_strings[2] = (const char *) glGetString (GL_VERSION);
+
+        for (i = 0; i < G_N_ELEMENTS (driver_strings); i++) {
+                const char *driver_string = driver_strings[i] != NULL? driver_strings[i] : "";
+
+                g_checksum_update (checksum, (const guchar *) driver_string, strlen (driver_string) + 1);
+        }
+
+        return g_strdup (g_checksum_get_string (checksum));
+}
+
+static char *
+get_cache_filename (const char *key)
+{
+        return g_build_filename (g_get_user_cache_dir (), "chips", "programs", key, NULL);
+}
+
+/* Returns FALSE if there's no usable binary, in which case the program
+ * needs to be compiled and linked as usual.  Drivers reject binaries
+ * after they get updated, so that's expected, and the stale file is
+ * dropped.
+ */
+gboolean
+chips_program_cache_load (const char   *key,
+                          unsigned int  program_id)
+{
+        g_autofree char *filename = NULL;
+        g_autofree char *contents = NULL;
+        ProgramCacheHeader header;
+        size_t size;
+        int link_status = GL_FALSE;
+
+        if (!chips_program_cache_is_supported ()) {
+                return FALSE;
+        }
+
+        filename = get_cache_filename (key);
+
+        if (!g_file_get_contents (filename, &contents, &size, NULL)) {
+                return FALSE;
+        }
+
+        if (size <= sizeof (header)) {
+                g_unlink (filename);
+                return FALSE;
+        }
+
+        memcpy (&header, contents, sizeof (header));
+
+        if (memcmp (header.magic, PROGRAM_CACHE_MAGIC, sizeof (header.magic)) != 0) {
+                g_unlink (filename);
+                return FALSE;
+        }
+
+        glProgramBinary (program_id,
+                         header.binary_format,
+                         contents + sizeof (header),
+                         size - sizeof (header));
+        glGetProgramiv (program_id, GL_LINK_STATUS, &link_status);
+
+        if (!link_status) {
+                g_debug ("driver rejected cached program binary '%s'", filename);
+                g_unlink (filename);
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+/* The program has to have been linked with
+ * GL_PROGRAM_BINARY_RETRIEVABLE_HINT set.  Failures aren't reported,
+ * the next launch just compiles again.
+ */
+void
+chips_program_cache_save (const char   *key,
+                          unsigned int  program_id)
+{
+        g_autofree char *filename = NULL;
+        g_autofree char *directory = NULL;
+        g_autofree char *contents = NULL;
+        g_autoptr (GError) error = NULL;
+        ProgramCacheHeader header = { { 0 } };
+        GLenum binary_format;
+        int binary_size = 0;
+        GLsizei written_size = 0;
+
+        if (!chips_program_cache_is_supported ()) {
+                return;
+        }
+
+        glGetProgramiv (program_id, GL_PROGRAM_BINARY_LENGTH, &binary_size);
+
+        if (binary_size <= 0) {
+                return;
+        }
+
+        contents = g_malloc (sizeof (header) + binary_size);
+        glGetProgramBinary (program_id, binary_size, &written_size, &binary_format, contents + sizeof (header));
+
+        if (written_size <= 0) {
+                return;
+        }
+
+        memcpy (header.magic, PROGRAM_CACHE_MAGIC, sizeof (header.magic));
+        header.binary_format = binary_format;
+        memcpy (contents, &header, sizeof (header));
+
+        filename = get_cache_filename (key);
+        directory = g_path_get_dirname (filename);
+
+        if (g_mkdir_with_parents (directory, 0700) < 0) {
+                g_debug ("couldn't create program cache directory '%s': %m", directory);
+                return;
+        }
+
+        /* Written to a temporary file and renamed into place, so a
+         * concurrent launch never sees half a binary
+         */
+        if (!g_file_set_contents (filename, contents, sizeof (header) + written_size, &error)) {
+                g_debug ("couldn't cache program binary: %s", error->message);
+        }
+}
@@ -0,0 +1,34 @@
+/* chips-program-cache.h
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CHIPS_PROGRAM_CACHE_H
+#define CHIPS_PROGRAM_CACHE_H
+
+#include "chips.h"
+
+/* Linked shader programs, as the driver hands them back, kept under the
+ * user's cache directory so later launches can skip compiling
+ */
+char     *chips_program_cache_compute_key  (const char * const *sources,
+                                            size_t              number_of_sources);
+gboolean  chips_program_cache_load         (const char         *key,
+                                            unsigned int        program_id);
+void      chips_program_cache_save         (const char         *key,
+                                            unsigned int        program_id);
+gboolean  chips_program_cache_is_supported (void);
+
+#endif /* CHIPS_PROGRAM_CACHE_H */
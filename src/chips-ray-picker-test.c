@@ -0,0 +1,330 @@
+/* chips-ray-picker-test.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chips-ray-picker.h"
+
+/* Fixed, so a failure shows up the same way every run */
+#define RANDOM_SEED 0x43686970
+
+#define NUMBER_OF_RANDOM_TRIANGLES 20000
+#define NUMBER_OF_RANDOM_RAYS 2000
+
+/* The picker works in single precision and the brute force check in
+ * double, so distances only have to agree to about this much
+ */
+#define DISTANCE_TOLERANCE 1e-4
+
+/* Rays that pass this close to an edge, in barycentric terms, may go
+ * either way in single precision
+ */
+#define EDGE_TOLERANCE 1e-4
+
+typedef struct
+{
+        float   *positions;
+        guint32 *indices;
+        guint32  number_of_triangles;
+} Triangles;
+
+static ChipsRayPicker *
+create_picker (const Triangles *triangles)
+{
+        ChipsVertexFormat format;
+        g_autoptr (GError) error = NULL;
+        ChipsRayPicker *picker;
+
+        chips_vertex_format_init (&format,
+                                  CHIPS_VERTEX_ENCODING_FLOAT,
+                                  CHIPS_VERTEX_ENCODING_NONE,
+                                  CHIPS_VERTEX_ENCODING_NONE);
+
+        picker = chips_ray_picker_new (&format,
+                                       (const guint8 *) triangles->positions,
+                                       triangles->indices,
+                                       sizeof (guint32),
+                                       0,
+                                       triangles->number_of_triangles * 3,
+                                       NULL,
+                                       &error);
+        g_assert_no_error (error);
+        g_assert_nonnull (picker);
+
+        return picker;
+}
+
+static void
+triangles_clear (Triangles *triangles)
+{
+        g_free (triangles->positions);
+        g_free (triangles->indices);
+}
+
+/* Möller–Trumbore in double precision, one triangle at a time, with
+ * the triangle grown or shrunk by margin
+ */
+static gboolean
+intersect_triangle (const double  origin[3],
+                    const double  direction[3],
+                    const float  *corners,
+                    double        margin,
+                    double       *distance)
+{
+        double edges[2][3], p[3], q[3], t[3];
+        double determinant, u, v;
+        int k;
+
+        for (k = 0; k < 3; k++) {
+                edges[0][k] = corners[3 + k] - corners[k];
+                edges[1][k] = corners[6 + k] - corners[k];
+                t[k] = origin[k] - corners[k];
+        }
+
+        p[0] = direction[1] * edges[1][2] - direction[2] * edges[1][1];
+        p[1] = direction[2] * edges[1][0] - direction[0] * edges[1][2];
+        p[2] = direction[0] * edges[1][1] - direction[1] * edges[1][0];
+
+        determinant = edges[0][0] * p[0] + edges[0][1] * p[1] + edges[0][2] * p[2];
+
+        if (fabs (determinant) < 1e-12) {
+                return FALSE;
+        }
+
+        u = (t[0] * p[0] + t[1] * p[1] + t[2] * p[2]) / determinant;
+
+        if (u < -margin || u > 1.0 + margin) {
+                return FALSE;
+        }
+
+        q[0] = t[1] * edges[0][2] - t[2] * edges[0][1];
+        q[1] = t[2] * edges[0][0] - t[0] * edges[0][2];
+        q[2] = t[0] * edges[0][1] - t[1] * edges[0][0];
+
+        v = (direction[0] * q[0] + direction[1] * q[1] + direction[2] * q[2]) / determinant;
+
+        if (v < -margin || u + v > 1.0 + margin) {
+                return FALSE;
+        }
+
+        *distance = (edges[1][0] * q[0] + edges[1][1] * q[1] + edges[1][2] * q[2]) / determinant;
+
+        return *distance >= 0.0;
+}
+
+/* Returns the distance to the nearest hit, or infinity for a miss */
+static double
+cast_brute_force (const Triangles          *triangles,
+                  const graphene_point3d_t *origin,
+                  const graphene_vec3_t    *direction,
+                  double                    margin)
+{
+        graphene_vec3_t unit_direction;
+        double origin_values[3], direction_values[3];
+        double nearest_distance = INFINITY;
+        guint32 i;
+
+        graphene_vec3_normalize (direction, &unit_direction);
+
+        origin_values[0] = origin->x;
+        origin_values[1] = origin->y;
+        origin_values[2] = origin->z;
+        direction_values[0] = graphene_vec3_get_x (&unit_direction);
+        direction_values[1] = graphene_vec3_get_y (&unit_direction);
+        direction_values[2] = graphene_vec3_get_z (&unit_direction);
+
+        for (i = 0; i < triangles->number_of_triangles; i++) {
+                double distance;
+
+                if (!intersect_triangle (origin_values,
+                                         direction_values,
+                                         triangles->positions + i * 9,
+                                         margin,
+                                         &distance)) {
+                        continue;
+                }
+
+                nearest_distance = MIN (nearest_distance, distance);
+        }
+
+        return nearest_distance;
+}
+
+static void
+test_single_triangle (void)
+{
+        float positions[] = { -1, -1, 0,
+                               1, -1, 0,
+                               0,  1, 0 };
+        guint32 indices[] = { 0, 1, 2 };
+        Triangles triangles = { positions, indices, 1 };
+        g_autoptr (ChipsRayPicker) picker = NULL;
+        graphene_point3d_t origin;
+        graphene_vec3_t direction;
+        ChipsRayHit hit = { 0 };
+
+        picker = create_picker (&triangles);
+
+        graphene_point3d_init (&origin, 0, 0, 5);
+        graphene_vec3_init (&direction, 0, 0, -2);
+        g_assert_true (chips_ray_picker_cast (picker, &origin, &direction, &hit));
+        g_assert_cmpuint (hit.triangle, ==, 0);
+        g_assert_cmpfloat (fabs (hit.distance - 5), <, DISTANCE_TOLERANCE);
+        g_assert_cmpfloat (fabs (hit.position.x), <, DISTANCE_TOLERANCE);
+        g_assert_cmpfloat (fabs (hit.position.y), <, DISTANCE_TOLERANCE);
+        g_assert_cmpfloat (fabs (hit.position.z), <, DISTANCE_TOLERANCE);
+
+        /* Pointing away from it */
+        graphene_vec3_init (&direction, 0, 0, 1);
+        g_assert_false (chips_ray_picker_cast (picker, &origin, &direction, &hit));
+
+        /* Passing beside it */
+        graphene_point3d_init (&origin, 2, 0, 5);
+        graphene_vec3_init (&direction, 0, 0, -1);
+        g_assert_false (chips_ray_picker_cast (picker, &origin, &direction, &hit));
+}
+
+static void
+test_nearest_of_stacked_triangles (void)
+{
+        float positions[] = { -1, -1, -1,   1, -1, -1,   0, 1, -1,
+                              -1, -1,  1,   1, -1,  1,   0, 1,  1,
+                              -1, -1,  0,   1, -1,  0,   0, 1,  0 };
+        guint32 indices[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8 };
+        Triangles triangles = { positions, indices, 3 };
+        g_autoptr (ChipsRayPicker) picker = NULL;
+        graphene_point3d_t origin;
+        graphene_vec3_t direction;
+        ChipsRayHit hit = { 0 };
+
+        picker = create_picker (&triangles);
+
+        graphene_point3d_init (&origin, 0, 0, 5);
+        graphene_vec3_init (&direction, 0, 0, -1);
+        g_assert_true (chips_ray_picker_cast (picker, &origin, &direction, &hit));
+        g_assert_cmpuint (hit.triangle, ==, 1);
+        g_assert_cmpfloat (fabs (hit.distance - 4), <, DISTANCE_TOLERANCE);
+
+        graphene_point3d_init (&origin, 0, 0, -5);
+        graphene_vec3_init (&direction, 0, 0, 1);
+        g_assert_true (chips_ray_picker_cast (picker, &origin, &direction, &hit));
+        g_assert_cmpuint (hit.triangle, ==, 0);
+        g_assert_cmpfloat (fabs (hit.distance - 4), <, DISTANCE_TOLERANCE);
+}
+
+/* Small triangles scattered through a cube, so rays pass through
+ * plenty of nodes and hit or miss at random
+ */
+static void
+generate_random_triangles (GRand     *random,
+                           Triangles *triangles)
+{
+        guint32 i;
+        int j, k;
+
+        triangles->number_of_triangles = NUMBER_OF_RANDOM_TRIANGLES;
+        triangles->positions = g_new (float, NUMBER_OF_RANDOM_TRIANGLES * 9);
+        triangles->indices = g_new (guint32, NUMBER_OF_RANDOM_TRIANGLES * 3);
+
+        for (i = 0; i < NUMBER_OF_RANDOM_TRIANGLES; i++) {
+                float center[3];
+
+                for (k = 0; k < 3; k++) {
+                        center[k] = g_rand_double_range (random, -1, 1);
+                }
+
+                for (j = 0; j < 3; j++) {
+                        for (k = 0; k < 3; k++) {
+                                triangles->positions[i * 9 + j * 3 + k] = center[k] + g_rand_double_range (random, -0.05, 0.05);
+                        }
+
+                        triangles->indices[i * 3 + j] = i * 3 + j;
+                }
+        }
+}
+
+static void
+test_random_rays_match_brute_force (void)
+{
+        g_autoptr (GRand) random = NULL;
+        g_autoptr (ChipsRayPicker) picker = NULL;
+        Triangles triangles = { 0 };
+        size_t number_of_hits = 0;
+        int i;
+
+        random = g_rand_new_with_seed (RANDOM_SEED);
+        generate_random_triangles (random, &triangles);
+        picker = create_picker (&triangles);
+
+        for (i = 0; i < NUMBER_OF_RANDOM_RAYS; i++) {
+                graphene_point3d_t origin;
+                graphene_vec3_t direction;
+                ChipsRayHit hit = { 0 };
+                double nearest_distance, farthest_distance;
+
+                graphene_point3d_init (&origin,
+                                       g_rand_double_range (random, -3, 3),
+                                       g_rand_double_range (random, -3, 3),
+                                       g_rand_double_range (random, -3, 3));
+
+                /* Aimed somewhere around the cube, so most rays go
+                 * through it, but some pass by
+                 */
+                graphene_vec3_init (&direction,
+                                    g_rand_double_range (random, -1.5, 1.5) - origin.x,
+                                    g_rand_double_range (random, -1.5, 1.5) - origin.y,
+                                    g_rand_double_range (random, -1.5, 1.5) - origin.z);
+
+                /* Grown triangles give the nearest the hit could
+                 * rightly be, and shrunk ones the farthest.  Rays that
+                 * only graze an edge miss the shrunk triangles, so they
+                 * may hit or miss.
+                 */
+                nearest_distance = cast_brute_force (&triangles, &origin, &direction, EDGE_TOLERANCE);
+                farthest_distance = cast_brute_force (&triangles, &origin, &direction, -EDGE_TOLERANCE);
+
+                if (!chips_ray_picker_cast (picker, &origin, &direction, &hit)) {
+                        g_assert_false (isfinite (farthest_distance));
+                        continue;
+                }
+
+                g_assert_true (isfinite (nearest_distance));
+                g_assert_cmpfloat (hit.distance, >=, nearest_distance - DISTANCE_TOLERANCE);
+
+                if (isfinite (farthest_distance)) {
+                        g_assert_cmpfloat (hit.distance, <=, farthest_distance + DISTANCE_TOLERANCE);
+                }
+
+                number_of_hits++;
+        }
+
+        /* Make sure the rays actually exercised the hierarchy */
+        g_assert_cmpuint (number_of_hits, >, NUMBER_OF_RANDOM_RAYS / 10);
+
+        triangles_clear (&triangles);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+        g_test_init (&argc, &argv, NULL);
+
+        g_test_add_func ("/ray-picker/single-triangle", test_single_triangle);
+        g_test_add_func ("/ray-picker/nearest-of-stacked-triangles", test_nearest_of_stacked_triangles);
+        g_test_add_func ("/ray-picker/random-rays-match-brute-force", test_random_rays_match_brute_force);
+
+        return g_test_run ();
+}
@@ -0,0 +1,643 @@
+/* chips-ray-picker.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chips-ray-picker.h"
+#include "chips-culling.h"
+#include "chips-parallel.h"
+
+#define TRIANGLES_PER_PACKET 4
+
+/* Four triangles at a time, a component per vector, so one ray gets
+ * tested against all of them at once.  Unused slots are degenerate and
+ * never hit.
+ */
+typedef struct
+{
+        ChipsFloat4 corner_x;
+        ChipsFloat4 corner_y;
+        ChipsFloat4 corner_z;
+        ChipsFloat4 first_edge_x;
+        ChipsFloat4 first_edge_y;
+        ChipsFloat4 first_edge_z;
+        ChipsFloat4 second_edge_x;
+        ChipsFloat4 second_edge_y;
+        ChipsFloat4 second_edge_z;
+        guint32     triangles[TRIANGLES_PER_PACKET];
+} ChipsTrianglePacket;
+
+/* Laid out depth first, so the first child of an interior node comes
+ * right after it.  first is the second child of an interior node, and
+ * the first packet of a leaf, which is a node with packets.
+ */
+typedef struct
+{
+        float   bounds_minimum[3];
+        guint32 first;
+        float   bounds_maximum[3];
+        guint32 number_of_packets;
+} ChipsRayPickerNode;
+
+struct _ChipsRayPicker
+{
+        ChipsRayPickerNode  *nodes;
+        size_t               number_of_nodes;
+        ChipsTrianglePacket *packets;
+        size_t               number_of_packets;
+};
+
+typedef struct
+{
+        float bounds_minimum[3];
+        float bounds_maximum[3];
+        float centroid[3];
+} ChipsTriangleBounds;
+
+typedef struct
+{
+        const ChipsVertexFormat *format;
+        const guint8            *vertices;
+        gconstpointer            indices;
+        size_t                   index_size;
+        guint64                  first_index;
+
+        float                   *corners;
+        ChipsTriangleBounds     *bounds;
+        guint32                 *triangles;
+
+        GArray                  *nodes;
+        GArray                  *packets;
+        GCancellable            *cancellable;
+} BuildJob;
+
+/* Candidate splits per axis.  More find slightly better splits but take
+ * longer to build.
+ */
+#define NUMBER_OF_BINS 16
+
+/* Leaves stop at a packet unless splitting them further doesn't pay */
+#define MAXIMUM_TRIANGLES_PER_LEAF (4 * TRIANGLES_PER_PACKET)
+
+/* Visiting a node costs about this many packet tests */
+#define TRAVERSAL_COST 1.0f
+
+/* Deep enough for any sensible split of billions of triangles, with
+ * what's left at the bottom put in one leaf
+ */
+#define MAXIMUM_DEPTH 64
+
+#define TRIANGLES_PER_CHUNK 65536
+
+static void
+measure_triangle_range (size_t    start,
+                        size_t    end,
+                        BuildJob *job)
+{
+        size_t i, j, k;
+
+        for (i = start; i < end; i++) {
+                ChipsTriangleBounds *bounds = &job->bounds[i];
+                float *corners = job->corners + i * 9;
+
+                for (j = 0; j < 3; j++) {
+                        guint64 index_number = job->first_index + i * 3 + j;
+                        guint32 index;
+
+                        if (job->index_size == sizeof (guint16)) {
+                                index = ((const guint16 *) job->indices)[index_number];
+                        } else {
+                                index = ((const guint32 *) job->indices)[index_number];
+                        }
+
+                        chips_vertex_format_decode_position (job->format,
+                                                             job->vertices + (size_t) index * job->format->stride,
+                                                             corners + j * 3);
+                }
+
+                for (k = 0; k < 3; k++) {
+                        bounds->bounds_minimum[k] = MIN (corners[k], MIN (corners[3 + k], corners[6 + k]));
+                        bounds->bounds_maximum[k] = MAX (corners[k], MAX (corners[3 + k], corners[6 + k]));
+                        bounds->centroid[k] = (bounds->bounds_minimum[k] + bounds->bounds_maximum[k]) / 2.0f;
+                }
+
+                job->triangles[i] = i;
+        }
+}
+
+static float
+get_surface_area (const float *minimum,
+                  const float *maximum)
+{
+        float x = maximum[0] - minimum[0];
+        float y = maximum[1] - minimum[1];
+        float z = maximum[2] - minimum[2];
+
+        return 2.0f * (x * y + y * z + z * x);
+}
+
+static size_t
+get_number_of_packets (size_t number_of_triangles)
+{
+        return (number_of_triangles + TRIANGLES_PER_PACKET - 1) / TRIANGLES_PER_PACKET;
+}
+
+static void
+add_leaf (BuildJob           *job,
+          ChipsRayPickerNode *node,
+          size_t              first_triangle,
+          size_t              number_of_triangles)
+{
+        size_t i, lane;
+
+        node->first = job->packets->len;
+        node->number_of_packets = get_number_of_packets (number_of_triangles);
+
+        for (i = 0; i < number_of_triangles; i += TRIANGLES_PER_PACKET) {
+                ChipsTrianglePacket packet;
+
+                memset (&packet, 0, sizeof (packet));
+
+                for (lane = 0; lane < TRIANGLES_PER_PACKET && i + lane < number_of_triangles; lane++) {
+                        guint32 triangle = job->triangles[first_triangle + i + lane];
+                        const float *corners = job->corners + (size_t) triangle * 9;
+
+                        packet.corner_x[lane] = corners[0];
+                        packet.corner_y[lane] = corners[1];
+                        packet.corner_z[lane] = corners[2];
+                        packet.first_edge_x[lane] = corners[3] - corners[0];
+                        packet.first_edge_y[lane] = corners[4] - corners[1];
+                        packet.first_edge_z[lane] = corners[5] - corners[2];
+                        packet.second_edge_x[lane] = corners[6] - corners[0];
+                        packet.second_edge_y[lane] = corners[7] - corners[1];
+                        packet.second_edge_z[lane] = corners[8] - corners[2];
+                        packet.triangles[lane] = job->first_index / 3 + triangle;
+                }
+
+                g_array_append_val (job->packets, packet);
+        }
+}
+
+/* Sorts the triangles' centroids into bins along each axis, and splits
+ * where the surface area heuristic says rays will have the least work
+ * to do.  Returns FALSE when keeping the triangles together is cheaper.
+ */
+static gboolean
+find_split (BuildJob    *job,
+            size_t       first_triangle,
+            size_t       number_of_triangles,
+            const float *bounds_minimum,
+            const float *bounds_maximum,
+            int         *split_axis,
+            float       *split_position)
+{
+        float centroid_minimum[3] = { G_MAXFLOAT, G_MAXFLOAT, G_MAXFLOAT };
+        float centroid_maximum[3] = { -G_MAXFLOAT, -G_MAXFLOAT, -G_MAXFLOAT };
+        float best_cost, node_area;
+        size_t i;
+        int axis, k;
+
+        for (i = first_triangle; i < first_triangle + number_of_triangles; i++) {
+                const ChipsTriangleBounds *bounds = &job->bounds[job->triangles[i]];
+
+                for (k = 0; k < 3; k++) {
+                        centroid_minimum[k] = MIN (centroid_minimum[k], bounds->centroid[k]);
+                        centroid_maximum[k] = MAX (centroid_maximum[k], bounds->centroid[k]);
+                }
+        }
+
+        node_area = get_surface_area (bounds_minimum, bounds_maximum);
+        best_cost = get_number_of_packets (number_of_triangles);
+        *split_axis = -1;
+
+        for (axis = 0; axis < 3; axis++) {
+                struct {
+                        size_t count;
+                        float  minimum[3];
+                        float  maximum[3];
+                } bins[NUMBER_OF_BINS];
+                float right_area[NUMBER_OF_BINS];
+                size_t right_count[NUMBER_OF_BINS];
+                float extent, scale, minimum[3], maximum[3];
+                size_t count;
+                int b;
+
+                extent = centroid_maximum[axis] - centroid_minimum[axis];
+
+                if (extent <= 0.0f) {
+                        continue;
+                }
+
+                scale = NUMBER_OF_BINS / extent;
+
+                for (b = 0; b < NUMBER_OF_BINS; b++) {
+                        bins[b].count = 0;
+
+                        for (k = 0; k < 3; k++) {
+                                bins[b].minimum[k] = G_MAXFLOAT;
+                                bins[b].maximum[k] = -G_MAXFLOAT;
+                        }
+                }
+
+                for (i = first_triangle; i < first_triangle + number_of_triangles; i++) {
+                        const ChipsTriangleBounds *bounds = &job->bounds[job->triangles[i]];
+
+                        b = MIN ((int) ((bounds->centroid[axis] - centroid_minimum[axis]) * scale), NUMBER_OF_BINS - 1);
+                        bins[b].count++;
+
+                        for (k = 0; k < 3; k++) {
+                                bins[b].minimum[k] = MIN (bins[b].minimum[k], bounds->bounds_minimum[k]);
+                                bins[b].maximum[k] = MAX (bins[b].maximum[k], bounds->bounds_maximum[k]);
+                        }
+                }
+
+                /* Sweep from the right to know what's past each split,
+                 * then from the left to price them
+                 */
+                count = 0;
+
+                for (k = 0; k < 3; k++) {
+                        minimum[k] = G_MAXFLOAT;
+                        maximum[k] = -G_MAXFLOAT;
+                }
+
+                for (b = NUMBER_OF_BINS - 1; b > 0; b--) {
+                        count += bins[b].count;
+
+                        for (k = 0; k < 3; k++) {
+                                minimum[k] = MIN (minimum[k], bins[b].minimum[k]);
+                                maximum[k] = MAX (maximum[k], bins[b].maximum[k]);
+                        }
+
+                        right_count[b] = count;
+                        right_area[b] = count > 0? get_surface_area (minimum, maximum) : 0.0f;
+                }
+
+                count = 0;
+
+                for (k = 0; k < 3; k++) {
+                        minimum[k] = G_MAXFLOAT;
+                        maximum[k] = -G_MAXFLOAT;
+                }
+
+                for (b = 0; b < NUMBER_OF_BINS - 1; b++) {
+                        float cost;
+
+                        count += bins[b].count;
+
+                        for (k = 0; k < 3; k++) {
+                                minimum[k] = MIN (minimum[k], bins[b].minimum[k]);
+                                maximum[k] = MAX (maximum[k], bins[b].maximum[k]);
+                        }
+
+                        if (count == 0 || right_count[b + 1] == 0) {
+                                continue;
+                        }
+
+                        cost = TRAVERSAL_COST +
+                               (get_surface_area (minimum, maximum) * get_number_of_packets (count) +
+                                right_area[b + 1] * get_number_of_packets (right_count[b + 1])) / MAX (node_area, G_MINFLOAT);
+
+                        if (cost < best_cost) {
+                                best_cost = cost;
+                                *split_axis = axis;
+                                *split_position = centroid_minimum[axis] + (b + 1) / scale;
+                        }
+                }
+        }
+
+        return *split_axis >= 0;
+}
+
+static gboolean
+build_node (BuildJob *job,
+            size_t    first_triangle,
+            size_t    number_of_triangles,
+            guint     depth)
+{
+        ChipsRayPickerNode node;
+        size_t node_index, i, middle;
+        float split_position = 0.0f;
+        int split_axis, k;
+
+        if (number_of_triangles > TRIANGLES_PER_CHUNK &&
+            g_cancellable_is_cancelled (job->cancellable)) {
+                return FALSE;
+        }
+
+        for (k = 0; k < 3; k++) {
+                node.bounds_minimum[k] = G_MAXFLOAT;
+                node.bounds_maximum[k] = -G_MAXFLOAT;
+        }
+
+        for (i = first_triangle; i < first_triangle + number_of_triangles; i++) {
+                const ChipsTriangleBounds *bounds = &job->bounds[job->triangles[i]];
+
+                for (k = 0; k < 3; k++) {
+                        node.bounds_minimum[k] = MIN (node.bounds_minimum[k], bounds->bounds_minimum[k]);
+                        node.bounds_maximum[k] = MAX (node.bounds_maximum[k], bounds->bounds_maximum[k]);
+                }
+        }
+
+        node.first = 0;
+        node.number_of_packets = 0;
+
+        node_index = job->nodes->len;
+        g_array_append_val (job->nodes, node);
+
+        if (number_of_triangles <= TRIANGLES_PER_PACKET || depth >= MAXIMUM_DEPTH) {
+                add_leaf (job, &g_array_index (job->nodes, ChipsRayPickerNode, node_index), first_triangle, number_of_triangles);
+                return TRUE;
+        }
+
+        if (find_split (job, first_triangle, number_of_triangles, node.bounds_minimum, node.bounds_maximum, &split_axis, &split_position)) {
+                size_t left = first_triangle, right = first_triangle + number_of_triangles;
+
+                while (left < right) {
+                        if (job->bounds[job->triangles[left]].centroid[split_axis] < split_position) {
+                                left++;
+                        } else {
+                                guint32 triangle = job->triangles[left];
+
+                                job->triangles[left] = job->triangles[--right];
+                                job->triangles[right] = triangle;
+                        }
+                }
+
+                middle = left;
+        } else if (number_of_triangles <= MAXIMUM_TRIANGLES_PER_LEAF) {
+                add_leaf (job, &g_array_index (job->nodes, ChipsRayPickerNode, node_index), first_triangle, number_of_triangles);
+                return TRUE;
+        } else {
+                /* Too many triangles in the same spot to sort out, so
+                 * they get split in any order
+                 */
+                middle = first_triangle + number_of_triangles / 2;
+        }
+
+        /* Rounding at the edge of a bin can leave a side empty */
+        if (middle == first_triangle || middle == first_triangle + number_of_triangles) {
+                middle = first_triangle + number_of_triangles / 2;
+        }
+
+        if (!build_node (job, first_triangle, middle - first_triangle, depth + 1)) {
+                return FALSE;
+        }
+
+        g_array_index (job->nodes, ChipsRayPickerNode, node_index).first = job->nodes->len;
+
+        return build_node (job, middle, first_triangle + number_of_triangles - middle, depth + 1);
+}
+
+/* Builds the hierarchy with the surface area heuristic, over the
+ * triangles in indices from first_index on, whose positions are in
+ * vertices as described by format
+ */
+ChipsRayPicker *
+chips_ray_picker_new (const ChipsVertexFormat  *format,
+                      const guint8             *vertices,
+                      gconstpointer             indices,
+                      size_t                    index_size,
+                      guint64                   first_index,
+                      guint64                   number_of_indices,
+                      GCancellable             *cancellable,
+                      GError                  **error)
+{
+        BuildJob job = { 0 };
+        ChipsRayPicker *picker = NULL;
+        size_t number_of_triangles = number_of_indices / 3;
+        gboolean built;
+
+        g_return_val_if_fail (number_of_triangles > 0, NULL);
+
+        job.format = format;
+        job.vertices = vertices;
+        job.indices = indices;
+        job.index_size = index_size;
+        job.first_index = first_index;
+        job.cancellable = cancellable;
+        job.corners = g_new (float, number_of_triangles * 9);
+        job.bounds = g_new (ChipsTriangleBounds, number_of_triangles);
+        job.triangles = g_new (guint32, number_of_triangles);
+        job.nodes = g_array_new (FALSE, FALSE, sizeof (ChipsRayPickerNode));
+        job.packets = g_array_sized_new (FALSE, FALSE, sizeof (ChipsTrianglePacket), get_number_of_packets (number_of_triangles));
+
+        built = chips_parallel_for (number_of_triangles,
+                                    TRIANGLES_PER_CHUNK,
+                                    (ChipsParallelFunc) measure_triangle_range,
+                                    &job,
+                                    cancellable,
+                                    error);
+
+        if (built && !build_node (&job, 0, number_of_triangles, 0)) {
+                g_cancellable_set_error_if_cancelled (cancellable, error);
+                built = FALSE;
+        }
+
+        g_free (job.corners);
+        g_free (job.bounds);
+        g_free (job.triangles);
+
+        if (!built) {
+                g_array_unref (job.nodes);
+                g_array_unref (job.packets);
+                return NULL;
+        }
+
+        picker = g_slice_new0 (ChipsRayPicker);
+        picker->number_of_nodes = job.nodes->len;
+        picker->nodes = (ChipsRayPickerNode *) g_array_free (job.nodes, FALSE);
+        picker->number_of_packets = job.packets->len;
+        picker->packets = (ChipsTrianglePacket *) g_array_free (job.packets, FALSE);
+
+        return picker;
+}
+
+void
+chips_ray_picker_free (ChipsRayPicker *picker)
+{
+        g_free (picker->nodes);
+        g_free (picker->packets);
+        g_slice_free (ChipsRayPicker, picker);
+}
+
+/* The distance along the ray to where it enters the node, or G_MAXFLOAT
+ * if it misses
+ */
+static float
+intersect_node (const ChipsRayPickerNode *node,
+                const float              *origin,
+                const float              *inverse_direction)
+{
+        float entry = 0.0f, exit = G_MAXFLOAT;
+        int k;
+
+        for (k = 0; k < 3; k++) {
+                float near_distance = (node->bounds_minimum[k] - origin[k]) * inverse_direction[k];
+                float far_distance = (node->bounds_maximum[k] - origin[k]) * inverse_direction[k];
+
+                /* fminf and fmaxf drop the NaN a ray along a face makes */
+                entry = fmaxf (entry, fminf (near_distance, far_distance));
+                exit = fminf (exit, fmaxf (near_distance, far_distance));
+        }
+
+        return entry <= exit? entry : G_MAXFLOAT;
+}
+
+/* Möller–Trumbore against all four triangles of the packet at once */
+static void
+intersect_packet (const ChipsTrianglePacket *packet,
+                  const float               *origin,
+                  const float               *direction,
+                  ChipsRayHit               *hit)
+{
+        ChipsFloat4 p_x, p_y, p_z, q_x, q_y, q_z, s_x, s_y, s_z;
+        ChipsFloat4 determinant, inverse_determinant, u, v, t;
+        ChipsInt4 hits;
+        int lane;
+
+        p_x = direction[1] * packet->second_edge_z - direction[2] * packet->second_edge_y;
+        p_y = direction[2] * packet->second_edge_x - direction[0] * packet->second_edge_z;
+        p_z = direction[0] * packet->second_edge_y - direction[1] * packet->second_edge_x;
+
+        determinant = packet->first_edge_x * p_x + packet->first_edge_y * p_y + packet->first_edge_z * p_z;
+        inverse_determinant = 1.0f / determinant;
+
+        s_x = origin[0] - packet->corner_x;
+        s_y = origin[1] - packet->corner_y;
+        s_z = origin[2] - packet->corner_z;
+
+        u = (s_x * p_x + s_y * p_y + s_z * p_z) * inverse_determinant;
+
+        q_x = s_y * packet->first_edge_z - s_z * packet->first_edge_y;
+        q_y = s_z * packet->first_edge_x - s_x * packet->first_edge_z;
+        q_z = s_x * packet->first_edge_y - s_y * packet->first_edge_x;
+
+        v = (direction[0] * q_x + direction[1] * q_y + direction[2] * q_z) * inverse_determinant;
+        t = (packet->second_edge_x * q_x + packet->second_edge_y * q_y + packet->second_edge_z * q_z) * inverse_determinant;
+
+        hits = (determinant != 0.0f) & (u >= 0.0f) & (v >= 0.0f) & (u + v <= 1.0f) & (t >= 0.0f) & (t < hit->distance);
+
+        if (!(hits[0] | hits[1] | hits[2] | hits[3])) {
+                return;
+        }
+
+        for (lane = 0; lane < TRIANGLES_PER_PACKET; lane++) {
+                if (hits[lane] && t[lane] < hit->distance) {
+                        hit->distance = t[lane];
+                        hit->triangle = packet->triangles[lane];
+                }
+        }
+}
+
+/* Finds the nearest triangle along the ray, nearer nodes first so
+ * further ones can be skipped once something closer is hit.  Returns
+ * FALSE if the ray misses everything.
+ */
+gboolean
+chips_ray_picker_cast (const ChipsRayPicker     *picker,
+                       const graphene_point3d_t *origin,
+                       const graphene_vec3_t    *direction,
+                       ChipsRayHit              *hit)
+{
+        graphene_vec3_t unit_direction;
+        float origin_values[3], direction_values[3], inverse_direction[3];
+        guint32 stack[MAXIMUM_DEPTH + 2];
+        float stack_distances[MAXIMUM_DEPTH + 2];
+        size_t stack_depth = 0;
+        ChipsRayHit nearest_hit = { 0 };
+        int k;
+
+        graphene_vec3_normalize (direction, &unit_direction);
+        graphene_vec3_to_float (&unit_direction, direction_values);
+
+        origin_values[0] = origin->x;
+        origin_values[1] = origin->y;
+        origin_values[2] = origin->z;
+
+        for (k = 0; k < 3; k++) {
+                inverse_direction[k] = 1.0f / direction_values[k];
+        }
+
+        nearest_hit.distance = G_MAXFLOAT;
+
+        stack[stack_depth] = 0;
+        stack_distances[stack_depth] = intersect_node (&picker->nodes[0], origin_values, inverse_direction);
+        stack_depth++;
+
+        while (stack_depth > 0) {
+                const ChipsRayPickerNode *node;
+                guint32 first_child, second_child;
+                float first_distance, second_distance;
+                size_t i;
+
+                stack_depth--;
+
+                /* Something nearer may have been hit since it was pushed */
+                if (stack_distances[stack_depth] >= nearest_hit.distance) {
+                        continue;
+                }
+
+                node = &picker->nodes[stack[stack_depth]];
+
+                if (node->number_of_packets > 0) {
+                        for (i = node->first; i < node->first + node->number_of_packets; i++) {
+                                intersect_packet (&picker->packets[i], origin_values, direction_values, &nearest_hit);
+                        }
+                        continue;
+                }
+
+                first_child = node - picker->nodes + 1;
+                second_child = node->first;
+                first_distance = intersect_node (&picker->nodes[first_child], origin_values, inverse_direction);
+                second_distance = intersect_node (&picker->nodes[second_child], origin_values, inverse_direction);
+
+                if (second_distance < first_distance) {
+                        guint32 child = first_child;
+                        float distance = first_distance;
+
+                        first_child = second_child;
+                        first_distance = second_distance;
+                        second_child = child;
+                        second_distance = distance;
+                }
+
+                /* The further child goes on first, so it comes off last */
+                if (second_distance < nearest_hit.distance) {
+                        stack[stack_depth] = second_child;
+                        stack_distances[stack_depth] = second_distance;
+                        stack_depth++;
+                }
+
+                if (first_distance < nearest_hit.distance) {
+                        stack[stack_depth] = first_child;
+                        stack_distances[stack_depth] = first_distance;
+                        stack_depth++;
+                }
+        }
+
+        if (nearest_hit.distance == G_MAXFLOAT) {
+                return FALSE;
+        }
+
+        graphene_point3d_init (&nearest_hit.position,
+                               origin_values[0] + direction_values[0] * nearest_hit.distance,
+                               origin_values[1] + direction_values[1] * nearest_hit.distance,
+                               origin_values[2] + direction_values[2] * nearest_hit.distance);
+
+        *hit = nearest_hit;
+
+        return TRUE;
+}
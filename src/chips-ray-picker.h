@@ -0,0 +1,58 @@
+/* chips-ray-picker.h
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CHIPS_RAY_PICKER_H
+#define CHIPS_RAY_PICKER_H
+
+#include "chips.h"
+#include "chips-vertex-format.h"
+
+/* Where a ray first meets a model.  The triangle is numbered from the
+ * start of the vertex arrangement, and the distance is along the ray
+ * from its origin, in model units.
+ */
+typedef struct
+{
+        guint32            triangle;
+        graphene_point3d_t position;
+        float              distance;
+} ChipsRayHit;
+
+/* A bounding volume hierarchy over one run of triangles, holding its
+ * own copy of their corners, so rays can be cast against it after the
+ * model's geometry is let go of
+ */
+typedef struct _ChipsRayPicker ChipsRayPicker;
+
+ChipsRayPicker *chips_ray_picker_new  (const ChipsVertexFormat   *format,
+                                       const guint8              *vertices,
+                                       gconstpointer              indices,
+                                       size_t                     index_size,
+                                       guint64                    first_index,
+                                       guint64                    number_of_indices,
+                                       GCancellable              *cancellable,
+                                       GError                   **error);
+void            chips_ray_picker_free (ChipsRayPicker            *picker);
+
+gboolean        chips_ray_picker_cast (const ChipsRayPicker      *picker,
+                                       const graphene_point3d_t  *origin,
+                                       const graphene_vec3_t     *direction,
+                                       ChipsRayHit               *hit);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ChipsRayPicker, chips_ray_picker_free);
+
+#endif /* CHIPS_RAY_PICKER_H */
@@ -0,0 +1,958 @@
+/* chips-renderer.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chips-renderer.h"
+#include "chips-culling.h"
+#include "chips-occlusion-culler.h"
+#include "chips-shader-program.h"
+
+struct _ChipsRenderer
+{
+        /* The model whose geometry is going to the GPU.  What has
+         * arrived of it is drawn until it's initialized.
+         */
+        Chips3DModel *model;
+        guint64 vertices_available;
+        guint64 indices_available;
+        guint64 vertices_uploaded;
+        guint64 indices_uploaded;
+        guint64 indices_drawable;
+        guint32 largest_uploaded_index;
+        void *mapped_vertex_buffer;
+        void *mapped_vertex_arrangement;
+
+        unsigned int vertex_array_id;
+
+        unsigned int vertex_buffer_id;
+        unsigned int vertex_arrangement_id;
+
+        /* How big the buffers are, which can be more than the model
+         * needs after it's replaced with a smaller one
+         */
+        size_t vertex_buffer_capacity;
+        size_t vertex_arrangement_capacity;
+
+        ChipsShaderProgram *program;
+
+        /* Every copy of the model gets drawn by the same call, placed
+         * by its own transform from this buffer
+         */
+        unsigned int instance_buffer_id;
+        GArray *instance_transforms;
+        graphene_box_t instance_bounds;
+
+        GArray *visible_ranges;
+        GArray *draw_counts;
+        GArray *draw_offsets;
+
+        /* Which clusters of the level drawn last got hidden behind the
+         * rest, and the view they were last tested from
+         */
+        ChipsOcclusionCuller *occlusion_culler;
+        const ChipsBvh *occlusion_culled_hierarchy;
+        GArray *visible_clusters;
+        float occlusion_tested_matrix[16];
+
+        unsigned int model_initialized : 1;
+        unsigned int geometry_uploaded : 1;
+        unsigned int geometry_held : 1;
+        unsigned int instance_bounds_valid : 1;
+};
+
+/* How far, in pixels, a level of detail may stray from the full model
+ * before a finer one gets drawn
+ */
+#define ACCEPTABLE_PIXEL_ERROR 1.0f
+
+/* How much geometry goes up in one call */
+#define UPLOAD_SLICE_SIZE (1024 * 1024)
+
+/* Needs a current GL context, which has to stay current for every
+ * other call, chips_renderer_free included
+ */
+ChipsRenderer *
+chips_renderer_new (void)
+{
+        ChipsRenderer *renderer;
+        graphene_matrix_t identity;
+
+        renderer = g_slice_new0 (ChipsRenderer);
+        renderer->visible_ranges = g_array_new (FALSE, FALSE, sizeof (ChipsIndexRange));
+        renderer->draw_counts = g_array_new (FALSE, FALSE, sizeof (GLsizei));
+        renderer->draw_offsets = g_array_new (FALSE, FALSE, sizeof (const void *));
+        renderer->instance_transforms = g_array_new (FALSE, FALSE, sizeof (graphene_matrix_t));
+        renderer->visible_clusters = g_array_new (FALSE, FALSE, sizeof (guint32));
+
+        glEnable (GL_DEPTH_TEST);
+        glEnable (GL_CULL_FACE);
+
+        glGenVertexArrays (1, &renderer->vertex_array_id);
+        glBindVertexArray (renderer->vertex_array_id);
+
+        renderer->program = chips_shader_program_new ();
+
+        glGenBuffers (1, &renderer->instance_buffer_id);
+        glBindBuffer (GL_ARRAY_BUFFER, renderer->instance_buffer_id);
+        chips_shader_program_bind_instances (renderer->program, CHIPS_INSTANCE_TRANSFORM_SIZE, 0, FALSE);
+        graphene_matrix_init_identity (&identity);
+        chips_renderer_set_instances (renderer, &identity, 1);
+
+        return renderer;
+}
+
+static void
+release_model_geometry (ChipsRenderer *renderer)
+{
+        if (!renderer->geometry_held) {
+                return;
+        }
+
+        chips_3d_model_release_geometry (renderer->model);
+        renderer->geometry_held = FALSE;
+}
+
+static void
+release_buffers (ChipsRenderer *renderer)
+{
+        release_model_geometry (renderer);
+
+        glBindVertexArray (renderer->vertex_array_id);
+
+        if (renderer->mapped_vertex_buffer != NULL) {
+                glBindBuffer (GL_ARRAY_BUFFER, renderer->vertex_buffer_id);
+                glUnmapBuffer (GL_ARRAY_BUFFER);
+                renderer->mapped_vertex_buffer = NULL;
+        }
+
+        if (renderer->mapped_vertex_arrangement != NULL) {
+                glUnmapBuffer (GL_ELEMENT_ARRAY_BUFFER);
+                renderer->mapped_vertex_arrangement = NULL;
+        }
+
+        if (renderer->vertex_buffer_id != 0) {
+                glDeleteBuffers (1, &renderer->vertex_buffer_id);
+                renderer->vertex_buffer_id = 0;
+        }
+
+        if (renderer->vertex_arrangement_id != 0) {
+                glDeleteBuffers (1, &renderer->vertex_arrangement_id);
+                renderer->vertex_arrangement_id = 0;
+        }
+
+        renderer->vertex_buffer_capacity = 0;
+        renderer->vertex_arrangement_capacity = 0;
+}
+
+void
+chips_renderer_free (ChipsRenderer *renderer)
+{
+        release_buffers (renderer);
+
+        g_clear_pointer (&renderer->occlusion_culler, chips_occlusion_culler_free);
+        chips_shader_program_free (renderer->program);
+
+        glDeleteBuffers (1, &renderer->instance_buffer_id);
+        glDeleteVertexArrays (1, &renderer->vertex_array_id);
+
+        g_clear_object (&renderer->model);
+        g_clear_pointer (&renderer->visible_ranges, g_array_unref);
+        g_clear_pointer (&renderer->draw_counts, g_array_unref);
+        g_clear_pointer (&renderer->draw_offsets, g_array_unref);
+        g_clear_pointer (&renderer->instance_transforms, g_array_unref);
+        g_clear_pointer (&renderer->visible_clusters, g_array_unref);
+
+        g_slice_free (ChipsRenderer, renderer);
+}
+
+/* Where the driver can keep a buffer mapped while it's in use, the
+ * geometry gets copied straight in, otherwise it goes through
+ * glBufferSubData.  Either way glBufferSubData works on the buffer
+ * afterward, for when the model is replaced.
+ */
+static void *
+allocate_buffer (GLenum target,
+                 size_t size)
+{
+        if (size > 0 && (epoxy_gl_version () >= 44 || epoxy_has_gl_extension ("GL_ARB_buffer_storage"))) {
+                GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+                glBufferStorage (target, size, NULL, flags | GL_DYNAMIC_STORAGE_BIT);
+                return glMapBufferRange (target, 0, size, flags);
+        }
+
+        glBufferData (target, size, NULL, GL_STATIC_DRAW);
+        return NULL;
+}
+
+static void
+upload_to_buffer (GLenum        target,
+                  void         *mapping,
+                  size_t        offset,
+                  size_t        size,
+                  const guint8 *data)
+{
+        if (mapping != NULL) {
+                memcpy ((guint8 *) mapping + offset, data + offset, size);
+                return;
+        }
+
+        glBufferSubData (target, offset, size, data + offset);
+}
+
+static void
+allocate_model_buffers (ChipsRenderer *renderer)
+{
+        glBindVertexArray (renderer->vertex_array_id);
+
+        renderer->vertex_buffer_capacity = chips_3d_model_get_vertex_buffer_size (renderer->model);
+        renderer->vertex_arrangement_capacity = chips_3d_model_get_vertex_arrangement_size (renderer->model);
+
+        glGenBuffers (1, &renderer->vertex_buffer_id);
+        glBindBuffer (GL_ARRAY_BUFFER, renderer->vertex_buffer_id);
+        renderer->mapped_vertex_buffer = allocate_buffer (GL_ARRAY_BUFFER, renderer->vertex_buffer_capacity);
+
+        glGenBuffers (1, &renderer->vertex_arrangement_id);
+        glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, renderer->vertex_arrangement_id);
+        renderer->mapped_vertex_arrangement = allocate_buffer (GL_ELEMENT_ARRAY_BUFFER,
+                                                               renderer->vertex_arrangement_capacity);
+
+        chips_shader_program_bind_vertex_format (renderer->program, chips_3d_model_get_vertex_format (renderer->model));
+}
+
+/* Sets aside room for the whole model up front.  The geometry itself
+ * goes up as it arrives, in chips_renderer_upload.  The model's vertex
+ * format has to be settled, so this waits for the first
+ * geometry-available signal.
+ */
+void
+chips_renderer_set_model (ChipsRenderer *renderer,
+                          Chips3DModel  *model)
+{
+        release_buffers (renderer);
+
+        g_set_object (&renderer->model, model);
+        renderer->vertices_available = 0;
+        renderer->indices_available = 0;
+        renderer->vertices_uploaded = 0;
+        renderer->indices_uploaded = 0;
+        renderer->indices_drawable = 0;
+        renderer->largest_uploaded_index = 0;
+        renderer->model_initialized = FALSE;
+        renderer->geometry_uploaded = FALSE;
+        renderer->instance_bounds_valid = FALSE;
+        renderer->occlusion_culled_hierarchy = NULL;
+
+        allocate_model_buffers (renderer);
+}
+
+static gboolean
+chunk_changed (const guint64 *old_hashes,
+               size_t         number_of_old_hashes,
+               const guint64 *new_hashes,
+               size_t         chunk)
+{
+        return chunk >= number_of_old_hashes || new_hashes[chunk] != old_hashes[chunk];
+}
+
+/* Sends up the chunks whose hashes differ from the ones already in the
+ * buffer, merging neighboring chunks into one call.  Returns how many
+ * bytes went up.
+ */
+static size_t
+upload_changed_chunks (GLenum         target,
+                       const guint64 *old_hashes,
+                       size_t         number_of_old_hashes,
+                       const guint64 *new_hashes,
+                       size_t         number_of_new_hashes,
+                       const guint8  *data,
+                       size_t         size)
+{
+        size_t chunk = 0, first_changed_chunk, offset, end, bytes_uploaded = 0;
+
+        while (chunk < number_of_new_hashes) {
+                if (!chunk_changed (old_hashes, number_of_old_hashes, new_hashes, chunk)) {
+                        chunk++;
+                        continue;
+                }
+
+                first_changed_chunk = chunk;
+
+                while (chunk < number_of_new_hashes && chunk_changed (old_hashes, number_of_old_hashes, new_hashes, chunk)) {
+                        chunk++;
+                }
+
+                offset = first_changed_chunk * CHIPS_3D_MODEL_CHUNK_SIZE;
+                end = MIN (chunk * CHIPS_3D_MODEL_CHUNK_SIZE, size);
+
+                upload_to_buffer (target, NULL, offset, end - offset, data);
+                bytes_uploaded += end - offset;
+        }
+
+        return bytes_uploaded;
+}
+
+static gboolean
+can_replace_model_in_place (ChipsRenderer *renderer,
+                            Chips3DModel  *replacement)
+{
+        if (renderer->model == NULL || !renderer->geometry_uploaded || renderer->vertex_buffer_id == 0) {
+                return FALSE;
+        }
+
+        if (memcmp (chips_3d_model_get_vertex_format (renderer->model),
+                    chips_3d_model_get_vertex_format (replacement),
+                    sizeof (ChipsVertexFormat)) != 0) {
+                return FALSE;
+        }
+
+        if (chips_3d_model_get_index_size (renderer->model) != chips_3d_model_get_index_size (replacement)) {
+                return FALSE;
+        }
+
+        return chips_3d_model_get_vertex_buffer_size (replacement) <= renderer->vertex_buffer_capacity &&
+               chips_3d_model_get_vertex_arrangement_size (replacement) <= renderer->vertex_arrangement_capacity;
+}
+
+/* Switches to replacement, an initialized model reloaded from the same
+ * file, sending only the chunks of its geometry that differ from the
+ * model's before it.  The buffers are only made again when the new
+ * geometry doesn't fit in them, or is laid out differently, and then
+ * everything goes up through chips_renderer_upload() like it did the
+ * first time.
+ */
+void
+chips_renderer_replace_model (ChipsRenderer *renderer,
+                              Chips3DModel  *replacement)
+{
+        g_autoptr (GError) error = NULL;
+        const guint64 *old_hashes, *new_hashes;
+        size_t number_of_old_hashes, number_of_new_hashes;
+        size_t bytes_uploaded;
+
+        if (!can_replace_model_in_place (renderer, replacement) ||
+            !chips_3d_model_hold_geometry (replacement, &error)) {
+                if (error != NULL) {
+                        g_debug ("couldn't update model in place: %s", error->message);
+                }
+
+                chips_renderer_set_model (renderer, replacement);
+                chips_renderer_set_model_initialized (renderer);
+                return;
+        }
+
+        glBindVertexArray (renderer->vertex_array_id);
+
+        old_hashes = chips_3d_model_get_vertex_buffer_chunk_hashes (renderer->model, &number_of_old_hashes);
+        new_hashes = chips_3d_model_get_vertex_buffer_chunk_hashes (replacement, &number_of_new_hashes);
+        glBindBuffer (GL_ARRAY_BUFFER, renderer->vertex_buffer_id);
+        bytes_uploaded = upload_changed_chunks (GL_ARRAY_BUFFER,
+                                                old_hashes,
+                                                number_of_old_hashes,
+                                                new_hashes,
+                                                number_of_new_hashes,
+                                                chips_3d_model_get_vertex_buffer (replacement),
+                                                chips_3d_model_get_vertex_buffer_size (replacement));
+
+        old_hashes = chips_3d_model_get_vertex_arrangement_chunk_hashes (renderer->model, &number_of_old_hashes);
+        new_hashes = chips_3d_model_get_vertex_arrangement_chunk_hashes (replacement, &number_of_new_hashes);
+        bytes_uploaded += upload_changed_chunks (GL_ELEMENT_ARRAY_BUFFER,
+                                                 old_hashes,
+                                                 number_of_old_hashes,
+                                                 new_hashes,
+                                                 number_of_new_hashes,
+                                                 chips_3d_model_get_vertex_arrangement (replacement),
+                                                 chips_3d_model_get_vertex_arrangement_size (replacement));
+
+        chips_3d_model_release_geometry (replacement);
+
+        g_debug ("replaced model, uploading %" G_GSIZE_FORMAT " of %" G_GSIZE_FORMAT " bytes",
+                 bytes_uploaded,
+                 chips_3d_model_get_vertex_buffer_size (replacement) +
+                 chips_3d_model_get_vertex_arrangement_size (replacement));
+
+        g_set_object (&renderer->model, replacement);
+        renderer->vertices_available = chips_3d_model_get_number_of_vertices (replacement);
+        renderer->indices_available = chips_3d_model_get_number_of_indices (replacement);
+        renderer->vertices_uploaded = renderer->vertices_available;
+        renderer->indices_uploaded = renderer->indices_available;
+        renderer->indices_drawable = renderer->indices_available;
+        renderer->model_initialized = TRUE;
+        renderer->instance_bounds_valid = FALSE;
+        renderer->occlusion_culled_hierarchy = NULL;
+}
+
+/* Draws a copy of the model at each of the transforms, which are
+ * applied before the view's model matrix.  Levels of detail are
+ * chosen assuming the transforms don't scale the model much.
+ */
+void
+chips_renderer_set_instances (ChipsRenderer           *renderer,
+                              const graphene_matrix_t *transforms,
+                              size_t                   number_of_transforms)
+{
+        g_autofree float *matrix_values = NULL;
+        size_t i;
+
+        g_return_if_fail (number_of_transforms > 0);
+
+        matrix_values = g_new (float, number_of_transforms * 16);
+
+        for (i = 0; i < number_of_transforms; i++) {
+                graphene_matrix_to_float (&transforms[i], matrix_values + i * 16);
+        }
+
+        glBindBuffer (GL_ARRAY_BUFFER, renderer->instance_buffer_id);
+        glBufferData (GL_ARRAY_BUFFER,
+                      number_of_transforms * 16 * sizeof (float),
+                      matrix_values,
+                      GL_STATIC_DRAW);
+
+        g_array_set_size (renderer->instance_transforms, 0);
+        g_array_append_vals (renderer->instance_transforms, transforms, number_of_transforms);
+        renderer->instance_bounds_valid = FALSE;
+}
+
+void
+chips_renderer_add_geometry (ChipsRenderer *renderer,
+                             guint64        vertices_available,
+                             guint64        indices_available)
+{
+        renderer->vertices_available = MAX (renderer->vertices_available, vertices_available);
+        renderer->indices_available = MAX (renderer->indices_available, indices_available);
+}
+
+/* Once the model is initialized its levels of detail and clusters can
+ * be used, so drawing switches over to them when the upload finishes
+ */
+void
+chips_renderer_set_model_initialized (ChipsRenderer *renderer)
+{
+        renderer->model_initialized = TRUE;
+        chips_renderer_add_geometry (renderer,
+                                     chips_3d_model_get_number_of_vertices (renderer->model),
+                                     chips_3d_model_get_number_of_indices (renderer->model));
+}
+
+static void
+upload_vertex_slice (ChipsRenderer *renderer)
+{
+        const guint8 *vertices;
+        size_t stride, number_of_vertices;
+
+        vertices = chips_3d_model_get_vertex_buffer (renderer->model);
+        stride = chips_3d_model_get_vertex_buffer_get_stride (renderer->model);
+        number_of_vertices = MIN (renderer->vertices_available - renderer->vertices_uploaded,
+                                  MAX (UPLOAD_SLICE_SIZE / stride, 1));
+
+        glBindBuffer (GL_ARRAY_BUFFER, renderer->vertex_buffer_id);
+        upload_to_buffer (GL_ARRAY_BUFFER,
+                          renderer->mapped_vertex_buffer,
+                          renderer->vertices_uploaded * stride,
+                          number_of_vertices * stride,
+                          vertices);
+
+        renderer->vertices_uploaded += number_of_vertices;
+}
+
+static void
+upload_index_slice (ChipsRenderer *renderer)
+{
+        const guint8 *indices;
+        size_t index_size, number_of_indices, i;
+
+        indices = chips_3d_model_get_vertex_arrangement (renderer->model);
+        index_size = chips_3d_model_get_index_size (renderer->model);
+        number_of_indices = MIN (renderer->indices_available - renderer->indices_uploaded,
+                                 UPLOAD_SLICE_SIZE / index_size);
+
+        for (i = renderer->indices_uploaded; i < renderer->indices_uploaded + number_of_indices; i++) {
+                guint32 index;
+
+                if (index_size == sizeof (guint16)) {
+                        index = ((const guint16 *) indices)[i];
+                } else {
+                        index = ((const guint32 *) indices)[i];
+                }
+
+                renderer->largest_uploaded_index = MAX (renderer->largest_uploaded_index, index);
+        }
+
+        upload_to_buffer (GL_ELEMENT_ARRAY_BUFFER,
+                          renderer->mapped_vertex_arrangement,
+                          renderer->indices_uploaded * index_size,
+                          number_of_indices * index_size,
+                          indices);
+
+        renderer->indices_uploaded += number_of_indices;
+}
+
+/* Uploads as much of the geometry that has arrived as fits in
+ * time_budget microseconds.  Indices only go ahead of the vertices they
+ * use when there are no vertices left to send, so usually everything up
+ * to indices_drawable can be drawn.  Returns whether there's more to
+ * come.
+ */
+gboolean
+chips_renderer_upload (ChipsRenderer *renderer,
+                       gint64         time_budget)
+{
+        gint64 deadline;
+
+        if (renderer->model == NULL || renderer->geometry_uploaded) {
+                return FALSE;
+        }
+
+        /* Evicted geometry goes back up the same way it first did */
+        if (renderer->vertex_buffer_id == 0) {
+                allocate_model_buffers (renderer);
+        }
+
+        if (!renderer->geometry_held) {
+                g_autoptr (GError) error = NULL;
+
+                if (!chips_3d_model_hold_geometry (renderer->model, &error)) {
+                        g_warning ("couldn't upload model: %s", error->message);
+                        release_buffers (renderer);
+                        g_clear_object (&renderer->model);
+                        return FALSE;
+                }
+
+                renderer->geometry_held = TRUE;
+        }
+
+        deadline = g_get_monotonic_time () + time_budget;
+
+        glBindVertexArray (renderer->vertex_array_id);
+
+        do {
+                gboolean has_indices, has_vertices;
+
+                has_indices = renderer->indices_uploaded < renderer->indices_available;
+                has_vertices = renderer->vertices_uploaded < renderer->vertices_available;
+
+                if (has_indices && (renderer->largest_uploaded_index < renderer->vertices_uploaded || !has_vertices)) {
+                        upload_index_slice (renderer);
+                } else if (has_vertices) {
+                        upload_vertex_slice (renderer);
+                } else {
+                        break;
+                }
+
+                if (renderer->largest_uploaded_index < renderer->vertices_uploaded) {
+                        renderer->indices_drawable = renderer->indices_uploaded - renderer->indices_uploaded % 3;
+                }
+        } while (g_get_monotonic_time () < deadline);
+
+        if (renderer->vertices_uploaded < chips_3d_model_get_number_of_vertices (renderer->model) ||
+            renderer->indices_uploaded < chips_3d_model_get_number_of_indices (renderer->model)) {
+                return TRUE;
+        }
+
+        if (renderer->mapped_vertex_buffer != NULL) {
+                glBindBuffer (GL_ARRAY_BUFFER, renderer->vertex_buffer_id);
+                glUnmapBuffer (GL_ARRAY_BUFFER);
+                renderer->mapped_vertex_buffer = NULL;
+        }
+
+        if (renderer->mapped_vertex_arrangement != NULL) {
+                glUnmapBuffer (GL_ELEMENT_ARRAY_BUFFER);
+                renderer->mapped_vertex_arrangement = NULL;
+        }
+
+        renderer->geometry_uploaded = TRUE;
+
+        /* The GPU has its own copy now */
+        release_model_geometry (renderer);
+
+        return FALSE;
+}
+
+/* Skips the clusters of a lone copy of the model that the rest of it
+ * hides.  Occlusion queries answer a frame late, so clusters that come
+ * out from behind something show up a frame after they should.
+ */
+void
+chips_renderer_set_occlusion_culling (ChipsRenderer *renderer,
+                                      gboolean       occlusion_culling)
+{
+        if (occlusion_culling == (renderer->occlusion_culler != NULL)) {
+                return;
+        }
+
+        renderer->occlusion_culled_hierarchy = NULL;
+
+        if (!occlusion_culling) {
+                g_clear_pointer (&renderer->occlusion_culler, chips_occlusion_culler_free);
+                return;
+        }
+
+        renderer->occlusion_culler = chips_occlusion_culler_new (renderer->program,
+                                                                 renderer->instance_buffer_id);
+}
+
+/* Whether some occlusion queries haven't been answered yet, in which
+ * case drawing again soon will pick up what they found
+ */
+gboolean
+chips_renderer_has_pending_occlusion_tests (ChipsRenderer *renderer)
+{
+        if (renderer->occlusion_culler == NULL) {
+                return FALSE;
+        }
+
+        return chips_occlusion_culler_has_pending_tests (renderer->occlusion_culler);
+}
+
+Chips3DModel *
+chips_renderer_get_model (ChipsRenderer *renderer)
+{
+        return renderer->model;
+}
+
+/* How much GPU memory the model's geometry takes up */
+guint64
+chips_renderer_get_resident_size (ChipsRenderer *renderer)
+{
+        if (renderer->model == NULL || renderer->vertex_buffer_id == 0) {
+                return 0;
+        }
+
+        return renderer->vertex_buffer_capacity + renderer->vertex_arrangement_capacity;
+}
+
+/* Frees the model's geometry from the GPU.  The next
+ * chips_renderer_upload() starts putting it back, and until it's all
+ * back, only what has made it is drawn.
+ */
+void
+chips_renderer_evict (ChipsRenderer *renderer)
+{
+        release_buffers (renderer);
+
+        renderer->vertices_uploaded = 0;
+        renderer->indices_uploaded = 0;
+        renderer->indices_drawable = 0;
+        renderer->largest_uploaded_index = 0;
+        renderer->geometry_uploaded = FALSE;
+}
+
+/* The box around every copy of the model.  The model's bounds are only
+ * known once it's initialized, so this is worked out on first draw.
+ */
+static const graphene_box_t *
+get_instance_bounds (ChipsRenderer *renderer)
+{
+        graphene_box_t model_bounds;
+        size_t i;
+
+        if (renderer->instance_bounds_valid) {
+                return &renderer->instance_bounds;
+        }
+
+        chips_3d_model_get_bounds (renderer->model, &model_bounds);
+
+        for (i = 0; i < renderer->instance_transforms->len; i++) {
+                const graphene_matrix_t *transform = &g_array_index (renderer->instance_transforms, graphene_matrix_t, i);
+                graphene_box_t bounds;
+
+                graphene_matrix_transform_box (transform, &model_bounds, &bounds);
+
+                if (i == 0) {
+                        renderer->instance_bounds = bounds;
+                } else {
+                        graphene_box_union (&renderer->instance_bounds, &bounds, &renderer->instance_bounds);
+                }
+        }
+
+        renderer->instance_bounds_valid = TRUE;
+
+        return &renderer->instance_bounds;
+}
+
+/* Projects a pixel's worth of screen space out to the distance of the
+ * nearest part of bounds, which are in the space the view's model
+ * matrix applies to, giving how far geometry there can stray without
+ * anyone noticing
+ */
+float
+chips_render_view_get_acceptable_error (const ChipsRenderView *view,
+                                        const graphene_box_t  *bounds)
+{
+        graphene_point3d_t center;
+        graphene_vec3_t center_vector, offset;
+        float radius, distance, pixels_per_unit_at_unit_distance;
+
+        graphene_box_get_center (bounds, &center);
+        graphene_matrix_transform_point3d (&view->model_matrix, &center, &center);
+        graphene_point3d_to_vec3 (&center, &center_vector);
+
+        graphene_box_get_size (bounds, &offset);
+        radius = graphene_vec3_length (&offset) / 2.0f;
+
+        graphene_vec3_subtract (&view->camera_position, &center_vector, &offset);
+        distance = MAX (graphene_vec3_length (&offset) - radius, view->near_plane);
+
+        /* The second diagonal entry of a perspective matrix is the
+         * cotangent of half the vertical field of view
+         */
+        pixels_per_unit_at_unit_distance = graphene_matrix_get_value (&view->projection_matrix, 1, 1) *
+                                           view->viewport_height / 2.0f;
+
+        return ACCEPTABLE_PIXEL_ERROR * distance / pixels_per_unit_at_unit_distance;
+}
+
+/* The coarsest level of detail of the model whose error fits */
+unsigned int
+chips_render_view_choose_level_of_detail (const ChipsRenderView *view,
+                                          Chips3DModel          *model,
+                                          const graphene_box_t  *bounds)
+{
+        return chips_3d_model_choose_level_of_detail (model,
+                                                      chips_render_view_get_acceptable_error (view, bounds));
+}
+
+/* Each cluster is only tested against the view once, so with several
+ * copies of the model the clusters that might be in view of any of
+ * them can't be told apart.  Instead the whole level gets drawn for
+ * every copy in one call, unless all of them are out of view.
+ */
+static void
+draw_instances (ChipsRenderer      *renderer,
+                unsigned int        level,
+                const ChipsFrustum *frustum,
+                GLenum              index_type,
+                unsigned int        index_size)
+{
+        const ChipsMeshLevelOfDetail *level_of_detail;
+
+        if (chips_frustum_test_bounds (frustum, get_instance_bounds (renderer)) == CHIPS_FRUSTUM_OUTSIDE) {
+                return;
+        }
+
+        level_of_detail = chips_3d_model_get_level_of_detail (renderer->model, level);
+
+        glDrawElementsInstanced (GL_TRIANGLES,
+                                 level_of_detail->number_of_indices,
+                                 index_type,
+                                 (const void *) (uintptr_t) (level_of_detail->first_index * index_size),
+                                 renderer->instance_transforms->len);
+}
+
+static void
+draw_visible_ranges (ChipsRenderer *renderer,
+                     GLenum         index_type,
+                     unsigned int   index_size)
+{
+        size_t i;
+
+        g_array_set_size (renderer->draw_counts, renderer->visible_ranges->len);
+        g_array_set_size (renderer->draw_offsets, renderer->visible_ranges->len);
+
+        for (i = 0; i < renderer->visible_ranges->len; i++) {
+                const ChipsIndexRange *range = &g_array_index (renderer->visible_ranges, ChipsIndexRange, i);
+
+                g_array_index (renderer->draw_counts, GLsizei, i) = range->number_of_indices;
+                g_array_index (renderer->draw_offsets, const void *, i) = (const void *) (uintptr_t) (range->first_index * index_size);
+        }
+
+        if (renderer->visible_ranges->len > 0) {
+                glMultiDrawElements (GL_TRIANGLES,
+                                     (const GLsizei *) renderer->draw_counts->data,
+                                     index_type,
+                                     (const void * const *) renderer->draw_offsets->data,
+                                     renderer->visible_ranges->len);
+        }
+}
+
+/* Boxes the camera is about to pass into can't be tested, so they get
+ * drawn regardless.  The view's near plane is scaled into model space
+ * by however much the placement shrinks things the most.
+ */
+static float
+get_model_space_near_plane (const ChipsRenderView   *view,
+                            const graphene_matrix_t *inverse_placement_matrix)
+{
+        float scale;
+
+        scale = MAX (graphene_matrix_get_x_scale (inverse_placement_matrix),
+                     MAX (graphene_matrix_get_y_scale (inverse_placement_matrix),
+                          graphene_matrix_get_z_scale (inverse_placement_matrix)));
+
+        /* The corners of the near plane are further out than its center */
+        return 2.0f * view->near_plane * scale;
+}
+
+/* Draws the clusters in view that weren't hidden the last time they
+ * were tested, and then, against the depth they left behind, tests the
+ * boxes of the clusters in view.  Nothing new gets tested unless the
+ * view moved or something came into or out of hiding, so a still scene
+ * settles down once the queries are answered.
+ */
+static void
+draw_unoccluded_clusters (ChipsRenderer           *renderer,
+                          const ChipsBvh          *bvh,
+                          const ChipsFrustum      *frustum,
+                          const ChipsRenderView   *view,
+                          const graphene_matrix_t *placement_matrix,
+                          const graphene_matrix_t *model_view_projection_matrix,
+                          GLenum                   index_type,
+                          unsigned int             index_size)
+{
+        ChipsOcclusionCuller *culler = renderer->occlusion_culler;
+        graphene_matrix_t inverse_placement_matrix;
+        graphene_point3d_t camera_position;
+        float matrix_values[16];
+        gboolean visibility_changed, view_changed;
+        size_t i;
+
+        if (bvh != renderer->occlusion_culled_hierarchy) {
+                chips_occlusion_culler_reset (culler, chips_bvh_get_number_of_clusters (bvh));
+                renderer->occlusion_culled_hierarchy = bvh;
+        }
+
+        visibility_changed = chips_occlusion_culler_collect_results (culler);
+
+        g_array_set_size (renderer->visible_clusters, 0);
+        chips_bvh_cull_clusters (bvh, frustum, renderer->visible_clusters);
+
+        g_array_set_size (renderer->visible_ranges, 0);
+
+        for (i = 0; i < renderer->visible_clusters->len; i++) {
+                guint32 cluster = g_array_index (renderer->visible_clusters, guint32, i);
+
+                if (chips_occlusion_culler_is_visible (culler, cluster)) {
+                        chips_index_ranges_append (renderer->visible_ranges,
+                                                   chips_bvh_get_cluster_range (bvh, cluster));
+                }
+        }
+
+        draw_visible_ranges (renderer, index_type, index_size);
+
+        graphene_matrix_to_float (model_view_projection_matrix, matrix_values);
+        view_changed = memcmp (matrix_values, renderer->occlusion_tested_matrix, sizeof (matrix_values)) != 0;
+
+        if (!view_changed && !visibility_changed) {
+                return;
+        }
+
+        memcpy (renderer->occlusion_tested_matrix, matrix_values, sizeof (matrix_values));
+
+        if (!graphene_matrix_inverse (placement_matrix, &inverse_placement_matrix)) {
+                return;
+        }
+
+        graphene_point3d_init (&camera_position,
+                               graphene_vec3_get_x (&view->camera_position),
+                               graphene_vec3_get_y (&view->camera_position),
+                               graphene_vec3_get_z (&view->camera_position));
+        graphene_matrix_transform_point3d (&inverse_placement_matrix, &camera_position, &camera_position);
+
+        chips_occlusion_culler_begin_tests (culler,
+                                            &camera_position,
+                                            get_model_space_near_plane (view, &inverse_placement_matrix));
+
+        for (i = 0; i < renderer->visible_clusters->len; i++) {
+                guint32 cluster = g_array_index (renderer->visible_clusters, guint32, i);
+
+                chips_occlusion_culler_test_box (culler, cluster, chips_bvh_get_cluster_box (bvh, cluster));
+        }
+
+        chips_occlusion_culler_end_tests (culler);
+
+        glBindVertexArray (renderer->vertex_array_id);
+}
+
+/* Until everything is up, only the full detail level is drawn, as far
+ * as it has arrived.  After that only the clusters of the chosen level
+ * that could be in view get drawn, all with one call.
+ */
+void
+chips_renderer_draw (ChipsRenderer         *renderer,
+                     const ChipsRenderView *view)
+{
+        graphene_matrix_t placement_matrix, model_view_matrix, model_view_projection_matrix;
+        ChipsFrustum frustum;
+        const ChipsBvh *bvh;
+        unsigned int index_size, level;
+        GLenum index_type;
+
+        if (renderer->model == NULL || renderer->vertex_buffer_id == 0) {
+                return;
+        }
+
+        glBindVertexArray (renderer->vertex_array_id);
+
+        chips_shader_program_set_matrices (renderer->program,
+                                           &view->model_matrix,
+                                           &view->view_matrix,
+                                           &view->projection_matrix);
+        chips_shader_program_set_depth_range (renderer->program,
+                                              view->near_plane,
+                                              view->far_plane);
+        chips_shader_program_set_position_encoding (renderer->program,
+                                                    chips_3d_model_get_vertex_format (renderer->model));
+
+        index_size = chips_3d_model_get_index_size (renderer->model);
+        index_type = index_size == sizeof (guint16)? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+        if (!renderer->model_initialized || !renderer->geometry_uploaded) {
+                glDrawElementsInstanced (GL_TRIANGLES,
+                                         renderer->indices_drawable,
+                                         index_type,
+                                         NULL,
+                                         renderer->instance_transforms->len);
+                return;
+        }
+
+        level = chips_render_view_choose_level_of_detail (view, renderer->model, get_instance_bounds (renderer));
+
+        if (renderer->instance_transforms->len > 1) {
+                graphene_matrix_multiply (&view->model_matrix, &view->view_matrix, &model_view_matrix);
+                graphene_matrix_multiply (&model_view_matrix, &view->projection_matrix, &model_view_projection_matrix);
+                chips_frustum_init_from_matrix (&frustum, &model_view_projection_matrix);
+
+                draw_instances (renderer, level, &frustum, index_type, index_size);
+                return;
+        }
+
+        /* A lone copy draws as instance 0 of a plain draw call, so its
+         * transform has to be part of the culling frustum
+         */
+        graphene_matrix_multiply (&g_array_index (renderer->instance_transforms, graphene_matrix_t, 0),
+                                  &view->model_matrix,
+                                  &placement_matrix);
+        graphene_matrix_multiply (&placement_matrix, &view->view_matrix, &model_view_matrix);
+        graphene_matrix_multiply (&model_view_matrix, &view->projection_matrix, &model_view_projection_matrix);
+        chips_frustum_init_from_matrix (&frustum, &model_view_projection_matrix);
+
+        bvh = chips_3d_model_get_bounding_volume_hierarchy (renderer->model, level);
+
+        if (renderer->occlusion_culler != NULL && bvh != NULL) {
+                draw_unoccluded_clusters (renderer,
+                                          bvh,
+                                          &frustum,
+                                          view,
+                                          &placement_matrix,
+                                          &model_view_projection_matrix,
+                                          index_type,
+                                          index_size);
+                return;
+        }
+
+        chips_3d_model_cull (renderer->model, level, &frustum, renderer->visible_ranges);
+        draw_visible_ranges (renderer, index_type, index_size);
+}
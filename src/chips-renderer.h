@@ -0,0 +1,74 @@
+/* chips-renderer.h
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CHIPS_RENDERER_H
+#define CHIPS_RENDERER_H
+
+#include "chips.h"
+#include "chips-3d-model.h"
+
+/* Where the model is drawn from, and onto how tall a viewport */
+typedef struct
+{
+        graphene_matrix_t model_matrix;
+        graphene_matrix_t view_matrix;
+        graphene_matrix_t projection_matrix;
+        graphene_vec3_t   camera_position;
+        float             near_plane;
+        float             far_plane;
+        int               viewport_height;
+} ChipsRenderView;
+
+typedef struct _ChipsRenderer ChipsRenderer;
+
+float          chips_render_view_get_acceptable_error   (const ChipsRenderView *view,
+                                                         const graphene_box_t  *bounds);
+unsigned int   chips_render_view_choose_level_of_detail (const ChipsRenderView *view,
+                                                         Chips3DModel          *model,
+                                                         const graphene_box_t  *bounds);
+
+ChipsRenderer *chips_renderer_new                   (void);
+void           chips_renderer_free                  (ChipsRenderer           *renderer);
+
+void           chips_renderer_set_model             (ChipsRenderer           *renderer,
+                                                     Chips3DModel            *model);
+void           chips_renderer_set_instances         (ChipsRenderer           *renderer,
+                                                     const graphene_matrix_t *transforms,
+                                                     size_t                   number_of_transforms);
+void           chips_renderer_add_geometry          (ChipsRenderer           *renderer,
+                                                     guint64                  vertices_available,
+                                                     guint64                  indices_available);
+void           chips_renderer_set_model_initialized (ChipsRenderer           *renderer);
+void           chips_renderer_replace_model         (ChipsRenderer           *renderer,
+                                                     Chips3DModel            *replacement);
+
+gboolean       chips_renderer_upload                (ChipsRenderer           *renderer,
+                                                     gint64                   time_budget);
+void           chips_renderer_draw                  (ChipsRenderer           *renderer,
+                                                     const ChipsRenderView   *view);
+
+void           chips_renderer_set_occlusion_culling (ChipsRenderer           *renderer,
+                                                     gboolean                 occlusion_culling);
+gboolean       chips_renderer_has_pending_occlusion_tests (ChipsRenderer     *renderer);
+
+Chips3DModel  *chips_renderer_get_model             (ChipsRenderer           *renderer);
+guint64        chips_renderer_get_resident_size     (ChipsRenderer           *renderer);
+void           chips_renderer_evict                 (ChipsRenderer           *renderer);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ChipsRenderer, chips_renderer_free);
+
+#endif /* CHIPS_RENDERER_H */
@@ -0,0 +1,243 @@
+/* chips-residency-manager.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chips-residency-manager.h"
+
+struct _ChipsResidencyManager
+{
+        guint64 budget;
+
+        /* Most recently drawn first */
+        GQueue residents;
+
+        guint enforce_budget_id;
+};
+
+typedef struct
+{
+        ChipsRenderer           *renderer;
+        ChipsResidencyEvictFunc  evict_func;
+        gpointer                 user_data;
+} Resident;
+
+ChipsResidencyManager *
+chips_residency_manager_new (guint64 budget)
+{
+        ChipsResidencyManager *manager;
+
+        manager = g_slice_new0 (ChipsResidencyManager);
+        manager->budget = budget;
+        g_queue_init (&manager->residents);
+
+        return manager;
+}
+
+static void
+resident_free (Resident *resident)
+{
+        g_slice_free (Resident, resident);
+}
+
+static void
+free_resident (gpointer data,
+               gpointer user_data)
+{
+        resident_free (data);
+}
+
+void
+chips_residency_manager_free (ChipsResidencyManager *manager)
+{
+        if (manager->enforce_budget_id != 0) {
+                g_source_remove (manager->enforce_budget_id);
+        }
+
+        g_queue_foreach (&manager->residents, free_resident, NULL);
+        g_queue_clear (&manager->residents);
+        g_slice_free (ChipsResidencyManager, manager);
+}
+
+static GList *
+find_resident (ChipsResidencyManager *manager,
+               ChipsRenderer         *renderer)
+{
+        GList *node;
+
+        for (node = manager->residents.head; node != NULL; node = node->next) {
+                Resident *resident = node->data;
+
+                if (resident->renderer == renderer) {
+                        return node;
+                }
+        }
+
+        return NULL;
+}
+
+guint64
+chips_residency_manager_get_gpu_size (ChipsResidencyManager *manager)
+{
+        GList *node;
+        guint64 size = 0;
+
+        for (node = manager->residents.head; node != NULL; node = node->next) {
+                Resident *resident = node->data;
+
+                size += chips_renderer_get_resident_size (resident->renderer);
+        }
+
+        return size;
+}
+
+/* Windows showing the same file share its model, so each model is only
+ * counted once
+ */
+guint64
+chips_residency_manager_get_cpu_size (ChipsResidencyManager *manager)
+{
+        g_autoptr (GHashTable) models = NULL;
+        GList *node;
+        guint64 size = 0;
+
+        models = g_hash_table_new (NULL, NULL);
+
+        for (node = manager->residents.head; node != NULL; node = node->next) {
+                Resident *resident = node->data;
+                Chips3DModel *model = chips_renderer_get_model (resident->renderer);
+
+                if (model == NULL || !g_hash_table_add (models, model)) {
+                        continue;
+                }
+
+                size += chips_3d_model_get_resident_size (model);
+        }
+
+        return size;
+}
+
+/* Evicts from the least recently drawn end until everything fits.  The
+ * most recently drawn renderer is kept even if it alone doesn't fit,
+ * since it's the one being looked at.
+ */
+static gboolean
+enforce_budget (ChipsResidencyManager *manager)
+{
+        GList *node, *previous_node;
+        guint64 size;
+
+        manager->enforce_budget_id = 0;
+
+        size = chips_residency_manager_get_gpu_size (manager);
+
+        for (node = manager->residents.tail; node != manager->residents.head && size > manager->budget; node = previous_node) {
+                Resident *resident = node->data;
+                guint64 resident_size;
+
+                previous_node = node->prev;
+                resident_size = chips_renderer_get_resident_size (resident->renderer);
+
+                if (resident_size == 0) {
+                        continue;
+                }
+
+                resident->evict_func (resident->renderer, resident->user_data);
+                size -= resident_size;
+        }
+
+        g_debug ("models take up %" G_GUINT64_FORMAT " bytes of GPU memory and %" G_GUINT64_FORMAT " bytes of main memory",
+                 size,
+                 chips_residency_manager_get_cpu_size (manager));
+
+        return G_SOURCE_REMOVE;
+}
+
+/* Eviction waits for an idle, since a renderer can only be evicted
+ * with its own GL context current, and this is usually called with
+ * some other context current, in the middle of drawing
+ */
+static void
+queue_enforce_budget (ChipsResidencyManager *manager)
+{
+        if (manager->enforce_budget_id != 0) {
+                return;
+        }
+
+        if (chips_residency_manager_get_gpu_size (manager) <= manager->budget) {
+                return;
+        }
+
+        manager->enforce_budget_id = g_idle_add ((GSourceFunc) enforce_budget, manager);
+}
+
+void
+chips_residency_manager_set_budget (ChipsResidencyManager *manager,
+                                    guint64                budget)
+{
+        manager->budget = budget;
+        queue_enforce_budget (manager);
+}
+
+void
+chips_residency_manager_add_renderer (ChipsResidencyManager   *manager,
+                                      ChipsRenderer           *renderer,
+                                      ChipsResidencyEvictFunc  evict_func,
+                                      gpointer                 user_data)
+{
+        Resident *resident;
+
+        g_return_if_fail (find_resident (manager, renderer) == NULL);
+
+        resident = g_slice_new0 (Resident);
+        resident->renderer = renderer;
+        resident->evict_func = evict_func;
+        resident->user_data = user_data;
+
+        g_queue_push_head (&manager->residents, resident);
+}
+
+void
+chips_residency_manager_remove_renderer (ChipsResidencyManager *manager,
+                                         ChipsRenderer         *renderer)
+{
+        GList *node;
+
+        node = find_resident (manager, renderer);
+
+        g_return_if_fail (node != NULL);
+
+        resident_free (node->data);
+        g_queue_delete_link (&manager->residents, node);
+}
+
+/* Called after each draw, which also brings back anything the
+ * renderer had evicted, so the budget gets checked again
+ */
+void
+chips_residency_manager_renderer_drawn (ChipsResidencyManager *manager,
+                                        ChipsRenderer         *renderer)
+{
+        GList *node;
+
+        node = find_resident (manager, renderer);
+
+        g_return_if_fail (node != NULL);
+
+        g_queue_unlink (&manager->residents, node);
+        g_queue_push_head_link (&manager->residents, node);
+
+        queue_enforce_budget (manager);
+}
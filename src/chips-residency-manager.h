@@ -0,0 +1,58 @@
+/* chips-residency-manager.h
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CHIPS_RESIDENCY_MANAGER_H
+#define CHIPS_RESIDENCY_MANAGER_H
+
+#include "chips.h"
+#include "chips-renderer.h"
+
+/* How much GPU memory the geometry of every open model may take up,
+ * unless told otherwise.  Past it, the least recently drawn models get
+ * evicted.
+ */
+#define CHIPS_RESIDENCY_DEFAULT_BUDGET ((guint64) 1024 * 1024 * 1024)
+
+typedef struct _ChipsResidencyManager ChipsResidencyManager;
+
+/* Renderers belong to different GL contexts, so whoever added one is
+ * the one that gets to evict it
+ */
+typedef void (* ChipsResidencyEvictFunc) (ChipsRenderer *renderer,
+                                          gpointer       user_data);
+
+ChipsResidencyManager *chips_residency_manager_new             (guint64                  budget);
+void                   chips_residency_manager_free            (ChipsResidencyManager   *manager);
+
+void                   chips_residency_manager_set_budget      (ChipsResidencyManager   *manager,
+                                                                guint64                  budget);
+
+void                   chips_residency_manager_add_renderer    (ChipsResidencyManager   *manager,
+                                                                ChipsRenderer           *renderer,
+                                                                ChipsResidencyEvictFunc  evict_func,
+                                                                gpointer                 user_data);
+void                   chips_residency_manager_remove_renderer (ChipsResidencyManager   *manager,
+                                                                ChipsRenderer           *renderer);
+void                   chips_residency_manager_renderer_drawn  (ChipsResidencyManager   *manager,
+                                                                ChipsRenderer           *renderer);
+
+guint64                chips_residency_manager_get_gpu_size    (ChipsResidencyManager   *manager);
+guint64                chips_residency_manager_get_cpu_size    (ChipsResidencyManager   *manager);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ChipsResidencyManager, chips_residency_manager_free);
+
+#endif /* CHIPS_RESIDENCY_MANAGER_H */
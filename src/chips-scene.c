@@ -0,0 +1,688 @@
+/* chips-scene.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chips-scene.h"
+#include "chips-culling.h"
+#include "chips-shader-program.h"
+
+/* Pools start out this big, in bytes, and double when they fill up */
+#define POOL_MINIMUM_SIZE (4 * 1024 * 1024)
+
+/* Laid out the way glMultiDrawElementsIndirect reads it */
+typedef struct
+{
+        guint32 number_of_indices;
+        guint32 number_of_instances;
+        guint32 first_index;
+        gint32  base_vertex;
+        guint32 base_instance;
+} DrawCommand;
+
+typedef struct
+{
+        guint64 offset;
+        guint64 size;
+} FreeRange;
+
+/* Hands out runs of elements from a buffer of the given capacity,
+ * first fit, keeping the free runs sorted and merged
+ */
+typedef struct
+{
+        guint64  capacity;
+        GArray  *free_ranges;
+} RangeAllocator;
+
+/* Geometry of every model that shares a vertex layout and index size,
+ * drawn with one call
+ */
+typedef struct
+{
+        ChipsVertexFormat  format;
+        unsigned int       index_size;
+
+        unsigned int       vertex_array_id;
+        unsigned int       vertex_buffer_id;
+        unsigned int       index_buffer_id;
+
+        RangeAllocator     vertices;
+        RangeAllocator     indices;
+
+        GArray            *commands;
+} GeometryPool;
+
+typedef struct
+{
+        Chips3DModel  *model;
+        GeometryPool  *pool;
+        guint64        first_vertex;
+        guint64        first_index;
+        unsigned int   number_of_parts;
+} ModelAllocation;
+
+typedef struct
+{
+        ModelAllocation   *allocation;
+        graphene_matrix_t  transform;
+        graphene_box_t     bounds;
+} ScenePart;
+
+struct _ChipsScene
+{
+        ChipsShaderProgram *program;
+
+        GPtrArray *pools;
+        GHashTable *allocations;
+
+        /* Indexed by part id, with removed parts left as holes so the
+         * ids of the others stay put.  Each part's instance record is
+         * at the same index in the instance buffer.
+         */
+        GArray *parts;
+        unsigned int instance_buffer_id;
+        unsigned int command_buffer_id;
+
+        unsigned int instance_records_changed : 1;
+};
+
+static void
+range_allocator_init (RangeAllocator *allocator)
+{
+        allocator->capacity = 0;
+        allocator->free_ranges = g_array_new (FALSE, FALSE, sizeof (FreeRange));
+}
+
+static void
+range_allocator_clear (RangeAllocator *allocator)
+{
+        g_clear_pointer (&allocator->free_ranges, g_array_unref);
+}
+
+static gboolean
+range_allocator_allocate (RangeAllocator *allocator,
+                          guint64         size,
+                          guint64        *offset)
+{
+        size_t i;
+
+        for (i = 0; i < allocator->free_ranges->len; i++) {
+                FreeRange *range = &g_array_index (allocator->free_ranges, FreeRange, i);
+
+                if (range->size < size) {
+                        continue;
+                }
+
+                *offset = range->offset;
+                range->offset += size;
+                range->size -= size;
+
+                if (range->size == 0) {
+                        g_array_remove_index (allocator->free_ranges, i);
+                }
+
+                return TRUE;
+        }
+
+        return FALSE;
+}
+
+static void
+range_allocator_release (RangeAllocator *allocator,
+                         guint64         offset,
+                         guint64         size)
+{
+        FreeRange released = { offset, size };
+        size_t i;
+
+        if (size == 0) {
+                return;
+        }
+
+        for (i = 0; i < allocator->free_ranges->len; i++) {
+                if (g_array_index (allocator->free_ranges, FreeRange, i).offset > offset) {
+                        break;
+                }
+        }
+
+        g_array_insert_val (allocator->free_ranges, i, released);
+
+        if (i + 1 < allocator->free_ranges->len) {
+                FreeRange *range = &g_array_index (allocator->free_ranges, FreeRange, i);
+                FreeRange *next_range = &g_array_index (allocator->free_ranges, FreeRange, i + 1);
+
+                if (range->offset + range->size == next_range->offset) {
+                        range->size += next_range->size;
+                        g_array_remove_index (allocator->free_ranges, i + 1);
+                }
+        }
+
+        if (i > 0) {
+                FreeRange *previous_range = &g_array_index (allocator->free_ranges, FreeRange, i - 1);
+                FreeRange *range = &g_array_index (allocator->free_ranges, FreeRange, i);
+
+                if (previous_range->offset + previous_range->size == range->offset) {
+                        previous_range->size += range->size;
+                        g_array_remove_index (allocator->free_ranges, i);
+                }
+        }
+}
+
+static void
+range_allocator_grow (RangeAllocator *allocator,
+                      guint64         capacity)
+{
+        guint64 old_capacity = allocator->capacity;
+
+        allocator->capacity = capacity;
+        range_allocator_release (allocator, old_capacity, capacity - old_capacity);
+}
+
+/* Moves the contents of a buffer into a bigger one, on the GPU */
+static unsigned int
+grow_buffer (unsigned int buffer_id,
+             GLenum       target,
+             size_t       old_size,
+             size_t       new_size)
+{
+        unsigned int new_buffer_id;
+
+        glGenBuffers (1, &new_buffer_id);
+        glBindBuffer (target, new_buffer_id);
+        glBufferData (target, new_size, NULL, GL_STATIC_DRAW);
+
+        if (buffer_id != 0) {
+                glBindBuffer (GL_COPY_READ_BUFFER, buffer_id);
+                glCopyBufferSubData (GL_COPY_READ_BUFFER, target, 0, 0, old_size);
+                glDeleteBuffers (1, &buffer_id);
+        }
+
+        return new_buffer_id;
+}
+
+static GeometryPool *
+geometry_pool_new (ChipsScene              *scene,
+                   const ChipsVertexFormat *format,
+                   unsigned int             index_size)
+{
+        GeometryPool *pool;
+
+        pool = g_slice_new0 (GeometryPool);
+        pool->format = *format;
+        pool->index_size = index_size;
+        range_allocator_init (&pool->vertices);
+        range_allocator_init (&pool->indices);
+        pool->commands = g_array_new (FALSE, FALSE, sizeof (DrawCommand));
+
+        glGenVertexArrays (1, &pool->vertex_array_id);
+        glBindVertexArray (pool->vertex_array_id);
+
+        glBindBuffer (GL_ARRAY_BUFFER, scene->instance_buffer_id);
+        chips_shader_program_bind_instances (scene->program, CHIPS_INSTANCE_RECORD_SIZE, 0, TRUE);
+
+        return pool;
+}
+
+static void
+geometry_pool_free (GeometryPool *pool)
+{
+        glDeleteVertexArrays (1, &pool->vertex_array_id);
+
+        if (pool->vertex_buffer_id != 0) {
+                glDeleteBuffers (1, &pool->vertex_buffer_id);
+        }
+
+        if (pool->index_buffer_id != 0) {
+                glDeleteBuffers (1, &pool->index_buffer_id);
+        }
+
+        range_allocator_clear (&pool->vertices);
+        range_allocator_clear (&pool->indices);
+        g_clear_pointer (&pool->commands, g_array_unref);
+
+        g_slice_free (GeometryPool, pool);
+}
+
+static void
+geometry_pool_reserve_vertices (GeometryPool *pool,
+                                ChipsScene   *scene,
+                                guint64       number_of_vertices,
+                                guint64      *first_vertex)
+{
+        guint64 capacity;
+
+        if (range_allocator_allocate (&pool->vertices, number_of_vertices, first_vertex)) {
+                return;
+        }
+
+        capacity = MAX (pool->vertices.capacity * 2, pool->vertices.capacity + number_of_vertices);
+        capacity = MAX (capacity, POOL_MINIMUM_SIZE / pool->format.stride);
+
+        glBindVertexArray (pool->vertex_array_id);
+        pool->vertex_buffer_id = grow_buffer (pool->vertex_buffer_id,
+                                              GL_ARRAY_BUFFER,
+                                              pool->vertices.capacity * pool->format.stride,
+                                              capacity * pool->format.stride);
+        chips_shader_program_bind_vertex_format (scene->program, &pool->format);
+
+        range_allocator_grow (&pool->vertices, capacity);
+        range_allocator_allocate (&pool->vertices, number_of_vertices, first_vertex);
+}
+
+static void
+geometry_pool_reserve_indices (GeometryPool *pool,
+                               guint64       number_of_indices,
+                               guint64      *first_index)
+{
+        guint64 capacity;
+
+        if (range_allocator_allocate (&pool->indices, number_of_indices, first_index)) {
+                return;
+        }
+
+        capacity = MAX (pool->indices.capacity * 2, pool->indices.capacity + number_of_indices);
+        capacity = MAX (capacity, POOL_MINIMUM_SIZE / pool->index_size);
+
+        glBindVertexArray (pool->vertex_array_id);
+        pool->index_buffer_id = grow_buffer (pool->index_buffer_id,
+                                             GL_ELEMENT_ARRAY_BUFFER,
+                                             pool->indices.capacity * pool->index_size,
+                                             capacity * pool->index_size);
+
+        range_allocator_grow (&pool->indices, capacity);
+        range_allocator_allocate (&pool->indices, number_of_indices, first_index);
+}
+
+static GeometryPool *
+get_pool_for_model (ChipsScene   *scene,
+                    Chips3DModel *model)
+{
+        const ChipsVertexFormat *format;
+        unsigned int index_size;
+        GeometryPool *pool;
+        size_t i;
+
+        format = chips_3d_model_get_vertex_format (model);
+        index_size = chips_3d_model_get_index_size (model);
+
+        for (i = 0; i < scene->pools->len; i++) {
+                pool = g_ptr_array_index (scene->pools, i);
+
+                if (pool->index_size == index_size &&
+                    pool->format.stride == format->stride &&
+                    memcmp (pool->format.attributes, format->attributes, sizeof (format->attributes)) == 0) {
+                        return pool;
+                }
+        }
+
+        pool = geometry_pool_new (scene, format, index_size);
+        g_ptr_array_add (scene->pools, pool);
+
+        return pool;
+}
+
+static ModelAllocation *
+allocate_model (ChipsScene   *scene,
+                Chips3DModel *model)
+{
+        g_autoptr (GError) error = NULL;
+        ModelAllocation *allocation;
+        GeometryPool *pool;
+
+        allocation = g_hash_table_lookup (scene->allocations, model);
+
+        if (allocation != NULL) {
+                return allocation;
+        }
+
+        if (!chips_3d_model_hold_geometry (model, &error)) {
+                g_warning ("couldn't add model to scene: %s", error->message);
+                return NULL;
+        }
+
+        pool = get_pool_for_model (scene, model);
+
+        allocation = g_slice_new0 (ModelAllocation);
+        allocation->model = g_object_ref (model);
+        allocation->pool = pool;
+
+        geometry_pool_reserve_vertices (pool, scene, chips_3d_model_get_number_of_vertices (model), &allocation->first_vertex);
+        geometry_pool_reserve_indices (pool, chips_3d_model_get_number_of_indices (model), &allocation->first_index);
+
+        glBindBuffer (GL_ARRAY_BUFFER, pool->vertex_buffer_id);
+        glBufferSubData (GL_ARRAY_BUFFER,
+                         allocation->first_vertex * pool->format.stride,
+                         chips_3d_model_get_vertex_buffer_size (model),
+                         chips_3d_model_get_vertex_buffer (model));
+
+        glBindVertexArray (pool->vertex_array_id);
+        glBufferSubData (GL_ELEMENT_ARRAY_BUFFER,
+                         allocation->first_index * pool->index_size,
+                         chips_3d_model_get_vertex_arrangement_size (model),
+                         chips_3d_model_get_vertex_arrangement (model));
+
+        chips_3d_model_release_geometry (model);
+
+        g_hash_table_insert (scene->allocations, model, allocation);
+
+        return allocation;
+}
+
+static void
+release_model (ChipsScene      *scene,
+               ModelAllocation *allocation)
+{
+        Chips3DModel *model = allocation->model;
+
+        range_allocator_release (&allocation->pool->vertices,
+                                 allocation->first_vertex,
+                                 chips_3d_model_get_number_of_vertices (model));
+        range_allocator_release (&allocation->pool->indices,
+                                 allocation->first_index,
+                                 chips_3d_model_get_number_of_indices (model));
+
+        g_hash_table_remove (scene->allocations, model);
+        g_object_unref (model);
+        g_slice_free (ModelAllocation, allocation);
+}
+
+/* Needs a current GL context, which has to stay current for every
+ * other call, chips_scene_free included
+ */
+ChipsScene *
+chips_scene_new (void)
+{
+        ChipsScene *scene;
+
+        scene = g_slice_new0 (ChipsScene);
+        scene->pools = g_ptr_array_new_with_free_func ((GDestroyNotify) geometry_pool_free);
+        scene->allocations = g_hash_table_new (NULL, NULL);
+        scene->parts = g_array_new (FALSE, FALSE, sizeof (ScenePart));
+
+        glEnable (GL_DEPTH_TEST);
+        glEnable (GL_CULL_FACE);
+
+        scene->program = chips_shader_program_new ();
+
+        glGenBuffers (1, &scene->instance_buffer_id);
+        glGenBuffers (1, &scene->command_buffer_id);
+
+        return scene;
+}
+
+void
+chips_scene_free (ChipsScene *scene)
+{
+        size_t i;
+
+        for (i = 0; i < scene->parts->len; i++) {
+                chips_scene_remove_part (scene, i);
+        }
+
+        g_clear_pointer (&scene->pools, g_ptr_array_unref);
+        g_clear_pointer (&scene->allocations, g_hash_table_unref);
+        g_clear_pointer (&scene->parts, g_array_unref);
+
+        glDeleteBuffers (1, &scene->instance_buffer_id);
+        glDeleteBuffers (1, &scene->command_buffer_id);
+        chips_shader_program_free (scene->program);
+
+        g_slice_free (ChipsScene, scene);
+}
+
+/* Places a copy of an initialized model in the scene.  Its geometry
+ * only goes to the GPU the first time it's added.  A model whose
+ * geometry can't be read back is left out, but still gets a part id.
+ */
+guint
+chips_scene_add_part (ChipsScene              *scene,
+                      Chips3DModel            *model,
+                      const graphene_matrix_t *transform)
+{
+        ScenePart part = { 0 };
+        graphene_box_t model_bounds;
+
+        part.allocation = allocate_model (scene, model);
+        part.transform = *transform;
+
+        if (part.allocation == NULL) {
+                g_array_append_val (scene->parts, part);
+                return scene->parts->len - 1;
+        }
+
+        part.allocation->number_of_parts++;
+
+        chips_3d_model_get_bounds (model, &model_bounds);
+        graphene_matrix_transform_box (transform, &model_bounds, &part.bounds);
+
+        g_array_append_val (scene->parts, part);
+        scene->instance_records_changed = TRUE;
+
+        return scene->parts->len - 1;
+}
+
+void
+chips_scene_remove_part (ChipsScene *scene,
+                         guint       part_id)
+{
+        ScenePart *part;
+
+        g_return_if_fail (part_id < scene->parts->len);
+
+        part = &g_array_index (scene->parts, ScenePart, part_id);
+
+        if (part->allocation == NULL) {
+                return;
+        }
+
+        part->allocation->number_of_parts--;
+
+        if (part->allocation->number_of_parts == 0) {
+                release_model (scene, part->allocation);
+        }
+
+        part->allocation = NULL;
+        scene->instance_records_changed = TRUE;
+}
+
+static void
+upload_instance_records (ChipsScene *scene)
+{
+        g_autofree guint8 *records = NULL;
+        size_t i;
+
+        records = g_malloc0 (MAX (scene->parts->len, 1) * CHIPS_INSTANCE_RECORD_SIZE);
+
+        for (i = 0; i < scene->parts->len; i++) {
+                ScenePart *part = &g_array_index (scene->parts, ScenePart, i);
+                float *record = (float *) (records + i * CHIPS_INSTANCE_RECORD_SIZE);
+                const ChipsVertexFormat *format;
+
+                if (part->allocation == NULL) {
+                        continue;
+                }
+
+                format = chips_3d_model_get_vertex_format (part->allocation->model);
+
+                graphene_matrix_to_float (&part->transform, record);
+                memcpy (record + 16, format->position_offset, sizeof (format->position_offset));
+                memcpy (record + 19, format->position_scale, sizeof (format->position_scale));
+        }
+
+        glBindBuffer (GL_ARRAY_BUFFER, scene->instance_buffer_id);
+        glBufferData (GL_ARRAY_BUFFER,
+                      MAX (scene->parts->len, 1) * CHIPS_INSTANCE_RECORD_SIZE,
+                      records,
+                      GL_STATIC_DRAW);
+
+        scene->instance_records_changed = FALSE;
+}
+
+/* Every part that might be in view gets a draw command for its chosen
+ * level of detail, in the pool its model lives in
+ */
+static void
+build_draw_commands (ChipsScene            *scene,
+                     const ChipsRenderView *view)
+{
+        graphene_matrix_t model_view_matrix, model_view_projection_matrix;
+        ChipsFrustum frustum;
+        size_t i;
+
+        graphene_matrix_multiply (&view->model_matrix, &view->view_matrix, &model_view_matrix);
+        graphene_matrix_multiply (&model_view_matrix, &view->projection_matrix, &model_view_projection_matrix);
+        chips_frustum_init_from_matrix (&frustum, &model_view_projection_matrix);
+
+        for (i = 0; i < scene->pools->len; i++) {
+                GeometryPool *pool = g_ptr_array_index (scene->pools, i);
+
+                g_array_set_size (pool->commands, 0);
+        }
+
+        for (i = 0; i < scene->parts->len; i++) {
+                ScenePart *part = &g_array_index (scene->parts, ScenePart, i);
+                const ChipsMeshLevelOfDetail *level_of_detail;
+                DrawCommand command;
+                unsigned int level;
+
+                if (part->allocation == NULL) {
+                        continue;
+                }
+
+                if (chips_frustum_test_bounds (&frustum, &part->bounds) == CHIPS_FRUSTUM_OUTSIDE) {
+                        continue;
+                }
+
+                level = chips_render_view_choose_level_of_detail (view, part->allocation->model, &part->bounds);
+                level_of_detail = chips_3d_model_get_level_of_detail (part->allocation->model, level);
+
+                command.number_of_indices = level_of_detail->number_of_indices;
+                command.number_of_instances = 1;
+                command.first_index = part->allocation->first_index + level_of_detail->first_index;
+                command.base_vertex = part->allocation->first_vertex;
+                command.base_instance = i;
+
+                g_array_append_val (part->allocation->pool->commands, command);
+        }
+}
+
+static gboolean
+has_base_instance (void)
+{
+        return epoxy_gl_version () >= 42 || epoxy_has_gl_extension ("GL_ARB_base_instance");
+}
+
+/* Indirect draws can only pick out instance records with a base
+ * instance, which older versions of the extension don't have
+ */
+static gboolean
+has_multi_draw_indirect (void)
+{
+        if (epoxy_gl_version () >= 43) {
+                return TRUE;
+        }
+
+        return epoxy_has_gl_extension ("GL_ARB_multi_draw_indirect") && has_base_instance ();
+}
+
+/* Older drivers without indirect draws or base instances get the same
+ * commands one call at a time
+ */
+static void
+submit_draw_commands (ChipsScene   *scene,
+                      GeometryPool *pool)
+{
+        GLenum index_type;
+        size_t i;
+
+        index_type = pool->index_size == sizeof (guint16)? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+        if (has_multi_draw_indirect ()) {
+                glBindBuffer (GL_DRAW_INDIRECT_BUFFER, scene->command_buffer_id);
+                glBufferData (GL_DRAW_INDIRECT_BUFFER,
+                              pool->commands->len * sizeof (DrawCommand),
+                              pool->commands->data,
+                              GL_STREAM_DRAW);
+                glMultiDrawElementsIndirect (GL_TRIANGLES, index_type, NULL, pool->commands->len, 0);
+                return;
+        }
+
+        for (i = 0; i < pool->commands->len; i++) {
+                const DrawCommand *command = &g_array_index (pool->commands, DrawCommand, i);
+                const void *offset = (const void *) (uintptr_t) (command->first_index * pool->index_size);
+
+                if (has_base_instance ()) {
+                        glDrawElementsInstancedBaseVertexBaseInstance (GL_TRIANGLES,
+                                                                       command->number_of_indices,
+                                                                       index_type,
+                                                                       offset,
+                                                                       1,
+                                                                       command->base_vertex,
+                                                                       command->base_instance);
+                        continue;
+                }
+
+                glBindBuffer (GL_ARRAY_BUFFER, scene->instance_buffer_id);
+                chips_shader_program_bind_instances (scene->program,
+                                                     CHIPS_INSTANCE_RECORD_SIZE,
+                                                     command->base_instance,
+                                                     TRUE);
+                glDrawElementsBaseVertex (GL_TRIANGLES,
+                                          command->number_of_indices,
+                                          index_type,
+                                          (void *) offset,
+                                          command->base_vertex);
+        }
+}
+
+void
+chips_scene_draw (ChipsScene            *scene,
+                  const ChipsRenderView *view)
+{
+        size_t i;
+
+        if (scene->instance_records_changed) {
+                upload_instance_records (scene);
+        }
+
+        chips_shader_program_set_matrices (scene->program,
+                                           &view->model_matrix,
+                                           &view->view_matrix,
+                                           &view->projection_matrix);
+        chips_shader_program_set_depth_range (scene->program,
+                                              view->near_plane,
+                                              view->far_plane);
+
+        build_draw_commands (scene, view);
+
+        for (i = 0; i < scene->pools->len; i++) {
+                GeometryPool *pool = g_ptr_array_index (scene->pools, i);
+
+                if (pool->commands->len == 0) {
+                        continue;
+                }
+
+                glBindVertexArray (pool->vertex_array_id);
+
+                /* Uniforms belong to the program, not the vertex array,
+                 * so the normal encoding has to be set per pool
+                 */
+                glUniform1i (scene->program->octahedral_normals_id,
+                             pool->format.attributes[CHIPS_VERTEX_ATTRIBUTE_NORMAL].encoding == CHIPS_VERTEX_ENCODING_OCTAHEDRAL_SHORT);
+
+                submit_draw_commands (scene, pool);
+        }
+}
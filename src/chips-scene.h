@@ -0,0 +1,45 @@
+/* chips-scene.h
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CHIPS_SCENE_H
+#define CHIPS_SCENE_H
+
+#include "chips.h"
+#include "chips-3d-model.h"
+#include "chips-renderer.h"
+
+/* Many different models, each placed any number of times, with all of
+ * their geometry packed into a few shared buffers so the whole scene
+ * goes to the GPU in a handful of draw calls
+ */
+typedef struct _ChipsScene ChipsScene;
+
+ChipsScene *chips_scene_new         (void);
+void        chips_scene_free        (ChipsScene              *scene);
+
+guint       chips_scene_add_part    (ChipsScene              *scene,
+                                     Chips3DModel            *model,
+                                     const graphene_matrix_t *transform);
+void        chips_scene_remove_part (ChipsScene              *scene,
+                                     guint                    part_id);
+
+void        chips_scene_draw        (ChipsScene              *scene,
+                                     const ChipsRenderView   *view);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ChipsScene, chips_scene_free);
+
+#endif /* CHIPS_SCENE_H */
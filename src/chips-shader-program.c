@@ -0,0 +1,392 @@
+/* chips-shader-program.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chips-shader-program.h"
+#include "chips-profiler.h"
+#include "chips-program-cache.h"
+
+typedef enum
+{
+        CHIPS_VERTEX_SHADER = GL_VERTEX_SHADER,
+        CHIPS_FRAGMENT_SHADER = GL_FRAGMENT_SHADER
+} ChipsShaderType;
+
+static const char *vertex_attribute_names[CHIPS_NUMBER_OF_VERTEX_ATTRIBUTES] = {
+        [CHIPS_VERTEX_ATTRIBUTE_POSITION] = "position",
+        [CHIPS_VERTEX_ATTRIBUTE_NORMAL] = "normal",
+        [CHIPS_VERTEX_ATTRIBUTE_TEXTURE_COORDINATES] = "texture_coordinates",
+};
+
+/* How positions are encoded comes in as attributes rather than
+ * uniforms, so models with different encodings can share a draw call
+ */
+static const char *vertex_shader =
+"#version 330\n"
+"in vec3 position;\n"
+"in vec3 normal;\n"
+"in mat4 instance_matrix;\n"
+"in vec3 position_offset;\n"
+"in vec3 position_scale;\n"
+"out vec3 color;\n"
+"uniform mat4 model_matrix;\n"
+"uniform mat4 view_matrix;\n"
+"uniform mat4 projection_matrix;\n"
+"uniform float near_plane;\n"
+"uniform float far_plane;\n"
+"uniform bool octahedral_normals;\n"
+"vec3\n"
+"decode_octahedral_normal (vec2 encoded_normal)\n"
+"{\n"
+"        vec3 normal = vec3 (encoded_normal, 1.0 - abs (encoded_normal.x) - abs (encoded_normal.y));\n"
+"        float fold = max (-normal.z, 0.0);\n"
+"        normal.x += normal.x >= 0.0? -fold : fold;\n"
+"        normal.y += normal.y >= 0.0? -fold : fold;\n"
+"        return normalize (normal);\n"
+"}\n"
+"void\n"
+"main ()\n"
+"{\n"
+"        mat4 placement_matrix = model_matrix * instance_matrix;\n"
+"        vec3 model_position = position_offset + position * position_scale;\n"
+"        vec3 model_normal = octahedral_normals? decode_octahedral_normal (normal.xy) : normal;\n"
+"        float lighting, depth;\n"
+"        gl_Position = projection_matrix * view_matrix * placement_matrix * vec4 (model_position, 1.0);\n"
+"        lighting = 0.4 + 0.6 * abs (dot (normalize (mat3 (placement_matrix) * model_normal), normalize (vec3 (0.3, 0.5, 1.0))));\n"
+"        depth = clamp ((gl_Position.w - near_plane) / (far_plane - near_plane), 0.0, 1.0);\n"
+"        color = lighting * vec3 (1.0 - 0.8 * depth);\n"
+"}\n";
+
+static const char *fragment_shader =
+"#version 330\n"
+"in vec3 color;\n"
+"out vec4 fragment_color;\n"
+"void main ()\n"
+"{\n"
+"        fragment_color = vec4 (color, 1.0);\n"
+"}\n";
+
+static gboolean
+load_shader (ChipsShaderType  shader_type,
+             const char      *shader,
+             unsigned int    *shader_id)
+{
+        int compile_status;
+
+        *shader_id = glCreateShader (shader_type);
+        glShaderSource (*shader_id, 1, &shader, NULL);
+        glCompileShader (*shader_id);
+
+        glGetShaderiv (*shader_id, GL_COMPILE_STATUS, &compile_status);
+
+        if (!compile_status) {
+                char compile_log[4096];
+
+                glGetShaderInfoLog (*shader_id, sizeof (compile_log), NULL, compile_log);
+                g_warning ("failed to compile shader: '%s'\n%s",
+                           shader, compile_log);
+        }
+
+        return compile_status;
+}
+
+static gboolean
+link_shaders (ChipsShaderProgram *program)
+{
+        int link_status;
+
+        if (!load_shader (CHIPS_VERTEX_SHADER,
+                          vertex_shader,
+                          &program->vertex_shader_id) ||
+            !load_shader (CHIPS_FRAGMENT_SHADER,
+                          fragment_shader,
+                          &program->fragment_shader_id)) {
+                return FALSE;
+        }
+
+        glAttachShader (program->program_id,
+                        program->vertex_shader_id);
+        glAttachShader (program->program_id,
+                        program->fragment_shader_id);
+
+        glBindFragDataLocation (program->program_id,
+                                0,
+                                "fragment_color");
+
+        if (chips_program_cache_is_supported ()) {
+                glProgramParameteri (program->program_id,
+                                     GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                                     GL_TRUE);
+        }
+
+        glLinkProgram (program->program_id);
+
+        glGetProgramiv (program->program_id, GL_LINK_STATUS, &link_status);
+
+        if (!link_status) {
+                char link_log[4096];
+
+                glGetProgramInfoLog (program->program_id, sizeof (link_log), NULL, link_log);
+                g_warning ("failed to link shader program:\n%s", link_log);
+        }
+
+        return link_status;
+}
+
+/* Linking is slow on some drivers, so the linked program is cached
+ * and only built from source when there's no usable binary.  Needs a
+ * current GL context.
+ */
+ChipsShaderProgram *
+chips_shader_program_new (void)
+{
+        const char *sources[] = { vertex_shader, fragment_shader };
+        g_autofree char *cache_key = NULL;
+        ChipsShaderProgram *program;
+        size_t i;
+        gint64 span_start;
+
+        span_start = chips_profiler_begin_span ();
+        program = g_slice_new0 (ChipsShaderProgram);
+        program->program_id = glCreateProgram ();
+        cache_key = chips_program_cache_compute_key (sources, G_N_ELEMENTS (sources));
+
+        if (!chips_program_cache_load (cache_key, program->program_id) &&
+            link_shaders (program)) {
+                chips_program_cache_save (cache_key, program->program_id);
+        }
+
+        chips_profiler_end_span (span_start, "load", "load shader program");
+
+        glUseProgram (program->program_id);
+
+        for (i = 0; i < CHIPS_NUMBER_OF_VERTEX_ATTRIBUTES; i++) {
+                program->vertex_attribute_ids[i] = glGetAttribLocation (program->program_id,
+                                                                        vertex_attribute_names[i]);
+        }
+
+        program->instance_matrix_id = glGetAttribLocation (program->program_id, "instance_matrix");
+        program->position_offset_id = glGetAttribLocation (program->program_id, "position_offset");
+        program->position_scale_id = glGetAttribLocation (program->program_id, "position_scale");
+        program->octahedral_normals_id = glGetUniformLocation (program->program_id, "octahedral_normals");
+        program->model_matrix_id = glGetUniformLocation (program->program_id, "model_matrix");
+        program->view_matrix_id = glGetUniformLocation (program->program_id, "view_matrix");
+        program->projection_matrix_id = glGetUniformLocation (program->program_id, "projection_matrix");
+        program->near_plane_id = glGetUniformLocation (program->program_id, "near_plane");
+        program->far_plane_id = glGetUniformLocation (program->program_id, "far_plane");
+
+        return program;
+}
+
+void
+chips_shader_program_free (ChipsShaderProgram *program)
+{
+        glDeleteProgram (program->program_id);
+
+        if (program->vertex_shader_id != 0) {
+                glDeleteShader (program->vertex_shader_id);
+        }
+
+        if (program->fragment_shader_id != 0) {
+                glDeleteShader (program->fragment_shader_id);
+        }
+
+        g_slice_free (ChipsShaderProgram, program);
+}
+
+static void
+get_gl_attribute_type (ChipsVertexEncoding  encoding,
+                       GLenum              *type,
+                       GLboolean           *normalized)
+{
+        switch (encoding) {
+                case CHIPS_VERTEX_ENCODING_HALF_FLOAT:
+                        *type = GL_HALF_FLOAT;
+                        *normalized = GL_FALSE;
+                        break;
+                case CHIPS_VERTEX_ENCODING_NORMALIZED_SHORT:
+                        *type = GL_UNSIGNED_SHORT;
+                        *normalized = GL_TRUE;
+                        break;
+                case CHIPS_VERTEX_ENCODING_OCTAHEDRAL_SHORT:
+                        *type = GL_SHORT;
+                        *normalized = GL_TRUE;
+                        break;
+                default:
+                        *type = GL_FLOAT;
+                        *normalized = GL_FALSE;
+                        break;
+        }
+}
+
+/* Points the per vertex inputs of the bound vertex array at the bound
+ * array buffer, which holds vertices in the given format
+ */
+void
+chips_shader_program_bind_vertex_format (ChipsShaderProgram      *program,
+                                         const ChipsVertexFormat *format)
+{
+        size_t i;
+
+        glUseProgram (program->program_id);
+
+        for (i = 0; i < CHIPS_NUMBER_OF_VERTEX_ATTRIBUTES; i++) {
+                int attribute_id = program->vertex_attribute_ids[i];
+                GLenum type;
+                GLboolean normalized;
+
+                if (attribute_id < 0) {
+                        continue;
+                }
+
+                /* Missing attributes read a constant instead, which for
+                 * normals means flat, head on lighting
+                 */
+                if (format->attributes[i].encoding == CHIPS_VERTEX_ENCODING_NONE) {
+                        glDisableVertexAttribArray (attribute_id);
+                        glVertexAttrib3f (attribute_id, 0.0, 0.0, 1.0);
+                        continue;
+                }
+
+                get_gl_attribute_type (format->attributes[i].encoding, &type, &normalized);
+
+                glEnableVertexAttribArray (attribute_id);
+                glVertexAttribPointer (attribute_id,
+                                       chips_vertex_format_get_number_of_components (format, i),
+                                       type,
+                                       normalized,
+                                       format->stride,
+                                       (void *) (uintptr_t) format->attributes[i].offset);
+        }
+
+        glUniform1i (program->octahedral_normals_id,
+                     format->attributes[CHIPS_VERTEX_ATTRIBUTE_NORMAL].encoding == CHIPS_VERTEX_ENCODING_OCTAHEDRAL_SHORT);
+}
+
+static void
+bind_instance_attribute (int    attribute_id,
+                         int    number_of_components,
+                         size_t record_size,
+                         size_t offset)
+{
+        if (attribute_id < 0) {
+                return;
+        }
+
+        glEnableVertexAttribArray (attribute_id);
+        glVertexAttribPointer (attribute_id,
+                               number_of_components,
+                               GL_FLOAT,
+                               GL_FALSE,
+                               record_size,
+                               (void *) offset);
+        glVertexAttribDivisor (attribute_id, 1);
+}
+
+/* Points the per instance inputs of the bound vertex array at the
+ * records in the bound array buffer, starting at first_record.  A mat4
+ * attribute takes up four consecutive locations, one per row.
+ */
+void
+chips_shader_program_bind_instances (ChipsShaderProgram *program,
+                                     size_t              record_size,
+                                     size_t              first_record,
+                                     gboolean            with_position_encoding)
+{
+        size_t start = first_record * record_size;
+        int i;
+
+        if (program->instance_matrix_id >= 0) {
+                for (i = 0; i < 4; i++) {
+                        bind_instance_attribute (program->instance_matrix_id + i,
+                                                 4,
+                                                 record_size,
+                                                 start + i * 4 * sizeof (float));
+                }
+        }
+
+        if (!with_position_encoding) {
+                return;
+        }
+
+        bind_instance_attribute (program->position_offset_id,
+                                 3,
+                                 record_size,
+                                 start + CHIPS_INSTANCE_TRANSFORM_SIZE);
+        bind_instance_attribute (program->position_scale_id,
+                                 3,
+                                 record_size,
+                                 start + CHIPS_INSTANCE_TRANSFORM_SIZE + 3 * sizeof (float));
+}
+
+/* For drawing a single model, whose position encoding is the same for
+ * every instance.  Constant attribute values aren't part of the vertex
+ * array, so this has to happen before each draw.
+ */
+void
+chips_shader_program_set_position_encoding (ChipsShaderProgram      *program,
+                                            const ChipsVertexFormat *format)
+{
+        if (program->position_offset_id >= 0) {
+                glDisableVertexAttribArray (program->position_offset_id);
+                glVertexAttrib3fv (program->position_offset_id, format->position_offset);
+        }
+
+        if (program->position_scale_id >= 0) {
+                glDisableVertexAttribArray (program->position_scale_id);
+                glVertexAttrib3fv (program->position_scale_id, format->position_scale);
+        }
+}
+
+static void
+upload_matrix_to_shaders (int                      matrix_id,
+                          const graphene_matrix_t *matrix)
+{
+        float matrix_values[16];
+
+        graphene_matrix_to_float (matrix, matrix_values);
+        glUniformMatrix4fv(matrix_id,
+                           1,
+                           GL_FALSE,
+                           matrix_values);
+}
+
+void
+chips_shader_program_set_matrices (ChipsShaderProgram      *program,
+                                   const graphene_matrix_t *model_matrix,
+                                   const graphene_matrix_t *view_matrix,
+                                   const graphene_matrix_t *projection_matrix)
+{
+        glUseProgram (program->program_id);
+
+        upload_matrix_to_shaders (program->model_matrix_id, model_matrix);
+        upload_matrix_to_shaders (program->view_matrix_id, view_matrix);
+        upload_matrix_to_shaders (program->projection_matrix_id, projection_matrix);
+}
+
+/* Things fade with distance, from the near plane out to the far one, so
+ * however deep the scene is, all of the shading is used
+ */
+void
+chips_shader_program_set_depth_range (ChipsShaderProgram *program,
+                                      float               near_plane,
+                                      float               far_plane)
+{
+        glUseProgram (program->program_id);
+
+        glUniform1f (program->near_plane_id, near_plane);
+        glUniform1f (program->far_plane_id, far_plane);
+}
@@ -0,0 +1,71 @@
+/* chips-shader-program.h
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CHIPS_SHADER_PROGRAM_H
+#define CHIPS_SHADER_PROGRAM_H
+
+#include "chips.h"
+#include "chips-vertex-format.h"
+
+/* Each instance record starts with the transform of that copy of the
+ * model, optionally followed by how its positions are encoded
+ */
+#define CHIPS_INSTANCE_TRANSFORM_SIZE (16 * sizeof (float))
+#define CHIPS_INSTANCE_RECORD_SIZE (CHIPS_INSTANCE_TRANSFORM_SIZE + 6 * sizeof (float))
+
+/* The program every model is drawn with, and where its inputs are */
+typedef struct
+{
+        unsigned int program_id;
+        unsigned int vertex_shader_id;
+        unsigned int fragment_shader_id;
+
+        int vertex_attribute_ids[CHIPS_NUMBER_OF_VERTEX_ATTRIBUTES];
+        int instance_matrix_id;
+        int position_offset_id;
+        int position_scale_id;
+
+        int octahedral_normals_id;
+        int model_matrix_id;
+        int view_matrix_id;
+        int projection_matrix_id;
+        int near_plane_id;
+        int far_plane_id;
+} ChipsShaderProgram;
+
+ChipsShaderProgram *chips_shader_program_new                   (void);
+void                chips_shader_program_free                  (ChipsShaderProgram       *program);
+
+void                chips_shader_program_bind_vertex_format    (ChipsShaderProgram       *program,
+                                                                const ChipsVertexFormat  *format);
+void                chips_shader_program_bind_instances        (ChipsShaderProgram       *program,
+                                                                size_t                    record_size,
+                                                                size_t                    first_record,
+                                                                gboolean                  with_position_encoding);
+void                chips_shader_program_set_position_encoding (ChipsShaderProgram       *program,
+                                                                const ChipsVertexFormat  *format);
+void                chips_shader_program_set_matrices          (ChipsShaderProgram       *program,
+                                                                const graphene_matrix_t  *model_matrix,
+                                                                const graphene_matrix_t  *view_matrix,
+                                                                const graphene_matrix_t  *projection_matrix);
+void                chips_shader_program_set_depth_range       (ChipsShaderProgram       *program,
+                                                                float                     near_plane,
+                                                                float                     far_plane);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ChipsShaderProgram, chips_shader_program_free);
+
+#endif /* CHIPS_SHADER_PROGRAM_H */
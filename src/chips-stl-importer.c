@@ -0,0 +1,383 @@
+/* chips-stl-importer.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chips-importer.h"
+#include "chips-parallel.h"
+
+#define BINARY_STL_HEADER_SIZE 84
+#define BINARY_STL_TRIANGLE_SIZE 50
+#define TRIANGLES_PER_CHUNK 65536
+
+typedef struct
+{
+        const guint8            *triangles;
+        float                   *vertex_buffer;
+        guint32                 *vertex_arrangement;
+
+        ChipsImportProgressFunc  progress_func;
+        gpointer                 user_data;
+} BinaryStlImport;
+
+typedef struct
+{
+        ChipsTextChunk  text;
+        GArray         *positions;
+        size_t          vertex_offset;
+} AsciiStlChunk;
+
+typedef struct
+{
+        AsciiStlChunk           *chunks;
+        size_t                   number_of_chunks;
+
+        float                   *vertex_buffer;
+        guint32                 *vertex_arrangement;
+
+        ChipsImportProgressFunc  progress_func;
+        gpointer                 user_data;
+
+        volatile int             has_syntax_error;
+} AsciiStlImport;
+
+static guint32
+get_number_of_binary_triangles (const guint8 *data)
+{
+        guint32 number_of_triangles;
+
+        memcpy (&number_of_triangles, data + 80, sizeof (number_of_triangles));
+
+        return GUINT32_FROM_LE (number_of_triangles);
+}
+
+static gboolean
+starts_with_solid (const guint8 *data,
+                   size_t        size)
+{
+        size_t i = 0;
+
+        while (i < size && g_ascii_isspace (data[i])) {
+                i++;
+        }
+
+        return size - i >= 5 && memcmp (data + i, "solid", 5) == 0;
+}
+
+/* Binary STL files can also start with "solid", so for those the size
+ * is what tells the two flavors apart.  Exporters sometimes pad the end
+ * of binary files, so other files only need to be big enough for the
+ * triangles they say they have.
+ */
+static gboolean
+is_binary_stl (const guint8 *data,
+               size_t        size)
+{
+        guint64 triangles_size;
+
+        if (size < BINARY_STL_HEADER_SIZE) {
+                return FALSE;
+        }
+
+        triangles_size = (guint64) get_number_of_binary_triangles (data) * BINARY_STL_TRIANGLE_SIZE;
+
+        if (size - BINARY_STL_HEADER_SIZE == triangles_size) {
+                return TRUE;
+        }
+
+        return size - BINARY_STL_HEADER_SIZE > triangles_size &&
+               !starts_with_solid (data, BINARY_STL_HEADER_SIZE);
+}
+
+static void
+import_binary_triangles (size_t           start,
+                         size_t           end,
+                         BinaryStlImport *import)
+{
+        size_t i, j;
+
+        for (i = start; i < end; i++) {
+                const guint8 *triangle = import->triangles + i * BINARY_STL_TRIANGLE_SIZE;
+                float *vertices = import->vertex_buffer + i * 9;
+
+                /* Skip the facet normal, it gets recomputed anyway.  The
+                 * records are 50 bytes long, so the floats aren't aligned
+                 */
+                memcpy (vertices, triangle + 3 * sizeof (float), 9 * sizeof (float));
+
+#if G_BYTE_ORDER != G_LITTLE_ENDIAN
+                for (j = 0; j < 9; j++) {
+                        guint32 bits;
+
+                        memcpy (&bits, &vertices[j], sizeof (bits));
+                        bits = GUINT32_SWAP_LE_BE (bits);
+                        memcpy (&vertices[j], &bits, sizeof (bits));
+                }
+#endif
+
+                for (j = 0; j < 3; j++) {
+                        import->vertex_arrangement[i * 3 + j] = i * 3 + j;
+                }
+        }
+
+        if (import->progress_func != NULL) {
+                import->progress_func ((end - start) * BINARY_STL_TRIANGLE_SIZE,
+                                       (end - start) * 3,
+                                       import->user_data);
+        }
+}
+
+static gboolean
+import_binary_stl (const guint8             *data,
+                   size_t                    size,
+                   ChipsImportedMesh        *mesh,
+                   ChipsImportProgressFunc   progress_func,
+                   gpointer                  user_data,
+                   GCancellable             *cancellable,
+                   GError                  **error)
+{
+        BinaryStlImport import = { 0 };
+        size_t number_of_triangles;
+
+        /* Any padding past the last triangle is ignored */
+        number_of_triangles = get_number_of_binary_triangles (data);
+
+        if (number_of_triangles * 3 > G_MAXUINT32) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                             "model has too many vertices");
+                return FALSE;
+        }
+
+        import.triangles = data + BINARY_STL_HEADER_SIZE;
+        import.vertex_buffer = g_new (float, number_of_triangles * 9);
+        import.vertex_arrangement = g_new (guint32, number_of_triangles * 3);
+        import.progress_func = progress_func;
+        import.user_data = user_data;
+
+        mesh->vertex_buffer = g_bytes_new_take (import.vertex_buffer,
+                                                number_of_triangles * 9 * sizeof (float));
+        mesh->number_of_vertices = number_of_triangles * 3;
+        mesh->vertex_arrangement = g_bytes_new_take (import.vertex_arrangement,
+                                                     number_of_triangles * 3 * sizeof (guint32));
+        mesh->number_of_indices = number_of_triangles * 3;
+        mesh->index_size = sizeof (guint32);
+
+        if (!chips_parallel_for (number_of_triangles,
+                                 TRIANGLES_PER_CHUNK,
+                                 (ChipsParallelFunc) import_binary_triangles,
+                                 &import,
+                                 cancellable,
+                                 error)) {
+                chips_imported_mesh_clear (mesh);
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+static gboolean
+parse_ascii_chunk (AsciiStlChunk *chunk)
+{
+        const char *cursor = chunk->text.start;
+        const char *end = chunk->text.end;
+
+        while (cursor < end) {
+                cursor = chips_importer_skip_blanks (cursor, end);
+
+                if (end - cursor > 7 && memcmp (cursor, "vertex", 6) == 0 &&
+                    (cursor[6] == ' ' || cursor[6] == '\t')) {
+                        float position[3];
+                        size_t i;
+
+                        cursor += 7;
+
+                        for (i = 0; i < G_N_ELEMENTS (position); i++) {
+                                if (!chips_importer_parse_float (&cursor, end, &position[i])) {
+                                        return FALSE;
+                                }
+                        }
+
+                        g_array_append_vals (chunk->positions, position, G_N_ELEMENTS (position));
+                }
+
+                cursor = chips_importer_skip_line (cursor, end);
+        }
+
+        return TRUE;
+}
+
+static void
+parse_ascii_chunks (size_t          start,
+                    size_t          end,
+                    AsciiStlImport *import)
+{
+        size_t i;
+
+        for (i = start; i < end; i++) {
+                AsciiStlChunk *chunk = &import->chunks[i];
+
+                if (!parse_ascii_chunk (chunk)) {
+                        g_atomic_int_set (&import->has_syntax_error, TRUE);
+                }
+
+                if (import->progress_func != NULL) {
+                        import->progress_func (chunk->text.end - chunk->text.start,
+                                               chunk->positions->len / 3,
+                                               import->user_data);
+                }
+        }
+}
+
+static void
+merge_ascii_chunks (size_t          start,
+                    size_t          end,
+                    AsciiStlImport *import)
+{
+        size_t i, j;
+
+        for (i = start; i < end; i++) {
+                AsciiStlChunk *chunk = &import->chunks[i];
+                size_t number_of_vertices = chunk->positions->len / 3;
+
+                if (chunk->positions->len > 0) {
+                        memcpy (import->vertex_buffer + chunk->vertex_offset * 3,
+                                chunk->positions->data,
+                                chunk->positions->len * sizeof (float));
+                }
+
+                for (j = 0; j < number_of_vertices; j++) {
+                        import->vertex_arrangement[chunk->vertex_offset + j] = chunk->vertex_offset + j;
+                }
+
+                g_clear_pointer (&chunk->positions, g_array_unref);
+        }
+}
+
+static gboolean
+import_ascii_stl (const char               *data,
+                  size_t                    size,
+                  ChipsImportedMesh        *mesh,
+                  ChipsImportProgressFunc   progress_func,
+                  gpointer                  user_data,
+                  GCancellable             *cancellable,
+                  GError                  **error)
+{
+        g_autoptr (GArray) text_chunks = NULL;
+        AsciiStlImport import = { 0 };
+        size_t number_of_vertices = 0;
+        size_t i;
+        gboolean succeeded = FALSE;
+
+        text_chunks = chips_importer_split_lines (data, size, CHIPS_IMPORTER_CHUNK_SIZE);
+
+        import.number_of_chunks = text_chunks->len;
+        import.chunks = g_new0 (AsciiStlChunk, import.number_of_chunks);
+        import.progress_func = progress_func;
+        import.user_data = user_data;
+
+        for (i = 0; i < import.number_of_chunks; i++) {
+                import.chunks[i].text = g_array_index (text_chunks, ChipsTextChunk, i);
+                import.chunks[i].positions = g_array_new (FALSE, FALSE, sizeof (float));
+        }
+
+        if (!chips_parallel_for (import.number_of_chunks, 1,
+                                 (ChipsParallelFunc) parse_ascii_chunks,
+                                 &import,
+                                 cancellable,
+                                 error)) {
+                goto out;
+        }
+
+        if (import.has_syntax_error) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "malformed vertex statement");
+                goto out;
+        }
+
+        for (i = 0; i < import.number_of_chunks; i++) {
+                import.chunks[i].vertex_offset = number_of_vertices;
+                number_of_vertices += import.chunks[i].positions->len / 3;
+        }
+
+        /* Binary files that don't look binary end up here, and have
+         * no vertex statements, so they'd otherwise load as nothing
+         */
+        if (number_of_vertices == 0) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "model has no facets");
+                goto out;
+        }
+
+        if (number_of_vertices % 3 != 0) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "facet doesn't have three vertices");
+                goto out;
+        }
+
+        if (number_of_vertices > G_MAXUINT32) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                             "model has too many vertices");
+                goto out;
+        }
+
+        import.vertex_buffer = g_new (float, number_of_vertices * 3);
+        import.vertex_arrangement = g_new (guint32, number_of_vertices);
+
+        mesh->vertex_buffer = g_bytes_new_take (import.vertex_buffer,
+                                                number_of_vertices * 3 * sizeof (float));
+        mesh->number_of_vertices = number_of_vertices;
+        mesh->vertex_arrangement = g_bytes_new_take (import.vertex_arrangement,
+                                                     number_of_vertices * sizeof (guint32));
+        mesh->number_of_indices = number_of_vertices;
+        mesh->index_size = sizeof (guint32);
+
+        if (!chips_parallel_for (import.number_of_chunks, 1,
+                                 (ChipsParallelFunc) merge_ascii_chunks,
+                                 &import,
+                                 cancellable,
+                                 error)) {
+                chips_imported_mesh_clear (mesh);
+                goto out;
+        }
+
+        succeeded = TRUE;
+out:
+        for (i = 0; i < import.number_of_chunks; i++) {
+                g_clear_pointer (&import.chunks[i].positions, g_array_unref);
+        }
+        g_free (import.chunks);
+
+        return succeeded;
+}
+
+gboolean
+chips_import_stl (GBytes                   *contents,
+                  ChipsImportedMesh        *mesh,
+                  ChipsImportProgressFunc   progress_func,
+                  gpointer                  user_data,
+                  GCancellable             *cancellable,
+                  GError                  **error)
+{
+        const guint8 *data;
+        size_t size;
+
+        data = g_bytes_get_data (contents, &size);
+
+        if (is_binary_stl (data, size)) {
+                return import_binary_stl (data, size, mesh, progress_func, user_data, cancellable, error);
+        }
+
+        return import_ascii_stl ((const char *) data, size, mesh, progress_func, user_data, cancellable, error);
+}
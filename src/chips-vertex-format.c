@@ -0,0 +1,550 @@
+/* chips-vertex-format.c
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "chips-vertex-format.h"
+#include "chips-parallel.h"
+
+G_STATIC_ASSERT (sizeof (ChipsVertexFormat) == 72);
+
+#define VERTICES_PER_CHUNK 65536
+
+typedef struct
+{
+        ChipsVertexFormat *format;
+        const float       *positions;
+        const float       *normals;
+        const float       *texture_coordinates;
+        guint8            *vertices;
+
+        GMutex             bounds_lock;
+        float              position_minimum[3];
+        float              position_maximum[3];
+        float              texture_coordinate_minimum[2];
+        float              texture_coordinate_maximum[2];
+} EncodeJob;
+
+static size_t
+get_encoded_size (ChipsVertexAttribute attribute,
+                  ChipsVertexEncoding  encoding)
+{
+        size_t number_of_components;
+
+        number_of_components = attribute == CHIPS_VERTEX_ATTRIBUTE_TEXTURE_COORDINATES? 2 : 3;
+
+        switch (encoding) {
+                case CHIPS_VERTEX_ENCODING_NONE:
+                        return 0;
+                case CHIPS_VERTEX_ENCODING_FLOAT:
+                        return number_of_components * sizeof (float);
+                case CHIPS_VERTEX_ENCODING_HALF_FLOAT:
+                case CHIPS_VERTEX_ENCODING_NORMALIZED_SHORT:
+                        /* Attributes are kept 4 byte aligned */
+                        return ((number_of_components * sizeof (guint16) + 3) / 4) * 4;
+                case CHIPS_VERTEX_ENCODING_OCTAHEDRAL_SHORT:
+                        return 2 * sizeof (gint16);
+        }
+
+        return 0;
+}
+
+static gboolean
+is_valid_encoding (ChipsVertexAttribute attribute,
+                   ChipsVertexEncoding  encoding)
+{
+        switch (encoding) {
+                case CHIPS_VERTEX_ENCODING_NONE:
+                        return attribute != CHIPS_VERTEX_ATTRIBUTE_POSITION;
+                case CHIPS_VERTEX_ENCODING_FLOAT:
+                case CHIPS_VERTEX_ENCODING_HALF_FLOAT:
+                        return TRUE;
+                case CHIPS_VERTEX_ENCODING_NORMALIZED_SHORT:
+                        return attribute != CHIPS_VERTEX_ATTRIBUTE_NORMAL;
+                case CHIPS_VERTEX_ENCODING_OCTAHEDRAL_SHORT:
+                        return attribute == CHIPS_VERTEX_ATTRIBUTE_NORMAL;
+        }
+
+        return FALSE;
+}
+
+void
+chips_vertex_format_init (ChipsVertexFormat   *format,
+                          ChipsVertexEncoding  position_encoding,
+                          ChipsVertexEncoding  normal_encoding,
+                          ChipsVertexEncoding  texture_coordinate_encoding)
+{
+        ChipsVertexEncoding encodings[CHIPS_NUMBER_OF_VERTEX_ATTRIBUTES];
+        size_t i;
+
+        encodings[CHIPS_VERTEX_ATTRIBUTE_POSITION] = position_encoding;
+        encodings[CHIPS_VERTEX_ATTRIBUTE_NORMAL] = normal_encoding;
+        encodings[CHIPS_VERTEX_ATTRIBUTE_TEXTURE_COORDINATES] = texture_coordinate_encoding;
+
+        memset (format, 0, sizeof (*format));
+
+        for (i = 0; i < CHIPS_NUMBER_OF_VERTEX_ATTRIBUTES; i++) {
+                g_return_if_fail (is_valid_encoding (i, encodings[i]));
+
+                format->attributes[i].encoding = encodings[i];
+                format->attributes[i].offset = format->stride;
+                format->stride += get_encoded_size (i, encodings[i]);
+        }
+
+        for (i = 0; i < 3; i++) {
+                format->position_scale[i] = 1.0f;
+        }
+
+        for (i = 0; i < 2; i++) {
+                format->texture_coordinate_scale[i] = 1.0f;
+        }
+}
+
+/* For formats that come from files */
+gboolean
+chips_vertex_format_validate (const ChipsVertexFormat  *format,
+                              GError                  **error)
+{
+        size_t i;
+
+        for (i = 0; i < CHIPS_NUMBER_OF_VERTEX_ATTRIBUTES; i++) {
+                const ChipsVertexAttributeLayout *layout = &format->attributes[i];
+
+                if (!is_valid_encoding (i, layout->encoding)) {
+                        g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                                     "vertex attribute %zu has unsupported encoding %u",
+                                     i, layout->encoding);
+                        return FALSE;
+                }
+
+                if (layout->offset % 4 != 0 ||
+                    layout->offset > format->stride ||
+                    get_encoded_size (i, layout->encoding) > format->stride - layout->offset) {
+                        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                                     "vertex attribute %zu doesn't fit in a vertex", i);
+                        return FALSE;
+                }
+        }
+
+        return TRUE;
+}
+
+size_t
+chips_vertex_format_get_number_of_components (const ChipsVertexFormat *format,
+                                              ChipsVertexAttribute     attribute)
+{
+        switch (format->attributes[attribute].encoding) {
+                case CHIPS_VERTEX_ENCODING_NONE:
+                        return 0;
+                case CHIPS_VERTEX_ENCODING_OCTAHEDRAL_SHORT:
+                        return 2;
+                default:
+                        break;
+        }
+
+        return attribute == CHIPS_VERTEX_ATTRIBUTE_TEXTURE_COORDINATES? 2 : 3;
+}
+
+static guint16
+float_to_half (float value)
+{
+        guint32 bits, sign, mantissa;
+        int exponent;
+        guint32 half;
+
+        memcpy (&bits, &value, sizeof (bits));
+
+        sign = (bits >> 16) & 0x8000;
+        exponent = (int) ((bits >> 23) & 0xff) - 127 + 15;
+        mantissa = bits & 0x7fffff;
+
+        if (((bits >> 23) & 0xff) == 0xff) {
+                return sign | 0x7c00 | (mantissa != 0? 0x200 : 0);
+        }
+
+        if (exponent >= 31) {
+                return sign | 0x7c00;
+        }
+
+        if (exponent <= 0) {
+                int shift;
+
+                if (exponent < -10) {
+                        return sign;
+                }
+
+                mantissa |= 0x800000;
+                shift = 14 - exponent;
+                half = mantissa >> shift;
+
+                if ((mantissa >> (shift - 1)) & 1) {
+                        half++;
+                }
+
+                return sign | half;
+        }
+
+        half = ((guint32) exponent << 10) | (mantissa >> 13);
+
+        /* Rounding can carry into the exponent, which is what we want */
+        if (mantissa & 0x1000) {
+                half++;
+        }
+
+        return sign | half;
+}
+
+static guint16
+float_to_normalized_short (float value,
+                           float offset,
+                           float scale)
+{
+        float normalized;
+
+        if (scale <= 0.0f) {
+                return 0;
+        }
+
+        normalized = (value - offset) / scale;
+
+        return (guint16) (CLAMP (normalized, 0.0f, 1.0f) * 65535.0f + 0.5f);
+}
+
+static gint16
+float_to_signed_short (float value)
+{
+        return (gint16) lrintf (CLAMP (value, -1.0f, 1.0f) * 32767.0f);
+}
+
+/* Folds the unit sphere onto an octahedron and unfolds that into a
+ * square, which keeps the error of two 16 bit components well under
+ * what shading can show
+ */
+static void
+encode_octahedral_normal (const float *normal,
+                          gint16      *encoded)
+{
+        float length, x, y;
+
+        length = fabsf (normal[0]) + fabsf (normal[1]) + fabsf (normal[2]);
+
+        if (length == 0.0f) {
+                encoded[0] = encoded[1] = 0;
+                return;
+        }
+
+        x = normal[0] / length;
+        y = normal[1] / length;
+
+        if (normal[2] < 0.0f) {
+                float folded_x, folded_y;
+
+                folded_x = (1.0f - fabsf (y)) * (x >= 0.0f? 1.0f : -1.0f);
+                folded_y = (1.0f - fabsf (x)) * (y >= 0.0f? 1.0f : -1.0f);
+                x = folded_x;
+                y = folded_y;
+        }
+
+        encoded[0] = float_to_signed_short (x);
+        encoded[1] = float_to_signed_short (y);
+}
+
+static void
+encode_components (guint8              *destination,
+                   ChipsVertexEncoding  encoding,
+                   const float         *values,
+                   size_t               number_of_components,
+                   const float         *offset,
+                   const float         *scale)
+{
+        size_t i;
+
+        switch (encoding) {
+                case CHIPS_VERTEX_ENCODING_NONE:
+                        break;
+                case CHIPS_VERTEX_ENCODING_FLOAT:
+                        memcpy (destination, values, number_of_components * sizeof (float));
+                        break;
+                case CHIPS_VERTEX_ENCODING_HALF_FLOAT:
+                        for (i = 0; i < number_of_components; i++) {
+                                guint16 half = float_to_half (values[i]);
+
+                                memcpy (destination + i * sizeof (half), &half, sizeof (half));
+                        }
+                        break;
+                case CHIPS_VERTEX_ENCODING_NORMALIZED_SHORT:
+                        for (i = 0; i < number_of_components; i++) {
+                                guint16 component = float_to_normalized_short (values[i], offset[i], scale[i]);
+
+                                memcpy (destination + i * sizeof (component), &component, sizeof (component));
+                        }
+                        break;
+                case CHIPS_VERTEX_ENCODING_OCTAHEDRAL_SHORT: {
+                        gint16 encoded[2];
+
+                        encode_octahedral_normal (values, encoded);
+                        memcpy (destination, encoded, sizeof (encoded));
+                        break;
+                }
+        }
+}
+
+static void
+measure_bounds_range (size_t     start,
+                      size_t     end,
+                      EncodeJob *job)
+{
+        float position_minimum[3], position_maximum[3];
+        float texture_coordinate_minimum[2], texture_coordinate_maximum[2];
+        size_t i, j;
+
+        for (j = 0; j < 3; j++) {
+                position_minimum[j] = G_MAXFLOAT;
+                position_maximum[j] = -G_MAXFLOAT;
+        }
+
+        for (j = 0; j < 2; j++) {
+                texture_coordinate_minimum[j] = G_MAXFLOAT;
+                texture_coordinate_maximum[j] = -G_MAXFLOAT;
+        }
+
+        for (i = start; i < end; i++) {
+                for (j = 0; j < 3; j++) {
+                        position_minimum[j] = MIN (position_minimum[j], job->positions[i * 3 + j]);
+                        position_maximum[j] = MAX (position_maximum[j], job->positions[i * 3 + j]);
+                }
+
+                if (job->texture_coordinates == NULL) {
+                        continue;
+                }
+
+                for (j = 0; j < 2; j++) {
+                        texture_coordinate_minimum[j] = MIN (texture_coordinate_minimum[j], job->texture_coordinates[i * 2 + j]);
+                        texture_coordinate_maximum[j] = MAX (texture_coordinate_maximum[j], job->texture_coordinates[i * 2 + j]);
+                }
+        }
+
+        g_mutex_lock (&job->bounds_lock);
+        for (j = 0; j < 3; j++) {
+                job->position_minimum[j] = MIN (job->position_minimum[j], position_minimum[j]);
+                job->position_maximum[j] = MAX (job->position_maximum[j], position_maximum[j]);
+        }
+
+        for (j = 0; j < 2; j++) {
+                job->texture_coordinate_minimum[j] = MIN (job->texture_coordinate_minimum[j], texture_coordinate_minimum[j]);
+                job->texture_coordinate_maximum[j] = MAX (job->texture_coordinate_maximum[j], texture_coordinate_maximum[j]);
+        }
+        g_mutex_unlock (&job->bounds_lock);
+}
+
+static void
+encode_vertex_range (size_t     start,
+                     size_t     end,
+                     EncodeJob *job)
+{
+        const ChipsVertexFormat *format = job->format;
+        const ChipsVertexAttributeLayout *position_layout, *normal_layout, *texture_coordinate_layout;
+        size_t i;
+
+        position_layout = &format->attributes[CHIPS_VERTEX_ATTRIBUTE_POSITION];
+        normal_layout = &format->attributes[CHIPS_VERTEX_ATTRIBUTE_NORMAL];
+        texture_coordinate_layout = &format->attributes[CHIPS_VERTEX_ATTRIBUTE_TEXTURE_COORDINATES];
+
+        for (i = start; i < end; i++) {
+                guint8 *vertex = job->vertices + i * format->stride;
+
+                encode_components (vertex + position_layout->offset,
+                                   position_layout->encoding,
+                                   job->positions + i * 3,
+                                   3,
+                                   format->position_offset,
+                                   format->position_scale);
+
+                if (job->normals != NULL) {
+                        encode_components (vertex + normal_layout->offset,
+                                           normal_layout->encoding,
+                                           job->normals + i * 3,
+                                           3,
+                                           NULL,
+                                           NULL);
+                }
+
+                if (job->texture_coordinates != NULL) {
+                        encode_components (vertex + texture_coordinate_layout->offset,
+                                           texture_coordinate_layout->encoding,
+                                           job->texture_coordinates + i * 2,
+                                           2,
+                                           format->texture_coordinate_offset,
+                                           format->texture_coordinate_scale);
+                }
+        }
+}
+
+/* Packs separate float arrays into one interleaved buffer laid out as
+ * described by format, which should come from chips_vertex_format_init.
+ * Attributes without source data are dropped from the format, and the
+ * bounds that normalized shorts are relative to are filled in.
+ */
+GBytes *
+chips_vertex_format_encode (ChipsVertexFormat  *format,
+                            const float        *positions,
+                            const float        *normals,
+                            const float        *texture_coordinates,
+                            size_t              number_of_vertices,
+                            GCancellable       *cancellable,
+                            GError            **error)
+{
+        EncodeJob job = { 0 };
+        guint8 *vertices;
+        gboolean encoded;
+        size_t i;
+
+        if (normals == NULL || texture_coordinates == NULL) {
+                chips_vertex_format_init (format,
+                                          format->attributes[CHIPS_VERTEX_ATTRIBUTE_POSITION].encoding,
+                                          normals != NULL? format->attributes[CHIPS_VERTEX_ATTRIBUTE_NORMAL].encoding : CHIPS_VERTEX_ENCODING_NONE,
+                                          texture_coordinates != NULL? format->attributes[CHIPS_VERTEX_ATTRIBUTE_TEXTURE_COORDINATES].encoding : CHIPS_VERTEX_ENCODING_NONE);
+        }
+
+        job.format = format;
+        job.positions = positions;
+        job.normals = normals;
+        job.texture_coordinates = texture_coordinates;
+        g_mutex_init (&job.bounds_lock);
+
+        for (i = 0; i < 3; i++) {
+                job.position_minimum[i] = G_MAXFLOAT;
+                job.position_maximum[i] = -G_MAXFLOAT;
+        }
+
+        for (i = 0; i < 2; i++) {
+                job.texture_coordinate_minimum[i] = G_MAXFLOAT;
+                job.texture_coordinate_maximum[i] = -G_MAXFLOAT;
+        }
+
+        if (format->attributes[CHIPS_VERTEX_ATTRIBUTE_POSITION].encoding == CHIPS_VERTEX_ENCODING_NORMALIZED_SHORT ||
+            format->attributes[CHIPS_VERTEX_ATTRIBUTE_TEXTURE_COORDINATES].encoding == CHIPS_VERTEX_ENCODING_NORMALIZED_SHORT) {
+                if (!chips_parallel_for (number_of_vertices,
+                                         VERTICES_PER_CHUNK,
+                                         (ChipsParallelFunc) measure_bounds_range,
+                                         &job,
+                                         cancellable,
+                                         error)) {
+                        g_mutex_clear (&job.bounds_lock);
+                        return NULL;
+                }
+        }
+
+        if (format->attributes[CHIPS_VERTEX_ATTRIBUTE_POSITION].encoding == CHIPS_VERTEX_ENCODING_NORMALIZED_SHORT &&
+            number_of_vertices > 0) {
+                for (i = 0; i < 3; i++) {
+                        format->position_offset[i] = job.position_minimum[i];
+                        format->position_scale[i] = job.position_maximum[i] - job.position_minimum[i];
+                }
+        }
+
+        if (format->attributes[CHIPS_VERTEX_ATTRIBUTE_TEXTURE_COORDINATES].encoding == CHIPS_VERTEX_ENCODING_NORMALIZED_SHORT &&
+            number_of_vertices > 0) {
+                for (i = 0; i < 2; i++) {
+                        format->texture_coordinate_offset[i] = job.texture_coordinate_minimum[i];
+                        format->texture_coordinate_scale[i] = job.texture_coordinate_maximum[i] - job.texture_coordinate_minimum[i];
+                }
+        }
+
+        vertices = g_malloc0 (number_of_vertices * format->stride);
+        job.vertices = vertices;
+
+        encoded = chips_parallel_for (number_of_vertices,
+                                      VERTICES_PER_CHUNK,
+                                      (ChipsParallelFunc) encode_vertex_range,
+                                      &job,
+                                      cancellable,
+                                      error);
+        g_mutex_clear (&job.bounds_lock);
+
+        if (!encoded) {
+                g_free (vertices);
+                return NULL;
+        }
+
+        return g_bytes_new_take (vertices, number_of_vertices * format->stride);
+}
+
+static float
+half_to_float (guint16 half)
+{
+        guint32 sign, exponent, mantissa, bits;
+        float value;
+
+        sign = (guint32) (half & 0x8000) << 16;
+        exponent = (half >> 10) & 0x1f;
+        mantissa = half & 0x3ff;
+
+        if (exponent == 0) {
+                value = ldexpf ((float) mantissa, -24);
+                return sign != 0? -value : value;
+        }
+
+        if (exponent == 31) {
+                bits = sign | 0x7f800000 | (mantissa << 13);
+        } else {
+                bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+        }
+
+        memcpy (&value, &bits, sizeof (value));
+
+        return value;
+}
+
+/* Reads the position of the vertex starting at vertex back out of the
+ * encoding described by format, the way the vertex shader would
+ */
+void
+chips_vertex_format_decode_position (const ChipsVertexFormat *format,
+                                     const guint8            *vertex,
+                                     float                   *position)
+{
+        const ChipsVertexAttributeLayout *layout = &format->attributes[CHIPS_VERTEX_ATTRIBUTE_POSITION];
+        const guint8 *components = vertex + layout->offset;
+        size_t i;
+
+        for (i = 0; i < 3; i++) {
+                float component = 0.0f;
+
+                switch (layout->encoding) {
+                        case CHIPS_VERTEX_ENCODING_FLOAT:
+                                memcpy (&component, components + i * sizeof (float), sizeof (float));
+                                break;
+                        case CHIPS_VERTEX_ENCODING_HALF_FLOAT: {
+                                guint16 half;
+
+                                memcpy (&half, components + i * sizeof (half), sizeof (half));
+                                component = half_to_float (half);
+                                break;
+                        }
+                        case CHIPS_VERTEX_ENCODING_NORMALIZED_SHORT: {
+                                guint16 normalized;
+
+                                memcpy (&normalized, components + i * sizeof (normalized), sizeof (normalized));
+                                component = normalized / 65535.0f;
+                                break;
+                        }
+                        default:
+                                break;
+                }
+
+                position[i] = format->position_offset[i] + component * format->position_scale[i];
+        }
+}
@@ -0,0 +1,91 @@
+/* chips-vertex-format.h
+ *
+ * Copyright (C) 2016 Ray Strode <rstrode@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CHIPS_VERTEX_FORMAT_H
+#define CHIPS_VERTEX_FORMAT_H
+
+#include "chips.h"
+
+typedef enum
+{
+        CHIPS_VERTEX_ATTRIBUTE_POSITION = 0,
+        CHIPS_VERTEX_ATTRIBUTE_NORMAL,
+        CHIPS_VERTEX_ATTRIBUTE_TEXTURE_COORDINATES,
+        CHIPS_NUMBER_OF_VERTEX_ATTRIBUTES
+} ChipsVertexAttribute;
+
+/* How one attribute is stored in the interleaved vertex buffer.
+ * Normalized shorts are unsigned and relative to the bounds recorded in
+ * the format, and octahedral shorts are two signed components, which
+ * only makes sense for normals.
+ */
+typedef enum
+{
+        CHIPS_VERTEX_ENCODING_NONE = 0,
+        CHIPS_VERTEX_ENCODING_FLOAT,
+        CHIPS_VERTEX_ENCODING_HALF_FLOAT,
+        CHIPS_VERTEX_ENCODING_NORMALIZED_SHORT,
+        CHIPS_VERTEX_ENCODING_OCTAHEDRAL_SHORT,
+} ChipsVertexEncoding;
+
+typedef struct
+{
+        guint32 encoding;
+        guint32 offset;
+} ChipsVertexAttributeLayout;
+
+/* Stored as-is in mesh files, so only fixed size fields go in here.
+ * An encoded position or texture coordinate component c decodes to
+ * offset + c * scale, where c is the raw value for floating point
+ * encodings and 0 to 1 for normalized shorts.
+ */
+typedef struct
+{
+        ChipsVertexAttributeLayout attributes[CHIPS_NUMBER_OF_VERTEX_ATTRIBUTES];
+        guint32                    stride;
+        guint32                    reserved;
+
+        float                      position_offset[3];
+        float                      position_scale[3];
+        float                      texture_coordinate_offset[2];
+        float                      texture_coordinate_scale[2];
+} ChipsVertexFormat;
+
+void     chips_vertex_format_init                     (ChipsVertexFormat        *format,
+                                                       ChipsVertexEncoding       position_encoding,
+                                                       ChipsVertexEncoding       normal_encoding,
+                                                       ChipsVertexEncoding       texture_coordinate_encoding);
+
+gboolean chips_vertex_format_validate                 (const ChipsVertexFormat  *format,
+                                                       GError                  **error);
+
+size_t   chips_vertex_format_get_number_of_components (const ChipsVertexFormat  *format,
+                                                       ChipsVertexAttribute      attribute);
+
+GBytes  *chips_vertex_format_encode                   (ChipsVertexFormat        *format,
+                                                       const float              *positions,
+                                                       const float              *normals,
+                                                       const float              *texture_coordinates,
+                                                       size_t                    number_of_vertices,
+                                                       GCancellable             *cancellable,
+                                                       GError                  **error);
+
+void     chips_vertex_format_decode_position          (const ChipsVertexFormat  *format,
+                                                       const guint8             *vertex,
+                                                       float                    *position);
+
+#endif /* CHIPS_VERTEX_FORMAT_H */
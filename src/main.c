@@ -25,6 +25,7 @@ int main(int   argc,
 
   app = g_object_new (CHIPS_TYPE_APPLICATION,
                       "application-id", "org.gnome.Chips",
+                      "flags", G_APPLICATION_HANDLES_OPEN,
                       NULL);
 
   status = g_application_run (G_APPLICATION (app), argc, argv);